@@ -1,22 +1,17 @@
 #include "ARM.h"
 #include "error.h"
 #include "Thumb.h"
-
-// TODO (Birdman#1#): A3-37,Move imm to status reg
+#include "media.h"
 
 
 /**
-  * Initialize the general purpose registers, clear CPSR and MMU pointer.
+  * Work on the registers of the core, clear MMU pointer, count the semihosting calls with the registers.
+  * @param state The registers, shared with the Thumb decoder
   */
- ARM::ARM()
+ ARM::ARM(cpu_state *state) : CPU(state)
 {
-    //initialize the GPR
-    for (int i = 0; i < GPR_num; i++)
-	r[i] = 0;
-
-    cpsr = 0;
-
     my_mmu = NULL;
+    swi.getEvents(&state->swi);
 }
 
 /** 
@@ -29,11 +24,12 @@
 
 
 /**
-  * get the register value according to its index. 
+  * get the register value according to its index.
+  * @param reg_code The register number, 15 gives the address of the next instruction
   */
 GP_Reg ARM::get_reg_by_code(int reg_code)
 {
-    return 0;
+    return r[reg_code & MASK_4BIT];
 }
 
 /** 
@@ -45,664 +41,610 @@ GP_Reg ARM::get_reg_by_name(const char *reg_name)
 }
 
 /** 
-  * Get a 32-bit instruction from MMU modular, and increase PC by 4.
+  * Get the predecoded entry of the current instruction from MMU modular, decode it on the first visit, and increase PC by 4.
   */
 void ARM::fetch()
 {
-    cur_instr = my_mmu->getInstr32(rPC);
+    cur = my_mmu->getARMDecoded(rPC);
+    if (cur->handler == NULL)
+        decode(rPC, *cur);
+
+    cur_instr = cur->instr;
     rPC += 4;
+    budget--;
 }
 /** 
-  * Execute part of the 32-bit ARM instruction, the instructions are classified by most significant 3 bit.
+  * Execute the current instruction through the handler recorded in its predecoded entry, if its condition passes.
   * \exception UndefineInst For undefined instructions
   * \exception UnexpectInst For instructions can not be handled
   */
 STATUS ARM::exec()
 {
-    char cond = (cur_instr>>28) & MASK_4BIT;
-    char attempt_code = (cur_instr>>25) & MASK_3BIT;
+    if (cur->cond == 14 || ConditionPassed(cur->cond))
+        (this->*(cur->handler))(*cur);
 
-    //unconditional instruction
+    return 0;
+}
 
-    switch (attempt_code)
+#ifdef THREADED_DISPATCH
+/**
+  * Direct-threaded interpreter loop, built with -DTHREADED_DISPATCH, the same as Thumb::run_threaded(), returns once the budget is 0.
+  * \exception UndefineInst For undefined instructions
+  * \exception UnexpectInst For instructions can not be handled
+  */
+void ARM::run_loop()
+{
+    static void * const labels[A_CLASS_NUM] =
     {
-    	case 0://000
-    	{
-    	    //int opcode = (cur_instr>>21) & MASK_4BIT;
-    	    int bit4 = (cur_instr>>4) & MASK_1BIT;
-    	    int S = (cur_instr>>20) & MASK_1BIT;
+        &&l_data_proc,
+        &&l_misc_instr,
+        &&l_multiplies,
+        &&l_extra_ld_str,
+        &&l_mov_imm_to_status_reg,
+        &&l_ld_str_imm_off,
+        &&l_ld_str_reg_off,
+        &&l_media_instr,
+        &&l_ld_str_multiple,
+        &&l_branch_or_with_link,
+        &&l_coprocessor,
+        &&l_swi_handler,
+        &&l_undefined,
+        &&l_ignore
+    };
+    a_decoded * const base = my_mmu->getARMCache();
+    const unsigned int text_VMA = my_mmu->getTextVMA();
+    const unsigned int text_sz = my_mmu->getTextSz();
+
+//the same as fetch(), then jump to the handler, or past it if the condition fails
+#define A_DISPATCH() \
+    do { \
+        if (budget == 0) \
+            return; \
+        unsigned int off = (unsigned int)rPC - text_VMA; \
+        if (off >= text_sz) \
+            my_mmu->getInstr32(rPC); /* reports the error */ \
+        cur = &base[off>>2]; \
+        if (cur->handler == NULL) \
+            decode(rPC, *cur); \
+        cur_instr = cur->instr; \
+        rPC += 4; \
+        budget--; \
+        goto *labels[(cur->cond == 14 || ConditionPassed(cur->cond)) ? cur->cls : A_IGNORE]; \
+    } while (0)
+
+    A_DISPATCH();
+
+l_data_proc:                (this->*(cur->handler))(*cur);  A_DISPATCH();
+l_misc_instr:               misc_instr(*cur);               A_DISPATCH();
+l_multiplies:               multiplies(*cur);               A_DISPATCH();
+l_extra_ld_str:             extra_ld_str(*cur);             A_DISPATCH();
+l_mov_imm_to_status_reg:    mov_imm_to_status_reg(*cur);    A_DISPATCH();
+l_ld_str_imm_off:           ld_str_imm_off(*cur);           A_DISPATCH();
+l_ld_str_reg_off:           ld_str_reg_off(*cur);           A_DISPATCH();
+l_media_instr:              media_instr(*cur);              A_DISPATCH();
+l_ld_str_multiple:          ld_str_multiple(*cur);          A_DISPATCH();
+l_branch_or_with_link:      (this->*(cur->handler))(*cur);  A_DISPATCH();
+l_coprocessor:              coprocessor(*cur);              A_DISPATCH();
+l_swi_handler:              swi_handler(*cur);              A_DISPATCH();
+l_undefined:                undefined(*cur);                A_DISPATCH();
+l_ignore:                   A_DISPATCH();
+
+#undef A_DISPATCH
+}
+#endif
 
-    	    if (bit4 == 0)//data processing imm shift, misc instruction
-    	    {
-                if (S == 0 && (((cur_instr>>23) & MASK_2BIT) == 0x2))//tst, teq, cmp, cmn, these are 10xx,but S is always 1
-                {
-                    //misc instruction
-                    misc_instr(cur_instr);
-                }
-                else
-                {
-                    //data processing imm shift
-                    data_proc(cur_instr);
-                }
-            }
-            else//bit4 == 1, data processing reg shift, misc instruction, multiplies, extra ld/str
-            {
-                if ((S == 0) && (((cur_instr>>23) & MASK_2BIT) == 2) && (((cur_instr>>7) & MASK_1BIT) == 0))
-                {
-                    //misc instruction
-                    misc_instr(cur_instr);
-                }
-                else if (((cur_instr>>7) & MASK_1BIT) == 1)
-                {
-                    int sec_code = (cur_instr>>5) & MASK_2BIT;
-                    int M = (cur_instr>>24) & MASK_1BIT;
-
-                    if (M == 0 && sec_code == 0)
-                    {
-                        multiplies(cur_instr);
-                    //multiplies
-                    }
-                    else
-                    {
-                        extra_ld_str(cur_instr);
-                    //extra ld/str
-                    }
-                }
-                else
-                {
-                    //data processing reg shift
-                    data_proc(cur_instr);
-                }
-            }
+const a_handler ARM::handler_tab[A_CLASS_NUM] =
+{
+    NULL,//data processing, dp_handler() picks the variant
+    &ARM::misc_instr,
+    &ARM::multiplies,
+    &ARM::extra_ld_str,
+    &ARM::mov_imm_to_status_reg,
+    &ARM::ld_str_imm_off,
+    &ARM::ld_str_reg_off,
+    &ARM::media_instr,
+    &ARM::ld_str_multiple,
+    &ARM::branch_or_with_link,
+    &ARM::coprocessor,
+    &ARM::swi_handler,
+    &ARM::undefined,
+    &ARM::ignore
+};
 
-    		break;
-    	}
-        case 1://001
-        {
-            int S = (cur_instr>>20) & MASK_1BIT;
+/**
+  * Fill a predecoded entry. The entry point of a library routine run on the host gets the handler which runs it. A flag-setting data processing or multiply instruction whose flags are dead loses its S bit, so its handler runs without touching NZCV. A branch closing a loop without side effects gets idle_branch(), which checks its condition itself, so that the loop is seen being left.
+  * @param address The virtual address of the instruction
+  * @param d The predecoded entry to be filled
+  */
+void ARM::decode(int address, a_decoded &d)
+{
+    decode_fields(address, d);
 
-            if (S == 0 && (((cur_instr>>23) & MASK_2BIT) == 0x2))//tst, teq, cmp, cmn always with S == 1
-            {
-                if (((cur_instr>>21) & MASK_1BIT) == 1)
-                {
-                    //mov imm to status reg
-                    mov_imm_to_status_reg(cur_instr);
-                }
-                //else undefine
-            }
-            else
-            {
-                //data process imm
-                data_proc(cur_instr);
-            }
-            break;
-        }
+    if (hle.lookup(address) != NULL)//dispatched to its handler whatever its class, as the branches are
+    {
+        d.handler = &ARM::hle_call;
+        d.cls = A_BRANCH_OR_WITH_LINK;
+        d.cond = 14;
+        return;
+    }
+
+    if ((d.cls == A_DATA_PROC || d.cls == A_MULTIPLIES) && d.S == 1 && d.rd != 15 && d.cond == 14 && flags_dead(address, d))
+    {
+        d.S = 0;
+        if (d.cls == A_DATA_PROC)
+            d.handler = dp_handler(d);
+    }
+
+    if (d.cls == A_BRANCH_OR_WITH_LINK && idle_loop(address))
+    {
+        d.handler = &ARM::idle_branch;
+        d.cond = 14;
+    }
+}
+
+/**
+  * Whether an instruction may be part of a loop without side effects: it neither stores, calls, branches, writes PC, nor works on a coprocessor, whose registers are not compared. SWI is let in, the semihosting calls are counted at run time.
+  * @param d The predecoded instruction
+  * @return true if it has no side effects other than on the registers
+  */
+static bool no_side_effect(const a_decoded &d)
+{
+    int L = (d.instr>>20) & MASK_1BIT;
+
+    switch (d.cls)
+    {
+        case A_DATA_PROC:
+            return d.rd != 15;
+        case A_MULTIPLIES:
+        case A_MEDIA_INSTR:
+        case A_SWI_HANDLER:
+        case A_IGNORE:
+            return true;
+        case A_EXTRA_LD_STR://ldrd and the swaps have L clear too
+        case A_LD_STR_IMM_OFF:
+        case A_LD_STR_REG_OFF:
+            return L == 1 && d.rd != 15;
+        default:
+            return false;
+    }
+}
+
+/**
+  * Whether the branch at an address closes a short loop without side effects, see Thumb::idle_loop().
+  * @param address The virtual address of the branch
+  * @return true for a branch without link back over at most IDLE_LOOP_INSTRS instructions without side effects
+  */
+bool ARM::idle_loop(int address)
+{
+    a_decoded d;
+
+    decode_fields(address, d);
+    if (d.cls != A_BRANCH_OR_WITH_LINK || (d.instr>>28) == 15 || ((d.instr>>24) & MASK_1BIT) == 1)//blx, bl
+        return false;
+    if (d.imm > address || (address - d.imm)/4 >= IDLE_LOOP_INSTRS || d.imm < my_mmu->getTextVMA())
+        return false;
+
+    for (int addr = d.imm; addr < address; addr += 4)
+    {
+        decode_fields(addr, d);
+        if (!no_side_effect(d))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+  * Classify a 32-bit ARM instruction by bit[27:20] and bit[7:4], the same decode tree the handlers are documented with (A3-2). Only used at compile time to fill arm_decode_tab, the unconditional instructions are told apart by decode_fields().
+  * @param idx bit[27:20] in bit[11:4], bit[7:4] in bit[3:0]
+  * @return The a_class of the instruction
+  */
+static constexpr uint8_t arm_classify(unsigned int idx)
+{
+    unsigned int hi = idx>>4;//[27:20]
+    unsigned int lo = idx & MASK_4BIT;//[7:4]
+    bool misc = ((hi>>3) & MASK_2BIT) == 2 && (hi & MASK_1BIT) == 0;//tst, teq, cmp, cmn are 10xx, but S is always 1
+
+    switch (hi>>5)//[27:25]
+    {
+        case 0://000
+            if ((lo & MASK_1BIT) == 0 || (lo>>3) == 0)//data processing shift, misc instruction
+                return misc ? A_MISC_INSTR : A_DATA_PROC;
+            if (lo == 9 && ((hi>>4) & MASK_1BIT) == 0)//bit24 == 0
+                return A_MULTIPLIES;
+            return A_EXTRA_LD_STR;
+        case 1://001, data processing imm, mov imm to status reg
+            if (misc)
+                return ((hi>>1) & MASK_1BIT) ? A_MOV_IMM_TO_STATUS_REG : A_UNDEFINED;
+            return A_DATA_PROC;
         case 2://010
-        {
-            //ld/str imm offset
-            ld_str_imm_off(cur_instr);
-        	break;
-        }
+            return A_LD_STR_IMM_OFF;
         case 3://011
-        {
-            int bit4 = (cur_instr>>4) & MASK_1BIT;
-
-            if (bit4 == 0)
-            {
-                //ld/str reg offset
-                ld_str_reg_off(cur_instr);
-            }
-            else
-            {
-                if (((cur_instr>>20) & MASK_5BIT) == 0x1f && (((cur_instr>>4) & MASK_4BIT) == 0xf))
-                {
-                    //architurally undefine
-                }
-                else
-                {
-                    //media instruction
-                    media_instr(cur_instr);
-                }
-            }
-        	break;
-        }
+            if ((lo & MASK_1BIT) == 0)
+                return A_LD_STR_REG_OFF;
+            if (hi == 0x7f && lo == 0xf)//architecturally undefined
+                return A_UNDEFINED;
+            return A_MEDIA_INSTR;
         case 4://100
-        {
-            //ld/st multiple
-            ld_str_multiple(cur_instr);
-        	break;
-        }
+            return A_LD_STR_MULTIPLE;
         case 5://101
-        {
-            //branch and branch with link
-            branch_or_with_link(cur_instr);
-        	break;
-        }
-        case 6://110
-        {
-            //coprocessor ld/str and double reg transfer
-        	break;
-        }
-        case 7://111
-        {
-            int bit4 = (cur_instr>>4) & MASK_1BIT;
-            int bit24 = (cur_instr>>24) & MASK_1BIT;
+            return A_BRANCH_OR_WITH_LINK;
+        case 6://110, coprocessor ld/str and double reg transfer
+            return A_COPROC;
+        default://111, coprocessor data processing and reg transfer, swi
+            return ((hi>>4) & MASK_1BIT) ? A_SWI_HANDLER : A_COPROC;
+    }
+}
 
-            if (bit24 == 0)
-            {
-                if (bit4 == 0)
-                {
-                    //coprocessor data processing
-                }
-                else
-                {
-                    //coprocessor reg transfer
-                }
-            }
+/*! \struct arm_decode_table
+	\brief Every value of bit[27:20] and bit[7:4] mapped to its a_class, built by the compiler.
+ */
+struct arm_decode_table
+{
+    uint8_t cls[4096];
+
+    constexpr arm_decode_table() : cls()
+    {
+        for (unsigned int i = 0; i < 4096; i++)
+            cls[i] = arm_classify(i);
+    }
+};
+
+//! The decode table, it lives in read only data and costs nothing at run time.
+static constexpr arm_decode_table arm_decode_tab;
+
+//! The index of an instruction into arm_decode_tab
+#define ARM_DECODE_IDX(instr)   ((((instr)>>16) & 0xff0) | (((instr)>>4) & MASK_4BIT))
+
+static_assert(arm_decode_tab.cls[ARM_DECODE_IDX(0xe12fff1e)] == A_MISC_INSTR, "ARM decode table is broken");//bx lr
+static_assert(arm_decode_tab.cls[ARM_DECODE_IDX(0xe0010392)] == A_MULTIPLIES, "ARM decode table is broken");//mul r1, r2, r3
+static_assert(arm_decode_tab.cls[ARM_DECODE_IDX(0xe1d010b2)] == A_EXTRA_LD_STR, "ARM decode table is broken");//ldrh r1, [r0, #2]
+static_assert(arm_decode_tab.cls[ARM_DECODE_IDX(0xe3a00001)] == A_DATA_PROC, "ARM decode table is broken");//mov r0, #1
+
+/**
+  * Classify a 32-bit ARM instruction through arm_decode_tab, choose its handler, and pull out the fields the handlers share. The unconditional instructions (condition 1111) are BLX with an immediate and PLD, the rest of that space is undefined before ARMv6. A branch target is resolved here once.
+  * @param address The virtual address of the instruction
+  * @param d The predecoded entry to be filled
+  */
+void ARM::decode_fields(int address, a_decoded &d)
+{
+    A_INSTR instr = my_mmu->getInstr32(address);
+    int cls = arm_decode_tab.cls[ARM_DECODE_IDX(instr)];
+
+    d.instr = instr;
+    d.cond = (instr>>28) & MASK_4BIT;
+    d.op = (instr>>21) & MASK_4BIT;
+    d.S = (instr>>20) & MASK_1BIT;
+    d.rn = (instr>>16) & MASK_4BIT;
+    d.rd = (instr>>12) & MASK_4BIT;
+    d.imm = 0;
+
+    if (d.cond == 15)//unconditional instruction
+    {
+        d.cond = 14;
+        if (((instr>>25) & MASK_3BIT) == 5)//blx imm
+            cls = A_BRANCH_OR_WITH_LINK;
+        else if ((instr & 0x0d70f000) == 0x0550f000)//pld
+            cls = A_IGNORE;
+        else
+            cls = A_UNDEFINED;
+    }
+
+    if (cls == A_BRANCH_OR_WITH_LINK)//PC reads as the address plus 8
+    {
+        d.imm = address + 8 + ((int32_t)(instr<<8)>>6);
+        if ((instr>>28) == 15)//H is the halfword of the Thumb target
+            d.imm += ((instr>>23) & 2) | 1;
+    }
+
+    d.cls = cls;
+    d.handler = cls == A_DATA_PROC ? dp_handler(d) : handler_tab[cls];
+}
+
+/**
+  * The flags an instruction reads, and the ones it always writes, as NZCV nibbles with N in bit 3, the way the handlers use them.
+  * @param d The predecoded instruction
+  * @param rd The flags read
+  * @param wr The flags written
+  * @return true if the instruction may leave the straight-line code, or look at CPSR
+  */
+static bool flag_use(const a_decoded &d, int &rd, int &wr)
+{
+    A_INSTR instr = d.instr;
+    int L = (instr>>20) & MASK_1BIT;
+
+    rd = wr = 0;
+    if (d.cond != 14)//conditional
+        rd = 0xf;
+
+    switch (d.cls)
+    {
+        case A_DATA_PROC:
+        {
+            bool arith = (d.op >= 2 && d.op <= 7) || d.op == 10 || d.op == 11;
+            int shift = (instr>>5) & MASK_2BIT, shift_imm = (instr>>7) & MASK_5BIT;
+            bool keep_c, rrx = false;//whether the shifter carry is the C flag, whether the operand is RRX
+
+            if ((instr>>25) & MASK_1BIT)//IMM32
+                keep_c = ((instr>>8) & MASK_4BIT) == 0;
+            else if ((instr>>4) & MASK_1BIT)//REG_SH, the amount may be 0
+                keep_c = true;
             else
             {
-                //swi
-                swi_handler(cur_instr);
+                keep_c = shift == LSL_DATA && shift_imm == 0;
+                rrx = shift == ROR_DATA && shift_imm == 0;
             }
-        	break;
+
+            if ((d.op >= 5 && d.op <= 7) || rrx || (!arith && d.S == 1 && keep_c))//adc, sbc, rsc
+                rd |= 0x2;
+            if (d.S == 1 && d.rd != 15)
+                wr = arith ? 0xf : 0xe;//V unaffected
+            return d.rd == 15 && (d.op < 8 || d.op > 11);
         }
-    	default:
-            assert(0);
-    		break;
+        case A_MULTIPLIES:
+            if (d.S == 1)
+                wr = 0xc;//C and V unaffected
+            return false;
+        case A_LD_STR_REG_OFF:
+            if (((instr>>5) & MASK_2BIT) == ROR_DATA && ((instr>>7) & MASK_5BIT) == 0)//RRX index
+                rd |= 0x2;
+            return L == 1 && d.rd == 15;
+        case A_LD_STR_IMM_OFF:
+        case A_EXTRA_LD_STR:
+            return L == 1 && d.rd == 15;
+        case A_LD_STR_MULTIPLE:
+            return L == 1 && ((instr>>15) & MASK_1BIT);
+        case A_COPROC:
+            if ((instr & 0x0fffffff) == 0x0ef1fa10)//fmstat
+                wr = 0xf;
+            return false;
+        default://branches, SWI, status register access, and the rest
+            rd = 0xf;
+            return true;
     }
-
-    return 0;
 }
 
-/** 
-  * A bucket shifter emulator, solving the ARM address mode.
-  * @param shifter_operand the operand for shifter
-  * @param type the type of shifting, 32bit immediate number, immediate shifter, etc.
-  * @param carry_out whether there is a carry coming out
-  * @return The result of the bucket shifter
+/**
+  * Scan forward from a flag-setting instruction along the straight-line code after it, at most FLAG_SCAN_MAX instructions, the same as Thumb::flags_dead().
+  * @param address The virtual address of the instruction
+  * @param d Its predecoded entry
+  * @return true if the flags the instruction sets are never read
   */
-int ARM::shifter_operand(uint32_t shifter_operand, uint16_t type, int &carry_out)
+bool ARM::flags_dead(int address, const a_decoded &d)
 {
-    int res;
+    int rd, live;
+    unsigned int text_end = my_mmu->getTextVMA() + my_mmu->getTextSz();
 
-    switch (type)
+    flag_use(d, rd, live);
+    if (live == 0)
+        return false;
+
+    for (int i = 1; i <= FLAG_SCAN_MAX; i++)
     {
-    	case IMM32:
-    	{
-    	    int rotate_imm = ((shifter_operand>>8) & MASK_4BIT) * 2;
-    	    int imm_8 = shifter_operand & MASK_8BIT;
+        unsigned int addr = address + i * 4;
+        a_decoded n;
+        int wr;
 
-            res = (imm_8 >> rotate_imm) | (imm_8 << (32 - rotate_imm));
+        if (addr + 4 > text_end)
+            return false;
 
-            if (rotate_imm == 0)
-                carry_out = getCarry();
-            else
-                carry_out = (res>>31) & MASK_1BIT;
+        decode_fields(addr, n);
+        bool leaves = flag_use(n, rd, wr);
+        if (rd & live)
+            return false;
 
-            return res;
-    		break;
-    	}
-        case IMM_SH://bit4 == 0
-        {
-            int Rm = (shifter_operand) & MASK_4BIT;
-            int shift = (shifter_operand>>5) & MASK_2BIT;
-            int shift_imm = (shifter_operand>>7) & MASK_5BIT;
+        live &= ~wr;
+        if (live == 0)
+            return true;
 
-            if (Rm == 15)
-                r[Rm] += 4;
+        if (leaves)
+            return false;
+    }
 
-            switch (shift)
-            {
-            	case LSL_DATA:
-            	{
-            	    if (shift_imm == 0)
-            	    {
-            	        res = r[Rm];
-            	        carry_out = getCarry();
-                    }
-                    else
-                    {
-                        res = r[Rm]<<shift_imm;
-                        carry_out = (r[Rm]>>(32 - shift_imm)) & MASK_1BIT;
-                    }
-            		break;
-            	}
-            	case LSR_DATA:
-            	{
-            	    if (shift_imm == 0)//shift by 32
-            	    {
-            	        res = 0;
-            	        carry_out = (r[Rm]>>31) & MASK_1BIT;
-                    }
-                    else
-                    {
-                        res = (unsigned)r[Rm]>>shift_imm;
-                        carry_out = (r[Rm]>>(shift_imm - 1)) & MASK_1BIT;
-                    }
-            		break;
-            	}
-            	case ASR_DATA:
-            	{
-            	    if (shift_imm == 0)
-            	    {
-            	        if (((r[Rm]>>31) & MASK_1BIT) == 0)
-            	        {
-            	            res = 0;
-            	            carry_out = 0;//(r[Rm]>>31) & MASK_1BIT
-                        }
-                        else
-                        {
-                            res = 0xffffffff;
-                            carry_out = 1;//(r[Rm]>>31) & MASK_1BIT
-                        }
-                    }
-                    else
-                    {
-                        res = r[Rm] >> shift_imm;
-                        carry_out = (r[Rm]>>(shift_imm - 1)) & MASK_1BIT;
-                    }
-            		break;
-            	}
-            	case ROR_DATA:
-            	{
-            	    if (shift_imm == 0)
-            	    {
-            	        res = (getCarry()<<31) | ((unsigned)r[Rm]>>1);
-            	        carry_out = r[Rm] & MASK_1BIT;
-                    }
-                    else
-                    {
-                        res = ((unsigned)r[Rm]>>shift_imm) | (r[Rm]<<(32 - shift_imm));
-                        carry_out = (r[Rm]>>(shift_imm - 1)) & MASK_1BIT;
-                    }
-            		break;
-            	}
-            	default:
-                    assert(0);
-            		break;
-            }
+    return false;
+}
 
-            if (Rm == 15)
-                r[Rm] -= 4;
+/**
+  * A bucket shifter emulator for the data processing operand, one instance for every addressing mode and shift type, chosen by decode_fields(). Rm and Rs as PC read as the address of the instruction plus 8.
+  * @param instr The instruction
+  * @param carry_out The shifter carry, only computed if C is true
+  * @return The operand
+  */
+template<int Type, int Shift, bool C>
+inline int ARM::shifter(uint32_t instr, int &carry_out)
+{
+    if (Type == IMM32)
+    {
+        int rotate_imm = ((instr>>8) & MASK_4BIT) * 2;
+        uint32_t imm_8 = instr & MASK_8BIT;
 
-            return res;
-        	break;
-        }
-        case REG_SH://bit4 == 1, bit7 == 0
+        if (rotate_imm == 0)
         {
-            int Rm = (shifter_operand) & MASK_4BIT;
-            int shift = (shifter_operand>>5) & MASK_2BIT;
-            int Rs = (shifter_operand>>8) & MASK_4BIT;
+            if (C)
+                carry_out = getCarry();
+            return imm_8;
+        }
 
-            switch (shift)
+        uint32_t res = (imm_8>>rotate_imm) | (imm_8<<(32 - rotate_imm));
+        if (C)
+            carry_out = res>>31;
+        return res;
+    }
+
+    uint32_t rm = getReg(instr & MASK_4BIT);
+
+    if (Type == IMM_SH)//bit4 == 0
+    {
+        int shift_imm = (instr>>7) & MASK_5BIT;
+
+        if (shift_imm == 0)
+        {
+            switch (Shift)
             {
             	case LSL_DATA:
-            	{
-            	    if ((r[Rs] & MASK_8BIT) == 0)
-            	    {
-            	        res = r[Rm];
-            	        carry_out = getCarry();
-                    }
-                    else if(r[Rs] & MASK_8BIT < 32)
-                    {
-                        res = r[Rm]<<(r[Rs] & MASK_8BIT);
-                        carry_out = (r[Rm]>>(32 - r[Rs] & MASK_8BIT)) & MASK_1BIT;
-                    }
-                    else if((r[Rs] & MASK_8BIT) == 32)
-                    {
-                        res =0;
-                        carry_out = r[Rm] & MASK_1BIT;
-                    }
-                    else//r[Rs] & MASK_8BIT > 32
-                    {
-                        res = 0;
-                        carry_out = 0;
-                    }
-            		break;
-            	}
-                case LSR_DATA:
-                {
-                    if ((r[Rs] & MASK_8BIT) == 0)
-            	    {
-            	        res = r[Rm];
+            	    if (C)
             	        carry_out = getCarry();
-                    }
-                    else if(r[Rs] & MASK_8BIT < 32)
-                    {
-                        res = (unsigned)r[Rm]>>(r[Rs] & MASK_8BIT);
-                        carry_out = (r[Rm]>>(r[Rs] & MASK_8BIT) - 1) & MASK_1BIT;
-                    }
-                    else if((r[Rs] & MASK_8BIT) == 32)
-                    {
-                        res =0;
-                        carry_out = (r[Rm]>>31) & MASK_1BIT;
-                    }
-                    else//r[Rs] & MASK_7BIT > 32
-                    {
-                        res = 0;
-                        carry_out = 0;
-                    }
-                	break;
-                }
-                case ASR_DATA:
-                {
-                    if ((r[Rs] & MASK_8BIT) == 0)
-            	    {
-            	        res = r[Rm];
-            	        carry_out = getCarry();
-                    }
-                    else if(r[Rs] & MASK_8BIT < 32)
-                    {
-                        res = r[Rm]>>(r[Rs] & MASK_8BIT);
-                        carry_out = (r[Rm]>>(32 - r[Rs] & MASK_8BIT)) & MASK_1BIT;
-                    }
-                    else if(r[Rs] & MASK_8BIT >= 32)
-                    {
-                        if (((r[Rm]>>31) & MASK_1BIT) == 0)
-                        {
-                            res = 0;
-                            carry_out = 0;//(r[Rm]>>31) & MASK_1BIT
-                        }
-                        else
-                        {
-                            res = 0xffffffff;
-                            carry_out = 1;//(r[Rm]>>31) & MASK_1BIT
-                        }
-                    }
-                	break;
-                }
-                case ROR_DATA:
-                {
-                    if ((r[Rs] & MASK_8BIT) == 0)
-                    {
-                        res = r[Rm];
-                        carry_out = getCarry();
-                    }
-                    else if((r[Rs] & MASK_5BIT) == 0)
-                    {
-                        res = r[Rm];
-                        carry_out = r[Rm]>>31 & MASK_1BIT;
-                    }
-                    else//r[Rs] & MASK_5BIT > 0
-                    {
-                        res = (unsigned)r[Rm]>>(r[Rs] & MASK_5BIT) | r[Rm]<<(32 - r[Rs] & MASK_5BIT);
-                        carry_out = (r[Rm]>>(r[Rs] & MASK_5BIT -1)) & MASK_1BIT;
-                    }
-                	break;
-                }
-            	default:
-                    assert(0);
-            		break;
+            	    return rm;
+            	case LSR_DATA://shift by 32
+            	    if (C)
+            	        carry_out = rm>>31;
+            	    return 0;
+            	case ASR_DATA://shift by 32
+            	    if (C)
+            	        carry_out = rm>>31;
+            	    return (int32_t)rm>>31;
+            	default://RRX
+            	    if (C)
+            	        carry_out = rm & MASK_1BIT;
+            	    return (getCarry()<<31) | (rm>>1);
             }
-            return res;
-        	break;
         }
-        case IMM_OFF:
+
+        switch (Shift)
         {
-            int P = (shifter_operand>>24) & MASK_1BIT;
-            int U = (shifter_operand>>23) & MASK_1BIT;
-            int W = (shifter_operand>>21) & MASK_1BIT;
-            int Rn = (shifter_operand>>16) & MASK_4BIT;
-            int offset_12 = (shifter_operand) & 0xfff;
+        	case LSL_DATA:
+        	    if (C)
+        	        carry_out = (rm>>(32 - shift_imm)) & MASK_1BIT;
+        	    return rm<<shift_imm;
+        	case LSR_DATA:
+        	    if (C)
+        	        carry_out = (rm>>(shift_imm - 1)) & MASK_1BIT;
+        	    return rm>>shift_imm;
+        	case ASR_DATA:
+        	    if (C)
+        	        carry_out = ((int32_t)rm>>(shift_imm - 1)) & MASK_1BIT;
+        	    return (int32_t)rm>>shift_imm;
+        	default://ROR_DATA
+        	    if (C)
+        	        carry_out = (rm>>(shift_imm - 1)) & MASK_1BIT;
+        	    return (rm>>shift_imm) | (rm<<(32 - shift_imm));
+        }
+    }
 
-            if (Rn == 15)
-                r[Rn] +=4;
+    //REG_SH, bit4 == 1, bit7 == 0
+    int rs = getReg((instr>>8) & MASK_4BIT) & MASK_8BIT;
 
-            if (P == 1 && W == 0)
-            {
-                if (U == 1)
-                    res = r[Rn] + offset_12;
-                else//U == 0
-                    res = r[Rn] - offset_12;
-            }
-
-            if (P == 1 && W == 1)
-            {
-                if (U == 1)
-                    res = r[Rn] + offset_12;
-                else//U == 0
-                    res = r[Rn] - offset_12;
-
-                r[Rn] = res;
-            }
+    if (rs == 0)
+    {
+        if (C)
+            carry_out = getCarry();
+        return rm;
+    }
 
-            if (P == 0)//W ==1 is for unprevilige access
-            {
-                res = r[Rn];
-                if (U == 1)
-                    r[Rn] = r[Rn] + offset_12;
-                else//U == 0
-                    r[Rn] = r[Rn] - offset_12;
-            }
+    switch (Shift)
+    {
+    	case LSL_DATA:
+    	    if (rs >= 32)
+    	    {
+    	        if (C)
+    	            carry_out = rs == 32 ? rm & MASK_1BIT : 0;
+    	        return 0;
+    	    }
+    	    if (C)
+    	        carry_out = (rm>>(32 - rs)) & MASK_1BIT;
+    	    return rm<<rs;
+    	case LSR_DATA:
+    	    if (rs >= 32)
+    	    {
+    	        if (C)
+    	            carry_out = rs == 32 ? rm>>31 : 0;
+    	        return 0;
+    	    }
+    	    if (C)
+    	        carry_out = (rm>>(rs - 1)) & MASK_1BIT;
+    	    return rm>>rs;
+    	case ASR_DATA:
+    	    if (rs >= 32)
+    	    {
+    	        if (C)
+    	            carry_out = rm>>31;
+    	        return (int32_t)rm>>31;
+    	    }
+    	    if (C)
+    	        carry_out = ((int32_t)rm>>(rs - 1)) & MASK_1BIT;
+    	    return (int32_t)rm>>rs;
+    	default://ROR_DATA
+    	    rs &= MASK_5BIT;
+    	    if (rs == 0)
+    	    {
+    	        if (C)
+    	            carry_out = rm>>31;
+    	        return rm;
+    	    }
+    	    if (C)
+    	        carry_out = (rm>>(rs - 1)) & MASK_1BIT;
+    	    return (rm>>rs) | (rm<<(32 - rs));
+    }
+}
 
-            if (Rn == 15)
-                r[Rn] -= 4;
+/** 
+  * A bucket shifter emulator, solving the ARM load and store address modes. The base register is written back for the pre-indexed modes with W set and for the post-indexed ones, a PC base reads as the address of the instruction plus 8.
+  * @param shifter_operand the instruction
+  * @param type the address mode, IMM_OFF, REG_OFF, SCALE_OFF, MISC_IMM_OFF or MISC_REG_OFF
+  * @return The address
+  */
+int ARM::shifter_operand(uint32_t shifter_operand, uint16_t type)
+{
+    int P = (shifter_operand>>24) & MASK_1BIT;
+    int U = (shifter_operand>>23) & MASK_1BIT;
+    int W = (shifter_operand>>21) & MASK_1BIT;
+    int Rn = (shifter_operand>>16) & MASK_4BIT;
+    uint32_t rm = r[(shifter_operand) & MASK_4BIT];
+    int rn = getReg(Rn);
+    int offset;
 
-            return res;
+    switch (type)
+    {
+        case IMM_OFF:
+        {
+            offset = (shifter_operand) & 0xfff;
         	break;
         }
         case REG_OFF:
+        case MISC_REG_OFF://bit22=0
         {
-            int P = (shifter_operand>>24) & MASK_1BIT;
-            int U = (shifter_operand>>23) & MASK_1BIT;
-            int W = (shifter_operand>>21) & MASK_1BIT;
-            int Rn = (shifter_operand>>16) & MASK_4BIT;
-            int Rm = (shifter_operand) & MASK_4BIT;
-
-            if (Rn == 15)
-                r[Rn] += 4;
-
-            if (P == 1 && W == 0)
-            {
-                if (U == 1)
-                    res = r[Rn] + r[Rm];
-                else
-                    res = r[Rn] - r[Rm];
-            }
-
-            if (P == 1 && W == 1)
-            {
-                if (U == 1)
-                    res = r[Rn] + r[Rm];
-                else
-                    res = r[Rn] - r[Rm];
-
-                r[Rn] =res;
-            }
-
-            if (P == 0)//W ==1 is for unprevilige access
-            {
-                res = r[Rn];
-                if (U == 1)
-                    r[Rn] = r[Rn] + r[Rm];
-                else
-                    r[Rn] = r[Rn] - r[Rm];
-            }
-
-            if (Rn == 15)
-                r[Rn] -= 4;
-
-            return res;
+            offset = rm;
         	break;
         }
         case SCALE_OFF:
         {
-            int P = (shifter_operand>>24) & MASK_1BIT;
-            int U = (shifter_operand>>23) & MASK_1BIT;
-            int W = (shifter_operand>>21) & MASK_1BIT;
-            int Rn = (shifter_operand>>16) & MASK_4BIT;
-            int Rm = (shifter_operand) & MASK_4BIT;
             int shift_imm = (shifter_operand>>7) & MASK_5BIT;
             int shift = (shifter_operand>>5) & MASK_2BIT;
-            int index;
-
-            if (Rn == 15)
-                r[Rn] += 4;
 
             switch (shift)
             {
             	case LSL_DATA:
             	{
-            	    index = r[Rm]<<shift_imm;
+            	    offset = rm<<shift_imm;
             		break;
             	}
                 case LSR_DATA:
                 {
-                    if (shift_imm == 0)
-                        index = 0;
-                    else
-                        index = (unsigned)r[Rm]>>shift_imm;
+                    offset = shift_imm ? rm>>shift_imm : 0;
                 	break;
                 }
                 case ASR_DATA:
                 {
-                    if (shift_imm == 0)
-                        if (((r[Rm]>>31) & MASK_1BIT) == 1)
-                            index = 0xffffffff;
-                        else
-                            index = 0;
-                    else
-                        index = r[Rm]>>shift_imm;
+                    offset = (int32_t)rm>>(shift_imm ? shift_imm : 31);
                 	break;
                 }
-                case ROR_DATA:
+                default://ROR_DATA
                 {
-                    if (shift_imm == 0)
-                        index = (getCarry()<<31) | ((unsigned)r[Rm]>>1);
+                    if (shift_imm == 0)//RRX
+                        offset = (getCarry()<<31) | (rm>>1);
                     else
-                        index = (unsigned)r[Rm]>>shift_imm;
-                	break;
+                        offset = (rm>>shift_imm) | (rm<<(32 - shift_imm));
+                    break;
                 }
-            	default:
-                    assert(0);
-            		break;
-            }
-
-
-
-            if (P == 1 && W == 0)
-            {
-                if (U == 1)
-                    res = r[Rn] + index;
-                else
-                    res = r[Rn] - index;
             }
-
-            if (P == 1 && W == 1)
-            {
-                if (U == 1)
-                    res = r[Rn] + index;
-                else
-                    res = r[Rn] - index;
-
-                r[Rn] = res;
-            }
-
-            if (P == 0)//W ==1 is for unprevilige access
-            {
-                res = r[Rn];
-
-                if (U == 1)
-                    r[Rn] = r[Rn] + index;
-                else
-                    r[Rn] = r[Rn] - index;
-            }
-
-            if (Rn == 15)
-                r[Rn] -= 4;
-
-            return res;
         	break;
         }
         case MISC_IMM_OFF://bit22=1
         {
-            int P = (shifter_operand>>24) & MASK_1BIT;
-            int U = (shifter_operand>>23) & MASK_1BIT;
-            int W = (shifter_operand>>21) & MASK_1BIT;
             int immedH = (shifter_operand>>8) & MASK_4BIT;
             int immedL = (shifter_operand) & MASK_4BIT;
-            int offset_8 = (immedH<<4) | immedL;
-            int Rn = (shifter_operand>>16) & MASK_4BIT;
-
-            if (Rn == 15)
-                r[Rn] += 4;
-
-            if (P == 1 && W == 0)
-            {
-                if (U == 1)
-                    res = r[Rn] + offset_8;
-                else
-                    res = r[Rn] - offset_8;
-            }
-
-            if (P == 1 && W == 1)
-            {
-                if (U == 1)
-                    res = r[Rn] + offset_8;
-                else
-                    res = r[Rn] - offset_8;
-
-                r[Rn] = res;
-            }
-
-            if (P == 0)
-            {
-                res = r[Rn];
-                if (U == 1)
-                    r[Rn] = r[Rn] + offset_8;
-                else
-                    r[Rn] = r[Rn] - offset_8;
-            }
-
-            if (Rn == 15)
-                r[Rn] -= 4;
-
-            return res;
-        	break;
-        }
-        case MISC_REG_OFF://bit22=0
-        {
-            int P = (shifter_operand>>24) & MASK_1BIT;
-            int U = (shifter_operand>>23) & MASK_1BIT;
-            int W = (shifter_operand>>21) & MASK_1BIT;
-            int Rn = (shifter_operand>>16) & MASK_4BIT;
-            int Rm = (shifter_operand) & MASK_4BIT;
-
-            if (Rn == 15)
-                r[Rn] += 4;
-
-            if (P == 1 && W == 0)
-            {
-                if (U == 1)
-                    res = r[Rn] + r[Rm];
-                else
-                    res = r[Rn] - r[Rm];
-            }
-
-            if (P == 1 && W == 1)
-            {
-                if (U == 1)
-                    res = r[Rn] + r[Rm];
-                else
-                    res = r[Rn] - r[Rm];
-
-                r[Rn] = res;
-            }
 
-            if (P == 0)
-            {
-                res = r[Rn];
-
-                if (U == 1)
-                    r[Rn] = r[Rn] + r[Rm];
-                else
-                    r[Rn] = r[Rn] - r[Rm];
-            }
-
-            if (Rn == 15)
-                r[Rn] -= 4;
-
-            return res;
+            offset = (immedH<<4) | immedL;
         	break;
         }
     	default:
@@ -712,561 +654,555 @@ int ARM::shifter_operand(uint32_t shifter_operand, uint16_t type, int &carry_out
     		break;
     }
 
+    int address = U ? rn + offset : rn - offset;
+
+    if (P == 0)//post-indexed, W == 1 is for unprevilige access
+    {
+        r[Rn] = address;
+        return rn;
+    }
+
+    if (W == 1)
+        r[Rn] = address;
+    return address;
 }
 
-/** 
-  * The matching pattern is 000/001 opcode S (shift_operand).
-  * @param instruction The instructio to be executed.
-  * @exception UnexpectInst For instructions can not be handled
+/**
+  * The data processing handler for an instruction, by the form of its operand and whether it sets the flags.
+  * @param d The predecoded instruction
+  * @return The member of dp_handler_tab
   */
-void ARM::data_proc(A_INSTR instruction)
+a_handler ARM::dp_handler(const a_decoded &d)
 {
-    int I = (instruction>>25) & MASK_1BIT;
-    int S = (instruction>>20) & MASK_1BIT;
-    int opcode = (instruction>>21) & MASK_4BIT;
-    int Rn = (instruction>>16) & MASK_4BIT;
-    int Rd = (instruction>>12) & MASK_4BIT;
-    int bit4 = (instruction>>4) & MASK_1BIT;
-    int shifter_carry_out;
-    int operand;
+    int shift = (d.instr>>5) & MASK_2BIT;
+    int form;
 
-    if (Rn == 15)
-        r[Rn] += 4;
+    if ((d.instr>>25) & MASK_1BIT)//IMM32
+        form = 0;
+    else if (((d.instr>>4) & MASK_1BIT) == 0)//IMM_SH
+        form = 1 + shift;
+    else//REG_SH
+        form = 5 + shift;
 
-    if (I == 1)//IMM32
-    {
-        operand = shifter_operand(instruction, IMM32, shifter_carry_out);
-    }
-    else if(bit4 == 0)//IMM_SH
+    return dp_handler_tab[d.S][form];
+}
+
+const a_handler ARM::dp_handler_tab[2][9] =
+{
     {
-        operand = shifter_operand(instruction, IMM_SH, shifter_carry_out);
-    }
-    else if(((instruction>>7) & MASK_1BIT) == 0)//REG_SH
+        &ARM::data_proc<IMM32, LSL_DATA, false>,
+        &ARM::data_proc<IMM_SH, LSL_DATA, false>,
+        &ARM::data_proc<IMM_SH, LSR_DATA, false>,
+        &ARM::data_proc<IMM_SH, ASR_DATA, false>,
+        &ARM::data_proc<IMM_SH, ROR_DATA, false>,
+        &ARM::data_proc<REG_SH, LSL_DATA, false>,
+        &ARM::data_proc<REG_SH, LSR_DATA, false>,
+        &ARM::data_proc<REG_SH, ASR_DATA, false>,
+        &ARM::data_proc<REG_SH, ROR_DATA, false>
+    },
     {
-        operand = shifter_operand(instruction, REG_SH, shifter_carry_out);
+        &ARM::data_proc<IMM32, LSL_DATA, true>,
+        &ARM::data_proc<IMM_SH, LSL_DATA, true>,
+        &ARM::data_proc<IMM_SH, LSR_DATA, true>,
+        &ARM::data_proc<IMM_SH, ASR_DATA, true>,
+        &ARM::data_proc<IMM_SH, ROR_DATA, true>,
+        &ARM::data_proc<REG_SH, LSL_DATA, true>,
+        &ARM::data_proc<REG_SH, LSR_DATA, true>,
+        &ARM::data_proc<REG_SH, ASR_DATA, true>,
+        &ARM::data_proc<REG_SH, ROR_DATA, true>
     }
+};
+
+/** 
+  * The matching pattern is 000/001 opcode S (shift_operand). A result for PC is a plain branch, and S leaves the flags alone then, the SPSR it would copy does not exist in user mode. Type and Shift give the form of the operand, the variant without SetFlags skips the shifter carry.
+  * @param d The predecoded instruction to be executed.
+  */
+template<int Type, int Shift, bool SetFlags>
+void ARM::data_proc(const a_decoded &d)
+{
+    int opcode = d.op;
+    int Rd = d.rd;
+    int S = (SetFlags && (Rd != 15 || (opcode >= 8 && opcode <= 11))) ? 1 : 0;//tst, teq, cmp, cmn have no Rd
+    int shifter_carry_out = 0;
+    int operand = shifter<Type, Shift, SetFlags>(d.instr, shifter_carry_out);
+    int rn = getReg(d.rn);//Rd may be Rn
+    int res;
 
     switch (opcode)
     {
     	case 0://and
+    	case 8://tst
     	{
-    	    r[Rd] = r[Rn] & operand;
-            if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                shifter_carry_out?setCarry():clrCarry();
-                //V unaffected
-            }
-                    break;
+    	    res = rn & operand;
+    	    if (S == 1)
+    	        lazyNZC(res, shifter_carry_out != 0);//V unaffected
+    	    break;
     	}
     	case 1://eor
+    	case 9://teq
     	{
-    	    r[Rd] = r[Rn] ^ operand;
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                shifter_carry_out?setCarry():clrCarry();
-                //V unaffected
-            }
-    		break;
+    	    res = rn ^ operand;
+    	    if (S == 1)
+    	        lazyNZC(res, shifter_carry_out != 0);//V unaffected
+    	    break;
     	}
     	case 2://sub
+    	case 10://cmp
     	{
-    	    r[Rd] = r[Rn] - operand;
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                ((r[Rn] - operand) >= 0)?setCarry():clrCarry();//C flag
-                OverflowFrom(r[Rn], -operand)?setOverflow():clrOverflow();//V flag
-            }
-    		break;
+    	    res = rn - operand;
+    	    if (S == 1)
+    	        lazySub(res, rn, operand);
+    	    break;
     	}
     	case 3://rsb
     	{
-    	    r[Rd] = operand - r[Rn];
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                ((operand - r[Rn]) >= 0)?setCarry():clrCarry();//C flag
-                OverflowFrom(operand, -r[Rn])?setOverflow():clrOverflow();//V flag
-            }
-    		break;
+    	    res = operand - rn;
+    	    if (S == 1)
+    	        lazySub(res, operand, rn);
+    	    break;
     	}
     	case 4://add
+    	case 11://cmn
     	{
-    	    r[Rd] = r[Rn] + operand;
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                CarryFrom(r[Rn], operand)?setCarry():clrCarry();//C flag
-                OverflowFrom(r[Rn], operand)?setOverflow():clrOverflow();//V flag
-            }
-    		break;
+    	    res = rn + operand;
+    	    if (S == 1)
+    	        lazyAdd(res, rn, operand);
+    	    break;
     	}
     	case 5://adc
     	{
-    	    r[Rd] = r[Rn] + operand + getCarry();
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-            }
-            else if(S == 1)
-            {
-                ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-                r[Rd]?clrZero():setZero();//Z flag
-                CarryFrom(r[Rn], operand, getCarry());
-                OverflowFrom(r[Rn], operand, getCarry());
-            }
-    		break;
+    	    int carry = getCarry();
+    	    res = rn + operand + carry;
+    	    if (S == 1)
+    	    {
+    	        ((res>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
+    	        res?clrZero():setZero();//Z flag
+    	        CarryFrom(rn, operand, carry)?setCarry():clrCarry();//C flag
+    	        OverflowFrom(rn, operand, carry)?setOverflow():clrOverflow();//V flag
+    	    }
+    	    break;
     	}
     	case 6://sbc
     	{
-    	    r[Rd] = r[Rn] - operand - getCarry()?0:1;
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-            }
-            else if(S == 1)
-            {
-                ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-                r[Rd]?clrZero():setZero();//Z flag
-                if (getCarry() == 1)
-                {
-                    CarryFrom(r[Rn], -operand)?setCarry():clrCarry();//C flag
-                    OverflowFrom(r[Rn], -operand)?setOverflow():clrOverflow();//V flag
-                }
-                else// carry == 0
-                {
-                    if (r[Rn] - operand - 1 > 0)// in case one of them is 0xffffffff, or both are
-                        setCarry();
-                    else
-                        clrCarry();
-
-                    if (OverflowFrom(r[Rn], -operand - 1))
-                        setOverflow();
-                    else
-                        clrOverflow();
-                }
-            }
-    		break;
+    	    int carry = getCarry();
+    	    res = rn - operand - !carry;//rn + ~operand + carry
+    	    if (S == 1)
+    	    {
+    	        ((res>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
+    	        res?clrZero():setZero();//Z flag
+    	        CarryFrom(rn, ~operand, carry)?setCarry():clrCarry();//C flag
+    	        OverflowFrom(rn, ~operand, carry)?setOverflow():clrOverflow();//V flag
+    	    }
+    	    break;
     	}
     	case 7://rsc
     	{
-    	    r[Rd] = operand - r[Rn] - !getCarry();
-
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-            }
-            else if(S == 1)
-            {
-                ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-                r[Rd]?clrZero():setZero();//Z flag
-                if (getCarry() == 1)
-                {
-                    CarryFrom(operand, -r[Rn])?setCarry():clrCarry();//C flag
-                    OverflowFrom(operand, -r[Rn])?setOverflow():clrOverflow();//V flag
-                }
-                else// carry == 0
-                {
-                    if (operand - r[Rn] - 1 > 0)// in case one of them is 0xffffffff, or both are
-                        setCarry();
-                    else
-                        clrCarry();
-
-                    if (OverflowFrom(operand, -r[Rn] - 1))
-                        setOverflow();
-                    else
-                        clrOverflow();
-                }
-            }
-    		break;
-    	}
-    	case 8://tst
-    	{
-    	    int alu_out = r[Rn] & operand;
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-                UnexpectInst e;
-                throw e;
-            }
-            else if(S == 1)
-            {
-                (alu_out>>31)&MASK_1BIT?setNeg():clrNeg();
-                alu_out?clrZero():setZero();
-                shifter_carry_out?setCarry():clrCarry();
-                //V unaffected
-            }
-    		break;
-    	}
-    	case 9://teq
-    	{
-    	    int alu_out = r[Rn] ^ operand;
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-                UnexpectInst e;
-                throw e;
-            }
-            else if(S == 1)
-            {
-                (alu_out>>31)&MASK_1BIT?setNeg():clrNeg();
-                alu_out?clrZero():setZero();
-                shifter_carry_out?setCarry():clrCarry();
-                //V unaffected
-            }
-    		break;
-    	}
-    	case 10://cmp
-    	{
-    	    int alu_out = r[Rn] - operand;
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-                UnexpectInst e;
-                throw e;
-            }
-            else if(S == 1)
-            {
-                (alu_out>>31)&MASK_1BIT?setNeg():clrNeg();
-                alu_out?clrZero():setZero();
-                ((r[Rn] - operand) >= 0)?setCarry():clrCarry();//C flag
-                OverflowFrom(r[Rn], -operand)?setOverflow():clrOverflow();//V flag
-            }
-    		break;
-    	}
-    	case 11://cmn
-    	{
-    	    int alu_out = r[Rn] + operand;
-    	    if (S == 1 && Rd == 15)
-            {
-                //to be dealed
-                UnexpectInst e;
-                throw e;
-            }
-            else if(S == 1)
-            {
-                (alu_out>>31)&MASK_1BIT?setNeg():clrNeg();
-                alu_out?clrZero():setZero();
-                CarryFrom(r[Rn], operand)?setCarry():clrCarry();//C flag
-                OverflowFrom(r[Rn], operand)?setOverflow():clrOverflow();//V flag
-            }
-    		break;
+    	    int carry = getCarry();
+    	    res = operand - rn - !carry;//operand + ~rn + carry
+    	    if (S == 1)
+    	    {
+    	        ((res>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
+    	        res?clrZero():setZero();//Z flag
+    	        CarryFrom(operand, ~rn, carry)?setCarry():clrCarry();//C flag
+    	        OverflowFrom(operand, ~rn, carry)?setOverflow():clrOverflow();//V flag
+    	    }
+    	    break;
     	}
     	case 12://orr
     	{
-    	    r[Rd] =  r[Rn] | operand;
-    	    if (S == 1 && Rd == 15)
-    	    {
-    	        //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                shifter_carry_out?setCarry():clrCarry();
-                //V unaffected
-            }
-    		break;
+    	    res = rn | operand;
+    	    if (S == 1)
+    	        lazyNZC(res, shifter_carry_out != 0);//V unaffected
+    	    break;
     	}
     	case 13://mov
     	{
-    	    r[Rd] = operand;
-    	    if (S == 1 && Rd == 15)
-    	    {
-    	        //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                shifter_carry_out?setCarry():clrCarry();
-                //V unaffected
-            }
-    		break;
+    	    res = operand;
+    	    if (S == 1)
+    	        lazyNZC(res, shifter_carry_out != 0);//V unaffected
+    	    break;
     	}
     	case 14://bic
     	{
-    	    r[Rd] = r[Rn] & (~operand);
-    	    if (S == 1 && Rd == 15)
-    	    {
-    	        //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                shifter_carry_out?setCarry():clrCarry();
-                //V unaffected
-            }
-    		break;
+    	    res = rn & (~operand);
+    	    if (S == 1)
+    	        lazyNZC(res, shifter_carry_out != 0);//V unaffected
+    	    break;
     	}
-    	case 15://mvn
+    	default://15, mvn
     	{
-    	    r[Rd] = ~operand;
-    	    if (S == 1 && Rd == 15)
-    	    {
-    	        //to be dealed
-            }
-            else if(S == 1)
-            {
-                (r[Rd]>>31)&MASK_1BIT?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
-                shifter_carry_out?setCarry():clrCarry();
-                //V unaffected
-            }
-    		break;
+    	    res = ~operand;
+    	    if (S == 1)
+    	        lazyNZC(res, shifter_carry_out != 0);//V unaffected
+    	    break;
     	}
-    	default:
-            assert(0);
-    		break;
     }
 
-    if (Rn == 15)
-        r[Rn] -= 4;
+    if (opcode >= 8 && opcode <= 11)//tst, teq, cmp, cmn
+        return;
+
+    if (Rd == 15)//no interworking before ARMv7
+        rPC = res & ~3;
+    else
+        r[Rd] = res;
+}
+
+/**
+  * Saturate a result into a signed range.
+  * @param res The exact result
+  * @param bits The width of the range, 1 to 32
+  * @param sat Set if the result was out of the range
+  * @return The saturated result
+  */
+static inline int32_t SignedSat(int64_t res, int bits, bool &sat)
+{
+    int64_t max = ((int64_t)1<<(bits - 1)) - 1;
+
+    sat = true;
+    if (res > max)
+        return max;
+    if (res < -max - 1)
+        return -max - 1;
+    sat = false;
+    return res;
+}
+
+/**
+  * Saturate a result into an unsigned range.
+  * @param res The exact result
+  * @param bits The width of the range, 0 to 31
+  * @param sat Set if the result was out of the range
+  * @return The saturated result
+  */
+static inline int32_t UnsignedSat(int64_t res, int bits, bool &sat)
+{
+    int64_t max = ((int64_t)1<<bits) - 1;
+
+    sat = true;
+    if (res > max)
+        return max;
+    if (res < 0)
+        return 0;
+    sat = false;
+    return res;
+}
+
+/**
+  * The signed bottom or top halfword of a register, for the halfword multiplies.
+  */
+static inline int32_t halfword(int32_t reg, int top)
+{
+    return top ? reg>>16 : (int16_t)reg;
 }
 
 /** 
-  * The matching pattern is 000 10xx 0.
-  * @param instruction The instruction to be executed
-  * @exception UnexpectInst For instruction can not be handled
+  * The matching pattern is 000 10xx 0. Only the flag field of CPSR can be written in user mode, the rest of MSR is ignored, and SPSR reads as CPSR.
+  * @param d The predecoded instruction to be executed
+  * @exception UndefineInst For undefined instructions
   */
-void ARM::misc_instr(A_INSTR instruction)
+void ARM::misc_instr(const a_decoded &d)
 {
-    char sec_code = (instruction>>4) & MASK_4BIT;
+    int sec_code = (d.instr>>4) & MASK_4BIT;
+    int opcode = (d.instr>>21) & MASK_2BIT;
+    int Rm = (d.instr) & MASK_4BIT;
+    int Rd = d.rd;
 
     switch (sec_code)
     {
     	case 0://mrs,msr
     	{
-    	    int rs0_sr1 = (instruction>>21) & MASK_1BIT;
-    	    int R = (instruction>>22) & MASK_1BIT;
-    	    int Rd = (instruction>>12) & MASK_4BIT;
-
-    	    if (rs0_sr1 == 0)//mrs
+    	    if ((opcode & MASK_1BIT) == 0)//mrs
     	    {
-    	        if (R == 1)
-    	        {
-    	            //to be dealed
-                }
-    	        else
-    	        {
-    	            r[Rd] = cpsr;
-                }
-            }
-            else//msr,A4-76
-            {
-                UnexpectInst e;
-                throw e;
-            }
-    		break;
+    	        syncFlags();
+    	        r[Rd] = st->cpsr;
+    	    }
+    	    else if (opcode == 1 && ((d.instr>>19) & MASK_1BIT))//msr CPSR_f, A4-76
+    	    {
+    	        setFlagBits(r[Rm]);
+    	    }
+    	    break;
     	}
     	case 1://bx,count leading zeros
     	{
-    	    int opcode = (instruction>>21) & MASK_2BIT;
-
     	    if (opcode == 1)//bx
-    	    {
-    	        int Rm = (instruction) & MASK_4BIT;
-// TODO (Birdman#1#): switch mode, T bit = Rm[0] A4-20
-
-                if (r[Rm] & MASK_1BIT == 1)
-                {
-                    SwitchMode e;
-                    throw e;
-                }
-    	        rPC = r[Rm] & 0xfffffffe;
-            }
-            else if(opcode == 3)//count leading zeros
-            {
-                int Rm = (instruction) & MASK_4BIT;
-                int Rd = (instruction>>12) & MASK_4BIT;
-
-                if (r[Rm] == 0)
-                    r[Rd] = 32;
-                else
-                {
-                    int count = 0;
-                    while(!((r[Rm]>>(31-count)) & MASK_1BIT));
-                    r[Rd] = 31 - count;
-                }
-            }
-    		break;
+    	        interwork(r[Rm]);//bit 0 set switches to Thumb
+    	    else if (opcode == 3)//count leading zeros
+    	        r[Rd] = r[Rm] == 0 ? 32 : __builtin_clz(r[Rm]);
+    	    else
+    	        undefined(d);
+    	    break;
     	}
-    	case 2://bxj
+    	case 2://bxj, without Jazelle the same as bx
     	{
-    	    UnexpectInst e;
-    	    throw e;
+    	    if (opcode != 1)
+    	        undefined(d);
+    	    interwork(r[Rm]);
     		break;
     	}
     	case 3://blx
     	{
-    	    int Rm = (instruction) & MASK_4BIT;
+    	    int target = r[Rm];
 
-    	    rLR = rPC + 4;
-// TODO (Birdman#1#): switch mode, T bit = Rm[0]
-            if (r[Rm] & MASK_1BIT == 1)
-            {
-                SwitchMode e;
-                throw e;
-            }
-    	    rPC = r[Rm] & 0xfffffffe;
+    	    if (opcode != 1)
+    	        undefined(d);
+    	    rLR = rPC;//fetch() has moved PC to the next instruction
+    	    interwork(target);//bit 0 set switches to Thumb
             break;
     	}
-    	case 5://qadd,qdadd,qsub,qdsub
+    	case 5://qadd,qsub,qdadd,qdsub
     	{
-            int opcode = (instruction>>21) & MASK_2BIT;
-
-            UnexpectInst e;
-            throw e;
-    		break;
+    	    bool sat = false, sat2 = false;
+    	    int64_t rn = r[d.rn];
+
+    	    if (opcode & 2)//qdadd, qdsub
+    	        rn = SignedSat(rn * 2, 32, sat);
+    	    r[Rd] = SignedSat((opcode & 1) ? (int64_t)r[Rm] - rn : (int64_t)r[Rm] + rn, 32, sat2);
+    	    if (sat || sat2)
+    	        st->cpsr |= CPSR_Q;
+    	    break;
     	}
-    	case 7://bkpt
+    	case 7://bkpt, run() returns and goes on after it
     	{
-    	    UnexpectInst e;
+    	    if (opcode != 1)
+    	        undefined(d);
+    	    requestStop(STOP_BREAKPOINT);
     		break;
     	}
-    	case 8:case 10:case 12:case 14://smla,smlaw, smulw, smlal, smul
+    	case 8:case 10:case 12:case 14://smla,smlaw, smulw, smlal, smul, Rd is bit[19:16], Rn is bit[15:12]
     	{
-    	    int opcode = (instruction>>21) & MASK_2BIT;
-    	    int x = (instruction>>5) & MASK_1BIT;
-    	    int y = (instruction>>6) & MASK_1BIT;
-
-            UnexpectInst e;
-            throw e;
-// TODO (Birdman#1#): back to finish it
+    	    int x = (d.instr>>5) & MASK_1BIT;
+    	    int y = (d.instr>>6) & MASK_1BIT;
+    	    int64_t operand2 = halfword(r[(d.instr>>8) & MASK_4BIT], y);
 
     	    switch (opcode)
     	    {
     	    	case 0://smla
     	    	{
-                    int operand1, operand2;
-                    int Rd;
-                    if (x == 0)
-                        //operand1 = SignExtend(
+    	    	    int64_t res = halfword(r[Rm], x) * operand2 + r[Rd];
+
+    	    	    if (res != (int32_t)res)
+    	    	        st->cpsr |= CPSR_Q;
+    	    	    r[d.rn] = (int32_t)res;
     	    		break;
     	    	}
     	    	case 1://smlaw(bit5=0),smulw(bit5=1)
     	    	{
+    	    	    int64_t res = ((int64_t)r[Rm] * operand2)>>16;
+
+    	    	    if (x == 0)
+    	    	    {
+    	    	        res += r[Rd];
+    	    	        if (res != (int32_t)res)
+    	    	            st->cpsr |= CPSR_Q;
+    	    	    }
+    	    	    r[d.rn] = (int32_t)res;
     	    		break;
     	    	}
-                case 2://smlal
+                case 2://smlal, RdHi is bit[19:16], RdLo is bit[15:12]
                 {
+                    uint64_t acc = ((uint64_t)(uint32_t)r[d.rn]<<32) | (uint32_t)r[Rd];
+
+                    acc += (uint64_t)(halfword(r[Rm], x) * operand2);
+                    r[Rd] = (int32_t)acc;
+                    r[d.rn] = (int32_t)(acc>>32);
                 	break;
                 }
-                case 3://smul
+                default://3, smul
                 {
+                    r[d.rn] = (int32_t)(halfword(r[Rm], x) * operand2);
                 	break;
                 }
-    	    	default:
-                    assert(0);
-    	    		break;
     	    }
 
     		break;
     	}
     	default:
-            assert(0);
+            undefined(d);
     		break;
     }
 
 }
 
 /** 
-  * The matching pattern is 000  1(bit7)   1(bit4).
-  * @param instruction The instruction to be executed
-  * @exception UnexpectInst For instruction can not be handled
+  * The matching pattern is 000 0(bit24) 1001. S sets N and Z, C and V are unaffected.
+  * @param d The predecoded instruction to be executed
+  * @exception UndefineInst For undefined instructions
   */
-void ARM::multiplies(A_INSTR instruction)
+void ARM::multiplies(const a_decoded &d)
 {
-    UnexpectInst e;
-    throw e;
+    int opcode = (d.instr>>21) & MASK_3BIT;
+    int RdHi = d.rn;//Rd of mul, mla
+    int RdLo = d.rd;//Rn of mla
+    uint32_t rm = r[(d.instr) & MASK_4BIT];
+    uint32_t rs = r[(d.instr>>8) & MASK_4BIT];
+    uint64_t acc = ((uint64_t)(uint32_t)r[RdHi]<<32) | (uint32_t)r[RdLo];
+    uint64_t res;
+
+    switch (opcode)
+    {
+    	case 0://mul
+    	case 1://mla
+    	{
+    	    uint32_t res32 = rm * rs;
+
+    	    if (opcode == 1)
+    	        res32 += r[RdLo];
+    	    r[RdHi] = res32;
+    	    if (d.S == 1)
+    	        lazyNZ(res32);
+    	    return;
+    	}
+    	case 2://umaal
+    	{
+    	    res = (uint64_t)rm * rs + (uint32_t)r[RdLo] + (uint32_t)r[RdHi];
+    		break;
+    	}
+    	case 4://umull
+    	{
+    	    res = (uint64_t)rm * rs;
+    		break;
+    	}
+    	case 5://umlal
+    	{
+    	    res = (uint64_t)rm * rs + acc;
+    		break;
+    	}
+    	case 6://smull
+    	{
+    	    res = (uint64_t)((int64_t)(int32_t)rm * (int32_t)rs);
+    		break;
+    	}
+    	case 7://smlal
+    	{
+    	    res = (uint64_t)((int64_t)(int32_t)rm * (int32_t)rs) + acc;
+    		break;
+    	}
+    	default://3
+    	{
+    	    undefined(d);
+    		return;
+    	}
+    }
+
+    r[RdLo] = (int32_t)res;
+    r[RdHi] = (int32_t)(res>>32);
+    if (d.S == 1)//N from bit 63, Z from all 64 bits
+        lazyNZ((int32_t)((r[RdHi] & 0x80000000u) | (res != 0)));
 }
 
 /**
-  * The matching pattern is 000 1(bit7)   1(bit4).
-  * @param instruction The instruction to be executed
+  * The matching pattern is 000 1(bit7)   1(bit4). STREX always succeeds, nothing else shares the memory.
+  * @param d The predecoded instruction to be executed
   */
-void ARM::extra_ld_str(A_INSTR instruction)
+void ARM::extra_ld_str(const a_decoded &d)
 {
-    int sec_code = (instruction>>5) & MASK_2BIT;
+    int sec_code = (d.instr>>5) & MASK_2BIT;
+    int L = (d.instr>>20) & MASK_1BIT;
+    int Rd = d.rd;
 
-    switch (sec_code)
+    if (sec_code == 0)//swp, swpb, ldrex, strex
     {
-    	case 0://swp, swpb, ldrex, strex,
-    	{
+        int address = r[d.rn];
+        int Rm = (d.instr) & MASK_4BIT;
 
+        if ((d.instr>>23) & MASK_1BIT)//ldrex, strex
+        {
+            if (L == 1)
+                r[Rd] = my_mmu->get_word(address);
+            else
+            {
+                my_mmu->set_word(address, r[Rm]);
+                r[Rd] = 0;
+            }
+        }
+        else if ((d.instr>>22) & MASK_1BIT)//swpb
+        {
+            BYTE tmp = my_mmu->get_byte(address);
+            my_mmu->set_byte(address, r[Rm] & MASK_8BIT);
+            r[Rd] = tmp;
+        }
+        else//swp
+        {
+            int tmp = my_mmu->get_word(address);
+            my_mmu->set_word(address, r[Rm]);
+            r[Rd] = tmp;
+        }
+        return;
+    }
+
+    int value = getReg(Rd);//read before Rn is written back
+    int value2 = r[(Rd + 1) & MASK_4BIT];
+    int address = shifter_operand(d.instr, ((d.instr>>22) & MASK_1BIT) ? MISC_IMM_OFF : MISC_REG_OFF);
+
+    switch (sec_code | L<<2)
+    {
+    	case 1://strh
+    	{
+    	    my_mmu->set_halfword(address, value & 0xffff);
     		break;
     	}
-    	case 1://ldrh, strh,
+    	case 2://ldrd
     	{
+    	    r[Rd] = my_mmu->get_word(address);
+    	    r[(Rd + 1) & MASK_4BIT] = my_mmu->get_word(address + 4);
     		break;
     	}
-        case 2:case 3://A3-38
-        {
-        	break;
-        }
-    	default:
-            assert(0);
+    	case 3://strd
+    	{
+    	    my_mmu->set_word(address, value);
+    	    my_mmu->set_word(address + 4, value2);
+    		break;
+    	}
+    	case 5://ldrh
+    	{
+    	    r[Rd] = (HALFWORD)my_mmu->get_halfword(address);
+    		break;
+    	}
+    	case 6://ldrsb
+    	{
+    	    r[Rd] = (int8_t)my_mmu->get_byte(address);
+    		break;
+    	}
+    	default://7, ldrsh
+    	{
+    	    r[Rd] = (int16_t)my_mmu->get_halfword(address);
     		break;
+    	}
     }
-
 }
 
 /** 
-  * The matching pattern is 001 10 R 10.
-  * @param instruction The instruction to be executed
+  * The matching pattern is 001 10 R 10, only the flag field of CPSR can be written in user mode.
+  * @param d The predecoded instruction to be executed
   */
-void ARM::mov_imm_to_status_reg(A_INSTR instruction)
+void ARM::mov_imm_to_status_reg(const a_decoded &d)
 {
+    int R = (d.instr>>22) & MASK_1BIT;
+    int shifter_carry_out;
 
+    if (R == 0 && ((d.instr>>19) & MASK_1BIT))
+        setFlagBits(shifter<IMM32, LSL_DATA, false>(d.instr, shifter_carry_out));
 }
 
 /**
-  * The matching pattern is 010.
-  * @param instruction The instruction to be executed
+  * Load or store a word or an unsigned byte at the address from the shifter. A stored register is read before the base register is written back.
+  * @param d The predecoded instruction to be executed
+  * @param type IMM_OFF or SCALE_OFF
   */
-void ARM::ld_str_imm_off(A_INSTR instruction)
+void ARM::load_store(const a_decoded &d, uint16_t type)
 {
-    int L = (instruction>>20) & MASK_1BIT;
-    int B = (instruction>>22) & MASK_1BIT;
-    int shifter_carry_out;
-    int operand = shifter_operand(instruction, IMM_OFF, shifter_carry_out);
-    int Rd = (instruction>>12) & MASK_4BIT;
-
+    int L = (d.instr>>20) & MASK_1BIT;
+    int B = (d.instr>>22) & MASK_1BIT;
+    int Rd = d.rd;
+    int value = getReg(Rd);
+    int operand = shifter_operand(d.instr, type);
 
     if (L == 1 && B == 0)//LDR
     {
         int data = my_mmu->get_word(operand);
         if (Rd == 15)
         {
-            rPC = data & 0xfffffffc;
+            interwork(data);//bit 0 set switches to Thumb, A4-44
         }
         else
             r[Rd] = data;
@@ -1279,65 +1215,359 @@ void ARM::ld_str_imm_off(A_INSTR instruction)
 
     if (L == 0 && B == 0)//str
     {
-        my_mmu->set_word(operand, r[Rd]);
+        my_mmu->set_word(operand, value);
     }
 
     if (L == 0 && B == 1)//strb
     {
-        BYTE tmp = r[Rd] & MASK_8BIT;
+        BYTE tmp = value & MASK_8BIT;
         my_mmu->set_byte(operand, tmp);
     }
+}
 
+/**
+  * The matching pattern is 010.
+  * @param d The predecoded instruction to be executed
+  */
+void ARM::ld_str_imm_off(const a_decoded &d)
+{
+    load_store(d, IMM_OFF);
 }
 
 /**
   * The matching pattern is 011 0(bit4).
-  * @param instruction The instruction to be executed
+  * @param d The predecoded instruction to be executed
   */
-void ARM::ld_str_reg_off(A_INSTR instruction)
+void ARM::ld_str_reg_off(const a_decoded &d)
 {
-
+    load_store(d, SCALE_OFF);
 }
 
 /** 
-  * The matching pattern is 011 1(bit4).
-  * @param instruction The instruction to be executed
+  * The matching pattern is 011 1(bit4). The ARMv6 media instructions: parallel add and subtract (on the host vector unit, see media.h), extension, PKH, SEL, saturation, byte reversing, USAD8 and the dual and most significant word multiplies.
+  * @param d The predecoded instruction to be executed
+  * @exception UnexpectInst For instructions can not be handled
+  */
+void ARM::media_instr(const a_decoded &d)
+{
+    int op1 = (d.instr>>20) & MASK_3BIT;
+    int op2 = (d.instr>>5) & MASK_3BIT;
+    int Rd = d.rd;
+    uint32_t rm = r[(d.instr) & MASK_4BIT];
+
+    switch ((d.instr>>23) & MASK_2BIT)
+    {
+    	case 0://0110 0, parallel add and subtract
+    	    if (MEDIA_VALID(op1, op2))
+    	    {
+    	        uint32_t ge;
+
+    	        r[Rd] = media_parallel(op1, op2, r[d.rn], rm, ge);
+    	        if (MEDIA_SETS_GE(op1))
+    	            st->cpsr = (st->cpsr & ~CPSR_GE) | (ge<<16);
+    	        return;
+    	    }
+    		break;
+    	case 2://0111 0
+    	    multiply_media(d);
+    		return;
+    	case 3://0111 1
+    	    if (op1 == 0 && op2 == 0)//usad8, usada8 unless Ra is 15
+    	    {
+    	        uint32_t sum = media_usad8(rm, r[(d.instr>>8) & MASK_4BIT]);
+
+    	        r[d.rn] = Rd == 15 ? sum : sum + r[Rd];//Rd is bits 19:16, Ra bits 15:12
+    	        return;
+    	    }
+    		break;
+    }
+
+    if (((d.instr>>23) & MASK_2BIT) == 1)//0110 1
+    {
+        if (op2 == 3)//sign and zero extension, with add unless Rn is 15
+        {
+            int rotate = ((d.instr>>10) & MASK_2BIT) * 8;
+            uint32_t value = rotate ? (rm>>rotate) | (rm<<(32 - rotate)) : rm;
+            int rn = d.rn == 15 ? 0 : r[d.rn];
+
+            switch (op1)
+            {
+            	case 2://sxtab, sxtb
+            	    r[Rd] = rn + (int8_t)value;
+            		return;
+            	case 3://sxtah, sxth
+            	    r[Rd] = rn + (int16_t)value;
+            		return;
+            	case 6://uxtab, uxtb
+            	    r[Rd] = rn + (uint8_t)value;
+            		return;
+            	case 7://uxtah, uxth
+            	    r[Rd] = rn + (uint16_t)value;
+            		return;
+            	case 0://sxtab16, sxtb16, bytes 0 and 2 added to the halfwords
+            	    r[Rd] = ((rn + (int8_t)value) & 0xffff) | ((rn>>16) + (int8_t)(value>>16))<<16;
+            		return;
+            	case 4://uxtab16, uxtb16
+            	    r[Rd] = ((rn + (value & MASK_8BIT)) & 0xffff) | ((rn>>16) + ((value>>16) & MASK_8BIT))<<16;
+            		return;
+            	default:
+            		break;
+            }
+        }
+        else if (op1 == 0 && (op2 & MASK_1BIT) == 0)//pkhbt, pkhtb
+        {
+            int shift_imm = (d.instr>>7) & MASK_5BIT;
+            uint32_t rn = r[d.rn];
+
+            if ((d.instr>>6) & MASK_1BIT)//tb, asr #32 is the sign
+                r[Rd] = (rn & 0xffff0000) | (((int32_t)rm>>(shift_imm ? shift_imm : 31)) & 0xffff);
+            else
+                r[Rd] = (rn & 0xffff) | ((rm<<shift_imm) & 0xffff0000);
+            return;
+        }
+        else if (op1 == 0 && op2 == 5)//sel, each byte from Rn if its GE bit is set
+        {
+            uint32_t ge = (st->cpsr & CPSR_GE)>>16;
+            uint32_t mask = ((ge & 1) ? 0xff : 0) | ((ge & 2) ? 0xff00 : 0) | ((ge & 4) ? 0xff0000 : 0) | ((ge & 8) ? 0xff000000 : 0);
+
+            r[Rd] = (r[d.rn] & mask) | (rm & ~mask);
+            return;
+        }
+        else if ((op2 & MASK_1BIT) == 0 && (op1 & 2))//ssat, usat
+        {
+            int shift_imm = (d.instr>>7) & MASK_5BIT;
+            int sat_imm = (d.instr>>16) & MASK_5BIT;
+            int32_t operand = ((d.instr>>6) & MASK_1BIT) ? (int32_t)rm>>(shift_imm ? shift_imm : 31) : (int32_t)(rm<<shift_imm);//asr #32 is the sign
+            bool sat;
+
+            r[Rd] = (op1 & 4) ? UnsignedSat(operand, sat_imm, sat) : SignedSat(operand, sat_imm + 1, sat);
+            if (sat)
+                st->cpsr |= CPSR_Q;
+            return;
+        }
+        else if (op2 == 1 && (op1 == 2 || op1 == 6))//ssat16, usat16
+        {
+            int sat_imm = (d.instr>>16) & MASK_4BIT;
+            int lo, hi;
+            bool sat, sat2;
+
+            if (op1 == 2)
+            {
+                lo = SignedSat((int16_t)rm, sat_imm + 1, sat);
+                hi = SignedSat((int32_t)rm>>16, sat_imm + 1, sat2);
+            }
+            else
+            {
+                lo = UnsignedSat((int16_t)rm, sat_imm, sat);
+                hi = UnsignedSat((int32_t)rm>>16, sat_imm, sat2);
+            }
+            r[Rd] = (lo & 0xffff) | (hi<<16);
+            if (sat || sat2)
+                st->cpsr |= CPSR_Q;
+            return;
+        }
+        else if (op1 == 3 && op2 == 1)//rev
+        {
+            r[Rd] = __builtin_bswap32(rm);
+            return;
+        }
+        else if (op1 == 3 && op2 == 5)//rev16
+        {
+            r[Rd] = ((rm & 0x00ff00ff)<<8) | ((rm>>8) & 0x00ff00ff);
+            return;
+        }
+        else if (op1 == 7 && op2 == 5)//revsh
+        {
+            r[Rd] = (int16_t)(((rm & MASK_8BIT)<<8) | ((rm>>8) & MASK_8BIT));
+            return;
+        }
+    }
+
+    UnexpectInst e;
+    throw e;
+}
+
+/**
+  * The multiplies of the media space, 0111 0: SMLAD, SMLSD, SMUAD, SMUSD (Ra 15), SMLALD, SMLSLD and SMMLA, SMMLS, SMMUL (Ra 15). The operands are Rm and Rs, the result goes to bits 19:16 and the accumulator is bits 15:12.
+  * @param d The predecoded instruction to be executed
+  * @exception UnexpectInst For instructions can not be handled
+  */
+void ARM::multiply_media(const a_decoded &d)
+{
+    int op1 = (d.instr>>20) & MASK_3BIT;
+    int op2 = (d.instr>>5) & MASK_3BIT;
+    int Rd = d.rn;
+    int Ra = d.rd;
+    uint32_t rm = r[(d.instr) & MASK_4BIT];
+    uint32_t rs = r[(d.instr>>8) & MASK_4BIT];
+
+    if ((op1 == 0 || op1 == 4) && op2 < 4)//dual 16 x 16, 01X subtracts
+    {
+        if (op2 & MASK_1BIT)//X, the halves of Rs exchanged
+            rs = (rs>>16) | (rs<<16);
+
+        int64_t p1 = (int32_t)(int16_t)rm * (int16_t)rs;
+        int64_t p2 = (int64_t)((int32_t)rm>>16) * ((int32_t)rs>>16);
+        int64_t sum = (op2 & 2) ? p1 - p2 : p1 + p2;
+
+        if (op1 == 4)//smlald, smlsld, RdHi is bits 19:16, RdLo bits 15:12
+        {
+            uint64_t acc = ((uint64_t)(uint32_t)r[Rd]<<32) | (uint32_t)r[Ra];
+
+            acc += sum;
+            r[Ra] = (uint32_t)acc;
+            r[Rd] = (uint32_t)(acc>>32);
+            return;
+        }
+
+        if (Ra != 15)
+            sum += (int32_t)r[Ra];
+        r[Rd] = (int32_t)sum;
+        if (sum != (int32_t)sum)
+            st->cpsr |= CPSR_Q;
+        return;
+    }
+
+    if (op1 == 5 && (op2 == 0 || op2 == 1 || op2 == 6 || op2 == 7))//smmla, smmul, smmls, R rounds
+    {
+        int64_t product = (int64_t)(int32_t)rm * (int32_t)rs;
+        int64_t acc = Ra == 15 ? 0 : (int64_t)((uint64_t)r[Ra]<<32);
+        int64_t result = (op2 & 4) ? acc - product : acc + product;
+
+        if (op2 & MASK_1BIT)
+            result += 0x80000000;
+        r[Rd] = (uint32_t)((uint64_t)result>>32);
+        return;
+    }
+
+    UnexpectInst e;
+    throw e;
+}
+
+/**
+  * The matching pattern is 100. Registers go to increasing addresses from the lowest one, the base written back is the original one stepped by the list size, a loaded base wins over it. Loading PC may switch to Thumb, S (user bank, SPSR) is ignored in user mode.
+  * @param d The predecoded instruction to be executed
+  */
+void ARM::ld_str_multiple(const a_decoded &d)
+{
+    int P = (d.instr>>24) & MASK_1BIT;
+    int U = (d.instr>>23) & MASK_1BIT;
+    int W = (d.instr>>21) & MASK_1BIT;
+    int L = (d.instr>>20) & MASK_1BIT;
+    int reg_list = (d.instr) & 0xffff;
+    int count = __builtin_popcount(reg_list);
+    int size = count * 4;
+    int base = r[d.rn];
+    int address = U ? base + (P ? 4 : 0) : base - size + (P ? 0 : 4);
+    WORD words[16];
+    int n = 0;
+
+    if (L == 0)//stm, the registers are gathered and stored by one block transfer
+    {
+        for (int list = reg_list; list != 0; list &= list - 1)
+            words[n++] = getReg(__builtin_ctz(list));
+        my_mmu->set_words(address, words, count);
+
+        if (W == 1)
+            r[d.rn] = U ? base + size : base - size;
+        return;
+    }
+
+    my_mmu->get_words(address, words, count);//ldm
+
+    if (W == 1)
+        r[d.rn] = U ? base + size : base - size;
+
+    for (int list = reg_list & 0x7fff; list != 0; list &= list - 1)
+        r[__builtin_ctz(list)] = words[n++];
+
+    if ((reg_list>>15) & MASK_1BIT)
+        interwork(words[n]);//bit 0 set switches to Thumb
+}
+
+/**
+  * The matching pattern is 101, and 1111 101 for BLX which always switches to Thumb. The target was resolved by decode_fields().
+  * @param d The predecoded instruction to be executed
   */
-void ARM::media_instr(A_INSTR instruction)
+void ARM::branch_or_with_link(const a_decoded &d)
 {
+    int L = (d.instr>>24) & MASK_1BIT;
+
+    if ((d.instr>>28) == 15)//blx, bit 24 is H
+    {
+        rLR = rPC;//fetch() has moved PC to the next instruction
+        interwork(d.imm);
+        return;
+    }
 
+    if (L == 1)
+        rLR = rPC;
+    rPC = d.imm;
 }
 
 /**
-  * The matching pattern is 100.
-  * @param instruction The instruction to be executed
+  * A branch closing a loop without side effects, see idle_loop(). It is dispatched whatever its condition, to watch the loop for running idle while the branch is taken, and to stop watching once it is not.
+  * @param d The predecoded instruction to be executed
   */
-void ARM::ld_str_multiple(A_INSTR instruction)
+void ARM::idle_branch(const a_decoded &d)
 {
+    int cond = (d.instr>>28) & MASK_4BIT;
+
+    if (cond == 14 || ConditionPassed(cond))
+    {
+        uint32_t site = rPC - 4;
 
+        rPC = d.imm;
+        idleTaken(site);
+    }
+    else
+        idleLeft();
 }
 
 /**
-  * The matching pattern is 101.
-  * @param instruction The instruction to be executed
+  * The matching pattern is 110, and 1110 with bit24 clear. Coprocessors 10 and 11 are the VFP, the other coprocessors are not emulated, their instructions do nothing. FMSTAT copies the NZCV bits of FPSCR into CPSR.
+  * @param d The predecoded instruction to be executed
+  * @exception UndefineInst For undefined VFP instructions
   */
-void ARM::branch_or_with_link(A_INSTR instruction)
+void ARM::coprocessor(const a_decoded &d)
 {
+    int cp_num = (d.instr>>8) & MASK_4BIT;
 
+    if (cp_num != 10 && cp_num != 11)
+        return;
+
+    if (((d.instr>>25) & MASK_3BIT) == 6)
+    {
+        if (((d.instr>>21) & MASK_7BIT) == 0x62)//mcrr, mrrc
+            fpu.two_reg_transfer(d.instr, r);
+        else
+        {
+            int base = fpu.load_store(d.instr, getReg(d.rn), my_mmu);
+            if (d.rn != 15)
+                r[d.rn] = base;
+        }
+    }
+    else if (((d.instr>>4) & MASK_1BIT) == 0)//cdp
+        fpu.data_proc(d.instr);
+    else if ((d.instr & 0x0fffffff) == 0x0ef1fa10)//fmstat
+        setFlagBits(fpu.get_fpscr(), 0xf0000000u);
+    else//mcr, mrc
+        fpu.reg_transfer(d.instr, r);
 }
 
 /**
   * The matching pattern is 1111.
-  * @param instruction The instruction to be executed
+  * @param d The predecoded instruction to be executed
   */
-void ARM::swi_handler(A_INSTR instruction)
+void ARM::swi_handler(const a_decoded &d)
 {
-    int imm_24 = (instruction) & 0xffffff;
+    int imm_24 = (d.instr) & 0xffffff;
 
     if (imm_24 == 0x123456)
     {
         swi.get_para(r);
-        swi.swi_handler();
+        if (swi.swi_handler())
+            requestStop(STOP_ENDED);
     }
 }
 
@@ -1346,85 +1576,28 @@ void ARM::swi_handler(A_INSTR instruction)
 
 
 /**
-  * According to the condition field, determine whether it matches the CPSR, if matches, return true, otherwise false.
-  * @param cond The conditon field.
-  * @ return Whether condition field matches the CPSR.
+  * The undefined instructions of the decode table, and the unconditional ones other than BLX and PLD.
+  * @param d The predecoded instruction to be executed
+  * @exception UndefineInst Always
   */
-int ARM::ConditionPassed(unsigned char cond)
+void ARM::undefined(const a_decoded &d)
 {
-    int res = 0;
-    switch (cond)//A3-4,page112
-    {
-    	case 0://EQ
-            if (getZero())
-                res = 1;
-    		break;
-        case 1://NE
-            if (!getZero())
-                res = 1;
-            break;
-        case 2://CS/HS
-            if (getCarry())
-                res = 1;
-            break;
-    	case 3://CC/LO
-            if (!getCarry())
-                res = 1;
-            break;
-    	case 4://MI
-            if (getNeg())
-                res = 1;
-            break;
-    	case 5://PL
-            if (!getNeg())
-                res = 1;
-            break;
-    	case 6://VS
-            if (getOverflow())
-                res = 1;
-            break;
-    	case 7://VC
-            if (!getOverflow())
-                res = 1;
-            break;
-    	case 8://HI
-            if (getCarry() && !getZero())
-                res = 1;
-            break;
-    	case 9://LS
-            if (!getCarry() && getZero())
-                res = 1;
-            break;
-        case 10://GE
-            if (getNeg() == getOverflow())
-                res = 1;
-            break;
-    	case 11://LT
-            if (getNeg() != getOverflow())
-                res = 1;
-            break;
-    	case 12://GT
-            if (getZero() == 0 && getNeg() == getOverflow())
-                res = 1;
-            break;
-    	case 13://LE
-            if (getZero() == 1 && getNeg() != getOverflow())
-                res = 1;
-            break;
-    	case 14://AL
-            res = 1;
-            break;
-    	default:
-            assert(0);
-            //error
-    		break;
-    }
-
-    return res;
+    UndefineInst e;
+    char tmp[30];
 
+    sprintf(tmp,"%x : %x",rPC-4, d.instr);
+    e.error_name = tmp;
+    throw e;
 }
 
+/**
+  * Coprocessor and other not emulated instructions, nothing to do.
+  * @param d The predecoded instruction to be executed
+  */
+void ARM::ignore(const a_decoded &d)
+{
 
+}
 
 /**
   * Give out the current MMU pointer(for mode switch use).
@@ -1432,8 +1605,7 @@ int ARM::ConditionPassed(unsigned char cond)
   */
 MMU * ARM::get_mmu()
 {
-    if (my_mmu != 0)
-        return my_mmu;
+    return my_mmu;
 }
 
 /**
@@ -1447,6 +1619,7 @@ void ARM::InitMMU()
     rPC = my_mmu->getEntry();
 
     InitSWI();
+    hle.init(my_mmu, false);
 }
 
 /**
@@ -1468,46 +1641,33 @@ void ARM::InitSWI()
 }
 
 /**
-  * Not done, never used.
+  * never used
   * @return The CPSR value.
   */
 EFLAG ARM::get_eflag()
 {
-
+    syncFlags();
+    return st->cpsr;
 }
 
 /**
-  * Not done, never used.
+  * never used
   * @param p_eflag The process status to be set.
   */
 void ARM::set_eflag(EFLAG p_eflag)
 {
-
-}
-/**
-  * Copy the general purpose register, process status register, and MMU pointer.
-  * @param reg The pointer to array of general purpose registers
-  * @param flags The reference of process status register
-  * @param mmu The pointer to MMU modular 
-  */
-void ARM::getRegs(GP_Reg reg[], EFLAG &flags, MMU* &mmu)
-{
-    for (int i = 0; i < GPR_num; i++)
-        reg[i] = r[i];
-
-    flags = cpsr;
-    mmu = my_mmu;
-
+    st->flag_op = FLAGS_NONE;
+    st->cpsr = p_eflag;
 }
-
 /**
-  * Copy a CPU content to current one(for mode switch use).
-  * @param a_cpu The pointer to another CPU
+  * Use the MMU modular of the Thumb decoder, the registers are shared already.
+  * @param mmu The pointer to MMU modular
   */
-void ARM::CopyCPU(CPU *a_cpu)
+void ARM::AttachMMU(MMU *mmu)
 {
-    static_cast<Thumb *>(a_cpu)->getRegs(r, cpsr, my_mmu);
+    my_mmu = mmu;
     InitSWI();
+    hle.init(my_mmu, false);
 }
 
 /**
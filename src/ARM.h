@@ -47,6 +47,8 @@
 #include "CPU.h"
 #include "MMU.h"
 #include "swi_semihost.h"
+#include "vfp.h"
+#include "hle.h"
 #include <limits.h>
 
 #define GPR_num     16
@@ -82,30 +84,99 @@
 #define MISC_REG_OFF    1<<8
 
 
+class ARM;
+struct a_decoded;
+
+/*! \typedef a_handler
+	\brief Pointer to the member function which executes one kind of ARM instruction.
+ */
+typedef void (ARM::*a_handler)(const a_decoded &);
+
+/*! \enum a_class
+	\brief The handler classes of ARM instructions.
+ */
+enum a_class
+{
+    A_DATA_PROC,
+    A_MISC_INSTR,
+    A_MULTIPLIES,
+    A_EXTRA_LD_STR,
+    A_MOV_IMM_TO_STATUS_REG,
+    A_LD_STR_IMM_OFF,
+    A_LD_STR_REG_OFF,
+    A_MEDIA_INSTR,
+    A_LD_STR_MULTIPLE,
+    A_BRANCH_OR_WITH_LINK,
+    A_COPROC,
+    A_SWI_HANDLER,
+    A_UNDEFINED,
+    A_IGNORE,
+    A_CLASS_NUM
+};
+
+/*! \struct a_decoded
+	\brief A predecoded ARM instruction.
+
+	One entry exists for every word of the code segment, filled by ARM::decode() the first time its address is fetched.
+ */
+struct a_decoded
+{
+	//! The handler to execute, NULL while the entry is not decoded yet.
+    a_handler handler;
+	//! The raw instruction, the shifter still works on it.
+    A_INSTR instr;
+	//! The a_class of the instruction, used by the threaded dispatch.
+    uint8_t cls;
+	//! The condition field, bit[31:28], 14 (always) for the unconditional instructions too.
+    uint8_t cond;
+	//! The data processing opcode, bit[24:21].
+    uint8_t op;
+	//! The S bit, bit 20, cleared by decode() where the flags it asks for are dead.
+    uint8_t S;
+	//! The Rd field, bit[15:12].
+    uint8_t rd;
+	//! The Rn field, bit[19:16].
+    uint8_t rn;
+	//! The target of a branch, with bit 0 set for BLX to Thumb.
+    int32_t imm;
+};
+
+
 /*! \class ARM
     \brief ARM instruction decode class.
 
-    Decode part of the ARM instructions
+    Decode the ARMv5TE instructions and part of the ARMv6 ones through a table indexed by bit[27:20] and bit[7:4]. The condition field is checked once at dispatch, before the handler runs. Of the coprocessors only the VFP (10 and 11) is emulated.
 */
 class ARM: public CPU
 {
 public:
     //!A constructor
-    ARM();
+    ARM(cpu_state *state);
     //!A destructor
     ~ARM();
 
 private:
-	//! The general purpose registers array
-    GP_Reg r[GPR_num];//only user mode will appear in this CPU
-	//! The current process status register
-    EFLAG cpsr; //spsr will not be used in this CPU
 	//! The current instruction to be executed
     A_INSTR cur_instr;
+	//! The predecoded entry of the current instruction
+    a_decoded *cur;
 	//! The pointer to MMU module 
     MMU *my_mmu;
 	//! The SWI component
     swi_semihost swi;
+	//! The VFP coprocessor
+    vfp fpu;
+	//! The library routines of the program run on the host
+    hle_table hle;
+
+protected:
+    //inherit
+#ifdef THREADED_DISPATCH
+	//! Run instructions with direct-threaded dispatch
+    virtual void run_loop();
+#endif
+	//! The address of the current instruction
+    virtual uint32_t cur_address(){ return rPC - 4; };
 
 public:
     //inherit
@@ -115,7 +186,7 @@ public:
     virtual STATUS exec();
 	//! Get register value by its name(future use, not implemented)
     virtual GP_Reg get_reg_by_name(const char *reg_name);
-	//! Get register value by its index(future use, not implemented)
+	//! Get register value by its index
     virtual GP_Reg get_reg_by_code(int reg_code);
 
     //about MMU
@@ -129,12 +200,16 @@ public:
 	//! Get the MMU pointer(Mode switch use)
     MMU *get_mmu();
 
-	//! Copy another CPU's pointer(Mode switch use)
-    void CopyCPU(CPU *a_cpu);
-	//! Get all kinds of register and MMU pointer
-    void getRegs(GP_Reg reg[], EFLAG &flags, MMU* &mmu);
+	//! Use the MMU module of the other decoder
+    void AttachMMU(MMU *mmu);
 	//! Get arg for SWI component
     void getArg(char *arg, int len);
+	//! Collect the console output of the SWI component in a string
+    void setConsole(std::string *out){ swi.setConsole(out); hle.setConsole(out); };
+	//! Choose which library routines of the program run on the host, HLE_OFF, HLE_ON or HLE_PRINTF, before the MMU is initialized or attached
+    void setHLE(int level){ hle.enable(level); };
+	//! Print how many calls of library routines ran on the host
+    virtual void dump_stats(FILE *fp){ hle.dump(fp); };
 
 private:
     //inherit
@@ -144,128 +219,6 @@ private:
     virtual EFLAG get_eflag();
 
 private:
-	//! Get the negative bit value
-	/*!
-		\return The value of negative bit(1:neg, 0:pos)
-	*/
-    inline int getNeg(){ return (cpsr>>31) & MASK_1BIT; };
-	//! Get the zero bit value
-	/*!
-		\return The value of zero bit(1:reg is zero, 0:not zero)
-	*/
-    inline int getZero(){ return (cpsr>>30) & MASK_1BIT; };
-	//! Get the carry bit value
-	/*!
-		\return The value of carry bit(1:last operation has carry, 0:no carry)
-	*/
-    inline int getCarry(){ return (cpsr>>29) & MASK_1BIT; };
-	//! Get the overflow bit value
-	/*! 
-		\return The value of overflow bit(1:last operation has overflow, 0:no overflow)
-	*/
-    inline int getOverflow(){ return (cpsr>>28) & MASK_1BIT; };
-
-	//! Set negative bit
-    inline void setNeg(){cpsr |= 1<<31;};
-	//! Set Zero bit
-    inline void setZero(){cpsr |= 1<<30;};
-	//! Set Carry bit
-    inline void setCarry(){cpsr |= 1<<29;};
-	//! Set Overflow bit
-    inline void setOverflow(){cpsr |= 1<<28;};
-
-	//! Clear Negative bit
-    inline void clrNeg(){cpsr &= ~(1<<31);};
-	//! Clear Zero bit
-    inline void clrZero(){cpsr &= ~(1<<30);};
-	//! Clear Carry bit
-    inline void clrCarry(){cpsr &= ~(1<<29);};
-	//! Clear Overflow bit
-    inline void clrOverflow(){cpsr &= ~(1<<28);};
-
-	//! Determine the carry of an add operation 
-	/*!
-		It determines the add operation, negate num_b to determine substraction. 
-		\param num_a first operand
-		\param num_b second operand
-		\return The carry result
-	*/
-    inline int CarryFrom(unsigned int num_a, unsigned int num_b)
-    {
-        if ((unsigned long long)(num_a) + num_b > UINT_MAX)
-            return 1;
-        else
-            return 0;
-    };
-
-	//! Determine the overflow of an add operation
-	/*!
-		It is used as CarryFrom, negate num_b to determine substraction.
-		\param num_a first operand
-		\param num_b second operand
-		\return The overflow result
-	*/
-    inline int OverflowFrom(int num_a, int num_b)
-    {
-        int c = num_a + num_b;
-        if ((num_a > 0 && num_b > 0 && c < 0) || (num_a < 0 && num_b <0 && c >0))
-            return 1;
-        else
-            return 0;
-    };
-
-	//! Another CarryFrom
-	/*!
-		CarryFrom with carry.
-		\param num_a first operand
-		\param num_b second operand
-		\param carry the carry bit
-		\return The carry result
-	*/
-    inline int CarryFrom(unsigned int num_a, unsigned int num_b, int carry)
-    {
-        if (carry == 0)
-        {
-            return CarryFrom(num_a, num_b);//C flag
-        }
-        else// carry == 1
-        {
-            if (CarryFrom(num_a, num_b+1)
-             || CarryFrom(num_a+1, num_b)
-             || CarryFrom(num_a, num_b))// in case one of them is 0xffffffff, or both are
-                return 1;
-            else
-                return 0;
-        }
-
-    };
-
-	//! Another OverflowFrom
-	/*! 
-		OverflowFrom with carry
-		\param num_a first operand
-		\param num_b second operand
-		\param carry the carry bit
-		\return the overflow result
-	*/
-    inline int OverflowFrom(int num_a, int num_b, int carry)
-    {
-        if (getCarry() == 0)
-        {
-            return OverflowFrom(num_a, num_b);//V flag
-        }
-        else// carry == 1
-        {
-            if (OverflowFrom(num_a, num_b+1)
-             || OverflowFrom(num_a+1, num_b)
-             || OverflowFrom(num_a, num_b))
-                return 1;
-            else
-                return 0;
-        }
-
-    };
-
 	//! Exetension of signed number
 	/*!
 		Extend a signed short bit size number to a signed long bit size number.
@@ -294,36 +247,78 @@ private:
     };
 
 	//! Determine whether the condition is the same as CPRS
-    int ConditionPassed(unsigned char cond);
+    inline int ConditionPassed(unsigned char cond){ syncFlags(); return condPassed(cond, st->cpsr); };
+
+	//! Read a register as an operand, PC reads as the address of the instruction plus 8
+    inline GP_Reg getReg(int n){ return n == 15 ? rPC + 4 : r[n]; };
+
+	//! Write the NZCVQ bits of CPSR, the only ones MSR changes in user mode, or the bits of mask
+    inline void setFlagBits(uint32_t value, uint32_t mask = 0xf8000000u)
+    {
+        syncFlags();
+        st->cpsr = (st->cpsr & ~mask) | (value & mask);
+    };
+
+	//! Decode an instruction into its predecoded entry, dropping the S bit where the flags are dead
+    void decode(int address, a_decoded &d);
+	//! Classify an instruction and pull out its fields
+    void decode_fields(int address, a_decoded &d);
+	//! Whether the flags an instruction sets are overwritten before anything reads them
+    bool flags_dead(int address, const a_decoded &d);
+	//! Whether the branch at an address closes a loop of at most IDLE_LOOP_INSTRS which neither stores, calls nor branches out before it
+    bool idle_loop(int address);
+	//! The handlers of every a_class
+    static const a_handler handler_tab[A_CLASS_NUM];
 
 private:
-    //void data_proc_imm(A_INSTR instruction);
-	//! Data process decode
-    void data_proc(A_INSTR instruction);
+	//! Data process decode, for one form of the operand, with or without setting the flags
+    template<int Type, int Shift, bool SetFlags> void data_proc(const a_decoded &d);
+	//! The data_proc() variants, by S and the operand form
+    static const a_handler dp_handler_tab[2][9];
+	//! Pick the data_proc() variant of an instruction
+    a_handler dp_handler(const a_decoded &d);
 	//! Misc instruction decode
-    void misc_instr(A_INSTR instruction);
+    void misc_instr(const a_decoded &d);
 	//! Multiply instruction decode
-    void multiplies(A_INSTR instruction);
+    void multiplies(const a_decoded &d);
 	//! Extra load or store instruction decode
-    void extra_ld_str(A_INSTR instruction);
+    void extra_ld_str(const a_decoded &d);
 	//! Move immediate number into status register
-    void mov_imm_to_status_reg(A_INSTR instruction);
+    void mov_imm_to_status_reg(const a_decoded &d);
 	//! Load or store immediate offset
-    void ld_str_imm_off(A_INSTR instruction);
+    void ld_str_imm_off(const a_decoded &d);
 	//! Load or store register offset
-    void ld_str_reg_off(A_INSTR instruction);
+    void ld_str_reg_off(const a_decoded &d);
 	//! Media instruction decode
-    void media_instr(A_INSTR instruction);
+    void media_instr(const a_decoded &d);
+	//! The dual and most significant word multiplies of the media space
+    void multiply_media(const a_decoded &d);
 	//! Load or store all or subset of general purpose registers
-    void ld_str_multiple(A_INSTR instruction);
+    void ld_str_multiple(const a_decoded &d);
 	//! Branch with link instruction decode
-    void branch_or_with_link(A_INSTR instruction);
+    void branch_or_with_link(const a_decoded &d);
+	//! A branch closing a loop without side effects, which watches the loop for running idle
+    void idle_branch(const a_decoded &d);
+	//! Run a library routine on the host, PC is at its entry point
+    bool hle_run(hle_routine &h);
+	//! The entry point of a library routine, which runs the routine on the host
+    void hle_call(const a_decoded &d);
+	//! Coprocessor instruction decode
+    void coprocessor(const a_decoded &d);
 	//! SWI handle function
-    void swi_handler(A_INSTR instruction);
+    void swi_handler(const a_decoded &d);
+	//! Undefined instructions
+    void undefined(const a_decoded &d);
+	//! Instructions which are not emulated, executed as no operation
+    void ignore(const a_decoded &d);
 
 private:
-	//! Shifter for addressing mode
-    int shifter_operand(uint32_t shifter_operand, uint16_t type, int &carry_out);
+	//! Shifter for the data processing operand, C is false where the carry is not needed
+    template<int Type, int Shift, bool C> inline int shifter(uint32_t instr, int &carry_out);
+	//! Shifter for the load and store address modes
+    int shifter_operand(uint32_t shifter_operand, uint16_t type);
+	//! Load or store a word or unsigned byte
+    void load_store(const a_decoded &d, uint16_t type);
 };
 
 /*@}*/
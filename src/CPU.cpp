@@ -0,0 +1,110 @@
+/*! \file CPU.cpp
+	\brief The run loop shared by all cores.
+
+	Turns the stops requested by instructions and the faults of the guest program into the StopReason of CPU::run().
+ */
+#include <string.h>
+#include "CPU.h"
+#include "error.h"
+
+/**
+  * Work on the registers of the core, the interpreter engine, nothing run yet.
+  * @param state The registers, shared by the decoders of the core
+  */
+CPU::CPU(cpu_state *state)
+{
+    st = state;
+    r = state->r;
+    engine = ENGINE_INTERP;
+    budget = 0;
+    stop_left = 0;
+    last_stop.reason = STOP_NONE;
+    last_stop.fault = FAULT_NONE;
+    last_stop.address = 0;
+    last_stop.executed = 0;
+    idle.site = 0;
+    idle.wait = IDLE_CHECK_PERIOD;
+}
+
+/**
+  * Run the engine of the core until an instruction requests a stop, the budget runs out, or the guest program faults. Instruction faults and bad memory accesses are still thrown inside the core, they end the program, so they are caught here once rather than checked for on every instruction.
+  * @param max_instructions The instruction budget, RUN_FOREVER for no limit
+  * @return Why it stopped
+  */
+StopReason CPU::run(uint64_t max_instructions)
+{
+    budget = max_instructions;
+    last_stop.reason = STOP_NONE;
+    last_stop.fault = FAULT_NONE;
+    last_stop.detail.clear();
+
+    try
+    {
+        run_loop();
+    }
+    catch (UndefineInst &e)
+    {
+        last_stop.fault = FAULT_UNDEFINED;
+        last_stop.detail = e.error_name;
+    }
+    catch (UnexpectInst &e)
+    {
+        last_stop.fault = FAULT_UNEXPECTED;
+        last_stop.detail = e.error_name;
+    }
+    catch (Error &e)
+    {
+        last_stop.fault = FAULT_ERROR;
+        last_stop.detail = e.error_name;
+    }
+
+    if (last_stop.fault != FAULT_NONE)
+    {
+        last_stop.reason = STOP_FAULT;
+        last_stop.address = cur_address();
+        stop_left = budget;
+    }
+    else if (last_stop.reason == STOP_NONE)//the budget ran out
+    {
+        last_stop.reason = STOP_BUDGET;
+        last_stop.address = get_reg_by_code(15);
+        stop_left = 0;
+    }
+
+    last_stop.executed = max_instructions - stop_left;
+    budget = 0;
+
+    return last_stop.reason;
+}
+
+/**
+  * Compare the state at the branch closing a loop without side effects with the one taken there last time, IDLE_CHECK_PERIOD runs before, see idle_watch. If the registers, the flags and the semihosting calls other than clock reads are the same, the loop goes on like this for ever: with no clock read the program is stopped with STOP_IDLE, otherwise it waits for a clock to move on, and the clocks it read are moved on to their next tick, as if the time had gone by spinning. The state is taken again for the next comparison.
+  * @param site The address of the branch
+  */
+void CPU::idleCheck(uint32_t site)
+{
+    swi_events &ev = st->swi;
+
+    idle.wait = IDLE_CHECK_PERIOD;
+    syncFlags();
+    if (idle.site == site && idle.others == ev.others && idle.cpsr == st->cpsr && memcmp(idle.r, r, sizeof(idle.r)) == 0)
+    {
+        if (idle.clock_reads == ev.clock_reads && idle.time_reads == ev.time_reads)
+        {
+            requestStop(STOP_IDLE);
+            last_stop.address = site;
+            return;
+        }
+        if (idle.clock_reads != ev.clock_reads)
+            ev.clock_skip++;
+        if (idle.time_reads != ev.time_reads)
+            ev.time_skip++;
+    }
+
+    idle.site = site;
+    memcpy(idle.r, r, sizeof(idle.r));
+    idle.cpsr = st->cpsr;
+    idle.clock_reads = ev.clock_reads;
+    idle.time_reads = ev.time_reads;
+    idle.others = ev.others;
+}
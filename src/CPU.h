@@ -6,8 +6,228 @@
 #ifndef __CPU_H__
 #define __CPU_H__
 
+#include <stdio.h>
+#include <string>
 #include "arch.h"
 #include "MMU.h"
+#include "swi_semihost.h"
+
+/*! \def ENGINE_INTERP
+	\brief Execute one instruction at a time
+ */
+
+/*! \def ENGINE_BLOCK
+	\brief Execute chained guest basic blocks
+ */
+
+/*! \def ENGINE_JIT
+	\brief Execute chained guest basic blocks, hot ones translated into host code
+ */
+/*! \def ENGINE_AOT
+	\brief Execute chained guest basic blocks, the ones of the image translated ahead of time by host code from the first execution on, other hot ones translated as with ENGINE_JIT
+ */
+#define ENGINE_INTERP   0
+#define ENGINE_BLOCK    1
+#define ENGINE_JIT      2
+#define ENGINE_AOT      3
+
+/*! \def RUN_FOREVER
+	\brief The instruction budget of CPU::run() which never runs out
+ */
+#define RUN_FOREVER     UINT64_MAX
+
+/*! \enum StopReason
+	\brief Why CPU::run() returned.
+ */
+enum StopReason
+{
+    STOP_NONE,//still running, never returned
+    STOP_ENDED,//the program ended by SYS_KILL
+    STOP_SWITCH_MODE,//the program switched between ARM and Thumb status, arm_core goes on with its other decoder
+    STOP_FAULT,//an undefined or not handled instruction, or a bad memory access, nothing more can run
+    STOP_BUDGET,//the instruction budget ran out, run() can be called again
+    STOP_BREAKPOINT,//a BKPT instruction, run() goes on after it
+    STOP_IDLE,//a loop without side effects which nothing can end, address is its closing branch
+    STOP_RETURNED//the function started by arm_core::call() returned, r0 and r1 hold its result
+};
+
+/*! \enum StopFault
+	\brief What kind of fault stopped the run, for STOP_FAULT.
+ */
+enum StopFault
+{
+    FAULT_NONE,
+    FAULT_UNDEFINED,//UndefineInst
+    FAULT_UNEXPECTED,//UnexpectInst
+    FAULT_ERROR//Error, e.g. memory access violation
+};
+
+/*! \struct StopInfo
+	\brief The details of the last stop of CPU::run().
+ */
+struct StopInfo
+{
+	//! Why the run stopped
+    StopReason reason;
+	//! The kind of fault, FAULT_NONE unless reason is STOP_FAULT
+    StopFault fault;
+	//! The address of the instruction which stopped the run, PC for STOP_BUDGET
+    uint32_t address;
+	//! The number of instructions run by the call, including the one which stopped it
+    uint64_t executed;
+	//! The message of the fault
+    std::string detail;
+};
+
+/*! \def FLAGS_NONE
+	\brief No flag-setting operation is pending, cpsr holds NZCV
+ */
+
+/*! \def FLAGS_NZ
+	\brief N and Z are pending, from the result
+ */
+
+/*! \def FLAGS_NZC
+	\brief N and Z are pending from the result, C from the shifter
+ */
+
+/*! \def FLAGS_ADD
+	\brief NZCV are pending from an addition
+ */
+
+/*! \def FLAGS_SUB
+	\brief NZCV are pending from a subtraction
+ */
+#define FLAGS_NONE      0
+#define FLAGS_NZ        1
+#define FLAGS_NZC       2
+#define FLAGS_ADD       3
+#define FLAGS_SUB       4
+
+/*! \def CPSR_T
+	\brief The T bit of CPSR, set while Thumb instructions run
+ */
+#define CPSR_T          (1<<5)
+
+/*! \def CPSR_Q
+	\brief The sticky saturation bit of CPSR
+ */
+#define CPSR_Q          (1<<27)
+
+/*! \def CPSR_GE
+	\brief The GE bits of CPSR, one per byte, set by the parallel add and subtract and read by SEL
+ */
+#define CPSR_GE         (0xf<<16)
+
+/*! \struct cpu_state
+	\brief The registers of the core, shared by its ARM and Thumb decoders.
+
+	Both decoders point at the same cpu_state, so an interworking branch only writes PC and the T bit, and the other decoder goes on from there.
+ */
+struct cpu_state
+{
+	//! The general purpose registers, only user mode appears
+    GP_Reg r[16];
+	//! The current process status register, NZCV may be pending in the flag_ fields
+    EFLAG cpsr;
+	//! The kind of the last flag-setting operation whose flags are not in cpsr yet, FLAGS_NONE if cpsr is up to date
+    int flag_op;
+	//! The result of that operation, N and Z come from it
+    int32_t flag_res;
+	//! The operands C and V come from, flag_a is the carry for FLAGS_NZC
+    int32_t flag_a, flag_b;
+	//! What the semihosting calls of both decoders did
+    swi_events swi;
+};
+
+/*! \def IDLE_LOOP_INSTRS
+	\brief The most instructions of a loop the decoders watch for running idle
+ */
+#define IDLE_LOOP_INSTRS    16
+
+/*! \def IDLE_CHECK_PERIOD
+	\brief How many runs of a watched loop apart its state is compared, a power of 2
+ */
+#define IDLE_CHECK_PERIOD   64
+
+/*! \struct idle_watch
+	\brief The state of a loop without side effects, taken when its closing branch was taken.
+
+	Such a loop neither stores, calls, nor branches out before its end, so once its branch is taken it runs whole up to the branch again. If the state there is the same some runs later, and the semihosting calls in between only read the clock, nothing but the clock can ever change it.
+ */
+struct idle_watch
+{
+	//! The address of the closing branch, 0 while no loop is watched
+    uint32_t site;
+	//! The taken branches left until the next comparison, for the interpreters
+    int wait;
+	//! r0-r14
+    GP_Reg r[15];
+	//! CPSR, with the flags up to date
+    EFLAG cpsr;
+	//! The semihosting calls made until then
+    unsigned long long clock_reads, time_reads, others;
+};
+
+/*! \def FLAG_SCAN_MAX
+	\brief How many instructions after a flag-setting one are looked at to prove its flags dead
+ */
+#define FLAG_SCAN_MAX   16
+
+/*! \struct cond_pass_table
+	\brief Whether each condition field passes, for all 16 NZCV values.
+
+	Built at compile time, bit NZCV of mask[cond] is set if the condition passes with those flags, so a condition is checked with one load and one shift.
+ */
+struct cond_pass_table
+{
+	//! One mask per condition field
+    uint16_t mask[16];
+	//! The flags each condition field depends on, as an NZCV nibble
+    uint8_t reads[16];
+
+	//! Evaluate the condition fields, A3-4
+    constexpr cond_pass_table() : mask(), reads()
+    {
+        for (int cond = 0; cond < 16; cond++)
+            for (int i = 0; i < 16; i++)
+            {
+                bool N = i & 8, Z = i & 4, C = i & 2, V = i & 1;
+                bool res = false;
+
+                switch (cond)
+                {
+                    case 0: res = Z; break;//EQ
+                    case 1: res = !Z; break;//NE
+                    case 2: res = C; break;//CS/HS
+                    case 3: res = !C; break;//CC/LO
+                    case 4: res = N; break;//MI
+                    case 5: res = !N; break;//PL
+                    case 6: res = V; break;//VS
+                    case 7: res = !V; break;//VC
+                    case 8: res = C && !Z; break;//HI
+                    case 9: res = !C || Z; break;//LS
+                    case 10: res = N == V; break;//GE
+                    case 11: res = N != V; break;//LT
+                    case 12: res = !Z && N == V; break;//GT
+                    case 13: res = Z || N != V; break;//LE
+                    case 14: res = true; break;//AL
+                    default: res = false; break;//NV
+                }
+                if (res)
+                    mask[cond] |= 1<<i;
+            }
+
+        for (int cond = 0; cond < 16; cond++)//a flag is read if flipping it can change the outcome
+            for (int i = 0; i < 16; i++)
+                for (int f = 1; f < 16; f <<= 1)
+                    if (((mask[cond]>>i) & 1) != ((mask[cond]>>(i ^ f)) & 1))
+                        reads[cond] |= f;
+    }
+};
+
+//! The condition table shared by all cores
+static constexpr cond_pass_table cond_pass_tab;
 
 /*! \class CPU
 	\brief General CPU interface.
@@ -18,7 +238,7 @@ class CPU
 {
 public:
 	//! A constructor
-    CPU(){};
+    CPU(cpu_state *state);
 	//! Virtual destructor
     virtual ~CPU(){};
 	//implement
@@ -27,6 +247,24 @@ public:
     virtual void fetch() = 0;
 	//! Execute the current instruction
     virtual STATUS exec() = 0;
+	//! Run instructions until the program stops, or max_instructions of them have run
+	/*!
+		Faults of the guest program are reported as STOP_FAULT rather than thrown, only errors of the host, e.g. no memory, still leave by exception.
+		\param max_instructions The instruction budget, RUN_FOREVER for no limit
+		\return Why it stopped, stop_info() has the details
+	 */
+    StopReason run(uint64_t max_instructions = RUN_FOREVER);
+	//! The details of the last stop of run()
+    const StopInfo &stop_info(){ return last_stop; };
+	//! Choose the execution engine run() uses
+	/*!
+		\param mode ENGINE_INTERP, ENGINE_BLOCK, ENGINE_JIT or ENGINE_AOT, cores without such an engine ignore it
+	 */
+    void setEngine(int mode){ engine = mode; };
+	//! Print the profiling information collected by the engine
+    virtual void dump_stats(FILE * /*fp*/) {}
+	//! Stop watching a loop for running idle, for when the host changed the registers since the last run
+    void forgetIdle(){ idle.site = 0; };
 	//! Get the register value by its name
 	/*!
 		\param reg_name Register's name
@@ -43,13 +281,257 @@ public:
     virtual void InitMMU() = 0;
 	//! Deinitialize the MMU module
     virtual void DeinitMMU() = 0;
-	//! Copy CPU content from another cpu
-    virtual void CopyCPU(CPU *a_cpu) = 0;
-	//! Get register's value, process status, and MMU module
-    virtual void getRegs(GP_Reg reg[], EFLAG &flags, MMU* &MMU) = 0;
+	//! Use the MMU module of the other decoder of the core
+    virtual void AttachMMU(MMU *mmu) = 0;
+	//! Get the MMU module
+    virtual MMU *get_mmu() = 0;
 	//! Get argument which is for running program in emulator
     virtual void getArg(char *arg, int len) = 0;
 
+protected:
+	//! The registers, shared with the other decoder of the core
+    cpu_state *st;
+	//! The general purpose registers of st
+    GP_Reg *r;
+	//! The execution engine, ENGINE_INTERP by default
+    int engine;
+	//! The instructions run() may still execute, fetching an instruction takes one, 0 once a stop is requested
+    uint64_t budget;
+	//! The budget left when a stop was requested
+    uint64_t stop_left;
+	//! The stop requested by an instruction
+    StopInfo last_stop;
+	//! The loop watched for running idle
+    idle_watch idle;
+
+	//! Keep fetching and executing instructions while the budget lasts
+	/*!
+		Cores override it with a faster dispatch, all of them return once budget is 0.
+	 */
+    virtual void run_loop(){ while (budget != 0) { fetch(); exec(); } };
+	//! The address of the current instruction, for the stop details
+    virtual uint32_t cur_address() = 0;
+	//! Make run() return after the current instruction
+	/*!
+		\param reason STOP_ENDED, STOP_SWITCH_MODE or STOP_BREAKPOINT
+	 */
+    inline void requestStop(StopReason reason)
+    {
+        last_stop.reason = reason;
+        last_stop.address = cur_address();
+        stop_left = budget;
+        budget = 0;
+    };
+	//! Branch to an address whose bit 0 selects the instruction set, as BX does
+	/*!
+		A switch to the other instruction set only flips the T bit and makes run() return STOP_SWITCH_MODE, the core then goes on with its other decoder.
+		\param target The address, bit 0 set for Thumb
+	 */
+    inline void interwork(uint32_t target)
+    {
+        bool thumb = target & 1;
+
+        if (thumb != ((st->cpsr & CPSR_T) != 0))
+        {
+            requestStop(STOP_SWITCH_MODE);
+            st->cpsr ^= CPSR_T;
+        }
+        r[15] = thumb ? target & ~1u : target & ~3u;
+    };
+	//! The taken branch closing a loop without side effects, which is compared every IDLE_CHECK_PERIOD runs
+	/*!
+		\param site The address of the branch
+	 */
+    inline void idleTaken(uint32_t site){ if (--idle.wait == 0) idleCheck(site); };
+	//! The branch closing the watched loop was not taken, its state says nothing about the next run
+    inline void idleLeft(){ idle.site = 0; };
+	//! Compare the state at the branch closing a loop without side effects with the one taken before
+    void idleCheck(uint32_t site);
+
+	//! Get the negative bit value.
+	/*!
+		\return The value of negative bit(1:neg, 0:pos)
+	*/
+    inline int getNeg(){ syncFlags(); return (st->cpsr>>31) & 1; };
+	//! Get the zero bit value
+	/*!
+		\return The value of zero bit(1:reg is zero, 0:not zero)
+	*/
+    inline int getZero(){ syncFlags(); return (st->cpsr>>30) & 1; };
+	//! Get the carry bit value
+	/*!
+		\return The value of carry bit(1:last operation has carry, 0:no carry)
+	*/
+    inline int getCarry(){ syncFlags(); return (st->cpsr>>29) & 1; };
+	//! Get the overflow bit value
+	/*! 
+		\return The value of overflow bit(1:last operation has overflow, 0:no overflow)
+	*/
+    inline int getOverflow(){ syncFlags(); return (st->cpsr>>28) & 1; };
+
+	//! Set negative bit
+    inline void setNeg(){syncFlags(); st->cpsr |= 1<<31;};
+	//! Set Zero bit
+    inline void setZero(){syncFlags(); st->cpsr |= 1<<30;};
+	//! Set Carry bit
+    inline void setCarry(){syncFlags(); st->cpsr |= 1<<29;};
+	//! Set Overflow bit
+    inline void setOverflow(){syncFlags(); st->cpsr |= 1<<28;};
+
+	//! Clear Negative bit
+    inline void clrNeg(){syncFlags(); st->cpsr &= ~(1<<31);};
+	//! Clear Zero bit
+    inline void clrZero(){syncFlags(); st->cpsr &= ~(1<<30);};
+	//! Clear Carry bit
+    inline void clrCarry(){syncFlags(); st->cpsr &= ~(1<<29);};
+	//! Clear Overflow bit
+    inline void clrOverflow(){syncFlags(); st->cpsr &= ~(1<<28);};
+
+	//! Write the pending flags into cpsr
+    inline void evalFlags(){ st->cpsr = resolveFlags(st->cpsr, st->flag_op, st->flag_res, st->flag_a, st->flag_b); st->flag_op = FLAGS_NONE; };
+	//! Bring cpsr up to date, every direct read or write of the NZCV bits goes through it
+    inline void syncFlags(){ if (st->flag_op != FLAGS_NONE) evalFlags(); };
+	//! Record an operation setting N and Z from its result, C and V unaffected
+	/*!
+		The handlers pass S false for their variant run where the flags are dead, which records nothing.
+	 */
+    template<bool S = true> inline void lazyNZ(int res)
+    {
+        if (!S)
+            return;
+        if (st->flag_op > FLAGS_NZ)//C of the pending one survives
+            evalFlags();
+        st->flag_op = FLAGS_NZ;
+        st->flag_res = res;
+    };
+	//! Record an operation setting N and Z from its result and C from the shifter, V unaffected
+    template<bool S = true> inline void lazyNZC(int res, int carry)
+    {
+        if (!S)
+            return;
+        if (st->flag_op > FLAGS_NZC)//V of the pending one survives
+            evalFlags();
+        st->flag_op = FLAGS_NZC;
+        st->flag_res = res;
+        st->flag_a = carry;
+    };
+	//! Record an addition a + b, all four flags are computed from it when needed
+    template<bool S = true> inline void lazyAdd(int res, int a, int b)
+    {
+        if (!S)
+            return;
+        st->flag_op = FLAGS_ADD;
+        st->flag_res = res;
+        st->flag_a = a;
+        st->flag_b = b;
+    };
+	//! Record a subtraction a - b, all four flags are computed from it when needed
+    template<bool S = true> inline void lazySub(int res, int a, int b)
+    {
+        if (!S)
+            return;
+        st->flag_op = FLAGS_SUB;
+        st->flag_res = res;
+        st->flag_a = a;
+        st->flag_b = b;
+    };
+
+
+	//! Determine whether a condition field passes
+	/*!
+		\param cond The condition field
+		\param flags The CPSR value, only NZCV is used
+		\return 1 if it passes, otherwise 0
+	 */
+    static inline int condPassed(int cond, EFLAG flags)
+    {
+        return (cond_pass_tab.mask[cond & 0xf] >> ((unsigned int)flags >> 28)) & 1;
+    };
+
+	//! Determine the carry of an add operation
+	/*!
+		\param num_a first operand
+		\param num_b second operand
+		\param carry the carry bit, add ~num_b with carry 1 for a subtraction
+		\return The carry of num_a + num_b + carry
+	 */
+    static inline int CarryFrom(unsigned int num_a, unsigned int num_b, int carry = 0)
+    {
+        unsigned int sum;
+        int c = __builtin_add_overflow(num_a, num_b, &sum);
+
+        return c | __builtin_add_overflow(sum, (unsigned int)carry, &sum);
+    };
+
+	//! Determine the overflow of an add operation
+	/*!
+		A carry in can undo an overflow of num_a + num_b, so the two overflows are xor-ed.
+		\param num_a first operand
+		\param num_b second operand
+		\param carry the carry bit, add ~num_b with carry 1 for a subtraction
+		\return The overflow of num_a + num_b + carry
+	 */
+    static inline int OverflowFrom(int num_a, int num_b, int carry = 0)
+    {
+        int sum;
+        int v = __builtin_add_overflow(num_a, num_b, &sum);
+
+        return v ^ __builtin_add_overflow(sum, carry, &sum);
+    };
+
+	//! Determine the borrow of a substraction, C flag is its inverse
+    static inline int BorrowFrom(unsigned int num_a, unsigned int num_b)
+    {
+        unsigned int diff;
+
+        return __builtin_sub_overflow(num_a, num_b, &diff);
+    };
+
+	//! Determine the overflow of a substraction
+    static inline int OverflowFromSub(int num_a, int num_b)
+    {
+        int diff;
+
+        return __builtin_sub_overflow(num_a, num_b, &diff);
+    };
+
+	//! Work out the flags of a pending flag-setting operation
+	/*!
+		\param flags The CPSR value before the operation
+		\param op FLAGS_NZ, FLAGS_NZC, FLAGS_ADD or FLAGS_SUB
+		\param res The result
+		\param a The first operand, or the shifter carry for FLAGS_NZC
+		\param b The second operand
+		\return The CPSR value with NZCV updated
+	 */
+    static inline EFLAG resolveFlags(EFLAG flags, int op, int32_t res, int32_t a, int32_t b)
+    {
+        flags &= ~(3u<<30);
+        flags |= (EFLAG)(res < 0)<<31;//N flag
+        flags |= (EFLAG)(res == 0)<<30;//Z flag
+
+        switch (op)
+        {
+            case FLAGS_NZC:
+                flags = (flags & ~(1u<<29)) | (EFLAG)(a != 0)<<29;//C flag
+                break;
+            case FLAGS_ADD:
+                flags &= ~(3u<<28);
+                flags |= (EFLAG)CarryFrom(a, b)<<29;//C flag
+                flags |= (EFLAG)OverflowFrom(a, b)<<28;//V flag
+                break;
+            case FLAGS_SUB:
+                flags &= ~(3u<<28);
+                flags |= (EFLAG)!BorrowFrom(a, b)<<29;//C flag
+                flags |= (EFLAG)OverflowFromSub(a, b)<<28;//V flag
+                break;
+            default://FLAGS_NZ
+                break;
+        }
+
+        return flags;
+    };
+
 private:
 	//! Set process status register(future use)
     virtual void set_eflag(EFLAG p_eflag) = 0;
@@ -1,7 +1,11 @@
 #include "MMU.h"
 #include "error.h"
 #include "Thumb.h"
+#include "ARM.h"
 #include "cstring"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 // TODO (Birdman#1#): add .init and .fini sections to MMU
 
 extern char file_name[100];
@@ -75,6 +79,17 @@ extern char file_name[100];
     ifile.seekg(_text +code_infile_off);
     ifile.read(reinterpret_cast<char *>(code), _text_sz);
 
+    t_cache = NULL;
+    t_cache = new t_decoded[_text_sz/2 + 1]();//handler == NULL means not decoded
+    a_cache = NULL;
+    a_cache = new a_decoded[_text_sz/4 + 1]();
+    if (!t_cache || !a_cache)
+    {
+        Error e;
+        e.error_name = "No mem space for decoded instructions!";
+        throw e;
+    }
+
     rodata = NULL;
     rodata = new BYTE[_rodata_sz];
     if (!rodata)
@@ -126,6 +141,12 @@ extern char file_name[100];
     if (code != NULL)
         delete []code;
 
+    if (t_cache != NULL)
+        delete []t_cache;
+
+    if (a_cache != NULL)
+        delete []a_cache;
+
     if (rodata != NULL)
         delete []rodata;
 
@@ -383,6 +404,121 @@ A_INSTR MMU::getInstr32(int address)
 
 
 
+/**
+  * Give out the predecoded entry of a Thumb instruction. The entry is filled by Thumb::decode() on its first use, the code segment is never written, so entries stay valid.
+  * @param address The given virtual address of the desired instruction
+  * @exception Error For addresses out of code segment
+  */
+t_decoded *MMU::getThumbDecoded(int address)
+{
+    unsigned int off = address - _text_VMA;
+
+    if (off >= (unsigned int)_text_sz)
+        getInstr(address);//reports the error
+
+    return &t_cache[off>>1];
+}
+
+/**
+  * Give out the predecoded entry of an ARM instruction, the same as getThumbDecoded().
+  * @param address The given virtual address of the desired instruction
+  * @exception Error For addresses out of code segment
+  */
+a_decoded *MMU::getARMDecoded(int address)
+{
+    unsigned int off = address - _text_VMA;
+
+    if (off >= (unsigned int)_text_sz)
+        getInstr32(address);//reports the error
+
+    return &a_cache[off>>2];
+}
+
+/**
+  * Give out the host memory of the segment an address belongs to, the segments are searched in the same order as VMA2Seg() does. Stack words are stored in reverse order, so the stack has no such range. Never throws.
+  * @param address The given virtual address
+  * @param write Whether the memory will be written, code and read only segments are left out then
+  * @param VMA The virtual address of the segment
+  * @param size The size of the segment
+  * @return The host memory of the segment, NULL if the address has none
+  */
+BYTE *MMU::host_range(int address, bool write, int &VMA, int &size)
+{
+    if (address >= _text_VMA && address < (_text_VMA + _text_sz))
+    {
+        VMA = _text_VMA; size = _text_sz;
+        return write ? NULL : code;
+    }
+
+    if (address >= _rodata_VMA && address < (_rodata_VMA + _rodata_sz))
+    {
+        VMA = _rodata_VMA; size = _rodata_sz;
+        return write ? NULL : rodata;
+    }
+
+    if (address >= _data_VMA && address < (_data_VMA + _data_sz))
+    {
+        VMA = _data_VMA; size = _data_sz;
+        return data_seg;
+    }
+
+    if (address >= _bss_VMA && address < (_bss_VMA + _bss_sz))
+    {
+        VMA = _bss_VMA; size = _bss_sz;
+        return bss;
+    }
+
+    if (address >= (_bss_VMA + _bss_sz) && address < (_ss_VMA - STACK_SZ))
+    {
+        VMA = _heap_VMA; size = getHeapSz();
+        return heap;
+    }
+
+    return NULL;
+}
+
+/**
+  * Give out the range of the stack segment if it holds an address. The stack is kept in words from its top down, so unlike host_range() there is no host memory in guest order to give.
+  * @param address The virtual address
+  * @param VMA The lowest virtual address of the stack segment
+  * @param size The size of the stack segment
+  * @return true if the address is in the stack segment
+  */
+bool MMU::stack_range(int address, int &VMA, int &size)
+{
+    if (address < (_ss_VMA - STACK_SZ) || address >= _ss_VMA)
+        return false;
+
+    VMA = _ss_VMA - STACK_SZ; size = STACK_SZ;
+    return true;
+}
+
+/**
+  * Record a function or a data object of the program, from the symbol table of its ELF file. The first definition of a name is kept.
+  * @param name The name of the symbol
+  * @param address The virtual address, bit 0 set for Thumb code
+  * @param size The size in bytes, 0 if unknown
+  * @param func Whether it is a function, otherwise a data object
+  */
+void MMU::addSymbol(const char *name, int address, int size, bool func)
+{
+    guest_symbol sym = {address, size, func};
+
+    symbols.insert(std::make_pair(std::string(name), sym));
+}
+
+/**
+  * Give out a function or a data object of the program by name.
+  * @param name The name of the symbol
+  * @return The symbol, NULL if the symbol table of the program has none of that name
+  */
+const guest_symbol *MMU::getSymbol(const char *name)
+{
+    std::unordered_map<std::string, guest_symbol>::const_iterator it = symbols.find(name);
+
+    return it == symbols.end() ? NULL : &it->second;
+}
+
 /**
   * Give out a byte data, according to the given virtual address. First classify the virtual addresses into different segments, then get the data in various ways(e.g data, bss, heap, stack are from memory, code, rodata are directly from the file)
   * @param address The given virtual address of desired data
@@ -723,6 +859,113 @@ void MMU::set_word(int address, WORD data)
 
 }
 
+/**
+  * Give out the host memory of count words from a word aligned address, when they all lie in one segment. The words of other segments are in increasing order from the returned pointer, the stack ones in decreasing order. Never throws.
+  * @param address The virtual address of the first word
+  * @param count The number of words
+  * @param write Whether the memory will be written
+  * @param down Set when the words are stack words
+  * @return The host memory of the first word, NULL if the range needs a word at a time
+  */
+BYTE *MMU::words_range(int address, int count, bool write, bool &down)
+{
+    int VMA, size;
+    BYTE *host;
+
+    down = false;
+    if ((address & MASK_2BIT) != 0)
+        return NULL;
+
+    host = host_range(address, write, VMA, size);
+    if (host != NULL)
+        return (unsigned int)(address - VMA) + count * 4 <= (unsigned int)size ? host + (address - VMA) : NULL;
+
+    if (address >= (_ss_VMA - STACK_SZ) && address + count * 4 <= _ss_VMA && VMA2Seg(address) == STACKSEG)
+    {
+        down = true;
+        return reinterpret_cast<BYTE *>(&stack[(_ss_VMA - address)/4 - 1]);
+    }
+
+    return NULL;
+}
+
+/**
+  * Give out count words from consecutive addresses, for LDM and POP. The range is checked once, then copied in one pass; a range which is not in one segment is read by get_word().
+  * @param address The virtual address of the first word
+  * @param words Where the words go
+  * @param count The number of words
+  * @exception Error For errors which are memory-related, file-related, etc.
+  */
+void MMU::get_words(int address, WORD *words, int count)
+{
+    bool down;
+    BYTE *host = words_range(address, count, false, down);
+    int i = 0;
+
+    if (host == NULL)
+    {
+        for (; i < count; i++)
+            words[i] = get_word(address + i * 4);
+        return;
+    }
+
+    if (!down)
+    {
+        memcpy(words, host, count * 4);
+        return;
+    }
+
+    WORD *top = reinterpret_cast<WORD *>(host);
+
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4)//four stack words, reversed in a register
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i *>(top - i - 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(words + i), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#endif
+    for (; i < count; i++)
+        words[i] = top[-i];
+}
+
+/**
+  * Set count words at consecutive addresses, for STM and PUSH, the same as get_words().
+  * @param address The virtual address of the first word
+  * @param words The words
+  * @param count The number of words
+  */
+void MMU::set_words(int address, const WORD *words, int count)
+{
+    bool down;
+    BYTE *host = words_range(address, count, true, down);
+    int i = 0;
+
+    if (host == NULL)
+    {
+        for (; i < count; i++)
+            set_word(address + i * 4, words[i]);
+        return;
+    }
+
+    if (!down)
+    {
+        memcpy(host, words, count * 4);
+        return;
+    }
+
+    WORD *top = reinterpret_cast<WORD *>(host);
+
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(top - i - 3), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#endif
+    for (; i < count; i++)
+        top[-i] = words[i];
+}
+
 /**
   * Push a word data into stack
   * @param data The input data
@@ -11,6 +11,8 @@
  */
 /*@{*/
 
+#include <string>
+#include <unordered_map>
 #include "arch.h"
 #include "elf_file.h"
 
@@ -70,6 +72,21 @@
 #define STACK_SZ    0x2000
 
 class elf_file;//predeclaration
+struct t_decoded;
+struct a_decoded;
+
+/*! \struct guest_symbol
+	\brief A function or a data object of the program, from the symbol table of its ELF file.
+ */
+struct guest_symbol
+{
+	//! The virtual address, bit 0 set for Thumb code
+    int address;
+	//! The size in bytes, 0 if unknown
+    int size;
+	//! Whether it is a function, otherwise a data object
+    bool func;
+};
 
 /*! \class MMU
 	\brief The memory management unit class
@@ -170,17 +187,25 @@ private:
 	BYTE *code;
 	//! The pointer to read only data segment in memroy
 	BYTE *rodata;
+	//! The predecoded Thumb instructions, one entry per halfword of code segment
+	t_decoded *t_cache;
+	//! The predecoded ARM instructions, one entry per word of code segment
+	a_decoded *a_cache;
 
 	//! The entry point of the Thumb code(virtual address)
     int entry_point;
 	//! The file offset of Thumb code in the shared object file
     int code_infile_off;
+	//! The functions and data objects of the program by name
+    std::unordered_map<std::string, guest_symbol> symbols;
 
 private:
 	//! Transform virtual address to file offset of Thumb code file
     int VMA2FileOff(int VMAddr);
 	//! Determine which segment the virtual address resides
     SEGTYPE VMA2Seg(int VMAddr);
+	//! Give out the host memory of a run of words in one segment, for get_words() and set_words()
+    BYTE *words_range(int address, int count, bool write, bool &down);
 
 public:
 	//! Set code segment file range
@@ -212,6 +237,26 @@ public:
     T_INSTR getInstr(int address);
 	//! Give out the ARM instruction
     A_INSTR getInstr32(int address);
+	//! Give out the predecoded entry of a Thumb instruction
+    t_decoded *getThumbDecoded(int address);
+	//! Give out the predecoded entry of an ARM instruction
+    a_decoded *getARMDecoded(int address);
+	//! Give out the predecoded Thumb instructions, indexed by (address - getTextVMA())/2
+    t_decoded *getThumbCache(){ return t_cache; };
+	//! Give out the predecoded ARM instructions, indexed by (address - getTextVMA())/4
+    a_decoded *getARMCache(){ return a_cache; };
+	//! Give out the host memory of the segment holding an address, NULL for the stack and for addresses out of any segment
+    BYTE *host_range(int address, bool write, int &VMA, int &size);
+	//! Give out the range of the stack segment if it holds an address, its bytes are only reached through get_byte() and set_byte()
+    bool stack_range(int address, int &VMA, int &size);
+	//! Record a function or a data object of the program, from the symbol table
+    void addSymbol(const char *name, int address, int size, bool func);
+	//! Give out a function or a data object of the program by name, NULL if the symbol table has none
+    const guest_symbol *getSymbol(const char *name);
+	//! Give out the virtual address of code segment
+    int getTextVMA(){ return _text_VMA; };
+	//! Give out the size of code segment
+    int getTextSz(){ return _text_sz; };
 //get method
 	//! Output byte data by address
     BYTE get_byte(int address);
@@ -228,6 +273,12 @@ public:
 	//! Input word data by address
     void set_word(int address, WORD data);
 
+//block transfer
+	//! Output words from consecutive addresses
+    void get_words(int address, WORD *words, int count);
+	//! Input words at consecutive addresses
+    void set_words(int address, const WORD *words, int count);
+
 	//! Push operation for stack
 	/*! \deprecated replaced by set_word()
      */
@@ -3,16 +3,21 @@
 #include "ARM.h"
 
 /**
-  * Zero general purpose registers, current process status register, make MMU pointer null.
+  * Work on the registers of the core, make MMU pointer null, count the semihosting calls with the registers.
+  * @param state The registers, shared with the ARM decoder
   */
-Thumb::Thumb()
+Thumb::Thumb(cpu_state *state) : CPU(state)
 {
-	for (int i = 0; i < GPR_num; i++)
-		r[i] = 0;
-
-	cpsr = 0;
-
 	my_mmu = NULL;
+	swi.getEvents(&state->swi);
+
+	dispatched = 0;
+	flag_sites = nf_sites = 0;
+	for (int i = 0; i < F_KIND_NUM; i++)
+	{
+		fuse_cnt[i] = 0;
+		fuse_sites[i] = 0;
+	}
 }
 
 /**
@@ -27,16 +32,22 @@ Thumb::~Thumb()
 
 
 /**
-  * Get a 16-bit instruction from MMU modular, and increase PC by 2.
+  * Get the predecoded entry of the current instruction from MMU modular, decode it on the first visit, and increase PC by 2.
   */
 void Thumb::fetch()
 {
-    cur_instr = my_mmu->getInstr(rPC);
+    cur = my_mmu->getThumbDecoded(rPC);
+    if (cur->handler == NULL)
+        decode(rPC, *cur);
+
+    cur_instr = cur->instr;
     rPC += 2;
+    budget--;
+    dispatched++;
 }
 
 /**
-  * Execute all kinds of 16-bit Thumb instruction, the instructions are classified by most significant 3 bit.
+  * Execute the current instruction through the handler recorded in its predecoded entry.
   * @exception UndefineInst For undefined instructions
   * @exception UnexpectInst For instructions can not be handled
   */
@@ -46,185 +57,806 @@ STATUS Thumb::exec()
     //    printf("");
     //debug breakpoint
 
-    char attemp_code = cur_instr>>13, sec_code;
-    switch(attemp_code)//[15:13]
+    (this->*(cur->handler))(*cur);
+
+    return 0;
+}
+
+/**
+  * Run the block engine if it or the JIT engine is chosen, otherwise the threaded loop when it is built, or the plain fetch()/exec() loop. The block engine leaves the instructions too few for a whole block to the interpreter. The interpreter loops stop one instruction early, a superinstruction takes two of the budget, so the last one is run alone with the plain handler of its class, or as the call of a library routine run on the host.
+  * @exception UndefineInst For undefined instructions
+  * @exception UnexpectInst For instructions can not be handled
+  */
+void Thumb::run_loop()
+{
+    if (engine != ENGINE_INTERP)
+        run_blocks();
+
+#ifdef THREADED_DISPATCH
+    run_threaded();
+#else
+    while (budget > 1)
+    {
+        fetch();
+        exec();
+    }
+#endif
+
+    if (budget == 1)
+    {
+        fetch();
+        if (cur->handler == &Thumb::hle_call)//a call is one instruction too
+            hle_call(*cur);
+        else
+            (this->*(handler_tab[cur->cls]))(*cur);
+    }
+}
+
+#ifdef THREADED_DISPATCH
+/**
+  * Direct-threaded interpreter loop, built with -DTHREADED_DISPATCH. Every handler is reached by a label, and the code after it fetches the next predecoded entry and jumps straight to the next label, with neither the virtual fetch()/exec() pair nor a return to the loop in run(). Returns when one instruction of the budget is left, as the plain loop does.
+  * @exception UndefineInst For undefined instructions
+  * @exception UnexpectInst For instructions can not be handled
+  */
+void Thumb::run_threaded()
+{
+    static void * const labels[T_CLASS_NUM + 1] =
+    {
+        &&l_add_sub_reg_or_imm,
+        &&l_shift_by_imm,
+        &&l_add_sub_mov_cmp_imm,
+        &&l_ld_str_reg_offset,
+        &&l_ld_from_pool,
+        &&l_br_or_exec_is,
+        &&l_spec_data_proc,
+        &&l_data_proc_reg,
+        &&l_ld_str_word_byte_imm,
+        &&l_ld_str_stack,
+        &&l_ld_str_halfw_imm,
+        &&l_misc,
+        &&l_add_to_sp_or_pc,
+        &&l_ld_str_multiple,
+        &&l_con_br,
+        &&l_undefined,
+        &&l_software_int,
+        &&l_uncon_br,
+        &&l_blx_suffix,
+        &&l_undefined,
+        &&l_bl_blx_prefix,
+        &&l_bl_suffix,
+        &&l_handler
+    };
+    t_decoded * const base = my_mmu->getThumbCache();
+    const unsigned int text_VMA = my_mmu->getTextVMA();
+    const unsigned int text_sz = my_mmu->getTextSz();
+
+//the same as fetch(), then jump to the handler
+#define T_DISPATCH() \
+    do { \
+        if (budget <= 1) \
+            return; \
+        unsigned int off = (unsigned int)rPC - text_VMA; \
+        if (off >= text_sz) \
+            my_mmu->getInstr(rPC); /* reports the error */ \
+        cur = &base[off>>1]; \
+        if (cur->handler == NULL) \
+            decode(rPC, *cur); \
+        cur_instr = cur->instr; \
+        rPC += 2; \
+        budget--; \
+        dispatched++; \
+        goto *labels[cur->disp]; \
+    } while (0)
+
+    T_DISPATCH();
+
+l_add_sub_reg_or_imm:   add_sub_reg_or_imm<true>(*cur);   T_DISPATCH();
+l_shift_by_imm:         shift_by_imm<true>(*cur);         T_DISPATCH();
+l_add_sub_mov_cmp_imm:  add_sub_mov_cmp_imm<true>(*cur);  T_DISPATCH();
+l_ld_str_reg_offset:    ld_str_reg_offset(*cur);          T_DISPATCH();
+l_ld_from_pool:         ld_from_pool(*cur);               T_DISPATCH();
+l_br_or_exec_is:        br_or_exec_is(*cur);              T_DISPATCH();
+l_spec_data_proc:       spec_data_proc(*cur);             T_DISPATCH();
+l_data_proc_reg:        data_proc_reg<true>(*cur);        T_DISPATCH();
+l_ld_str_word_byte_imm: ld_str_word_byte_imm(*cur);       T_DISPATCH();
+l_ld_str_stack:         ld_str_stack(*cur);               T_DISPATCH();
+l_ld_str_halfw_imm:     ld_str_halfw_imm(*cur);           T_DISPATCH();
+l_misc:                 misc(*cur);                       T_DISPATCH();
+l_add_to_sp_or_pc:      add_to_sp_or_pc(*cur);            T_DISPATCH();
+l_ld_str_multiple:      ld_str_multiple(*cur);            T_DISPATCH();
+l_con_br:               con_br(*cur);                     T_DISPATCH();
+l_undefined:            undefined(*cur);                  T_DISPATCH();
+l_software_int:         software_int(*cur);               T_DISPATCH();
+l_uncon_br:             uncon_br(*cur);                   T_DISPATCH();
+l_blx_suffix:           blx_suffix(*cur);                 T_DISPATCH();
+l_bl_blx_prefix:        bl_blx_prefix(*cur);              T_DISPATCH();
+l_bl_suffix:            bl_suffix(*cur);                  T_DISPATCH();
+l_handler:              (this->*(cur->handler))(*cur);    T_DISPATCH();
+
+#undef T_DISPATCH
+}
+#endif
+
+/**
+  * Classify a 16-bit Thumb instruction by its most significant 3 bit, the same decode tree the handlers are documented with. Only used at compile time to fill thumb_decode_tab.
+  * @param instr The instruction
+  * @return The t_class of the instruction
+  */
+static constexpr uint8_t thumb_classify(unsigned int instr)
+{
+    switch (instr>>13)//[15:13]
     {
         case 0://000:shift by imm(00,01,10), add/sub reg(110), add/sub imm(111)
-        {
-            sec_code = (cur_instr>>11) & MASK_2BIT;
-            if (sec_code == 3)
-            {
-                //add/sub reg, add/sub imm
-                add_sub_reg_or_imm(cur_instr);
-            }
-            else
-            {
-                //shift by imm
-                shift_by_imm(cur_instr);
-            }
-            break;
-        }
+            if (((instr>>11) & MASK_2BIT) == 3)
+                return T_ADD_SUB_REG_OR_IMM;
+            return T_SHIFT_BY_IMM;
         case 1://001:add(10)/sub(11)/mov(00)/cmp(01) imm
-        {
-            add_sub_mov_cmp_imm(cur_instr);
-            //handle with func directly
-            break;
-        }
+            return T_ADD_SUB_MOV_CMP_IMM;
         case 2://010:data-processing reg(000), special data processing(001(00-10)), branch/exechange IS(00111), ld from literal pool(01), ld/st reg offset(1)
-        {
-            sec_code = (cur_instr>>12) & MASK_1BIT;
-            if (sec_code == 1)
-            {
-                //ld/st reg offset
-                ld_str_reg_offset(cur_instr);
-            }
-            else if (((cur_instr>>11) & MASK_2BIT) == 1)
+            if (((instr>>12) & MASK_1BIT) == 1)
+                return T_LD_STR_REG_OFFSET;
+            if (((instr>>11) & MASK_2BIT) == 1)
+                return T_LD_FROM_POOL;
+            if (((instr>>10) & MASK_3BIT) == 1)
             {
-                //ld from literal pool
-                ld_from_pool(cur_instr);
+                if (((instr>>8) & MASK_2BIT) == 3)//11
+                    return T_BR_OR_EXEC_IS;
+                return T_SPEC_DATA_PROC;
             }
-            else if (((cur_instr>>10) & MASK_3BIT) == 1)
-            {
-                if (((cur_instr>>8) & MASK_2BIT) == 3)//11
-                {
-                    //branch/exec IS
-                    br_or_exec_is(cur_instr);
-                }
-                else
-                {
-                    //special data processing
-                    spec_data_proc(cur_instr);
-                }
-            }
-            else//[12:10] = 0
-            {
-                //data-processing reg
-                data_proc_reg(cur_instr);
-            }
-            break;
-        }
+            return T_DATA_PROC_REG;//[12:10] = 0
         case 3://011:ld/st word/byte imm
-        {
-            //ld/st word/byte imm
-            ld_str_word_byte_imm(cur_instr);
-            break;
-        }
+            return T_LD_STR_WORD_BYTE_IMM;
         case 4://100:ld/st halfword imm,(0), ld/st to/from stack(1)
-        {
-            sec_code = (cur_instr>>12) & MASK_1BIT;
-            if (sec_code == 1)
-            {
-                //ld/st to/from stack
-                ld_str_stack(cur_instr);
-            }
-            else
+            if (((instr>>12) & MASK_1BIT) == 1)
+                return T_LD_STR_STACK;
+            return T_LD_STR_HALFW_IMM;
+        case 5://101:Add to SP or PC(0),Misc(1)
+            if (((instr>>12) & MASK_1BIT) == 1)
+                return T_MISC;
+            return T_ADD_TO_SP_OR_PC;
+        case 6://110:ld/st multiple(0),con branch(1), undef(1110), software int(1111)    ld/st will be detected first
+            if (((instr>>12) & MASK_1BIT) == 0)
+                return T_LD_STR_MULTIPLE;
+            if (((instr>>8) & MASK_4BIT) < 0xe)
+                return T_CON_BR;
+            if (((instr>>8) & MASK_4BIT) == 0xe)
+                return T_UNDEFINED;
+            return T_SOFTWARE_INT;
+        default://111:uncon branch(00), BLX suffix(01)last bit=0, undef(01xxxxxxxxxx1), BL/BLX prefix(10), BL suffix(11)
+            switch ((instr>>11) & MASK_2BIT)
             {
-                //ld/st halfword imm
-                ld_str_halfw_imm(cur_instr);
+                case 0:
+                    return T_UNCON_BR;
+                case 1:
+                    if ((instr & MASK_1BIT) == 0)
+                        return T_BLX_SUFFIX;
+                    return T_UNDEFINED_BLX;
+                case 2:
+                    return T_BL_BLX_PREFIX;
+                default:
+                    return T_BL_SUFFIX;
             }
-            break;
-        }
-        case 5://101:Add to SP or PC(0),Misc(1)
+    }
+}
+
+/*! \struct thumb_decode_table
+	\brief Every 16-bit halfword mapped to its t_class, built by the compiler.
+ */
+struct thumb_decode_table
+{
+    uint8_t cls[65536];
+
+    constexpr thumb_decode_table() : cls()
+    {
+        for (unsigned int i = 0; i < 65536; i++)
+            cls[i] = thumb_classify(i);
+    }
+};
+
+//! The decode table, it lives in read only data and costs nothing at run time.
+static constexpr thumb_decode_table thumb_decode_tab;
+
+static_assert(thumb_decode_tab.cls[0xdfab] == T_SOFTWARE_INT, "Thumb decode table is broken");
+static_assert(thumb_decode_tab.cls[0x4770] == T_BR_OR_EXEC_IS, "Thumb decode table is broken");
+
+const t_handler Thumb::handler_tab[T_CLASS_NUM] =
+{
+    &Thumb::add_sub_reg_or_imm<true>,
+    &Thumb::shift_by_imm<true>,
+    &Thumb::add_sub_mov_cmp_imm<true>,
+    &Thumb::ld_str_reg_offset,
+    &Thumb::ld_from_pool,
+    &Thumb::br_or_exec_is,
+    &Thumb::spec_data_proc,
+    &Thumb::data_proc_reg<true>,
+    &Thumb::ld_str_word_byte_imm,
+    &Thumb::ld_str_stack,
+    &Thumb::ld_str_halfw_imm,
+    &Thumb::misc,
+    &Thumb::add_to_sp_or_pc,
+    &Thumb::ld_str_multiple,
+    &Thumb::con_br,
+    &Thumb::undefined,
+    &Thumb::software_int,
+    &Thumb::uncon_br,
+    &Thumb::blx_suffix,
+    &Thumb::undefined,
+    &Thumb::bl_blx_prefix,
+    &Thumb::bl_suffix
+};
+
+const t_handler Thumb::nf_handler_tab[T_CLASS_NUM] =
+{
+    &Thumb::add_sub_reg_or_imm<false>,
+    &Thumb::shift_by_imm<false>,
+    &Thumb::add_sub_mov_cmp_imm<false>,
+    &Thumb::ld_str_reg_offset,
+    &Thumb::ld_from_pool,
+    &Thumb::br_or_exec_is,
+    &Thumb::spec_data_proc,
+    &Thumb::data_proc_reg<false>,
+    &Thumb::ld_str_word_byte_imm,
+    &Thumb::ld_str_stack,
+    &Thumb::ld_str_halfw_imm,
+    &Thumb::misc,
+    &Thumb::add_to_sp_or_pc,
+    &Thumb::ld_str_multiple,
+    &Thumb::con_br,
+    &Thumb::undefined,
+    &Thumb::software_int,
+    &Thumb::uncon_br,
+    &Thumb::blx_suffix,
+    &Thumb::undefined,
+    &Thumb::bl_blx_prefix,
+    &Thumb::bl_suffix
+};
+
+/**
+  * Fill a predecoded entry. The entry point of a library routine run on the host gets the handler which runs it, otherwise instructions whose flags are dead get the handler variant which leaves NZCV alone, branches closing a loop without side effects one which watches the loop for running idle, branches closing a copy, fill or compare loop one which runs the loop on the host, and pairs of instructions may become a superinstruction.
+  * @param address The virtual address of the instruction
+  * @param d The predecoded entry to be filled
+  */
+void Thumb::decode(int address, t_decoded &d)
+{
+    decode_fields(address, d);
+
+    if (hle.lookup(address) != NULL)
+    {
+        d.handler = &Thumb::hle_call;
+        d.disp = T_CLASS_NUM;
+        return;
+    }
+
+    d.disp = d.cls;
+    if (nf_handler_tab[d.cls] != handler_tab[d.cls])
+    {
+        flag_sites++;
+        if (flags_dead(address, d))
         {
-            sec_code = (cur_instr>>12) & MASK_1BIT;
-            if (sec_code == 1)
+            d.handler = nf_handler_tab[d.cls];
+            d.disp = T_CLASS_NUM;
+            nf_sites++;
+        }
+    }
+
+    if ((d.cls == T_CON_BR || d.cls == T_UNCON_BR) && idle_loop(address))
+    {
+        d.handler = &Thumb::idle_br;
+        d.disp = T_CLASS_NUM;
+    }
+    else if ((d.cls == T_CON_BR || d.cls == T_UNCON_BR) && loop_idiom(address) != NULL)
+    {
+        d.handler = &Thumb::idiom_br;
+        d.disp = T_CLASS_NUM;
+    }
+
+    fuse(address, d);
+}
+
+/**
+  * Look the handler up in the compile time decode table, and pull out the register numbers and immediates the handler needs. PC relative operands are turned into absolute values here, since the entry belongs to a fixed address.
+  * @param address The virtual address of the instruction
+  * @param d The predecoded entry to be filled
+  */
+void Thumb::decode_fields(int address, t_decoded &d)
+{
+    T_INSTR instr = my_mmu->getInstr(address);
+    int cls = thumb_decode_tab.cls[instr];
+
+    d.handler = handler_tab[cls];
+    d.cls = cls;
+    d.instr = instr;
+    d.op = 0;
+    d.rd = d.rn = d.rm = 0;
+    d.imm = 0;
+
+    switch (cls)
+    {
+        case T_ADD_SUB_REG_OR_IMM:
+            d.op = (instr>>9) & MASK_2BIT;//bit 10: imm, bit 9: sub
+            d.rm = (instr>>6) & MASK_3BIT;
+            d.imm = (instr>>6) & MASK_3BIT;
+            d.rn = (instr>>3) & MASK_3BIT;
+            d.rd = (instr) & MASK_3BIT;
+            break;
+        case T_SHIFT_BY_IMM:
+            d.op = (instr>>11) & MASK_2BIT;
+            d.imm = (instr>>6) & MASK_5BIT;
+            d.rm = (instr>>3) & MASK_3BIT;
+            d.rd = (instr) & MASK_3BIT;
+            break;
+        case T_ADD_SUB_MOV_CMP_IMM:
+            d.op = (instr>>11) & MASK_2BIT;
+            d.rd = (instr>>8) & MASK_3BIT;
+            d.imm = (instr) & MASK_8BIT;
+            break;
+        case T_LD_STR_REG_OFFSET:
+            d.op = (instr>>9) & MASK_3BIT;
+            d.rm = (instr>>6) & MASK_3BIT;
+            d.rn = (instr>>3) & MASK_3BIT;
+            d.rd = (instr) & MASK_3BIT;
+            break;
+        case T_LD_FROM_POOL:
+            d.rd = (instr>>8) & MASK_3BIT;
+            d.imm = ((address + 4) & 0xfffffffc) + ((instr & MASK_8BIT) * 4);//pc + 4, due to pipeline
+            break;
+        case T_BR_OR_EXEC_IS:
+            d.op = (instr>>7) & MASK_1BIT;//L
+            d.rm = ((instr>>3) & MASK_3BIT) | (((instr>>6) & MASK_1BIT)<<3);//H2
+            break;
+        case T_SPEC_DATA_PROC:
+            d.op = (instr>>8) & MASK_2BIT;
+            d.rm = ((instr>>3) & MASK_3BIT) | (((instr>>6) & MASK_1BIT)<<3);//H2
+            d.rd = ((instr) & MASK_3BIT) | (((instr>>7) & MASK_1BIT)<<3);//H1
+            break;
+        case T_DATA_PROC_REG:
+            d.op = (instr>>6) & MASK_4BIT;
+            d.rm = (instr>>3) & MASK_3BIT;//Rs
+            d.rd = (instr) & MASK_3BIT;
+            break;
+        case T_LD_STR_WORD_BYTE_IMM:
+            d.op = (instr>>11) & MASK_2BIT;//B, L
+            d.imm = (instr>>6) & MASK_5BIT;
+            if (((instr>>12) & MASK_1BIT) == 0)//word offset is scaled by 4
+                d.imm *= 4;
+            d.rn = (instr>>3) & MASK_3BIT;
+            d.rd = (instr) & MASK_3BIT;
+            break;
+        case T_LD_STR_STACK:
+            d.op = (instr>>11) & MASK_1BIT;//L
+            d.rd = (instr>>8) & MASK_3BIT;
+            d.imm = ((instr) & MASK_8BIT) * 4;
+            break;
+        case T_LD_STR_HALFW_IMM:
+            d.op = (instr>>11) & MASK_1BIT;//L
+            d.imm = ((instr>>6) & MASK_5BIT) * 2;
+            d.rn = (instr>>3) & MASK_3BIT;
+            d.rd = (instr) & MASK_3BIT;
+            break;
+        case T_MISC:
+            d.op = (instr>>8) & MASK_4BIT;
+            switch (d.op)
             {
-                //Misc
-                misc(cur_instr);
+                case 0://adjust stack pointer, imm is signed
+                    d.imm = ((instr) & MASK_7BIT)<<2;
+                    if (((instr>>7) & MASK_1BIT) == 1)
+                        d.imm = -d.imm;
+                    break;
+                case 4:case 5:case 12:case 13://push, pop, imm keeps R and the register list
+                    d.imm = (instr) & 0x1ff;
+                    d.rm = num_of_bits_set((instr) & MASK_8BIT);
+                    break;
+                default://extend, reverse bytes, imm keeps the second opcode
+                    d.imm = (instr>>6) & MASK_2BIT;
+                    d.rn = d.rm = (instr>>3) & MASK_3BIT;
+                    d.rd = (instr) & MASK_3BIT;
+                    break;
             }
+            break;
+        case T_ADD_TO_SP_OR_PC:
+            d.op = (instr>>11) & MASK_1BIT;
+            d.rd = (instr>>8) & MASK_3BIT;
+            if (d.op == 0)//pc + 4, due to pipeline
+                d.imm = ((address + 4) & 0xfffffffc) + ((instr & MASK_8BIT) * 4);
             else
-            {
-                //Add to SP or PC
-                add_to_sp_or_pc(cur_instr);
-            }
+                d.imm = (instr & MASK_8BIT) << 2;
             break;
-        }
-        case 6://110:ld/st multiple(0),con branch(1), undef(1110), software int(1111)    ld/st will be detected first
-        {
-            sec_code = (cur_instr>>12) & MASK_1BIT;
-            if (sec_code == 0)
-            {
-                //ld/st multiple
-                ld_str_multiple(cur_instr);
-            }
-            else if (((cur_instr>>8) & MASK_4BIT) < 0xe)
-            {
-                //con branch
-                con_br(cur_instr);
-            }
-            else if ((sec_code = (cur_instr>>8) & MASK_4BIT) == 0xe)
+        case T_LD_STR_MULTIPLE:
+            d.op = (instr>>11) & MASK_1BIT;
+            d.rn = (instr>>8) & MASK_3BIT;
+            d.imm = (instr) & MASK_8BIT;
+            d.rm = num_of_bits_set(d.imm);
+            break;
+        case T_CON_BR:
+            d.op = (instr>>8) & MASK_4BIT;
+            d.imm = (address + 4) + (SignExtend(instr & MASK_8BIT, 8) << 1);
+            break;
+        case T_SOFTWARE_INT:
+            d.imm = instr & MASK_8BIT;
+            break;
+        case T_UNCON_BR:
+            d.imm = (address + 4) + (SignExtend(instr & 0x7ff, 11) << 1);
+            break;
+        case T_UNDEFINED_BLX:
+            d.op = 1;//report the address
+            break;
+        case T_BL_BLX_PREFIX:
+            d.imm = (address + 4) + (SignExtend(instr & 0x7ff, 11) << 12);
+            break;
+        case T_BL_SUFFIX:
+        case T_BLX_SUFFIX:
+            d.imm = (instr & 0x7ff) << 1;
+            break;
+        default://T_UNDEFINED
+            break;
+    }
+}
+
+/**
+  * The flags an instruction reads, and the ones it always writes, as NZCV nibbles with N in bit 3, the way the handlers use them.
+  * @param d The predecoded instruction
+  * @param rd The flags read
+  * @param wr The flags written
+  */
+static void flag_use(const t_decoded &d, int &rd, int &wr)
+{
+    rd = wr = 0;
+
+    switch (d.cls)
+    {
+        case T_ADD_SUB_REG_OR_IMM:
+            wr = 0xf;
+            break;
+        case T_SHIFT_BY_IMM:
+            wr = (d.op == 0 && d.imm == 0) ? 0xc : 0xe;//lsl #0 keeps C
+            break;
+        case T_ADD_SUB_MOV_CMP_IMM:
+            wr = (d.op == 0) ? 0xc : 0xf;//mov sets N, Z
+            break;
+        case T_SPEC_DATA_PROC:
+            if (d.op == 1)//cmp
+                wr = 0xf;
+            break;
+        case T_DATA_PROC_REG:
+            switch (d.op)
             {
-                //error
-                UndefineInst e;
-                throw e;
+                case 5:case 6://adc, sbc
+                    rd = 0x2;
+                    wr = 0xf;
+                    break;
+                case 9:case 10:case 11://neg, cmp, cmn
+                    wr = 0xf;
+                    break;
+                case 2:case 3:case 4:case 7://shifts by register write C, or keep it for a zero shift, as ARM::flags_dead() takes REG_SH
+                    rd = 0x2;
+                    wr = 0xe;
+                    break;
+                default://logical, mul
+                    wr = 0xc;
+                    break;
             }
-            else//swi == 0xf
-            {
-                int imm_8 = cur_instr & MASK_8BIT;
+            break;
+        case T_CON_BR:
+            rd = cond_pass_tab.reads[d.op];
+            break;
+        default:
+            break;
+    }
+}
 
-                //printf("Aloha SWI  0x%x\n",r[0]);
-                if (imm_8 == 0xab)
-                {
-                    swi.get_para(r);
-                    swi.swi_handler();
-                }
-                else
-                {
-                    UnexpectInst e;
-                    char tmp[30];
-                    sprintf(tmp,"%x : %x",rPC-2, cur_instr);
-                    e.error_name = tmp;
-                    throw e;
-                }
+/**
+  * Scan forward from a flag-setting instruction along the straight-line code after it, at most FLAG_SCAN_MAX instructions. The flags are dead if later instructions overwrite every flag it sets before any of them is read. Reaching the end of the block, a handler which may look at CPSR, or the scan limit means the liveness is unknown, and the flags are kept.
+  * @param address The virtual address of the instruction
+  * @param d Its predecoded entry
+  * @return true if the flags the instruction sets are never read
+  */
+bool Thumb::flags_dead(int address, const t_decoded &d)
+{
+    int rd, live;
+    unsigned int text_end = my_mmu->getTextVMA() + my_mmu->getTextSz();
+
+    flag_use(d, rd, live);
+    if (live == 0 || ends_block(d))
+        return false;
+
+    for (int i = 1; i <= FLAG_SCAN_MAX; i++)
+    {
+        unsigned int addr = address + i * 2;
+        t_decoded n;
+        int wr;
+
+        if (addr >= text_end)
+            return false;
+
+        decode_fields(addr, n);
+        flag_use(n, rd, wr);
+        if (rd & live)
+            return false;
 
+        live &= ~wr;
+        if (live == 0)
+            return true;
+
+        if (ends_block(n))
+            return false;
+    }
+
+    return false;
+}
+
+/**
+  * Whether an instruction reads a low register, for the classes a literal pool load is fused with.
+  * @param instr The instruction
+  * @param cls Its t_class
+  * @param reg The register number
+  * @return true if the instruction reads the register
+  */
+static bool reads_low_reg(T_INSTR instr, int cls, int reg)
+{
+    int lo = instr & MASK_3BIT, mid = (instr>>3) & MASK_3BIT, hi = (instr>>6) & MASK_3BIT;
+
+    switch (cls)
+    {
+        case T_ADD_SUB_REG_OR_IMM://Rn, and Rm unless it is an immediate
+            return mid == reg || (((instr>>10) & MASK_1BIT) == 0 && hi == reg);
+        case T_DATA_PROC_REG://Rd and Rs
+            return lo == reg || mid == reg;
+        case T_LD_STR_REG_OFFSET://Rn, Rm, and Rd of str, strh, strb
+            return mid == reg || hi == reg || (((instr>>9) & MASK_3BIT) < 3 && lo == reg);
+        case T_LD_STR_WORD_BYTE_IMM:
+        case T_LD_STR_HALFW_IMM://Rn, and Rd of stores
+            return mid == reg || (((instr>>11) & MASK_1BIT) == 0 && lo == reg);
+        case T_SPEC_DATA_PROC://Rd and Rm, high ones included
+            return (lo | (((instr>>7) & MASK_1BIT)<<3)) == reg || ((instr>>3) & MASK_4BIT) == reg;
+        case T_BR_OR_EXEC_IS://Rm of bx, blx
+            return ((instr>>3) & MASK_4BIT) == reg;
+        default:
+            return false;
+    }
+}
+
+/**
+  * Look at the instruction after a freshly decoded one, and if the two are one of the pairs compilers emit all the time, point the entry at a superinstruction which runs both with one dispatch. The second entry is left as it is, it still runs alone when it is jumped to. The first instruction of every pair leaves PC alone, a branch closing a loop without side effects still watches the loop as the second one, and one closing an idiom still runs it on the host. Only the interpreter loops run superinstructions, the block engine and the JIT call the handler of cls.
+  * @param address The virtual address of the instruction
+  * @param d Its predecoded entry, already filled by decode()
+  */
+void Thumb::fuse(int address, t_decoded &d)
+{
+    unsigned int next = address + 2;
+
+    if (next - my_mmu->getTextVMA() >= (unsigned int)my_mmu->getTextSz())
+        return;
+
+    T_INSTR instr = my_mmu->getInstr(next);
+    int cls = thumb_decode_tab.cls[instr];
+    t_handler h = NULL;
+    int kind = -1;
+
+    switch (d.cls)
+    {
+        case T_BL_BLX_PREFIX:
+            if (cls == T_BL_SUFFIX)
+            {
+                h = &Thumb::fused<&Thumb::bl_blx_prefix, &Thumb::bl_suffix, F_BL>;
+                kind = F_BL;
             }
-            //other conditions will not be considered, because they can't appear
             break;
-        }
-        case 7://111:uncon branch(00), BLX suffix(01)last bit=0, undef(01xxxxxxxxxx1), BL/BLX prefix(10), BL suffix(11)
-        {
-            sec_code = (cur_instr>>11) & MASK_2BIT;
-            if (sec_code == 0)
+        case T_ADD_SUB_MOV_CMP_IMM:
+            if ((d.op == 1 || d.op == 3) && cls == T_CON_BR)//cmp, sub
             {
-                //uncon branch
-                uncon_br(cur_instr);
+                if (loop_idiom(next) != NULL)
+                    h = &Thumb::fused<&Thumb::add_sub_mov_cmp_imm<true>, &Thumb::idiom_br, F_CMP_BR>;
+                else
+                    h = idle_loop(next) ? &Thumb::sub_imm_br<true> : &Thumb::sub_imm_br<false>;
+                kind = F_CMP_BR;
             }
-            else if(sec_code == 1)
+            else if (d.op == 0)//mov, the next one has to work on the same register
             {
-                if ((cur_instr & MASK_1BIT) == 0)
-                {
-                    //BLX suffix
-                    blx_suffix(cur_instr);
-                }
-                else
-                {
-                    UndefineInst e;
-                    char tmp[30];
-                    sprintf(tmp,"%x : %x",rPC-2, cur_instr);
-                    e.error_name = tmp;
-                    throw e;
-                    //error
-                }
+                int rd = instr & MASK_3BIT;
+
+                if (cls == T_ADD_SUB_MOV_CMP_IMM && ((instr>>11) & MASK_2BIT) >= 2 && ((instr>>8) & MASK_3BIT) == d.rd)//add, sub
+                    h = &Thumb::fused<&Thumb::add_sub_mov_cmp_imm<true>, &Thumb::add_sub_mov_cmp_imm<true>, F_MOV_IMM>;
+                else if (cls == T_SHIFT_BY_IMM && ((instr>>11) & MASK_2BIT) == 0 && rd == d.rd && ((instr>>3) & MASK_3BIT) == d.rd)//lsl
+                    h = &Thumb::fused<&Thumb::add_sub_mov_cmp_imm<true>, &Thumb::shift_by_imm<true>, F_MOV_IMM>;
+                else if (cls == T_DATA_PROC_REG && ((instr>>6) & MASK_4BIT) == 15 && rd == d.rd && ((instr>>3) & MASK_3BIT) == d.rd)//mvn
+                    h = &Thumb::fused<&Thumb::add_sub_mov_cmp_imm<true>, &Thumb::data_proc_reg<true>, F_MOV_IMM>;
+                if (h != NULL)
+                    kind = F_MOV_IMM;
             }
-            else if(sec_code == 2)
+            break;
+        case T_DATA_PROC_REG:
+            if (d.op == 10 && cls == T_CON_BR)//cmp
             {
-                //BL/BLX prefix
-                bl_blx_prefix(cur_instr);
+                if (idle_loop(next))
+                    h = &Thumb::fused<&Thumb::data_proc_reg<true>, &Thumb::idle_br, F_CMP_BR>;
+                else if (loop_idiom(next) != NULL)
+                    h = &Thumb::fused<&Thumb::data_proc_reg<true>, &Thumb::idiom_br, F_CMP_BR>;
+                else
+                    h = &Thumb::fused<&Thumb::data_proc_reg<true>, &Thumb::con_br, F_CMP_BR>;
+                kind = F_CMP_BR;
             }
-            else//sec_code == 3
+            break;
+        case T_LD_FROM_POOL:
+            if (!reads_low_reg(instr, cls, d.rd))
+                break;
+            kind = F_POOL_USE;
+            switch (cls)
             {
-                //BL suffix
-                bl_suffix(cur_instr);
+                case T_ADD_SUB_REG_OR_IMM:
+                    h = &Thumb::fused<&Thumb::ld_from_pool, &Thumb::add_sub_reg_or_imm<true>, F_POOL_USE>;
+                    break;
+                case T_DATA_PROC_REG:
+                    h = &Thumb::fused<&Thumb::ld_from_pool, &Thumb::data_proc_reg<true>, F_POOL_USE>;
+                    break;
+                case T_LD_STR_REG_OFFSET:
+                    h = &Thumb::fused<&Thumb::ld_from_pool, &Thumb::ld_str_reg_offset, F_POOL_USE>;
+                    break;
+                case T_LD_STR_WORD_BYTE_IMM:
+                    h = &Thumb::fused<&Thumb::ld_from_pool, &Thumb::ld_str_word_byte_imm, F_POOL_USE>;
+                    break;
+                case T_LD_STR_HALFW_IMM:
+                    h = &Thumb::fused<&Thumb::ld_from_pool, &Thumb::ld_str_halfw_imm, F_POOL_USE>;
+                    break;
+                case T_SPEC_DATA_PROC:
+                    h = &Thumb::fused<&Thumb::ld_from_pool, &Thumb::spec_data_proc, F_POOL_USE>;
+                    break;
+                default://T_BR_OR_EXEC_IS
+                    h = &Thumb::fused<&Thumb::ld_from_pool, &Thumb::br_or_exec_is, F_POOL_USE>;
+                    break;
             }
             break;
-        }
-        default://undef
-            assert(0);
-            //error
+        default:
             break;
     }
 
-    return 0;
+    if (h != NULL)
+    {
+        d.handler = h;
+        d.disp = T_CLASS_NUM;
+        fuse_sites[kind]++;
+    }
+}
+
+/**
+  * A superinstruction: the first handler, then the second one on the next entry with PC and the current instruction moved on as fetch() does.
+  * @param d The predecoded entry of the first instruction
+  */
+template<t_handler first, t_handler second, int kind>
+void Thumb::fused(const t_decoded &d)
+{
+    (this->*first)(d);
+    fuse_cnt[kind]++;
+    (this->*second)(*pair_next(d));
+}
+
+/**
+  * The superinstruction cmp or sub Rd, #imm followed by a conditional branch, the loop counter idiom. The condition is taken from the subtraction itself, the flags stay pending. With WATCH the branch closes a loop without side effects, watched as idle_br() does.
+  * @param d The predecoded entry of the cmp or sub
+  */
+template<bool WATCH>
+void Thumb::sub_imm_br(const t_decoded &d)
+{
+    int a = r[d.rd];
+    int alu_out = a - d.imm;
+
+    if (d.op == 3)//sub
+        r[d.rd] = alu_out;
+
+    lazySub(alu_out, a, d.imm);
+    fuse_cnt[F_CMP_BR]++;
+
+    const t_decoded *br = pair_next(d);
+
+    if (condPassed(br->op, resolveFlags(0, FLAGS_SUB, alu_out, a, d.imm)))
+    {
+        uint32_t site = rPC - 2;//the branch
+
+        rPC = br->imm;
+        if (WATCH)
+            idleTaken(site);
+    }
+    else if (WATCH)
+        idleLeft();
+}
+
+/**
+  * Whether an instruction may be part of a loop without side effects: it neither stores, calls, branches, nor writes PC. SWI is let in, the semihosting calls are counted at run time.
+  * @param d The predecoded instruction
+  * @return true if it has no side effects other than on the registers
+  */
+static bool no_side_effect(const t_decoded &d)
+{
+    switch (d.cls)
+    {
+        case T_ADD_SUB_REG_OR_IMM:
+        case T_SHIFT_BY_IMM:
+        case T_ADD_SUB_MOV_CMP_IMM:
+        case T_LD_FROM_POOL:
+        case T_DATA_PROC_REG:
+        case T_ADD_TO_SP_OR_PC:
+            return true;
+        case T_SPEC_DATA_PROC:
+            return d.rd != 15;
+        case T_LD_STR_REG_OFFSET://ldrsb, ldr, ldrh, ldrb, ldrsh
+            return d.op >= 3;
+        case T_LD_STR_WORD_BYTE_IMM://L
+            return d.op & MASK_1BIT;
+        case T_LD_STR_STACK:
+        case T_LD_STR_HALFW_IMM:
+            return d.op == 1;
+        case T_MISC://adjust sp, extend, reverse bytes
+            return d.op == 0 || d.op == 2 || (d.op == 10 && d.imm != 2);
+        case T_SOFTWARE_INT:
+            return d.imm == 0xab;
+        default:
+            return false;
+    }
+}
+
+/**
+  * Whether the branch at an address closes a short loop without side effects, one whose branch back is its only way out besides faults. Once the branch is taken such a loop runs whole up to it again, so comparing the state there tells whether the loop runs idle, see idle_watch.
+  * @param address The virtual address of the branch
+  * @return true for a conditional or unconditional branch back over at most IDLE_LOOP_INSTRS instructions without side effects
+  */
+bool Thumb::idle_loop(int address)
+{
+    t_decoded d;
+
+    decode_fields(address, d);
+    if (d.cls != T_CON_BR && d.cls != T_UNCON_BR)
+        return false;
+    if (d.imm > address || (address - d.imm)/2 >= IDLE_LOOP_INSTRS || d.imm < my_mmu->getTextVMA())
+        return false;
+
+    for (int addr = d.imm; addr < address; addr += 2)
+    {
+        decode_fields(addr, d);
+        if (!no_side_effect(d))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+  * A branch closing a loop without side effects, as con_br() or uncon_br(), which also watches the loop for running idle. The block engine runs con_br() and uncon_br() and watches the loop in run_blocks().
+  * @param d The predecoded entry of the branch
+  */
+void Thumb::idle_br(const t_decoded &d)
+{
+    if (d.cls == T_UNCON_BR || ConditionPassed(d.op))
+    {
+        uint32_t site = rPC - 2;
+
+        rPC = d.imm;
+        idleTaken(site);
+    }
+    else
+        idleLeft();
+}
+
+/**
+  * Print how many decoded flag-setting instructions leave their dead flags alone, the superinstructions formed, how often each kind ran, and the share of executed instructions they covered.
+  * @param fp The output file
+  */
+void Thumb::dump_interp(FILE *fp)
+{
+    static const char * const names[F_KIND_NUM] = {"bl", "cmp/sub+b<cond>", "mov+imm op", "pool load+use"};
+    unsigned long long pairs = 0;
+
+    for (int i = 0; i < F_KIND_NUM; i++)
+        pairs += fuse_cnt[i];
+
+    unsigned long long instrs = dispatched + pairs;//a superinstruction is two
+
+    fprintf(fp, "Dead flags: %d of %d flag-setting instructions decoded run without setting flags\n", nf_sites, flag_sites);
+
+    fprintf(fp, "Superinstructions: %llu instructions, %llu dispatches, %.1f%% of instructions fused\n",
+            instrs, dispatched, instrs ? 200.0 * pairs / instrs : 0.0);
+    fprintf(fp, "%-16s %8s %14s %8s\n", "kind", "sites", "execs", "instrs");
+    for (int i = 0; i < F_KIND_NUM; i++)
+        fprintf(fp, "%-16s %8d %14llu %7.1f%%\n", names[i], fuse_sites[i], fuse_cnt[i],
+                instrs ? 200.0 * fuse_cnt[i] / instrs : 0.0);
 }
 
 /**
@@ -236,11 +868,12 @@ GP_Reg Thumb::get_reg_by_name(const char *reg_name)
 }
 
 /**
-  * get the register value according to its index. 
+  * get the register value according to its index.
+  * @param reg_code The register number, 15 gives the address of the next instruction
   */
 GP_Reg Thumb::get_reg_by_code(int reg_code)
 {
-    return 0;
+    return r[reg_code & MASK_4BIT];
 }
 
 
@@ -250,7 +883,8 @@ GP_Reg Thumb::get_reg_by_code(int reg_code)
   */
 void Thumb::set_eflag(EFLAG p_eflag)
 {
-	cpsr = p_eflag;
+	st->flag_op = FLAGS_NONE;
+	st->cpsr = p_eflag;
 }
 
 /**
@@ -259,74 +893,57 @@ void Thumb::set_eflag(EFLAG p_eflag)
   */
 EFLAG Thumb::get_eflag()
 {
-	return cpsr;
+	syncFlags();
+	return st->cpsr;
 }
 
 
 /**
   * The matching pattern is 000110 or 000111.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::add_sub_reg_or_imm(const T_INSTR instruction)
+template<bool S>
+void Thumb::add_sub_reg_or_imm(const t_decoded &d)
 {
-    int imm =  (instruction>>10) & MASK_1BIT;//bit 10, estimate imm or reg, imm will be used to estimate add or sub subsequently
-    int Rm, Rn, Rd, imm_3;
+    int imm = (d.op>>1) & MASK_1BIT;//bit 10, estimate imm or reg, bit 9 will be used to estimate add or sub subsequently
+    int Rm = d.rm, Rn = d.rn, Rd = d.rd, imm_3 = d.imm;
+    int rn = r[Rn], rm = r[Rm];//Rd may be one of them
 
     if (imm == 1)
     {
         //add/sub imm
-        imm_3 = (instruction>>6) & MASK_3BIT;
-        Rn = (instruction>>3) & MASK_3BIT;
-        Rd = (instruction) & MASK_3BIT;
-
-        if (((instruction>>9) & MASK_1BIT) == 0)//add
+        if ((d.op & MASK_1BIT) == 0)//add
         {
             //execuate
-            r[Rd] = r[Rn] + imm_3;
+            r[Rd] = rn + imm_3;
             //eflag!!!
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
-            CarryFrom(r[Rn], imm_3)?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rn], imm_3)?setOverflow():clrOverflow();//V flag
+            lazyAdd<S>(r[Rd], rn, imm_3);
         }
         else//sub
         {
             //executate
-            r[Rd] = r[Rn] - imm_3;
+            r[Rd] = rn - imm_3;
             //eflags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
-            ((unsigned)r[Rn] >= (unsigned)imm_3)?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rn], -imm_3)?setOverflow():clrOverflow();//V flag
+            lazySub<S>(r[Rd], rn, imm_3);
         }
     }
     else//reg add sub
     {
         //add/sub reg
-        Rm = (instruction>>6) & MASK_3BIT;
-        Rn = (instruction>>3) & MASK_3BIT;
-        Rd = (instruction) & MASK_3BIT;
-
-        if (((instruction>>9) & MASK_1BIT) == 0)//add
+        if ((d.op & MASK_1BIT) == 0)//add
         {
             //execute
-            r[Rd] = r[Rn] + r[Rm];
+            r[Rd] = rn + rm;
             //eflag
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
-            CarryFrom(r[Rn], r[Rm])?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rn], r[Rm])?setOverflow():clrOverflow();//V flag
+            lazyAdd<S>(r[Rd], rn, rm);
 
         }
         else//sub
         {
             //execute
-            r[Rd] = r[Rn] - r[Rm];
+            r[Rd] = rn - rm;
             //eflags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
-            ((unsigned)r[Rn] >= (unsigned)r[Rm])?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rn], -r[Rm])?setOverflow():clrOverflow();//V flag
+            lazySub<S>(r[Rd], rn, rm);
 
         }
     }
@@ -335,14 +952,16 @@ void Thumb::add_sub_reg_or_imm(const T_INSTR instruction)
 
 /**
   * The matching pattern is 000 opcode.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::shift_by_imm(const T_INSTR instruction)
+template<bool S>
+void Thumb::shift_by_imm(const t_decoded &d)
 {
-    int shift_kind = (instruction>>11) & MASK_2BIT;
-    int immed_5 = (instruction>>6) & MASK_5BIT;
-    int Rm = (instruction>>3) & MASK_3BIT;
-    int Rd = (instruction) & MASK_3BIT;
+    int shift_kind = d.op;
+    int immed_5 = d.imm;
+    int Rm = d.rm;
+    int Rd = d.rd;
+    int rm = r[Rm];//Rd may be Rm
 
     switch (shift_kind)
     {
@@ -351,43 +970,46 @@ void Thumb::shift_by_imm(const T_INSTR instruction)
     	    if (immed_5 == 0)
     	    {
                 r[Rd] = r[Rm];
+                //eflags, C flag & V flag unaffected
+                lazyNZ<S>(r[Rd]);
     	    }
             else
             {
                 //execute
-                r[Rd] = r[Rm] << immed_5;
-                ((r[Rm]>>(32-immed_5)) & MASK_1BIT)?setCarry():clrCarry();
+                r[Rd] = rm << immed_5;
+                //eflags, V flag unaffected
+                lazyNZC<S>(r[Rd], (rm>>(32-immed_5)) & MASK_1BIT);
             }
-            //eflags, V flag unaffected
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
 
             break;
     	}
         case 1://LSR
         {
+            int carry;
+
             if (immed_5 == 0)
             {
-                ((r[Rm]>>31) & MASK_1BIT)?setCarry():clrCarry();
+                carry = (r[Rm]>>31) & MASK_1BIT;
                 r[Rd] = 0;
             }
             else// immed_5 > 0
             {
                 //execute
-                r[Rd] = (unsigned)r[Rm] >> immed_5;//change r[Rm] to unsigned, in order to implment LSR
-                (r[Rm]>>(immed_5 - 1) & MASK_1BIT)?setCarry():clrCarry();
+                r[Rd] = (unsigned)rm >> immed_5;//change r[Rm] to unsigned, in order to implment LSR
+                carry = rm>>(immed_5 - 1) & MASK_1BIT;
             }
             //eflags V flag unaffected
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            lazyNZC<S>(r[Rd], carry);
 
             break;
         }
         case 2://ASR
         {
+            int carry;
+
             if (immed_5 == 0)
             {
-                ((r[Rm]>>31) & MASK_1BIT)?setCarry():clrCarry();
+                carry = (r[Rm]>>31) & MASK_1BIT;
                 if (((r[Rm]>>31) & MASK_1BIT) == 0)
                     r[Rd] = 0;
                 else// == 1
@@ -396,12 +1018,11 @@ void Thumb::shift_by_imm(const T_INSTR instruction)
             else// immed_5 > 0
             {
                 //execute
-                r[Rd] = r[Rm] >> immed_5;
-                (r[Rm]>>(immed_5 - 1) & MASK_1BIT)?setCarry():clrCarry();
+                r[Rd] = rm >> immed_5;
+                carry = rm>>(immed_5 - 1) & MASK_1BIT;
             }
             //eflags V flag unaffected
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            lazyNZC<S>(r[Rd], carry);
 
             break;
         }
@@ -415,38 +1036,34 @@ void Thumb::shift_by_imm(const T_INSTR instruction)
 
 /**
   * The matching pattern is 001, the subroutine is add(10)/sub(11)/mov(00)/cmp(01).
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::add_sub_mov_cmp_imm(const T_INSTR instruction)
+template<bool S>
+void Thumb::add_sub_mov_cmp_imm(const t_decoded &d)
 {
-    int opcode = (instruction>>11) & MASK_2BIT;
-    int Rd = (instruction>>8) & MASK_3BIT;
-    int imm = (instruction) & MASK_8BIT;
+    int opcode = d.op;
+    int Rd = d.rd;
+    int imm = d.imm;
 
     switch (opcode)
     {
     	case 2://add
     	{
-    	    CarryFrom(r[Rd], imm)?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rd], imm)?setOverflow():clrOverflow();//V flag
+    	    int rd = r[Rd];
             //execute
-            r[Rd] = r[Rd] + imm;
+            r[Rd] = rd + imm;
             //flags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            lazyAdd<S>(r[Rd], rd, imm);
 
             break;
     	}
         case 3://sub
         {
-            ((unsigned)r[Rd] >= (unsigned)imm)?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rd], -imm)?setOverflow():clrOverflow();//V flag
+            int rd = r[Rd];
             //execute
-            r[Rd] = r[Rd] - imm;
+            r[Rd] = rd - imm;
             //flags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
-
+            lazySub<S>(r[Rd], rd, imm);
 
             break;
         }
@@ -455,8 +1072,7 @@ void Thumb::add_sub_mov_cmp_imm(const T_INSTR instruction)
             //execute
             r[Rd] = imm;
             //flags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            lazyNZ<S>(r[Rd]);
 
             break;
         }
@@ -465,10 +1081,7 @@ void Thumb::add_sub_mov_cmp_imm(const T_INSTR instruction)
             //execute
             int alu_out = r[Rd] - imm;
             //flags
-            ((alu_out>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            alu_out?clrZero():setZero();//Z flag
-            ((unsigned)r[Rd] >= (unsigned)imm)?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rd], -imm)?setOverflow():clrOverflow();//V flag
+            lazySub<S>(alu_out, r[Rd], imm);
 
             break;
         }
@@ -482,15 +1095,15 @@ void Thumb::add_sub_mov_cmp_imm(const T_INSTR instruction)
 
 /**
   * The matching pattern is 0101.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   * @exception UnexpectInst For instructions can not be handled
   */
-void Thumb::ld_str_reg_offset(const T_INSTR instruction)
+void Thumb::ld_str_reg_offset(const t_decoded &d)
 {
-    int opcode = (instruction>>9) & MASK_3BIT;
-    int Rm = (instruction>>6) & MASK_3BIT;
-    int Rn = (instruction>>3) & MASK_3BIT;
-    int Rd = (instruction) & MASK_3BIT;
+    int opcode = d.op;
+    int Rm = d.rm;
+    int Rn = d.rn;
+    int Rd = d.rd;
 
     switch (opcode)
     {
@@ -609,75 +1222,42 @@ void Thumb::ld_str_reg_offset(const T_INSTR instruction)
 
 /**
   * The matching pattern is 01001.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::ld_from_pool(const T_INSTR instruction)
+void Thumb::ld_from_pool(const t_decoded &d)
 {
-    int Rd = (instruction>>8) & MASK_3BIT;
-    int offset = (instruction) & MASK_8BIT;
-    int address = ((rPC + 2) & 0xfffffffc) + (offset * 4);//pc + 2, due to pipeline
-
-    r[Rd] = my_mmu->get_word(address);//memory accessA7-51
+    r[d.rd] = my_mmu->get_word(d.imm);//memory accessA7-51, the address is resolved by decode()
 
 }
 
 /**
   * The matching pattern is 01000111.
-  * @param instruction The instruction to be executed.
-  * @exception UnexpectInst For instructions can not be handled
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::br_or_exec_is(const T_INSTR instruction)
+void Thumb::br_or_exec_is(const t_decoded &d)
 {
-    int L = (instruction>>7) & MASK_1BIT;
-    int H2 = (instruction>>6) & MASK_1BIT;
-    int Rm = (instruction>>3) & MASK_3BIT | (H2<<3);
-    //int SBZ = (instruction) & MASK_3BIT;
+    int L = d.op;
+    int Rm = d.rm;//H2 included
+    int target = Rm == 15 ? rPC + 2 : r[Rm];//bx pc, the veneer into ARM code, reads the address + 4
 
     if (L == 1)//BLX
     {
         rLR = (rPC) | 1;//A7-30,rLR = (rPC + 2) | 1;
         // NOTE (Birdman#1#): change rLR= (rPC + 2) | 1 to rLR = (rPC) | 1
-
-        rPC = r[Rm] & 0xfffffffe;
-        //flags
-        if ((r[Rm] & MASK_1BIT) == 0)
-        {
-            UnexpectInst e;
-            char tmp[40];
-            sprintf(tmp,"BLX Mode Switch not supported %x : %x\n",rPC-2, cur_instr);
-            e.error_name = tmp;
-            throw e;
-        }
-
-    }
-    else//BX
-    {
-        rPC = r[Rm] & 0xfffffffe;
-        //flags
-        if ((r[Rm] & MASK_1BIT) == 0)
-        {
-            UnexpectInst e;
-            char tmp[40];
-            sprintf(tmp,"BX Mode Switch not supported %x : %x\n",rPC-2, cur_instr);
-            e.error_name = tmp;
-            throw e;
-        }
-
     }
 
+    interwork(target);//BX, BLX, bit 0 clear switches to ARM
 }
 
 /**
   * The matching pattern is 010001 + opcode.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::spec_data_proc(const T_INSTR instruction)
+void Thumb::spec_data_proc(const t_decoded &d)
 {
-    int opcode =  (instruction>>8) & MASK_2BIT;
-    int H1 = (instruction>>7) & MASK_1BIT;
-    int H2 = (instruction>>6) & MASK_1BIT;
-    int Rm = (instruction>>3) & MASK_3BIT | (H2<<3);
-    int Rn = (instruction) & MASK_3BIT | (H1<<3);
+    int opcode = d.op;
+    int Rm = d.rm;//H2 included
+    int Rn = d.rd;//H1 included
 
     switch (opcode)
     {
@@ -685,10 +1265,7 @@ void Thumb::spec_data_proc(const T_INSTR instruction)
     	{
             int alu_out = r[Rn] - r[Rm];
             //flags
-            ((alu_out>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            alu_out?clrZero():setZero();//Z flag
-            ((unsigned)r[Rn] >= (unsigned)r[Rm])?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rn], -r[Rm])?setOverflow():clrOverflow();//V flag
+            lazySub(alu_out, r[Rn], r[Rm]);
 
     		break;
     	}
@@ -714,45 +1291,30 @@ void Thumb::spec_data_proc(const T_INSTR instruction)
 
 /**
   * The matching pattern is 010000 opcode.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::data_proc_reg(const T_INSTR instruction)
+template<bool S>
+void Thumb::data_proc_reg(const t_decoded &d)
 {
-    int opcode = (instruction>>6) & MASK_4BIT;
-    int Rs = (instruction>>3) & MASK_3BIT;
-    int Rd = (instruction) & MASK_3BIT;
+    int opcode = d.op;
+    int Rs = d.rm;
+    int Rd = d.rd;
 
     switch (opcode)
     {
     	case 5://adc
     	{
-
-            if (getCarry() == 0)
-            {
-                CarryFrom(r[Rd], r[Rs])?setCarry():clrCarry();//C flag
-                OverflowFrom(r[Rd], r[Rs])?setOverflow():clrOverflow();//V flag
-            }
-            else// carry == 1
-            {
-                if (CarryFrom(r[Rd], r[Rs]+1)
-                 || CarryFrom(r[Rd]+1, r[Rs])
-                 || CarryFrom(r[Rd], r[Rs]))// in case one of them is 0xffffffff, or both are
-                    setCarry();
-                else
-                    clrCarry();
-
-                if (OverflowFrom(r[Rd], r[Rs]+1)
-                 || OverflowFrom(r[Rd]+1, r[Rs])
-                 || OverflowFrom(r[Rd], r[Rs]))
-                    setOverflow();
-                else
-                    clrOverflow();
-            }
+    	    int rd = r[Rd], rs = r[Rs], carry = getCarry();
             //execute
-            r[Rd] = r[Rd] + r[Rs] + getCarry();
+            r[Rd] = rd + rs + carry;
             //flags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            if (S)
+            {
+                ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
+                r[Rd]?clrZero():setZero();//Z flag
+                CarryFrom(rd, rs, carry)?setCarry():clrCarry();//C flag
+                OverflowFrom(rd, rs, carry)?setOverflow():clrOverflow();//V flag
+            }
 
     		break;
     	}
@@ -760,8 +1322,7 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
         {
             r[Rd] = r[Rd] & r[Rs];
             //flags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            lazyNZ<S>(r[Rd]);
 
             break;
         }
@@ -770,29 +1331,26 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
             int shifter = r[Rs] & 0xff;
             if ( shifter < 32 && shifter != 0)
             {
-                if ((r[Rd] & (1<<(shifter-1))) == 0)
-                    clrCarry();
-                else
-                    setCarry();
+                int carry = (r[Rd] & (1<<(shifter-1))) != 0;
                 r[Rd] = r[Rd] >> shifter;
+                lazyNZC<S>(r[Rd], carry);
             }
             else if( shifter >= 32)
             {
                 if ((r[Rd] & (1<<31)) == 0)//(r[Rd] & (1<<31))?setCarry():clrCarry();
                 {
-                    clrCarry();
                     r[Rd] = 0;
+                    lazyNZC<S>(r[Rd], 0);
                 }
                 else
                 {
-                    setCarry();
                     r[Rd] = 0xffffffff;
+                    lazyNZC<S>(r[Rd], 1);
                 }
 
-            }//shifter == 0, nothing will be done
-
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();
-            r[Rd]?clrZero():setZero();
+            }
+            else//shifter == 0, nothing will be done
+                lazyNZ<S>(r[Rd]);
 
             break;
         }
@@ -800,8 +1358,7 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
         {
             r[Rd] = r[Rd] & ~(r[Rs]);
             //flags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            lazyNZ<S>(r[Rd]);
 
             break;
         }
@@ -809,10 +1366,7 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
         {
             int alu_out = r[Rd] + r[Rs];
             //flags
-            ((alu_out>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            alu_out?clrZero():setZero();//Z flag
-            CarryFrom(r[Rd], r[Rs])?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rd], r[Rs])?setOverflow():clrOverflow();//V flag
+            lazyAdd<S>(alu_out, r[Rd], r[Rs]);
 
             break;
         }
@@ -820,10 +1374,7 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
         {
             int alu_out = r[Rd] - r[Rs];
             //flags
-            ((alu_out>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            alu_out?clrZero():setZero();//Z flag
-            ((unsigned)r[Rd] >= (unsigned)r[Rs])?setCarry():clrCarry();//C flag
-            OverflowFrom(r[Rd], -r[Rs])?setOverflow():clrOverflow();//V flag
+            lazySub<S>(alu_out, r[Rd], r[Rs]);
 
             break;
         }
@@ -831,8 +1382,7 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
         {
             r[Rd] = r[Rd] ^ r[Rs];
             //flags
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            lazyNZ<S>(r[Rd]);
 
             break;
         }
@@ -841,29 +1391,23 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
             int shifter = r[Rs] & 0xff;
             if ( shifter < 32 && shifter != 0)
             {
-                if ((r[Rd] & (1<<(32-shifter))) == 0)
-                    clrCarry();
-                else
-                    setCarry();
+                int carry = (r[Rd] & (1<<(32-shifter))) != 0;
                 r[Rd] = r[Rd] << shifter;
+                lazyNZC<S>(r[Rd], carry);
             }
             else if( shifter == 32)
             {
-                if ((r[Rd] & MASK_1BIT) == 1)
-                    setCarry();
-                else
-                    clrCarry();
-
+                int carry = r[Rd] & MASK_1BIT;
                 r[Rd] = 0;
+                lazyNZC<S>(r[Rd], carry);
             }
             else if (shifter > 32)//shifter > 32
             {
-                clrCarry();
                 r[Rd] = 0;
-            }//else shifter == 0, unaffected
-
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();
-            r[Rd]?clrZero():setZero();
+                lazyNZC<S>(r[Rd], 0);
+            }
+            else//shifter == 0, unaffected
+                lazyNZ<S>(r[Rd]);
 
             break;
         }
@@ -872,29 +1416,23 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
             int shifter = r[Rs] & 0xff;
             if ( shifter < 32 && shifter != 0)
             {
-                if ((r[Rd] & (1<<(shifter-1))) == 0)
-                    clrCarry();
-                else
-                    setCarry();
+                int carry = (r[Rd] & (1<<(shifter-1))) != 0;
                 r[Rd] = (unsigned)r[Rd] >> shifter;//use unsigned to implement lsr
+                lazyNZC<S>(r[Rd], carry);
             }
             else if( shifter == 32)
             {
-                if (((r[Rd]>>31) & MASK_1BIT) == 1)
-                    setCarry();
-                else
-                    clrCarry();
-
+                int carry = (r[Rd]>>31) & MASK_1BIT;
                 r[Rd] = 0;
+                lazyNZC<S>(r[Rd], carry);
             }
             else if (shifter > 32)//shifter > 32
             {
-                clrCarry();
                 r[Rd] = 0;
-            }//else shifter == 0, unaffected
-
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();
-            r[Rd]?clrZero():setZero();
+                lazyNZC<S>(r[Rd], 0);
+            }
+            else//shifter == 0, unaffected
+                lazyNZ<S>(r[Rd]);
 
             break;
         }
@@ -904,60 +1442,47 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
 // NOTE (Birdman#1#): try long long, in case of data loss
 
             r[Rd] = (rd * rs) & 0xffffffff;
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();
-            r[Rd]?clrZero():setZero();
+            lazyNZ<S>(r[Rd]);
 
             break;
         }
         case 15://mvn
         {
             r[Rd] = ~r[Rs];
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();
-            r[Rd]?clrZero():setZero();
+            lazyNZ<S>(r[Rd]);
             break;
         }
         case 9://neg
         {
-            r[Rd] = 0 - r[Rs];
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();
-            r[Rd]?clrZero():setZero();
-            //C,V flags
-            ((unsigned)0 >= (unsigned)r[Rs])?setCarry():clrCarry();//C flag
-            OverflowFrom(0, -r[Rs])?setOverflow():clrOverflow();//V flag
+            int rs = r[Rs];//Rd may be Rs
+            r[Rd] = 0 - rs;
+            lazySub<S>(r[Rd], 0, rs);
 
             break;
         }
         case 12://orr
         {
             r[Rd] = r[Rd] | r[Rs];
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
+            lazyNZ<S>(r[Rd]);
             break;
         }
         case 7://ror
         {
             int shifter = r[Rs] & 0xff;
+            int carry;
             if (shifter == 0)
             {
-                ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();
-                r[Rd]?clrZero():setZero();
+                lazyNZ<S>(r[Rd]);
                 break;
             }
 
             if ((shifter & MASK_5BIT) == 0)
             {
-                if (((r[Rd]>>31) & MASK_1BIT) == 1)
-                    setCarry();
-                else
-                    clrCarry();
-
+                carry = (r[Rd]>>31) & MASK_1BIT;
             }
             else
             {
-                if (((r[Rd]>>((shifter & MASK_5BIT) - 1)) & MASK_1BIT) == 1)
-                    setCarry();
-                else
-                    clrCarry();
+                carry = (r[Rd]>>((shifter & MASK_5BIT) - 1)) & MASK_1BIT;
 
                 /*for (int i = (shifter & MASK_5BIT); i > 0; i--)
                 {
@@ -966,41 +1491,28 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
                 r[Rd] = (((r[Rd]) >> (shifter & MASK_5BIT)) | ((r[Rd]) << (32 - (shifter & MASK_5BIT))));
             }
 
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();
-            r[Rd]?clrZero():setZero();
+            lazyNZC<S>(r[Rd], carry);
             break;
         }
         case 6://sbc
         {
-            if (getCarry() == 1)
-            {
-                ((unsigned)r[Rd] >= (unsigned)r[Rs])?setCarry():clrCarry();//C flag
-                OverflowFrom(r[Rd], -r[Rs])?setOverflow():clrOverflow();//V flag
-            }
-            else// carry == 0
+            int rd = r[Rd], rs = r[Rs], carry = getCarry();
+            //execute, rd + ~rs + carry
+            r[Rd] = rd - rs - !carry;
+            //flags
+            if (S)
             {
-                if ((unsigned)r[Rd] >= (unsigned)(r[Rs] + 1))// in case one of them is 0xffffffff, or both are
-                    setCarry();
-                else
-                    clrCarry();
-
-                if (OverflowFrom(r[Rd], - r[Rs] - 1))
-                    setOverflow();
-                else
-                    clrOverflow();
+                ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
+                r[Rd]?clrZero():setZero();//Z flag
+                CarryFrom(rd, ~rs, carry)?setCarry():clrCarry();//C flag
+                OverflowFrom(rd, ~rs, carry)?setOverflow():clrOverflow();//V flag
             }
-
-            r[Rd] = r[Rd] - r[Rs] - getCarry()?0:1;
-
-            ((r[Rd]>>31) & MASK_1BIT)?setNeg():clrNeg();//N flag
-            r[Rd]?clrZero():setZero();//Z flag
             break;
         }
         case 8://tst
         {
             int alu_out = r[Rd] & r[Rs];
-            (alu_out & (1<<31))?setNeg():clrNeg();//N flag
-            alu_out?clrZero():setZero();//Z flag
+            lazyNZ<S>(alu_out);
 
             break;
         }
@@ -1014,23 +1526,23 @@ void Thumb::data_proc_reg(const T_INSTR instruction)
 
 /**
   * The matching pattern is 011 BL.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   * @exception UnexpectInst For instructions can not be handled
   */
-void Thumb::ld_str_word_byte_imm(const T_INSTR instruction)
+void Thumb::ld_str_word_byte_imm(const t_decoded &d)
 {
-    int B = (instruction>>12) & MASK_1BIT;// 1:byte, 0:word
-    int L = (instruction>>11) & MASK_1BIT;// 1:load, 0:store
-    int offset = (instruction>>6) & MASK_5BIT;
-    int Rn = (instruction>>3) & MASK_3BIT;
-    int Rd = (instruction) & MASK_3BIT;
+    int B = (d.op>>1) & MASK_1BIT;// 1:byte, 0:word
+    int L = (d.op) & MASK_1BIT;// 1:load, 0:store
+    int offset = d.imm;//scaled by decode()
+    int Rn = d.rn;
+    int Rd = d.rd;
 
 
 
 //memory access, LDR(1), A7-47, 01101
     if (B == 0 && L == 1)//load word
     {
-        int addr = r[Rn] + (offset * 4);
+        int addr = r[Rn] + offset;
 
         if (addr & MASK_2BIT != 0)
         {
@@ -1056,7 +1568,7 @@ void Thumb::ld_str_word_byte_imm(const T_INSTR instruction)
 //memory access, STR(1), A7-99, 01100
     if (B == 0 && L == 0)
     {
-        int addr = r[Rn] + (offset * 4);
+        int addr = r[Rn] + offset;
         if (addr & MASK_2BIT != 0)
         {
             UnexpectInst e;
@@ -1082,19 +1594,19 @@ void Thumb::ld_str_word_byte_imm(const T_INSTR instruction)
 
 /**
   * The matching pattern is 1001 L.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   * @exception UnexpectInst For instructions can not be handled
   */
-void Thumb::ld_str_stack(const T_INSTR instruction)
+void Thumb::ld_str_stack(const t_decoded &d)
 {
-    int L = (instruction>>11) & MASK_1BIT;// 1:load, 0:store
-    int Rd = (instruction>>8) & MASK_3BIT;
-    int imm = (instruction) & MASK_8BIT;
+    int L = d.op;// 1:load, 0:store
+    int Rd = d.rd;
+    int imm = d.imm;//scaled by decode()
 
 // memory access, LDR(4), A7-53
     if (L == 1)
     {
-        int addr = rSP + (imm * 4);
+        int addr = rSP + imm;
         if (addr & MASK_2BIT != 0)
         {
             UnexpectInst e;
@@ -1109,7 +1621,7 @@ void Thumb::ld_str_stack(const T_INSTR instruction)
 //(Birdman#1#): memory access, STR(3), A7-103
     if (L == 0)
     {
-        int addr = rSP + (imm * 4);
+        int addr = rSP + imm;
         if (addr & MASK_2BIT != 0)
         {
             UnexpectInst e;
@@ -1126,20 +1638,20 @@ void Thumb::ld_str_stack(const T_INSTR instruction)
 
 /**
   * The matching pattern is 1000 L.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   * @exception UnexpectInst For instructions can not be handled
   */
-void Thumb::ld_str_halfw_imm(const T_INSTR instruction)
+void Thumb::ld_str_halfw_imm(const t_decoded &d)
 {
-    int L = (instruction>>11) & MASK_1BIT;// 1:load, 0:store
-    int imm = (instruction>>6) & MASK_5BIT;
-    int Rn = (instruction>>3) & MASK_3BIT;
-    int Rd = (instruction) & MASK_3BIT;
+    int L = d.op;// 1:load, 0:store
+    int imm = d.imm;//scaled by decode()
+    int Rn = d.rn;
+    int Rd = d.rd;
 
 // memory access, LDRH(1), A7-57, 10001
     if (L == 1)
     {
-        int addr = r[Rn] + (imm * 2);
+        int addr = r[Rn] + imm;
         if (addr & MASK_1BIT != 0)
         {
             UnexpectInst e;
@@ -1154,7 +1666,7 @@ void Thumb::ld_str_halfw_imm(const T_INSTR instruction)
 //(Birdman#1#): memory access, STRH(1), A7-109, 10000
     if (L == 0)
     {
-        int addr = r[Rn] + (imm * 2);
+        int addr = r[Rn] + imm;
         if (addr & MASK_1BIT != 0)
         {
             UnexpectInst e;
@@ -1172,35 +1684,25 @@ void Thumb::ld_str_halfw_imm(const T_INSTR instruction)
 
 /**
   * The matching pattern is 1011, 10 instructions included.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   * @exception UndefineInst For undefined instructions
   */
-void Thumb::misc(const T_INSTR instruction)
+void Thumb::misc(const t_decoded &d)
 {
-    int sec_code = (instruction>>8) & MASK_4BIT;
+    int sec_code = d.op;
 
     switch (sec_code)
     {
     	case 0://adjust stack pointer
         {
-            int imm = (instruction) & MASK_7BIT;
-            int opc = (instruction>>7) & MASK_1BIT;
-
-            if (opc == 0)//add(7) page528
-            {
-                rSP = rSP + (imm<<2);
-            }
-            else//sub(4) page632
-            {
-                rSP = rSP - (imm<<2);
-            }
+            rSP = rSP + d.imm;//add(7) page528 or sub(4) page632, signed by decode()
     		break;
         }
         case 2://sign/zero extend
         {
-            int opc = (instruction>>6) & MASK_2BIT;
-            int Rm = (instruction>>3) & MASK_3BIT;
-            int Rd = (instruction) & MASK_3BIT;
+            int opc = d.imm;
+            int Rm = d.rm;
+            int Rd = d.rd;
 
             if (opc == 1)//sxtb
             {
@@ -1220,67 +1722,38 @@ void Thumb::misc(const T_INSTR instruction)
             }
             break;
         }
-        case 4:case 5:// L=0,R=1/0 push
+        case 4:case 5:// L=0,R=1/0 push, the registers are gathered and stored by one block transfer
         {
-            int R = (instruction>>8) & MASK_1BIT;
-            int reg_list = (instruction) & MASK_8BIT;
-            int start_addr = rSP - 4 * (R + num_of_bits_set(reg_list));
-            int end_addr = rSP - 4;
-            int addr = start_addr;
-
-            for (int i = 0; i < 8; i++)
-                if (((reg_list>>i) & MASK_1BIT) == 1)
-                {
-                    //put r[i] in memory addr ,A7-85
-                    //my_mmu->push_stack(r[i], addr);
-                    my_mmu->set_word(addr, r[i]);
+            int R = (d.imm>>8) & MASK_1BIT;
+            int reg_list = (d.imm) & MASK_8BIT;
+            WORD words[9];
+            int n = 0;
 
-                    addr += 4;
-                }
+            for (int list = reg_list; list != 0; list &= list - 1)
+                words[n++] = r[__builtin_ctz(list)];//put r[i] in memory addr ,A7-85
             if (R == 1)
-            {
-                //put in LR, A7-85
-                //my_mmu->push_stack(rLR, addr);
-                my_mmu->set_word(addr, rLR);
-                addr += 4;
-            }
-            assert(end_addr == addr - 4);
-            rSP = rSP - 4 * (R + num_of_bits_set(reg_list));
+                words[n++] = rLR;//put in LR, A7-85
+            assert(n == R + d.rm);
+
+            my_mmu->set_words(rSP - 4 * n, words, n);
+            rSP = rSP - 4 * n;
 
             break;
         }
         case 12:case 13://L=1,R=1/0 pop
         {
-            int R = (instruction>>8) & MASK_1BIT;
-            int reg_list = (instruction) & MASK_8BIT;
-            int start_addr = rSP;
-            int end_addr = rSP + 4 * (R + num_of_bits_set(reg_list));
-            int addr = start_addr;
-
-            for (int i = 0; i < 8; i++)
-                if (((reg_list>>i) & MASK_1BIT) == 1)
-                {
-                    //r[i] = my_mmu->pop_stack(rSP);//get reg from memory, addr's content, A7-83
-                    r[i] = my_mmu->get_word(addr);
-                    addr +=4;
-                }
+            int R = (d.imm>>8) & MASK_1BIT;
+            int reg_list = (d.imm) & MASK_8BIT;
+            int end_addr = rSP + 4 * (R + d.rm);
+            WORD words[9];
+            int n = 0;
+
+            my_mmu->get_words(rSP, words, R + d.rm);//get reg from memory, addr's content, A7-83
+            for (int list = reg_list; list != 0; list &= list - 1)
+                r[__builtin_ctz(list)] = words[n++];
             if (R == 1)
-            {
-                int value = my_mmu->get_word(addr);//my_mmu->pop_stack(addr);//get addr's content, A7-83
-                rPC = value & 0xfffffffe;
-                if ((value & MASK_1BIT) == 0)
-                {
-                    UnexpectInst e;
-                    char tmp[40];
-                    sprintf(tmp,"Mode Switch not supported %x : %x\n",rPC-2, cur_instr);
-                    e.error_name = tmp;
-                    throw e;
-                }
-                addr += 4;
-            }
+                interwork(words[n]);//bit 0 clear switches to ARM
 
-            assert(end_addr == addr);
-            //assert(end_addr == rSP);// check rSP == end_addr?
             rSP = end_addr;
             break;
         }
@@ -1295,29 +1768,29 @@ void Thumb::misc(const T_INSTR instruction)
         }
         case 10://reverse bytes
         {
-            int Rn = (instruction>>3) & MASK_3BIT;
-            int Rd = (instruction) & MASK_3BIT;
-            int opcode = (instruction>>6) & MASK_2BIT;
+            int Rd = d.rd;
+            int opcode = d.imm;
+            uint32_t rn = r[d.rn];//Rd may be Rn
 
             if (opcode == 0)//rev
             {
-                r[Rd] = (r[Rn] & 0xff)<<24;
-                r[Rd] |= (r[Rn] & 0xff00)<<8;
-                r[Rd] |= (r[Rn] & 0xff0000)>>8;
-                r[Rd] |= (r[Rn] & 0xff000000)>>24;
+                r[Rd] = (rn & 0xff)<<24;
+                r[Rd] |= (rn & 0xff00)<<8;
+                r[Rd] |= (rn & 0xff0000)>>8;
+                r[Rd] |= (rn & 0xff000000)>>24;
             }
             else if(opcode == 1)//rev16,page606
             {
-                r[Rd] = (r[Rn] & 0xff)<<8;
-                r[Rd] |= (r[Rn] & 0xff00)>>8;
-                r[Rd] |= (r[Rn] & 0xff0000)<<8;
-                r[Rd] |= (r[Rn] & 0xff000000)>>8;
+                r[Rd] = (rn & 0xff)<<8;
+                r[Rd] |= (rn & 0xff00)>>8;
+                r[Rd] |= (rn & 0xff0000)<<8;
+                r[Rd] |= (rn & 0xff000000)>>8;
             }
             else if(opcode == 3)//revsh
             {
-                r[Rd] = (r[Rn] & 0xff)<<8;
-                r[Rd] |= (r[Rn] & 0xff00)>>8;
-                if (((r[Rn]>>7) & MASK_1BIT) == 1)
+                r[Rd] = (rn & 0xff)<<8;
+                r[Rd] |= (rn & 0xff00)>>8;
+                if (((rn>>7) & MASK_1BIT) == 1)
                     r[Rd] |= 0xffff0000;
                 else
                     r[Rd] &= 0xffff;
@@ -1330,13 +1803,9 @@ void Thumb::misc(const T_INSTR instruction)
             //this caculation is tested
             break;
         }
-        case 14://breakpoint, will not come
+        case 14://breakpoint, run() returns and goes on after it
         {
-            UnexpectInst e;
-            char tmp[30];
-            sprintf(tmp,"Breakpoint not supported,%x : %x\n",rPC-2, cur_instr);
-            e.error_name = tmp;
-            throw e;
+            requestStop(STOP_BREAKPOINT);
             break;
         }
     	default:
@@ -1353,205 +1822,143 @@ void Thumb::misc(const T_INSTR instruction)
 
 /**
   * The matching pattern is 1010 SP.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::add_to_sp_or_pc(const T_INSTR instruction)
+void Thumb::add_to_sp_or_pc(const t_decoded &d)
 {
-    int SP_BIT = (instruction>>11) & MASK_1BIT;
-    int Rd = (instruction>>8) & MASK_3BIT;
-    int imm = (instruction) & MASK_8BIT;
-
-    if (SP_BIT == 0)//add(5)
+    if (d.op == 0)//add(5), the address is resolved by decode()
     {
-        r[Rd] = ((rPC + 2) & 0xfffffffc) + (imm * 4);
+        r[d.rd] = d.imm;
     }
     else//ADD(6)
     {
-        r[Rd] = rSP + (imm << 2);
+        r[d.rd] = rSP + d.imm;
     }
 }
 
 /**
   * The matching pattern is 1100 L.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::ld_str_multiple(const T_INSTR instruction)
+void Thumb::ld_str_multiple(const t_decoded &d)
 {
-    int L = (instruction>>11) & MASK_1BIT;
-    int Rn = (instruction>>8) & MASK_3BIT;
-    int reg_list = (instruction) & MASK_8BIT;
-    int start_addr, end_addr, addr;
+    int L = d.op;
+    int Rn = d.rn;
+    int reg_list = d.imm;
+    WORD words[8];
+    int n = 0;
 
     if (L == 1)//ldmia
     {
-        addr = start_addr = r[Rn];
-        end_addr = r[Rn] + num_of_bits_set(reg_list) * 4 - 4;
-        for (int i = 0; i < 8; i++)
-            if (((reg_list>>i) & MASK_1BIT) == 1)
-            {
-                r[i] = my_mmu->get_word(addr); //memory access, A7-45
-                addr +=4;
-            }
-        assert(end_addr  == addr -4);
-        r[Rn] = r[Rn] + num_of_bits_set(reg_list) * 4;
+        my_mmu->get_words(r[Rn], words, d.rm); //memory access, A7-45
+        for (int list = reg_list; list != 0; list &= list - 1)
+            r[__builtin_ctz(list)] = words[n++];
+        r[Rn] = r[Rn] + d.rm * 4;
     }
     else//stmia
     {
-        addr = start_addr = r[Rn];
-        end_addr = r[Rn] + num_of_bits_set(reg_list) * 4 - 4;
-        for (int i = 0; i < 8; i++)
-            if (((reg_list>>i) & MASK_1BIT) == 1)
-            {
+        for (int list = reg_list; list != 0; list &= list - 1)
+            words[n++] = r[__builtin_ctz(list)];
 //(Birdman#1#): memory access store, A7-97
-                my_mmu->set_word(addr, r[i]);
-
-                addr +=4;
-            }
-        assert(end_addr  == addr -4);
-        r[Rn] = r[Rn] + num_of_bits_set(reg_list) * 4;
+        my_mmu->set_words(r[Rn], words, d.rm);
+        r[Rn] = r[Rn] + d.rm * 4;
     }
 }
 
 /**
   * The matching pattern is 1101 cond.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::con_br(const T_INSTR instruction)
+void Thumb::con_br(const t_decoded &d)
 {
-    unsigned char cond = (instruction>>8) & MASK_4BIT;
-    int imm = (instruction) & MASK_8BIT;
-
-    if (ConditionPassed(cond))
-        rPC = (rPC + 2) + (SignExtend(imm, 8) << 1);//conditon judge, change pc, A7-19, revisit is needed
+    if (ConditionPassed(d.op))
+        rPC = d.imm;//conditon judge, change pc, A7-19, target resolved by decode()
 
 }
 
 /**
   * The matching pattern is 11100.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::uncon_br(const T_INSTR instruction)
+void Thumb::uncon_br(const t_decoded &d)
 {
-    int imm_11 = instruction & 0x7ff;//mask bit[10:0]
-
-    rPC = (rPC + 2) + (SignExtend(imm_11, 11) << 1);
+    rPC = d.imm;//target resolved by decode()
 //change PC, A7-21
 
 }
 
 /**
   * The matching pattern is 11101.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::blx_suffix(const T_INSTR instruction)
+void Thumb::blx_suffix(const t_decoded &d)
 {
-    //int offset = instruction & 0x3ff;
+    int target = (rLR + d.imm) & 0xfffffffc;//A7-26
 
-     //should not come here
-     printf("Switch to ARM, not supported\n");
+    rLR = (rPC) | 1;
+    interwork(target);//always to ARM
 }
 
 /**
   * The matching pattern is 11110.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::bl_blx_prefix(const T_INSTR instruction)
+void Thumb::bl_blx_prefix(const t_decoded &d)
 {
-    int offset = instruction & 0x7ff;
-
-    rLR = (rPC + 2) + (SignExtend(offset, 11) << 12);
+    rLR = d.imm;//resolved by decode()
 }
 
 /**
   * The matching pattern is 11111.
-  * @param instruction The instruction to be executed.
+  * @param d The predecoded instruction to be executed.
   */
-void Thumb::bl_suffix(const T_INSTR instruction)
+void Thumb::bl_suffix(const t_decoded &d)
 {
-    int offset = instruction & 0x7ff;
     int temp = rPC;
 
-    rPC = rLR + (offset << 1);
+    rPC = rLR + d.imm;
     rLR = ( temp ) | 1;//rLR = temp | 1;
 }
 
 /**
-  * According to the condition field, determine whether it matches the CPSR, if matches, return true, otherwise false.
-  * @param cond The conditon field.
-  * @ return Whether condition field matches the CPSR.
+  * The matching pattern is 11011111, only the semihosting SWI 0xab is handled.
+  * @param d The predecoded instruction to be executed.
+  * @exception UnexpectInst For other SWI numbers
   */
-int Thumb::ConditionPassed(unsigned char cond)
+void Thumb::software_int(const t_decoded &d)
 {
-    int res = 0;
-    switch (cond)//A3-4,page112
+    //printf("Aloha SWI  0x%x\n",r[0]);
+    if (d.imm == 0xab)
     {
-    	case 0://EQ
-            if (getZero())
-                res = 1;
-    		break;
-        case 1://NE
-            if (!getZero())
-                res = 1;
-            break;
-        case 2://CS/HS
-            if (getCarry())
-                res = 1;
-            break;
-    	case 3://CC/LO
-            if (!getCarry())
-                res = 1;
-            break;
-    	case 4://MI
-            if (getNeg())
-                res = 1;
-            break;
-    	case 5://PL
-            if (!getNeg())
-                res = 1;
-            break;
-    	case 6://VS
-            if (getOverflow())
-                res = 1;
-            break;
-    	case 7://VC
-            if (!getOverflow())
-                res = 1;
-            break;
-    	case 8://HI
-            if (getCarry() && !getZero())
-                res = 1;
-            break;
-    	case 9://LS
-            if (!getCarry() || getZero())
-                res = 1;
-            break;
-        case 10://GE
-            if (getNeg() == getOverflow())
-                res = 1;
-            break;
-    	case 11://LT
-            if (getNeg() != getOverflow())
-                res = 1;
-            break;
-    	case 12://GT
-            if ((getZero() == 0) && (getNeg() == getOverflow()))
-                res = 1;
-            break;
-    	case 13://LE
-            if ((getZero() == 1) || (getNeg() != getOverflow()))
-                res = 1;
-            break;
-    	case 14://AL
-            res = 1;
-            break;
-    	default:
-            assert(0);
-            //error
-    		break;
+        swi.get_para(r);
+        if (swi.swi_handler())
+            requestStop(STOP_ENDED);
     }
+    else
+    {
+        UnexpectInst e;
+        char tmp[30];
+        sprintf(tmp,"%x : %x",rPC-2, cur_instr);
+        e.error_name = tmp;
+        throw e;
+    }
+}
 
-    return res;
-
+/**
+  * The matching pattern is 11011110, or 11101 with the last bit set.
+  * @param d The predecoded instruction to be executed.
+  * @exception UndefineInst Always
+  */
+void Thumb::undefined(const t_decoded &d)
+{
+    UndefineInst e;
+    if (d.op == 1)
+    {
+        char tmp[30];
+        sprintf(tmp,"%x : %x",rPC-2, cur_instr);
+        e.error_name = tmp;
+    }
+    throw e;
 }
 
 /**
@@ -1569,7 +1976,7 @@ MMU * Thumb::get_mmu()
 
 
 /**
-  * Get a new MMU modular, get stack pointer from MMU, get program's entry pointer from MMU, initialize SWI.
+  * Get a new MMU modular, get stack pointer from MMU, get program's entry pointer from MMU, initialize SWI, find the library routines run on the host.
   */
 void Thumb::InitMMU()
 {
@@ -1579,6 +1986,7 @@ void Thumb::InitMMU()
     rPC = my_mmu->getEntry();
 
     InitSWI();
+    hle.init(my_mmu, true);
 }
 
 /**
@@ -1602,28 +2010,14 @@ void Thumb::InitSWI()
 }
 
 /**
-  * Copy the general purpose register, process status register, and MMU pointer.
-  * @param reg The pointer to array of general purpose registers
-  * @param flags The reference of process status register
-  * @param mmu The pointer to MMU modular 
-  */
-void Thumb::getRegs(GP_Reg reg[], EFLAG &flags, MMU* &mmu)
-{
-    for (int i = 0; i < GPR_num; i++)
-        reg[i] = r[i];
-
-    flags = cpsr;
-    mmu = my_mmu;
-}
-
-/**
-  * Copy a CPU content to current one(for mode switch use).
-  * @param a_cpu The pointer to another CPU
+  * Use the MMU modular of the ARM decoder, the registers are shared already, and find the library routines run on the host in its program.
+  * @param mmu The pointer to MMU modular
   */
-void Thumb::CopyCPU(CPU *a_cpu)
+void Thumb::AttachMMU(MMU *mmu)
 {
-    static_cast<ARM *>(a_cpu)->getRegs(r, cpsr, my_mmu);
+    my_mmu = mmu;
     InitSWI();
+    hle.init(my_mmu, true);
 }
 
 /**
@@ -12,10 +12,17 @@
 /*@{*/
 
 #include <limits.h>
+#include <exception>
+#include <unordered_map>
 #include "CPU.h"
 #include "assert.h"
 #include "MMU.h"
 #include "swi_semihost.h"
+#include "block.h"
+#include "jit.h"
+#include "aot.h"
+#include "idiom.h"
+#include "hle.h"
 
 
 
@@ -51,34 +58,131 @@
 #define MASK_8BIT   0xff
 
 
+class Thumb;
+struct t_decoded;
 
+/*! \typedef t_handler
+	\brief Pointer to the member function which executes one kind of Thumb instruction.
+ */
+typedef void (Thumb::*t_handler)(const t_decoded &);
+
+/*! \enum t_class
+	\brief The handler classes of Thumb instructions, the values stored in the 65536-entry decode table.
+ */
+enum t_class
+{
+    T_ADD_SUB_REG_OR_IMM,
+    T_SHIFT_BY_IMM,
+    T_ADD_SUB_MOV_CMP_IMM,
+    T_LD_STR_REG_OFFSET,
+    T_LD_FROM_POOL,
+    T_BR_OR_EXEC_IS,
+    T_SPEC_DATA_PROC,
+    T_DATA_PROC_REG,
+    T_LD_STR_WORD_BYTE_IMM,
+    T_LD_STR_STACK,
+    T_LD_STR_HALFW_IMM,
+    T_MISC,
+    T_ADD_TO_SP_OR_PC,
+    T_LD_STR_MULTIPLE,
+    T_CON_BR,
+    T_UNDEFINED,
+    T_SOFTWARE_INT,
+    T_UNCON_BR,
+    T_BLX_SUFFIX,
+    T_UNDEFINED_BLX,//undefined BLX suffix, reports its address
+    T_BL_BLX_PREFIX,
+    T_BL_SUFFIX,
+    T_CLASS_NUM
+};
+
+/*! \enum t_fuse
+	\brief The kinds of superinstructions, pairs of instructions run by one handler, for the statistics.
+ */
+enum t_fuse
+{
+    F_BL,//BL prefix and suffix
+    F_CMP_BR,//cmp, or sub of an immediate, then a conditional branch
+    F_MOV_IMM,//mov of an immediate, then add, sub, lsl or mvn building a constant in the same register
+    F_POOL_USE,//literal pool load, then an instruction reading the loaded register
+    F_KIND_NUM
+};
+
+/*! \struct t_decoded
+	\brief A predecoded Thumb instruction.
+
+	One entry exists for every halfword of the code segment. The entry is filled by Thumb::decode() the first time its address is fetched, after that exec() calls the handler with the operands already pulled out of the instruction.
+ */
+struct t_decoded
+{
+	//! The handler to execute, NULL while the entry is not decoded yet.
+    t_handler handler;
+	//! Immediate operand, already scaled, sign extended, or turned into an absolute address for PC relative forms.
+    int32_t imm;
+	//! The raw instruction.
+    T_INSTR instr;
+	//! The t_class of the instruction.
+    uint8_t cls;
+	//! The label the threaded dispatch jumps to, cls, or T_CLASS_NUM if handler is not the one of cls: a superinstruction, or a variant leaving dead flags alone.
+    uint8_t disp;
+	//! The opcode inside the handler's group.
+    uint8_t op;
+	//! Destination, or transfer, register number.
+    uint8_t rd;
+	//! Base or first operand register number.
+    uint8_t rn;
+	//! Offset or second operand register number, the register count for ld/st multiple and push/pop.
+    uint8_t rm;
+};
 
 
 /*! \class Thumb
 	\brief Thumb instruction decode class.
 
-	Decode all the Thumb instructions, except breakpoint, and mode switch related instructions.
+	Decode all the Thumb instructions. Breakpoints and switches to ARM status stop run(), the ARM decoder of the core goes on with the same registers.
  */
 class Thumb: public CPU
 {
+    friend class thumb_jit;
+    friend class thumb_aot;
+    template<int N> friend class thumb_lockstep;
+
 public:
 	//!A constructor
-	Thumb();
+	Thumb(cpu_state *state);
 	//!A destructor
 	~Thumb();
 
 	//members
 private:
-	//! The general purpose registers array.
-	GP_Reg r[GPR_num];//only user mode will appear in this CPU
-	//! The current process status register.
-	EFLAG cpsr; //spsr will not be used in this CPU
 	//! The current instruction to be executed.
 	T_INSTR cur_instr;
+	//! The predecoded entry of the current instruction.
+	t_decoded *cur;
 	//! The pointer to MMU module.
 	MMU *my_mmu;
 	//! The SWI component.
     swi_semihost swi;
+	//! The guest basic blocks of the block engine.
+    block_cache blocks;
+	//! The translator of the JIT engine.
+    thumb_jit jit;
+	//! The image translated ahead of time.
+    thumb_aot aot;
+	//! The exception a handler called from host code threw, rethrown by run_blocks().
+    std::exception_ptr jit_exc;
+	//! The number of dispatches of the interpreter loops, a superinstruction is one.
+    unsigned long long dispatched;
+	//! The number of superinstructions executed, per t_fuse.
+    unsigned long long fuse_cnt[F_KIND_NUM];
+	//! The number of superinstructions formed by decode(), per t_fuse.
+    int fuse_sites[F_KIND_NUM];
+	//! The number of flag-setting instructions decoded, and how many of them got a handler leaving dead flags alone.
+    int flag_sites, nf_sites;
+	//! The loops recognised as copy, fill or compare idioms, by the address of their closing branch, n is 0 for the branches looked at which close none.
+    std::unordered_map<int, t_idiom> idioms;
+	//! The library routines of the program run on the host.
+    hle_table hle;
 
 	//implement
 public:
@@ -87,9 +191,11 @@ public:
     virtual void fetch();
 	//! Execute current instruction.
     virtual STATUS exec();
+	//! Print the per-block execution counts and the JIT and AOT statistics.
+    virtual void dump_stats(FILE *fp);
 	//! Get register value by its name(future use, not implemented).
     virtual GP_Reg get_reg_by_name(const char *reg_name);
-	//! Get register value by its index(future use, not implemented).
+	//! Get register value by its index.
     virtual GP_Reg get_reg_by_code(int reg_code);
 
     //about MMU
@@ -103,14 +209,26 @@ public:
 	//! Get the MMU pointer(Mode switch use).
     MMU *get_mmu();
 
-	//! Copy another CPU's pointer(Mode switch use).
-    void CopyCPU(CPU *a_cpu);
-	//! Get all kinds of register and MMU pointer.
-    void getRegs(GP_Reg reg[], EFLAG &flags, MMU* &mmu);
+	//! Use the MMU module of the other decoder.
+    void AttachMMU(MMU *mmu);
+
+	//! Translate the Thumb code of the loaded program into the AOT image of its ELF file.
+    void build_aot(const char *elf_path);
 
 	//! Get argument for SWI component.
     void getArg(char *arg, int len);
+	//! Collect the console output of the SWI component in a string.
+    void setConsole(std::string *out){ swi.setConsole(out); hle.setConsole(out); };
+	//! Choose which library routines of the program run on the host, HLE_OFF, HLE_ON or HLE_PRINTF, before the MMU is initialized or attached.
+    void setHLE(int level){ hle.enable(level); };
+
 
+protected:
+    //inherit
+	//! Run instructions with the chosen engine.
+    virtual void run_loop();
+	//! The address of the current instruction.
+    virtual uint32_t cur_address(){ return rPC - 2; };
 
 private:
     //inherit
@@ -118,47 +236,6 @@ private:
     virtual void set_eflag(EFLAG p_eflag);
 	//! Get the value of CPSR.
     virtual EFLAG get_eflag();
-	//EFLAG related
-private://change to private after test
-	//! Get the negative bit value.
-	/*!
-		\return The value of negative bit(1:neg, 0:pos)
-	*/
-    inline int getNeg(){ return (cpsr>>31) & MASK_1BIT; };
-	//! Get the zero bit value
-	/*!
-		\return The value of zero bit(1:reg is zero, 0:not zero)
-	*/
-    inline int getZero(){ return (cpsr>>30) & MASK_1BIT; };
-	//! Get the carry bit value
-	/*!
-		\return The value of carry bit(1:last operation has carry, 0:no carry)
-	*/
-    inline int getCarry(){ return (cpsr>>29) & MASK_1BIT; };
-	//! Get the overflow bit value
-	/*! 
-		\return The value of overflow bit(1:last operation has overflow, 0:no overflow)
-	*/
-    inline int getOverflow(){ return (cpsr>>28) & MASK_1BIT; };
-
-	//! Set negative bit
-    inline void setNeg(){cpsr |= 1<<31;};
-	//! Set Zero bit
-    inline void setZero(){cpsr |= 1<<30;};
-	//! Set Carry bit
-    inline void setCarry(){cpsr |= 1<<29;};
-	//! Set Overflow bit
-    inline void setOverflow(){cpsr |= 1<<28;};
-
-	//! Clear Negative bit
-    inline void clrNeg(){cpsr &= ~(1<<31);};
-	//! Clear Zero bit
-    inline void clrZero(){cpsr &= ~(1<<30);};
-	//! Clear Carry bit
-    inline void clrCarry(){cpsr &= ~(1<<29);};
-	//! Clear Overflow bit
-    inline void clrOverflow(){cpsr &= ~(1<<28);};
-
 	//! Get the number of 1 in a binary number
 	/*!
 		Get the number of 1 in a binary number.
@@ -194,91 +271,123 @@ private://change to private after test
         return num;
     };
 
-	//! Determine the carry of an add operation 
-	/*!
-		It determines the add operation, negate num_b to determine substraction. 
-		\param num_a first operand
-		\param num_b second operand
-		\return The carry result
-	*/
-    inline int CarryFrom(unsigned int num_a, unsigned int num_b)
+	//! Determine whether the condition is the same as CPRS
+    inline int ConditionPassed(unsigned char cond){ syncFlags(); return condPassed(cond, st->cpsr); };
+
+	//! Decode an instruction into its predecoded entry, and pick the handler the interpreter runs
+    void decode(int address, t_decoded &d);
+	//! Pull the operands out of an instruction
+    void decode_fields(int address, t_decoded &d);
+	//! The handlers of every t_class, indexed by the decode table
+    static const t_handler handler_tab[T_CLASS_NUM];
+	//! The handlers of every t_class which leave NZCV alone, for instructions whose flags are dead
+    static const t_handler nf_handler_tab[T_CLASS_NUM];
+	//! Whether the flags an instruction sets are overwritten before anything reads them
+    bool flags_dead(int address, const t_decoded &d);
+	//! Turn an instruction and the one after it into a superinstruction, if they form one
+    void fuse(int address, t_decoded &d);
+	//! Move on to the second instruction of a superinstruction, as fetch() would
+    inline t_decoded *pair_next(const t_decoded &d)
     {
-        if ((unsigned long long)(num_a) + num_b > UINT_MAX)
-            return 1;
-        else
-            return 0;
-    };
+        t_decoded *n = const_cast<t_decoded *>(&d) + 1;
 
-	//! Determine the overflow of an add operation
-	/*!
-		It is used as CarryFrom, negate num_b to determine substraction.
-		\param num_a first operand
-		\param num_b second operand
-		\return The overflow result
-	*/
-    inline int OverflowFrom(int num_a, int num_b)
-    {
-        int c = num_a + num_b;
-        if (num_b == 0x80000000)
-            return 1;
+        if (n->handler == NULL)
+            decode(rPC, *n);
+        cur = n;
+        cur_instr = n->instr;
+        rPC += 2;
+        budget--;
 
-        if ((num_a > 0 && num_b > 0 && c < 0) || (num_a < 0 && num_b <0 && c >0))
-            return 1;
-        else
-            return 0;
+        return n;
     };
-
-	//! Determine whether the condition is the same as CPRS
-    int ConditionPassed(unsigned char cond);
+	//! Run two instructions with one handler
+    template<t_handler first, t_handler second, int kind> void fused(const t_decoded &d);
+	//! The superinstruction cmp or sub Rd, #imm, then a conditional branch, watching the loop it closes if WATCH
+    template<bool WATCH> void sub_imm_br(const t_decoded &d);
+	//! Whether the branch at an address closes a loop of at most IDLE_LOOP_INSTRS which neither stores, calls nor branches out before it
+    bool idle_loop(int address);
+	//! A branch closing such a loop, for the interpreter loops, which watch the loop for running idle
+    void idle_br(const t_decoded &d);
+	//! Find the idiom of the loop the branch at an address closes, NULL if it closes none
+    t_idiom *loop_idiom(int address);
+	//! Recognise the loop the branch at an address closes as a copy, fill or compare idiom
+    bool match_idiom(int address, t_idiom &id);
+	//! Run the loop of an idiom on the host, its branch back was taken
+    void idiom_run(t_idiom &id);
+	//! A branch closing an idiom, for the interpreter loops, which runs the loop on the host
+    void idiom_br(const t_decoded &d);
+	//! Run a library routine on the host, PC is at its entry point
+    bool hle_run(hle_routine &h);
+	//! The entry point of a library routine, for the interpreter loops, which runs the routine on the host
+    void hle_call(const t_decoded &d);
+	//! Print the dead flag sites, and how often superinstructions ran
+    void dump_interp(FILE *fp);
+	//! Print the idioms recognised, and how much of them ran on the host
+    void dump_idioms(FILE *fp);
+
+#ifdef THREADED_DISPATCH
+	//! Run instructions with direct-threaded dispatch
+    void run_threaded();
+#endif
+	//! Run chained basic blocks
+    void run_blocks();
+	//! Find the block starting at an address, build it on the first visit
+    t_block *get_block(int address);
+	//! Run one handler for host code, which exceptions must not pass through
+    static int jit_call(Thumb *cpu, const t_decoded *d);
 
 //instruction exection implement
 private:
     //000
-	//! Add or sub with register or immediate number
-    void add_sub_reg_or_imm(const T_INSTR instruction);
-	//! Shift a number by immediate number
-    void shift_by_imm(const T_INSTR instruction);
+	//! Add or sub with register or immediate number, setting the flags if S
+    template<bool S> void add_sub_reg_or_imm(const t_decoded &d);
+	//! Shift a number by immediate number, setting the flags if S
+    template<bool S> void shift_by_imm(const t_decoded &d);
     //001
-	//! Add, sub, mov, cmp with immediate number
-    void add_sub_mov_cmp_imm(const T_INSTR instruction);
+	//! Add, sub, mov, cmp with immediate number, setting the flags if S
+    template<bool S> void add_sub_mov_cmp_imm(const t_decoded &d);
     //010
 	//! Load or store with register offset
-    void ld_str_reg_offset(const T_INSTR instruction);
+    void ld_str_reg_offset(const t_decoded &d);
 	//! Load from a literal pool
-    void ld_from_pool(const T_INSTR instruction);
+    void ld_from_pool(const t_decoded &d);
 	//! branch or exechange instruction set
-    void br_or_exec_is(const T_INSTR instruction);
+    void br_or_exec_is(const t_decoded &d);
 	//! Special data processing
-    void spec_data_proc(const T_INSTR instruction);
-	//! Data-processing register
-    void data_proc_reg(const T_INSTR instruction);
+    void spec_data_proc(const t_decoded &d);
+	//! Data-processing register, setting the flags if S
+    template<bool S> void data_proc_reg(const t_decoded &d);
     //011
 	//! Load/store word/byte immediate offset
-    void ld_str_word_byte_imm(const T_INSTR instruction);
+    void ld_str_word_byte_imm(const t_decoded &d);
     //100
 	//! Load/store to/from stack
-    void ld_str_stack(const T_INSTR instruction);
+    void ld_str_stack(const t_decoded &d);
 	//! Load/store halfword immediate offset
-    void ld_str_halfw_imm(const T_INSTR instruction);
+    void ld_str_halfw_imm(const t_decoded &d);
     //101
 	//! Miscellaneous instruction
-    void misc(const T_INSTR instruction);
+    void misc(const t_decoded &d);
 	//! Add to SP or PC
-    void add_to_sp_or_pc(const T_INSTR instruction);
+    void add_to_sp_or_pc(const t_decoded &d);
     //110
 	//! Load/store multiple
-    void ld_str_multiple(const T_INSTR instruction);
+    void ld_str_multiple(const t_decoded &d);
 	//! Conditional branch
-    void con_br(const T_INSTR instruction);
+    void con_br(const t_decoded &d);
     //111
 	//! Unconditional branch
-    void uncon_br(const T_INSTR instruction);
+    void uncon_br(const t_decoded &d);
 	//! BLX suffix
-    void blx_suffix(const T_INSTR instruction);
+    void blx_suffix(const t_decoded &d);
 	//! BL/BLX prefix
-    void bl_blx_prefix(const T_INSTR instruction);
+    void bl_blx_prefix(const t_decoded &d);
 	//! BL suffix
-    void bl_suffix(const T_INSTR instruction);
+    void bl_suffix(const t_decoded &d);
+	//! Software interrupt
+    void software_int(const t_decoded &d);
+	//! Undefined instruction
+    void undefined(const t_decoded &d);
 
 };
 
@@ -0,0 +1,506 @@
+/*! \file aeabi.cpp
+	\brief The AEABI run-time helpers run on the host.
+
+	Programs for cores without a divider or a floating point unit call the helpers of the run-time library for integer division and soft-float arithmetic, comparisons and conversions, each of them tens to hundreds of instructions. They run on host integers, float and double, rounding to nearest as the helpers do. A NaN result is the first NaN operand made quiet, or the default NaN if the operands are numbers. Division by zero and conversions of NaN or of values out of range of the integer are left to the guest helpers, whose results for them differ between libraries.
+ */
+#include <string.h>
+#include <math.h>
+#include "hle.h"
+
+/**
+  * The float held in a register.
+  */
+static inline float get_f(GP_Reg v)
+{
+    float f;
+
+    memcpy(&f, &v, 4);
+    return f;
+}
+
+/**
+  * The register holding a float.
+  */
+static inline GP_Reg set_f(float f)
+{
+    GP_Reg v;
+
+    memcpy(&v, &f, 4);
+    return v;
+}
+
+/**
+  * The double held in registers i and i + 1, the low word first.
+  */
+static inline double get_d(const GP_Reg *r, int i)
+{
+    uint64_t bits = (uint32_t)r[i] | (uint64_t)(uint32_t)r[i + 1]<<32;
+    double d;
+
+    memcpy(&d, &bits, 8);
+    return d;
+}
+
+/**
+  * Put a double into registers i and i + 1, the low word first.
+  */
+static inline void set_d(GP_Reg *r, int i, double d)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &d, 8);
+    r[i] = (uint32_t)bits;
+    r[i + 1] = (uint32_t)(bits>>32);
+}
+
+/**
+  * The 64-bit integer held in registers i and i + 1, the low word first.
+  */
+static inline uint64_t get_l(const GP_Reg *r, int i)
+{
+    return (uint32_t)r[i] | (uint64_t)(uint32_t)r[i + 1]<<32;
+}
+
+/**
+  * Put a 64-bit integer into registers i and i + 1, the low word first.
+  */
+static inline void set_l(GP_Reg *r, int i, uint64_t v)
+{
+    r[i] = (uint32_t)v;
+    r[i + 1] = (uint32_t)(v>>32);
+}
+
+/**
+  * A NaN made quiet, its sign and payload kept.
+  */
+static inline float quiet(float f)
+{
+    return get_f(set_f(f) | 0x00400000);
+}
+
+static inline double quiet(double d)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &d, 8);
+    bits |= 0x0008000000000000ULL;
+    memcpy(&d, &bits, 8);
+    return d;
+}
+
+/**
+  * The default NaN, positive and quiet, which the host does not always give.
+  */
+static inline float default_nan(float)
+{
+    return get_f(0x7fc00000);
+}
+
+static inline double default_nan(double)
+{
+    uint64_t bits = 0x7ff8000000000000ULL;
+    double d;
+
+    memcpy(&d, &bits, 8);
+    return d;
+}
+
+/*! \enum aeabi_op
+	\brief The arithmetic of the helpers.
+ */
+enum aeabi_op
+{
+    OP_ADD,
+    OP_SUB,
+    OP_RSUB,
+    OP_MUL,
+    OP_DIV
+};
+
+/*! \enum aeabi_cmp
+	\brief The comparisons of the helpers, each giving 1 if it holds and 0 if not.
+ */
+enum aeabi_cmp
+{
+    CMP_EQ,
+    CMP_LT,
+    CMP_LE,
+    CMP_GE,
+    CMP_GT,
+    CMP_UN
+};
+
+/**
+  * An operation of the helpers, with their NaN results.
+  * @param op The operation
+  * @param a The first operand
+  * @param b The second operand
+  */
+template <typename T>
+static T arith(aeabi_op op, T a, T b)
+{
+    if (isnan(a))
+        return quiet(a);
+    if (isnan(b))
+        return quiet(b);
+
+    T res;
+
+    switch (op)
+    {
+        case OP_ADD:  res = a + b; break;
+        case OP_SUB:  res = a - b; break;
+        case OP_RSUB: res = b - a; break;
+        case OP_MUL:  res = a * b; break;
+        default:      res = a / b; break;
+    }
+    return isnan(res) ? default_nan(res) : res;
+}
+
+/**
+  * A comparison of the helpers, NaN operands are unordered and make any but CMP_UN false.
+  */
+template <typename T>
+static GP_Reg compare(aeabi_cmp op, T a, T b)
+{
+    switch (op)
+    {
+        case CMP_EQ: return a == b;
+        case CMP_LT: return a < b;
+        case CMP_LE: return a <= b;
+        case CMP_GE: return a >= b;
+        case CMP_GT: return a > b;
+        default:     return isnan(a) || isnan(b);
+    }
+}
+
+/**
+  * Convert toward zero to an integer of bits bits.
+  * @param v The value
+  * @param bits The width of the integer
+  * @param sign Whether the integer is signed
+  * @param res Set to the integer, as its bits
+  * @return false if v is NaN or out of range of the integer
+  */
+template <typename T>
+static bool to_int(T v, int bits, bool sign, uint64_t &res)
+{
+    T t = trunc(v);
+    T lo = sign ? -ldexp((T)1, bits - 1) : 0, hi = ldexp((T)1, sign ? bits - 1 : bits);//powers of two, exact in T
+
+    if (!(t >= lo && t < hi))
+        return false;
+
+    res = sign ? (uint64_t)(int64_t)t : (uint64_t)t;
+    return true;
+}
+
+/**
+  * __aeabi_fadd, __aeabi_fsub, __aeabi_frsub, __aeabi_fmul and __aeabi_fdiv, r0 op r1.
+  */
+template <aeabi_op OP>
+static bool aeabi_farith(GP_Reg *r, MMU *, const hle_table &)
+{
+    r[0] = set_f(arith(OP, get_f(r[0]), get_f(r[1])));
+    return true;
+}
+
+/**
+  * __aeabi_dadd, __aeabi_dsub, __aeabi_drsub, __aeabi_dmul and __aeabi_ddiv, r0:r1 op r2:r3.
+  */
+template <aeabi_op OP>
+static bool aeabi_darith(GP_Reg *r, MMU *, const hle_table &)
+{
+    set_d(r, 0, arith(OP, get_d(r, 0), get_d(r, 2)));
+    return true;
+}
+
+/**
+  * __aeabi_fcmpeq, ..., __aeabi_fcmpun, r0 compared with r1.
+  */
+template <aeabi_cmp OP>
+static bool aeabi_fcmp(GP_Reg *r, MMU *, const hle_table &)
+{
+    r[0] = compare(OP, get_f(r[0]), get_f(r[1]));
+    return true;
+}
+
+/**
+  * __aeabi_dcmpeq, ..., __aeabi_dcmpun, r0:r1 compared with r2:r3.
+  */
+template <aeabi_cmp OP>
+static bool aeabi_dcmp(GP_Reg *r, MMU *, const hle_table &)
+{
+    r[0] = compare(OP, get_d(r, 0), get_d(r, 2));
+    return true;
+}
+
+/**
+  * __aeabi_f2iz, __aeabi_f2uiz, __aeabi_f2lz and __aeabi_f2ulz, r0 toward zero to r0, or r0:r1 for 64 bits.
+  */
+template <int BITS, bool SIGN>
+static bool aeabi_f2int(GP_Reg *r, MMU *, const hle_table &)
+{
+    uint64_t res;
+
+    if (!to_int(get_f(r[0]), BITS, SIGN, res))
+        return false;
+
+    if (BITS == 64)
+        set_l(r, 0, res);
+    else
+        r[0] = (uint32_t)res;
+    return true;
+}
+
+/**
+  * __aeabi_d2iz, __aeabi_d2uiz, __aeabi_d2lz and __aeabi_d2ulz, r0:r1 toward zero to r0, or r0:r1 for 64 bits.
+  */
+template <int BITS, bool SIGN>
+static bool aeabi_d2int(GP_Reg *r, MMU *, const hle_table &)
+{
+    uint64_t res;
+
+    if (!to_int(get_d(r, 0), BITS, SIGN, res))
+        return false;
+
+    if (BITS == 64)
+        set_l(r, 0, res);
+    else
+        r[0] = (uint32_t)res;
+    return true;
+}
+
+/**
+  * __aeabi_i2f and __aeabi_ui2f, r0 to the nearest float.
+  */
+template <bool SIGN>
+static bool aeabi_i2f(GP_Reg *r, MMU *, const hle_table &)
+{
+    r[0] = set_f(SIGN ? (float)r[0] : (float)(uint32_t)r[0]);
+    return true;
+}
+
+/**
+  * __aeabi_l2f and __aeabi_ul2f, r0:r1 to the nearest float.
+  */
+template <bool SIGN>
+static bool aeabi_l2f(GP_Reg *r, MMU *, const hle_table &)
+{
+    uint64_t v = get_l(r, 0);
+
+    r[0] = set_f(SIGN ? (float)(int64_t)v : (float)v);
+    return true;
+}
+
+/**
+  * __aeabi_i2d and __aeabi_ui2d, r0 to a double, which is exact.
+  */
+template <bool SIGN>
+static bool aeabi_i2d(GP_Reg *r, MMU *, const hle_table &)
+{
+    set_d(r, 0, SIGN ? (double)r[0] : (double)(uint32_t)r[0]);
+    return true;
+}
+
+/**
+  * __aeabi_l2d and __aeabi_ul2d, r0:r1 to the nearest double.
+  */
+template <bool SIGN>
+static bool aeabi_l2d(GP_Reg *r, MMU *, const hle_table &)
+{
+    uint64_t v = get_l(r, 0);
+
+    set_d(r, 0, SIGN ? (double)(int64_t)v : (double)v);
+    return true;
+}
+
+/**
+  * __aeabi_f2d, r0 to r0:r1, which is exact but for a signaling NaN, made quiet.
+  */
+static bool aeabi_f2d(GP_Reg *r, MMU *, const hle_table &)
+{
+    float f = get_f(r[0]);
+
+    set_d(r, 0, isnan(f) ? quiet((double)f) : (double)f);
+    return true;
+}
+
+/**
+  * __aeabi_d2f, r0:r1 to the nearest float in r0. A NaN keeps its sign and the top of its payload, and is made quiet.
+  */
+static bool aeabi_d2f(GP_Reg *r, MMU *, const hle_table &)
+{
+    double d = get_d(r, 0);
+
+    if (isnan(d))
+    {
+        uint64_t bits = get_l(r, 0);
+
+        r[0] = (uint32_t)(bits>>32 & 0x80000000) | 0x7fc00000 | (uint32_t)(bits>>29 & 0x003fffff);
+        return true;
+    }
+    r[0] = set_f((float)d);
+    return true;
+}
+
+/**
+  * __aeabi_idiv and __aeabi_idivmod, r0 / r1 toward zero to r0, the remainder to r1. INT_MIN / -1 wraps to INT_MIN as the helpers give.
+  */
+static bool aeabi_idivmod(GP_Reg *r, MMU *, const hle_table &)
+{
+    int32_t n = r[0], d = r[1];
+
+    if (d == 0)
+        return false;
+
+    if (d == -1)
+    {
+        r[0] = (int32_t)(0 - (uint32_t)n);
+        r[1] = 0;
+        return true;
+    }
+    r[0] = n / d;
+    r[1] = n % d;
+    return true;
+}
+
+/**
+  * __aeabi_uidiv and __aeabi_uidivmod, r0 / r1 to r0, the remainder to r1.
+  */
+static bool aeabi_uidivmod(GP_Reg *r, MMU *, const hle_table &)
+{
+    uint32_t n = r[0], d = r[1];
+
+    if (d == 0)
+        return false;
+
+    r[0] = n / d;
+    r[1] = n % d;
+    return true;
+}
+
+/**
+  * __modsi3, the remainder of r0 / r1 toward zero to r0.
+  */
+static bool aeabi_imod(GP_Reg *r, MMU *, const hle_table &)
+{
+    int32_t n = r[0], d = r[1];
+
+    if (d == 0)
+        return false;
+
+    r[0] = d == -1 ? 0 : n % d;
+    return true;
+}
+
+/**
+  * __umodsi3, the remainder of r0 / r1 to r0.
+  */
+static bool aeabi_umod(GP_Reg *r, MMU *, const hle_table &)
+{
+    uint32_t n = r[0], d = r[1];
+
+    if (d == 0)
+        return false;
+
+    r[0] = n % d;
+    return true;
+}
+
+/**
+  * __aeabi_ldivmod, r0:r1 / r2:r3 toward zero to r0:r1, the remainder to r2:r3. INT64_MIN / -1 wraps to INT64_MIN.
+  */
+static bool aeabi_ldivmod(GP_Reg *r, MMU *, const hle_table &)
+{
+    int64_t n = get_l(r, 0), d = get_l(r, 2);
+
+    if (d == 0)
+        return false;
+
+    if (d == -1)
+    {
+        set_l(r, 0, 0 - (uint64_t)n);
+        set_l(r, 2, 0);
+        return true;
+    }
+    set_l(r, 0, n / d);
+    set_l(r, 2, n % d);
+    return true;
+}
+
+/**
+  * __aeabi_uldivmod, r0:r1 / r2:r3 to r0:r1, the remainder to r2:r3.
+  */
+static bool aeabi_uldivmod(GP_Reg *r, MMU *, const hle_table &)
+{
+    uint64_t n = get_l(r, 0), d = get_l(r, 2);
+
+    if (d == 0)
+        return false;
+
+    set_l(r, 0, n / d);
+    set_l(r, 2, n % d);
+    return true;
+}
+
+/**
+  * The helpers run on the host, by the name the program links them with. The result registers of a helper returning fewer words than another of the same routine are set all the same, which the callers do not read.
+  */
+const hle_def aeabi_routines[] =
+{
+    {"__aeabi_idiv", aeabi_idivmod},
+    {"__aeabi_idivmod", aeabi_idivmod},
+    {"__divsi3", aeabi_idivmod},
+    {"__modsi3", aeabi_imod},
+    {"__aeabi_uidiv", aeabi_uidivmod},
+    {"__aeabi_uidivmod", aeabi_uidivmod},
+    {"__udivsi3", aeabi_uidivmod},
+    {"__umodsi3", aeabi_umod},
+    {"__aeabi_ldivmod", aeabi_ldivmod},
+    {"__aeabi_uldivmod", aeabi_uldivmod},
+
+    {"__aeabi_fadd", aeabi_farith<OP_ADD>},
+    {"__aeabi_fsub", aeabi_farith<OP_SUB>},
+    {"__aeabi_frsub", aeabi_farith<OP_RSUB>},
+    {"__aeabi_fmul", aeabi_farith<OP_MUL>},
+    {"__aeabi_fdiv", aeabi_farith<OP_DIV>},
+    {"__aeabi_fcmpeq", aeabi_fcmp<CMP_EQ>},
+    {"__aeabi_fcmplt", aeabi_fcmp<CMP_LT>},
+    {"__aeabi_fcmple", aeabi_fcmp<CMP_LE>},
+    {"__aeabi_fcmpge", aeabi_fcmp<CMP_GE>},
+    {"__aeabi_fcmpgt", aeabi_fcmp<CMP_GT>},
+    {"__aeabi_fcmpun", aeabi_fcmp<CMP_UN>},
+    {"__aeabi_f2iz", aeabi_f2int<32, true> },
+    {"__aeabi_f2uiz", aeabi_f2int<32, false> },
+    {"__aeabi_f2lz", aeabi_f2int<64, true> },
+    {"__aeabi_f2ulz", aeabi_f2int<64, false> },
+    {"__aeabi_i2f", aeabi_i2f<true> },
+    {"__aeabi_ui2f", aeabi_i2f<false> },
+    {"__aeabi_l2f", aeabi_l2f<true> },
+    {"__aeabi_ul2f", aeabi_l2f<false> },
+    {"__aeabi_f2d", aeabi_f2d},
+
+    {"__aeabi_dadd", aeabi_darith<OP_ADD>},
+    {"__aeabi_dsub", aeabi_darith<OP_SUB>},
+    {"__aeabi_drsub", aeabi_darith<OP_RSUB>},
+    {"__aeabi_dmul", aeabi_darith<OP_MUL>},
+    {"__aeabi_ddiv", aeabi_darith<OP_DIV>},
+    {"__aeabi_dcmpeq", aeabi_dcmp<CMP_EQ>},
+    {"__aeabi_dcmplt", aeabi_dcmp<CMP_LT>},
+    {"__aeabi_dcmple", aeabi_dcmp<CMP_LE>},
+    {"__aeabi_dcmpge", aeabi_dcmp<CMP_GE>},
+    {"__aeabi_dcmpgt", aeabi_dcmp<CMP_GT>},
+    {"__aeabi_dcmpun", aeabi_dcmp<CMP_UN>},
+    {"__aeabi_d2iz", aeabi_d2int<32, true> },
+    {"__aeabi_d2uiz", aeabi_d2int<32, false> },
+    {"__aeabi_d2lz", aeabi_d2int<64, true> },
+    {"__aeabi_d2ulz", aeabi_d2int<64, false> },
+    {"__aeabi_i2d", aeabi_i2d<true> },
+    {"__aeabi_ui2d", aeabi_i2d<false> },
+    {"__aeabi_l2d", aeabi_l2d<true> },
+    {"__aeabi_ul2d", aeabi_l2d<false> },
+    {"__aeabi_d2f", aeabi_d2f}
+};
+
+const int aeabi_routine_num = sizeof(aeabi_routines) / sizeof(aeabi_routines[0]);
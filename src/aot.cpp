@@ -0,0 +1,822 @@
+/*! \file aot.cpp
+	\brief The ahead-of-time translator for the Thumb code of an ELF image.
+
+	The control flow is recovered from the ways into Thumb code: a Thumb entry point, odd words pointing into the code segment, which are Thumb function pointers, and the Thumb addresses ARM code computes with add Rd, pc, #imm or branches to with BLX. From there the targets of direct branches and BL, and the instruction after a conditional branch, a call or a SWI are followed. Returns, BX and other writes to PC are left to the block engine at run time. Each block becomes a C function in the style of the JIT engine: ALU instructions, moves, constant loads, branches and loads and stores through a per-instruction segment cache are written as C, the others call their handler.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dlfcn.h>
+#include "aot.h"
+#include "Thumb.h"
+#include "error.h"
+
+/**
+  * What the generated file starts with. It repeats the layout of jit_mem_cache, aot_host and aot_entry, and defines the flag updates of the handlers, NZCV being kept in fn, fz, fc and fv.
+  */
+static const char prelude[] =
+"#include <stdint.h>\n"
+"\n"
+"typedef struct { uint32_t VMA, lim; uint8_t *host; int size; _Bool write; } jit_mem_cache;\n"
+"typedef struct { int (*call)(void *, uint32_t); int (*mem_miss)(void *, uint32_t, uint32_t, jit_mem_cache *); uint64_t *budget; } aot_host;\n"
+"typedef struct { uint32_t start, n; int (*fn)(void *, int32_t *, uint32_t *); unsigned long long **count; } aot_entry;\n"
+"\n"
+"static aot_host H;\n"
+"void aot_bind(const aot_host *h){ H = *h; }\n"
+"\n"
+"#define LOAD() (r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4], r5 = r[5], r6 = r[6], r7 = r[7], \\\n"
+"    r8 = r[8], r9 = r[9], r10 = r[10], r11 = r[11], r12 = r[12], r13 = r[13], r14 = r[14], \\\n"
+"    fn = *cpsr>>31, fz = (*cpsr>>30) & 1, fc = (*cpsr>>29) & 1, fv = (*cpsr>>28) & 1)\n"
+"#define FLAGS() (*cpsr = (*cpsr & 0x0fffffff) | fn<<31 | fz<<30 | fc<<29 | fv<<28)\n"
+"#define NZ(d) (fn = (d)>>31, fz = (d) == 0)\n"
+"#define ADDS(d, a, b) do { uint32_t a_ = (a), b_ = (b); d = a_ + b_; NZ(d); fc = d < a_; fv = (~(a_ ^ b_) & (a_ ^ d))>>31; } while (0)\n"
+"#define SUBS(d, a, b) do { uint32_t a_ = (a), b_ = (b); d = a_ - b_; NZ(d); fc = a_ >= b_; fv = ((a_ ^ b_) & (a_ ^ d))>>31; } while (0)\n"
+"#define ADCS(d, a, b) do { uint32_t a_ = (a), b_ = (b); uint64_t s_ = (uint64_t)a_ + b_ + fc; d = (uint32_t)s_; NZ(d); fc = s_>>32; fv = (~(a_ ^ b_) & (a_ ^ d))>>31; } while (0)\n"
+"#define REGS uint32_t r0, r1, r2, r3, r4, r5, r6, r7, r8, r9, r10, r11, r12, r13, r14, fn, fz, fc, fv, t\n"
+"\n"
+"static inline uint32_t lsl_r(uint32_t x, uint32_t s, uint32_t *c)\n"
+"{\n"
+"    s &= 0xff;\n"
+"    if (s == 0) return x;\n"
+"    if (s < 32) { *c = (x>>(32 - s)) & 1; return x<<s; }\n"
+"    *c = s == 32 ? x & 1 : 0;\n"
+"    return 0;\n"
+"}\n"
+"static inline uint32_t lsr_r(uint32_t x, uint32_t s, uint32_t *c)\n"
+"{\n"
+"    s &= 0xff;\n"
+"    if (s == 0) return x;\n"
+"    if (s < 32) { *c = (x>>(s - 1)) & 1; return x>>s; }\n"
+"    *c = s == 32 ? x>>31 : 0;\n"
+"    return 0;\n"
+"}\n"
+"static inline uint32_t asr_r(uint32_t x, uint32_t s, uint32_t *c)\n"
+"{\n"
+"    s &= 0xff;\n"
+"    if (s == 0) return x;\n"
+"    if (s < 32) { *c = (x>>(s - 1)) & 1; return (int32_t)x>>s; }\n"
+"    *c = x>>31;\n"
+"    return (int32_t)x>>31;\n"
+"}\n"
+"static inline uint32_t ror_r(uint32_t x, uint32_t s, uint32_t *c)\n"
+"{\n"
+"    s &= 0xff;\n"
+"    if (s == 0) return x;\n"
+"    if ((s & 31) == 0) { *c = x>>31; return x; }\n"
+"    s &= 31;\n"
+"    *c = (x>>(s - 1)) & 1;\n"
+"    return ((int32_t)x>>s) | (x<<(32 - s));/* the handler shifts the signed register */\n"
+"}\n"
+"\n";
+
+/**
+  * The C conditions of the condition field, on fn, fz, fc and fv.
+  */
+static const char *cond_c[14] =
+{
+    "fz", "!fz", "fc", "!fc", "fn", "!fn", "fv", "!fv",
+    "fc && !fz", "!fc || fz", "fn == fv", "fn != fv", "!fz && fn == fv", "fz || fn != fv"
+};
+
+/*! \struct aot_access
+	\brief How a load or store instruction accesses memory, as jit_access.
+ */
+struct aot_access
+{
+	//! The access size in bytes
+    int size;
+	//! The address bits which must be clear for the generated code, otherwise the handler decides
+    int align;
+	//! Whether it is a load
+    bool load;
+	//! Whether a byte or halfword load is sign extended
+    bool sign;
+};
+
+/**
+  * Describe the memory access of a load or store instruction, the same as the JIT engine does.
+  * @param d The predecoded instruction
+  * @return The access
+  */
+static aot_access mem_access(const t_decoded &d)
+{
+    aot_access a;
+
+    a.sign = false;
+    switch (d.cls)
+    {
+        case T_LD_STR_WORD_BYTE_IMM:
+            a.size = ((d.op>>1) & MASK_1BIT) ? 1 : 4;
+            a.load = d.op & MASK_1BIT;
+            break;
+        case T_LD_STR_HALFW_IMM:
+            a.size = 2;
+            a.load = d.op;
+            break;
+        case T_LD_STR_STACK:
+            a.size = 4;
+            a.load = d.op;
+            break;
+        default://T_LD_STR_REG_OFFSET
+        {
+            static const int size[8] = {4, 2, 1, 1, 4, 2, 1, 2};
+
+            a.size = size[d.op];
+            a.load = d.op >= 3;
+            a.sign = d.op == 3 || d.op == 7;
+            break;
+        }
+    }
+    a.align = a.size - 1;
+    if (d.cls == T_LD_STR_REG_OFFSET && d.op == 2)//the handler wants STRB(2) word aligned
+        a.align = 3;
+
+    return a;
+}
+
+/**
+  * Whether an instruction is written as C, otherwise its handler is called.
+  * @param d The predecoded instruction
+  * @param mmu The MMU, literal pools must be in code segment to be constants
+  * @return true for C
+  */
+static bool is_native(const t_decoded &d, MMU *mmu)
+{
+    switch (d.cls)
+    {
+        case T_ADD_SUB_REG_OR_IMM:
+        case T_SHIFT_BY_IMM:
+        case T_ADD_SUB_MOV_CMP_IMM:
+        case T_DATA_PROC_REG:
+        case T_ADD_TO_SP_OR_PC:
+        case T_CON_BR:
+        case T_UNCON_BR:
+        case T_BL_BLX_PREFIX:
+        case T_BL_SUFFIX:
+        case T_LD_STR_REG_OFFSET:
+        case T_LD_STR_WORD_BYTE_IMM:
+        case T_LD_STR_HALFW_IMM:
+        case T_LD_STR_STACK:
+            return true;
+        case T_LD_FROM_POOL:
+            return (unsigned int)(d.imm - mmu->getTextVMA()) <= (unsigned int)mmu->getTextSz() - 4;
+        case T_SPEC_DATA_PROC:
+            return d.rd != 15 && d.rm != 15;
+        case T_MISC:
+            return d.op == 0 || d.op == 2 || (d.op == 10 && d.imm != 2);
+        default:
+            return false;
+    }
+}
+
+/*! \struct c_writer
+	\brief Write the C code of one block, keeping track of the registers and flags which differ from r[] and CPSR.
+ */
+struct c_writer
+{
+	//! The output file
+    FILE *fp;
+	//! The guest registers written since they were stored, one bit per register
+    int dirty;
+	//! Whether the flags were written since they were stored
+    bool fdirty;
+
+	//! Store the written registers and flags, indented by ind spaces, and forget them unless keep
+    void flush(int ind, bool keep)
+    {
+        for (int g = 0; g < 15; g++)
+            if ((dirty>>g) & 1)
+                fprintf(fp, "%*sr[%d] = r%d;\n", ind, "", g, g);
+        if (fdirty)
+            fprintf(fp, "%*sFLAGS();\n", ind, "");
+        if (!keep)
+        {
+            dirty = 0;
+            fdirty = false;
+        }
+    };
+	//! Leave the block for addr, from code indented by ind spaces
+    void exit_to(int ind, bool keep, uint32_t addr)
+    {
+        flush(ind, keep);
+        fprintf(fp, "%*sr[15] = 0x%08x;\n%*sreturn 0;\n", ind, "", addr, ind, "");
+    };
+	//! Loop back to the head of a block while the budget holds another run of it, otherwise leave to its start. A loop without side effects, or an idiom, also leaves every IDLE_CHECK_PERIOD runs, for run_blocks() to watch it or run it on the host.
+    void loop_back(int ind, bool keep, t_block *blk)
+    {
+        flush(ind, keep);
+        if (blk->idle || blk->idiom != NULL)
+            fprintf(fp, "%*sif ((*k_%08x & %d) != 0 && *H.budget >= %d)\n%*s{\n", ind, "", blk->start, IDLE_CHECK_PERIOD - 1, blk->n, ind, "");
+        else
+            fprintf(fp, "%*sif (*H.budget >= %d)\n%*s{\n", ind, "", blk->n, ind, "");
+        fprintf(fp, "%*s*H.budget -= %d;\n%*s(*k_%08x)++;\n%*sgoto head;\n", ind + 4, "", blk->n, ind + 4, "", blk->start, ind + 4, "");
+        fprintf(fp, "%*s}\n", ind, "");
+        fprintf(fp, "%*sr[15] = 0x%08x;\n%*sreturn 0;\n", ind, "", blk->start, ind, "");
+    };
+};
+
+/**
+  * Nothing loaded.
+  */
+thumb_aot::thumb_aot()
+{
+    lib = NULL;
+    tried = false;
+    entries = NULL;
+    num = 0;
+    attached = 0;
+    blocks = native_instrs = called_instrs = 0;
+}
+
+/**
+  * Unload the image.
+  */
+thumb_aot::~thumb_aot()
+{
+    if (lib != NULL)
+        dlclose(lib);
+}
+
+/**
+  * The 64-bit FNV-1a hash of a file.
+  * @param path The file name
+  * @return The hash, 0 if the file can not be read
+  */
+uint64_t thumb_aot::file_hash(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    uint64_t h = 0xcbf29ce484222325ull;
+    unsigned char buf[4096];
+    size_t len;
+
+    if (fp == NULL)
+        return 0;
+
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+        for (size_t i = 0; i < len; i++)
+        {
+            h ^= buf[i];
+            h *= 0x100000001b3ull;
+        }
+
+    fclose(fp);
+    return h;
+}
+
+/**
+  * Write a block as a C function named after its address. Registers live in local variables, they are stored to r[] with the flags before a handler runs and when the function returns, and loaded again after a handler ran.
+  * @param fp The output file
+  * @param cpu The core the block was built by
+  * @param blk The block
+  */
+void thumb_aot::emit_block(FILE *fp, Thumb *cpu, t_block *blk)
+{
+    MMU *mmu = cpu->my_mmu;
+    int n = blk->n;
+    bool loops = false;
+    c_writer w;
+
+    w.fp = fp;
+    w.dirty = 0;
+    w.fdirty = false;
+
+    for (int i = 0; i < n; i++)
+    {
+        const t_decoded &d = blk->first[i];
+
+        if ((d.cls == T_CON_BR || d.cls == T_UNCON_BR) && d.imm == blk->start)
+            loops = true;
+        if (d.cls == T_LD_STR_REG_OFFSET || d.cls == T_LD_STR_WORD_BYTE_IMM || d.cls == T_LD_STR_HALFW_IMM || d.cls == T_LD_STR_STACK)
+        {
+            aot_access a = mem_access(d);
+            fprintf(fp, "static jit_mem_cache c_%08x_%d = { 0, 0, 0, %d, %d };\n", blk->start, i, a.size, a.load ? 0 : 1);
+        }
+    }
+    if (loops)
+        fprintf(fp, "static unsigned long long *k_%08x;\n", blk->start);
+
+    fprintf(fp, "int b_%08x(void *cpu, int32_t *r, uint32_t *cpsr)\n{\n    REGS;\n\n    LOAD();\n", blk->start);
+    if (loops)
+        fprintf(fp, "head:\n");
+
+    bool ended = false;
+
+    for (int i = 0; i < n; i++)
+    {
+        const t_decoded &d = blk->first[i];
+        int address = blk->start + i * 2;
+        uint32_t next = address + 2;
+        bool last = (i == n - 1);
+
+        fprintf(fp, "    //%08x: %04x\n", address, d.instr);
+
+        if (!is_native(d, mmu))
+        {
+            //the handler, with r[] and PC as the interpreter leaves them
+            w.flush(4, false);
+            fprintf(fp, "    r[15] = 0x%08x;\n    if (H.call(cpu, 0x%08x))\n        return 1;\n", next, address);
+            if (last)
+            {
+                fprintf(fp, "    return 0;\n");
+                ended = true;
+            }
+            else
+                fprintf(fp, "    LOAD();\n");
+            called_instrs++;
+            continue;
+        }
+
+        native_instrs++;
+        switch (d.cls)
+        {
+            case T_LD_STR_REG_OFFSET:
+            case T_LD_STR_WORD_BYTE_IMM:
+            case T_LD_STR_HALFW_IMM:
+            case T_LD_STR_STACK:
+            {
+                aot_access a = mem_access(d);
+                char c[24];//blocks may overlap, a cache belongs to a block
+                static const char *type[2][5] = {{"", "uint8_t", "uint16_t", "", "uint32_t"}, {"", "int8_t", "int16_t", "", "int32_t"}};
+
+                if (d.cls == T_LD_STR_STACK)
+                    fprintf(fp, "    t = r13 + %d;\n", d.imm);
+                else if (d.cls == T_LD_STR_REG_OFFSET)
+                    fprintf(fp, "    t = r%d + r%d;\n", d.rn, d.rm);
+                else
+                    fprintf(fp, "    t = r%d + %d;\n", d.rn, d.imm);
+
+                snprintf(c, sizeof(c), "c_%08x_%d", blk->start, i);
+                fprintf(fp, "    if (t - %s.VMA < %s.lim && (t & %d) == 0)\n", c, c, a.align);
+                if (a.load)
+                {
+                    fprintf(fp, "        r%d = (int32_t)*(%s *)(%s.host + (t - %s.VMA));\n", d.rd, type[a.sign][a.size], c, c);
+                    w.dirty |= 1<<d.rd;
+                }
+                else
+                    fprintf(fp, "        *(%s *)(%s.host + (t - %s.VMA)) = r%d;\n", type[0][a.size], c, c, d.rd);
+
+                //the handler, which also refreshes the cache
+                fprintf(fp, "    else\n    {\n");
+                w.flush(8, true);
+                fprintf(fp, "        r[15] = 0x%08x;\n        if (H.mem_miss(cpu, 0x%08x, t, &%s))\n            return 1;\n        LOAD();\n    }\n",
+                        next, address, c);
+                break;
+            }
+            case T_ADD_SUB_REG_OR_IMM:
+                if ((d.op>>1) & MASK_1BIT)
+                    fprintf(fp, "    %s(r%d, r%d, %d);\n", (d.op & 1) ? "SUBS" : "ADDS", d.rd, d.rn, d.imm);
+                else
+                    fprintf(fp, "    %s(r%d, r%d, r%d);\n", (d.op & 1) ? "SUBS" : "ADDS", d.rd, d.rn, d.rm);
+                w.dirty |= 1<<d.rd;
+                w.fdirty = true;
+                break;
+            case T_SHIFT_BY_IMM:
+                if (d.op == 0 && d.imm == 0)
+                    fprintf(fp, "    r%d = r%d;\n", d.rd, d.rm);
+                else if (d.op == 0)
+                    fprintf(fp, "    fc = (r%d>>%d) & 1;\n    r%d = r%d<<%d;\n", d.rm, 32 - d.imm, d.rd, d.rm, d.imm);
+                else if (d.imm == 0)//shift by 32
+                    fprintf(fp, "    fc = r%d>>31;\n    r%d = %s;\n", d.rm, d.rd, d.op == 1 ? "0" : "(int32_t)fc * -1");
+                else
+                    fprintf(fp, "    fc = (r%d>>%d) & 1;\n    r%d = %sr%d>>%d;\n", d.rm, d.imm - 1, d.rd, d.op == 1 ? "" : "(int32_t)", d.rm, d.imm);
+                fprintf(fp, "    NZ(r%d);\n", d.rd);
+                w.dirty |= 1<<d.rd;
+                w.fdirty = true;
+                break;
+            case T_ADD_SUB_MOV_CMP_IMM:
+                switch (d.op)
+                {
+                    case 0: fprintf(fp, "    r%d = %d;\n    NZ(r%d);\n", d.rd, d.imm, d.rd); break;
+                    case 1: fprintf(fp, "    SUBS(t, r%d, %d);\n", d.rd, d.imm); break;
+                    case 2: fprintf(fp, "    ADDS(r%d, r%d, %d);\n", d.rd, d.rd, d.imm); break;
+                    case 3: fprintf(fp, "    SUBS(r%d, r%d, %d);\n", d.rd, d.rd, d.imm); break;
+                }
+                if (d.op != 1)
+                    w.dirty |= 1<<d.rd;
+                w.fdirty = true;
+                break;
+            case T_LD_FROM_POOL://code segment is never written
+                fprintf(fp, "    r%d = 0x%08xu;\n", d.rd, mmu->get_word(d.imm));
+                w.dirty |= 1<<d.rd;
+                break;
+            case T_SPEC_DATA_PROC:
+                if (d.op == 1)
+                {
+                    fprintf(fp, "    SUBS(t, r%d, r%d);\n", d.rd, d.rm);
+                    w.fdirty = true;
+                    break;
+                }
+                if (d.op == 0)
+                    fprintf(fp, "    r%d = r%d + r%d;\n", d.rd, d.rd, d.rm);
+                else
+                    fprintf(fp, "    r%d = r%d;\n", d.rd, d.rm);
+                w.dirty |= 1<<d.rd;
+                break;
+            case T_DATA_PROC_REG:
+            {
+                static const char *shift[8] = {"", "", "lsl_r", "lsr_r", "asr_r", "", "", "ror_r"};
+                int Rd = d.rd, Rs = d.rm;
+
+                switch (d.op)
+                {
+                    case 0: fprintf(fp, "    r%d &= r%d;\n", Rd, Rs); break;
+                    case 1: fprintf(fp, "    r%d ^= r%d;\n", Rd, Rs); break;
+                    case 12: fprintf(fp, "    r%d |= r%d;\n", Rd, Rs); break;
+                    case 14: fprintf(fp, "    r%d &= ~r%d;\n", Rd, Rs); break;
+                    case 13: fprintf(fp, "    r%d *= r%d;\n", Rd, Rs); break;
+                    case 15: fprintf(fp, "    r%d = ~r%d;\n", Rd, Rs); break;
+                    case 2:case 3:case 4:case 7:
+                        fprintf(fp, "    r%d = %s(r%d, r%d, &fc);\n", Rd, shift[d.op], Rd, Rs);
+                        break;
+                    case 5: fprintf(fp, "    ADCS(r%d, r%d, r%d);\n", Rd, Rd, Rs); break;
+                    case 6: fprintf(fp, "    ADCS(r%d, r%d, ~r%d);\n", Rd, Rd, Rs); break;
+                    case 9: fprintf(fp, "    SUBS(r%d, 0, r%d);\n", Rd, Rs); break;
+                    case 8: fprintf(fp, "    t = r%d & r%d;\n    NZ(t);\n", Rd, Rs); break;
+                    case 10: fprintf(fp, "    SUBS(t, r%d, r%d);\n", Rd, Rs); break;
+                    case 11: fprintf(fp, "    ADDS(t, r%d, r%d);\n", Rd, Rs); break;
+                }
+                switch (d.op)//the ones which leave the flags to NZ()
+                {
+                    case 0:case 1:case 2:case 3:case 4:case 7:case 12:case 13:case 14:case 15:
+                        fprintf(fp, "    NZ(r%d);\n", Rd);
+                        break;
+                    default:
+                        break;
+                }
+                if (d.op != 8 && d.op != 10 && d.op != 11)
+                    w.dirty |= 1<<Rd;
+                w.fdirty = true;
+                break;
+            }
+            case T_MISC:
+                if (d.op == 0)
+                {
+                    fprintf(fp, "    r13 += %d;\n", d.imm);
+                    w.dirty |= 1<<13;
+                    break;
+                }
+                if (d.op == 2)
+                {
+                    static const char *ext[4] = {"(int32_t)(int16_t)r%d", "(int32_t)(int8_t)r%d", "r%d & 0xffff", "r%d & 0xff"};//sxth, sxtb, uxth, uxtb
+
+                    fprintf(fp, "    r%d = ", d.rd);
+                    fprintf(fp, ext[d.imm], d.rm);
+                    fprintf(fp, ";\n");
+                }
+                else if (d.imm == 0)//rev
+                    fprintf(fp, "    r%d = __builtin_bswap32(r%d);\n", d.rd, d.rn);
+                else if (d.imm == 1)//rev16
+                    fprintf(fp, "    r%d = ((r%d & 0x00ff00ff)<<8) | ((r%d>>8) & 0x00ff00ff);\n", d.rd, d.rn, d.rn);
+                else//revsh
+                    fprintf(fp, "    r%d = (int32_t)(int16_t)(((r%d & 0xff)<<8) | ((r%d>>8) & 0xff));\n", d.rd, d.rn, d.rn);
+                w.dirty |= 1<<d.rd;
+                break;
+            case T_ADD_TO_SP_OR_PC:
+                if (d.op == 0)
+                    fprintf(fp, "    r%d = 0x%08xu;\n", d.rd, d.imm);
+                else
+                    fprintf(fp, "    r%d = r13 + %d;\n", d.rd, d.imm);
+                w.dirty |= 1<<d.rd;
+                break;
+            case T_BL_BLX_PREFIX:
+                fprintf(fp, "    r14 = 0x%08xu;\n", d.imm);
+                w.dirty |= 1<<14;
+                break;
+            case T_BL_SUFFIX:
+                fprintf(fp, "    t = r14 + %d;\n    r14 = 0x%08xu;\n", d.imm, next | 1);
+                w.dirty |= 1<<14;
+                w.flush(4, false);
+                fprintf(fp, "    r[15] = t;\n    return 0;\n");
+                ended = true;
+                break;
+            case T_UNCON_BR:
+                if (d.imm == blk->start)
+                    w.loop_back(4, false, blk);
+                else
+                    w.exit_to(4, false, d.imm);
+                ended = true;
+                break;
+            case T_CON_BR:
+                fprintf(fp, "    if (%s)\n    {\n", cond_c[d.op]);
+                if (d.imm == blk->start)
+                    w.loop_back(8, true, blk);
+                else
+                    w.exit_to(8, true, d.imm);
+                fprintf(fp, "    }\n");
+                w.exit_to(4, false, next);
+                ended = true;
+                break;
+        }
+    }
+
+    if (!ended)
+        w.exit_to(4, false, blk->start + n * 2);
+
+    fprintf(fp, "}\n\n");
+    blocks++;
+}
+
+/**
+  * Add a block start found by the control flow recovery, if it is in code segment and new.
+  */
+static void add_target(std::vector<int> &work, std::vector<bool> &seen, MMU *mmu, uint32_t address)
+{
+    uint32_t off = address - mmu->getTextVMA();
+
+    if ((address & 1) != 0 || off >= (uint32_t)mmu->getTextSz() || seen[off>>1])
+        return;
+
+    seen[off>>1] = true;
+    work.push_back(address);
+}
+
+/**
+  * Order blocks by address.
+  */
+static bool block_before(const t_block *a, const t_block *b)
+{
+    return a->start < b->start;
+}
+
+/**
+  * A path as one word of the shell, in single quotes, a quote in it closed, escaped and opened again.
+  */
+static std::string shell_quote(const std::string &path)
+{
+    std::string q = "'";
+
+    for (size_t i = 0; i < path.size(); i++)
+        if (path[i] == '\'')
+            q += "'\\''";
+        else
+            q += path[i];
+    return q + "'";
+}
+
+/**
+  * Find the Thumb blocks reachable from the entry point, function pointers and ARM code, write them as C next to the ELF file, and compile it with the host compiler ($CC, or cc) into the image, the ELF file name with AOT_SUFFIX appended.
+  * @param cpu The core, its program loaded
+  * @param elf_path The ELF file
+  * @exception Error If the C file can not be written or compiled
+  */
+void thumb_aot::build(Thumb *cpu, const char *elf_path)
+{
+    MMU *mmu = cpu->my_mmu;
+    std::vector<int> work;
+    std::vector<bool> seen(mmu->getTextSz()/2 + 1, false);
+    std::vector<t_block *> found;
+    uint32_t text_VMA = mmu->getTextVMA(), text_end = text_VMA + mmu->getTextSz();
+
+    if (!cpu->blocks.ready())
+        cpu->blocks.init(mmu->getTextVMA(), mmu->getTextSz());
+
+    if (cpu->st->cpsr & CPSR_T)
+        add_target(work, seen, mmu, cpu->rPC);
+
+    //the ways into Thumb code from elsewhere: function pointers, and ARM code switching to Thumb status
+    for (uint32_t address = text_VMA; address + 4 <= text_end; address += 4)
+    {
+        uint32_t w = mmu->get_word(address);
+
+        if ((w & 1) != 0)//a Thumb address, in a literal pool or a table
+            add_target(work, seen, mmu, w & ~1u);
+        if ((w & 0x0fff0000) == 0x028f0000)//add Rd, pc, #imm, as before bx Rd
+        {
+            int rot = (w>>7) & 0x1e;
+            uint32_t imm = w & 0xff;
+            uint32_t value = address + 8 + ((imm>>rot) | (imm<<((32 - rot) & 31)));
+
+            if (value & 1)
+                add_target(work, seen, mmu, value & ~1u);
+        }
+        if ((w & 0xfe000000) == 0xfa000000)//blx label
+            add_target(work, seen, mmu, address + 8 + ((int32_t)(w<<8)>>6) + ((w>>23) & 2));
+    }
+
+    while (!work.empty())
+    {
+        t_block *blk = cpu->get_block(work.back());
+        work.pop_back();
+        found.push_back(blk);
+
+        const t_decoded &last = blk->first[blk->n - 1];
+        uint32_t end = blk->start + blk->n * 2;
+
+        if (!ends_block(last))//too long, or at the end of code segment
+        {
+            add_target(work, seen, mmu, end);
+            continue;
+        }
+
+        switch (last.cls)
+        {
+            case T_CON_BR:
+                add_target(work, seen, mmu, last.imm);
+                add_target(work, seen, mmu, end);
+                break;
+            case T_UNCON_BR:
+                add_target(work, seen, mmu, last.imm);
+                break;
+            case T_BL_SUFFIX://the callee, and where it returns to
+                if (blk->n >= 2 && blk->first[blk->n - 2].cls == T_BL_BLX_PREFIX)
+                    add_target(work, seen, mmu, blk->first[blk->n - 2].imm + last.imm);
+                add_target(work, seen, mmu, end);
+                break;
+            case T_BR_OR_EXEC_IS://blx returns, bx does not
+                if (last.op == 1)
+                    add_target(work, seen, mmu, end);
+                break;
+            case T_BLX_SUFFIX:
+            case T_SOFTWARE_INT:
+                add_target(work, seen, mmu, end);
+                break;
+            case T_SPEC_DATA_PROC://only reads PC
+                if (last.rd != 15)
+                    add_target(work, seen, mmu, end);
+                break;
+            case T_MISC://breakpoint
+                if (last.op == 14)
+                    add_target(work, seen, mmu, end);
+                break;
+            default://pop {pc}, writes to PC, undefined
+                break;
+        }
+    }
+
+    std::sort(found.begin(), found.end(), block_before);
+
+    std::string c_path = std::string(elf_path) + ".aot.c";
+    std::string so_path = std::string(elf_path) + AOT_SUFFIX;
+    FILE *fp = fopen(c_path.c_str(), "w");
+
+    if (fp == NULL)
+    {
+        Error e;
+        e.error_name = "Can not write " + c_path;
+        throw e;
+    }
+
+    fprintf(fp, "/* The Thumb code of %s, translated ahead of time. */\n", elf_path);
+    fputs(prelude, fp);
+    fprintf(fp, "const int aot_version = %d;\n", AOT_VERSION);
+    fprintf(fp, "const unsigned long long aot_elf_hash = 0x%016llxull;\n\n", (unsigned long long)file_hash(elf_path));
+
+    for (size_t i = 0; i < found.size(); i++)
+        emit_block(fp, cpu, found[i]);
+
+    fprintf(fp, "aot_entry aot_entries[] =\n{\n");
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        t_block *blk = found[i];
+        bool loops = false;
+
+        for (int k = 0; k < blk->n; k++)
+            if ((blk->first[k].cls == T_CON_BR || blk->first[k].cls == T_UNCON_BR) && blk->first[k].imm == blk->start)
+                loops = true;
+
+        fprintf(fp, "    { 0x%08x, %d, b_%08x, ", blk->start, blk->n, blk->start);
+        if (loops)
+            fprintf(fp, "&k_%08x },\n", blk->start);
+        else
+            fprintf(fp, "0 },\n");
+    }
+    fprintf(fp, "    { 0, 0, 0, 0 }\n};\n");
+    fprintf(fp, "const int aot_num_entries = %d;\n", (int)found.size());
+    fclose(fp);
+
+    const char *cc = getenv("CC");
+    std::string cmd = std::string(cc ? cc : "cc") + " -O2 -fPIC -shared -fno-strict-aliasing -w -o " + shell_quote(so_path) + " " + shell_quote(c_path);
+
+    if (system(cmd.c_str()) != 0)
+    {
+        Error e;
+        e.error_name = "Can not compile " + c_path;
+        throw e;
+    }
+}
+
+/**
+  * Open the image of an ELF file, and check that it was built from this file by the same version of the translator. Nothing is loaded otherwise, and the blocks run as with the JIT engine.
+  * @param cpu The core, the image calls it
+  * @param elf_path The ELF file
+  * @return Whether the image is used
+  */
+bool thumb_aot::load(Thumb *cpu, const char *elf_path)
+{
+    std::string so_path = std::string(elf_path) + AOT_SUFFIX;
+
+    tried = true;
+    if (strchr(so_path.c_str(), '/') == NULL)//not searched in the library path
+        so_path = "./" + so_path;
+
+    lib = dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL)
+    {
+        fprintf(stderr, "AOT: %s\n", dlerror());
+        return false;
+    }
+
+    const int *version = (const int *)dlsym(lib, "aot_version");
+    const unsigned long long *hash = (const unsigned long long *)dlsym(lib, "aot_elf_hash");
+    const int *count = (const int *)dlsym(lib, "aot_num_entries");
+    void (*bind)(const aot_host *) = (void (*)(const aot_host *))dlsym(lib, "aot_bind");
+
+    entries = (aot_entry *)dlsym(lib, "aot_entries");
+    if (version == NULL || hash == NULL || count == NULL || bind == NULL || entries == NULL
+     || *version != AOT_VERSION || *hash != file_hash(elf_path))
+    {
+        fprintf(stderr, "AOT: %s was not built from %s, not used\n", so_path.c_str(), elf_path);
+        dlclose(lib);
+        lib = NULL;
+        entries = NULL;
+        return false;
+    }
+
+    num = *count;
+    host.call = call;
+    host.mem_miss = mem_miss;
+    host.budget = &cpu->budget;
+    bind(&host);
+
+    return true;
+}
+
+/**
+  * Find a block in the image by its start, the number of instructions must match. A block looping to itself is given its execution count.
+  * @param blk The block just built by the block engine
+  * @return The host code, NULL if the image does not have the block
+  */
+jit_fn thumb_aot::lookup(t_block *blk)
+{
+    int lo = 0, hi = num;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (entries[mid].start < (uint32_t)blk->start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == num || entries[lo].start != (uint32_t)blk->start || entries[lo].n != (uint32_t)blk->n)
+        return NULL;
+
+    if (entries[lo].count != NULL)
+        *entries[lo].count = &blk->exec_cnt;
+    attached++;
+
+    return entries[lo].fn;
+}
+
+/**
+  * Run the handler of an instruction, see Thumb::jit_call().
+  * @param cpu The core
+  * @param address The address of the instruction, its block was built so it is decoded
+  * @return 0, or 1 if the handler threw
+  */
+int thumb_aot::call(Thumb *cpu, uint32_t address)
+{
+    return Thumb::jit_call(cpu, cpu->my_mmu->getThumbDecoded(address));
+}
+
+/**
+  * Run the handler of a load or store whose address missed the cache, or was not aligned. If the handler succeeds, the cache is pointed at the segment of the address.
+  * @param cpu The core
+  * @param address The address of the instruction
+  * @param mem_address The address of the access
+  * @param c The cache of the instruction
+  * @return 0, or 1 if the handler threw
+  */
+int thumb_aot::mem_miss(Thumb *cpu, uint32_t address, uint32_t mem_address, jit_mem_cache *c)
+{
+    if (call(cpu, address) != 0)
+        return 1;
+
+    int VMA, size;
+    BYTE *host = cpu->my_mmu->host_range(mem_address, c->write, VMA, size);
+
+    if (host != NULL && size >= c->size)
+    {
+        c->VMA = VMA;
+        c->lim = size - c->size + 1;
+        c->host = host;
+    }
+
+    return 0;
+}
+
+/**
+  * Print what was translated, or how much of the image runs.
+  * @param fp The output file
+  */
+void thumb_aot::dump(FILE *fp)
+{
+    if (blocks > 0)
+        fprintf(fp, "AOT: %d blocks translated, %d instructions to C, %d to handler calls\n", blocks, native_instrs, called_instrs);
+    if (lib != NULL)
+        fprintf(fp, "AOT: image of %d blocks, %d of them run\n", num, attached);
+}
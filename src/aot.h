@@ -0,0 +1,111 @@
+/*! \file aot.h
+	\brief The ahead-of-time translator for the Thumb code of an ELF image.
+
+	Offline, the Thumb code reachable from the entry point is cut into the blocks of the block engine and written out as C, one function per block, which the host compiler builds into a shared object. At run time the object is loaded when it was built from the same ELF file, and its functions run their blocks from the first execution on. Blocks it does not have, the targets of indirect branches it could not resolve, go to the JIT engine.
+ */
+#ifndef __AOT_H__
+#define __AOT_H__
+
+/*!
+	\addtogroup instruction
+ */
+/*@{*/
+
+#include <stdio.h>
+#include "arch.h"
+#include "block.h"
+#include "jit.h"
+
+/*! \def AOT_VERSION
+	\brief The interface between the emulator and a translated image, an image of another version is not loaded
+ */
+#define AOT_VERSION     3
+
+/*! \def AOT_SUFFIX
+	\brief The translated image of an ELF file is the file name with this appended
+ */
+#define AOT_SUFFIX      ".aot.so"
+
+class Thumb;
+
+/*! \struct aot_entry
+	\brief A block of a translated image, the image has them sorted by start.
+ */
+struct aot_entry
+{
+	//! The virtual address of the first instruction
+    uint32_t start;
+	//! The number of instructions
+    uint32_t n;
+	//! The host code
+    jit_fn fn;
+	//! Where the image keeps a pointer to the execution count of a block looping to itself, NULL for the others
+    unsigned long long **count;
+};
+
+/*! \struct aot_host
+	\brief What the emulator gives a translated image when it is loaded.
+ */
+struct aot_host
+{
+	//! Run the handler of the instruction at an address, 0, or 1 if it threw
+    int (*call)(Thumb *cpu, uint32_t address);
+	//! Run the handler of a load or store which missed its cache, and refresh the cache, 0, or 1 if it threw
+    int (*mem_miss)(Thumb *cpu, uint32_t address, uint32_t mem_address, jit_mem_cache *c);
+	//! The instruction budget, for blocks looping to themselves
+    uint64_t *budget;
+};
+
+/*! \class thumb_aot
+	\brief Build and load translated images.
+
+	The generated functions follow jit_fn, so the block engine runs them like translated blocks of the JIT engine: CPSR holds the flags when they are called, the registers and flags are in r[] and CPSR whenever a handler runs or the function returns.
+ */
+class thumb_aot
+{
+public:
+	//! A constructor
+    thumb_aot();
+	//! A destructor
+    ~thumb_aot();
+
+private:
+	//! The image, NULL if none is loaded
+    void *lib;
+	//! Whether loading was tried already
+    bool tried;
+	//! The blocks of the image
+    aot_entry *entries;
+	//! The number of entries
+    int num;
+	//! What the image calls
+    aot_host host;
+	//! The number of blocks running image code
+    int attached;
+	//! The number of blocks, and of their instructions, translated or called
+    int blocks, native_instrs, called_instrs;
+
+	//! The hash of a file, 0 if it can not be read
+    static uint64_t file_hash(const char *path);
+	//! Write the C function of a block
+    void emit_block(FILE *fp, Thumb *cpu, t_block *blk);
+	//! Run the handler of an instruction for image code
+    static int call(Thumb *cpu, uint32_t address);
+	//! Run the handler of a load or store which missed its cache for image code
+    static int mem_miss(Thumb *cpu, uint32_t address, uint32_t mem_address, jit_mem_cache *c);
+
+public:
+	//! Translate the Thumb code of an ELF file into its image
+    void build(Thumb *cpu, const char *elf_path);
+	//! Load the image of an ELF file, if it was built from this one
+    bool load(Thumb *cpu, const char *elf_path);
+	//! Whether load() was called
+    bool loaded(){ return tried; };
+	//! Give out the host code of a block from the image, NULL if the image does not have it
+    jit_fn lookup(t_block *blk);
+	//! Print what was translated or attached
+    void dump(FILE *fp);
+};
+
+/*@}*/
+#endif // __AOT_H__
@@ -0,0 +1,345 @@
+/*! \file block.cpp
+	\brief The Thumb block engine.
+
+	Blocks are built from the predecoded entries in MMU, run as one unit, and chained to the blocks they branch to.
+ */
+#include <stdlib.h>
+#include "block.h"
+#include "Thumb.h"
+#include "error.h"
+
+extern char file_name[100];
+
+/**
+  * Nothing allocated until init().
+  */
+block_cache::block_cache()
+{
+    map = NULL;
+    text_VMA = 0;
+    text_sz = 0;
+}
+
+/**
+  * Delete every block and the directory.
+  */
+block_cache::~block_cache()
+{
+    if (map == NULL)
+        return;
+
+    for (int i = 0; i < text_sz/2 + 1; i++)
+        if (map[i] != NULL)
+            delete map[i];
+
+    delete []map;
+}
+
+/**
+  * Allocate one empty slot for every halfword of the code segment.
+  * @param VMA The virtual address of code segment
+  * @param size The size of code segment
+  * @exception Error For no memory space
+  */
+void block_cache::init(int VMA, int size)
+{
+    text_VMA = VMA;
+    text_sz = size;
+
+    map = NULL;
+    map = new t_block *[text_sz/2 + 1]();
+    if (!map)
+    {
+        Error e;
+        e.error_name = "No mem space for basic blocks!";
+        throw e;
+    }
+}
+
+/**
+  * Record a block at its starting address.
+  * @param blk The new block
+  */
+void block_cache::insert(t_block *blk)
+{
+    map[(unsigned int)(blk->start - text_VMA)>>1] = blk;
+}
+
+/**
+  * Order blocks by execution count, the hottest first.
+  */
+static int cmp_exec_cnt(const void *a, const void *b)
+{
+    unsigned long long ca = (*(t_block * const *)a)->exec_cnt;
+    unsigned long long cb = (*(t_block * const *)b)->exec_cnt;
+
+    if (ca == cb)
+        return 0;
+    return (ca > cb) ? -1 : 1;
+}
+
+/**
+  * Print every executed block with its execution count, the hottest first.
+  * @param fp The output file
+  */
+void block_cache::dump(FILE *fp)
+{
+    if (map == NULL)
+        return;
+
+    int num = 0;
+    t_block **list = new t_block *[text_sz/2 + 1];
+    unsigned long long execs = 0, instrs = 0;
+
+    for (int i = 0; i < text_sz/2 + 1; i++)
+        if (map[i] != NULL && map[i]->exec_cnt > 0)
+        {
+            list[num++] = map[i];
+            execs += map[i]->exec_cnt;
+            instrs += map[i]->exec_cnt * map[i]->n;
+        }
+
+    qsort(list, num, sizeof(t_block *), cmp_exec_cnt);
+
+    fprintf(fp, "Block profile: %d blocks, %llu block executions, %llu instructions\n", num, execs, instrs);
+    fprintf(fp, "%10s %10s %6s %14s\n", "start", "end", "instrs", "execs");
+    for (int i = 0; i < num; i++)
+        fprintf(fp, "0x%08x 0x%08x %6d %14llu\n", list[i]->start, list[i]->start + list[i]->n * 2, list[i]->n, list[i]->exec_cnt);
+
+    delete []list;
+}
+
+/**
+  * Whether an instruction must be the last one of a block. These are the instructions which read or write PC, or which stop the program on purpose, all of them expect PC to be set as fetch() leaves it.
+  * @param d The predecoded instruction
+  * @return true if the block ends at this instruction
+  */
+bool ends_block(const t_decoded &d)
+{
+    switch (d.cls)
+    {
+        case T_SPEC_DATA_PROC://mov pc, add pc, or reads pc
+            return d.rd == 15 || d.rm == 15;
+        case T_MISC:
+            switch (d.op)
+            {
+                case 0:case 2:case 4:case 5:case 12://adjust sp, extend, push, pop without pc
+                    return false;
+                case 10://reverse bytes, opcode 2 is undefined
+                    return d.imm == 2;
+                default://pop {pc}, and the ones which throw
+                    return true;
+            }
+        case T_BR_OR_EXEC_IS:
+        case T_CON_BR:
+        case T_UNDEFINED:
+        case T_SOFTWARE_INT:
+        case T_UNCON_BR:
+        case T_BLX_SUFFIX:
+        case T_UNDEFINED_BLX:
+        case T_BL_SUFFIX:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+  * Give out the block starting at an address. On the first visit the block is built: instructions are decoded from the address on, until one of them ends the block, BLOCK_MAX_INSTR is reached, or the code segment ends.
+  * @param address The virtual address of the first instruction
+  * @return The block
+  * @exception Error For addresses out of code segment
+  */
+t_block *Thumb::get_block(int address)
+{
+    t_decoded *first = my_mmu->getThumbDecoded(address);//reports addresses out of code segment
+    t_block *blk = blocks.lookup(address);
+
+    if (blk != NULL)
+        return blk;
+
+    unsigned int text_end = my_mmu->getTextVMA() + my_mmu->getTextSz();
+    int n = 0;
+
+    for (unsigned int addr = address; n < BLOCK_MAX_INSTR && addr < text_end; addr += 2)
+    {
+        t_decoded *d = first + n;
+
+        if (d->handler == NULL)
+            decode(addr, *d);
+        n++;
+
+        if (ends_block(*d))
+            break;
+    }
+
+    blk = new t_block;
+    blk->start = address;
+    blk->n = n;
+    blk->first = first;
+    blk->link[0] = blk->link[1] = NULL;
+    blk->exec_cnt = 0;
+    blk->native = NULL;
+    blk->idle = (first[n - 1].cls == T_CON_BR || first[n - 1].cls == T_UNCON_BR) && idle_loop(address + (n - 1) * 2);
+    blk->idiom = first[n - 1].cls == T_CON_BR || first[n - 1].cls == T_UNCON_BR ? loop_idiom(address + (n - 1) * 2) : NULL;
+    blk->hle = hle.lookup(address);
+    if (engine == ENGINE_AOT)
+        blk->native = aot.lookup(blk);
+
+    blocks.insert(blk);
+
+    return blk;
+}
+
+/**
+  * The block engine. All but the last instruction of a block run back to back without touching PC; PC is set once before the last one, which may be a branch. The block then goes straight to its successor through its links, a successor is only looked up in the directory the first time it is reached. With the JIT engine a block is translated when it has run JIT_THRESHOLD times, and from then on its host code runs instead. With the AOT engine the image of the ELF file is loaded first, its blocks run their host code from the first execution, the others are left to the JIT engine. The whole block is taken from the budget before it runs, instructions which request a stop all end their block. A block closing a loop without side effects has the loop watched for running idle, one closing a copy, fill or compare idiom has the loop run on the host when it branches back. A block at the entry point of a library routine run on the host is not run, the routine is, and the block engine goes on at its return address. Returns when the budget left is too small for the next block, which is 0 after a stop, and leaves by exception with PC set as the plain loop would have left it.
+  * @exception UndefineInst For undefined instructions
+  * @exception UnexpectInst For instructions can not be handled
+  */
+void Thumb::run_blocks()
+{
+    if (!blocks.ready())
+        blocks.init(my_mmu->getTextVMA(), my_mmu->getTextSz());
+    if (engine == ENGINE_AOT && !aot.loaded())
+        aot.load(this, file_name);
+
+    t_block *blk = get_block(rPC);
+
+    while (budget >= (uint64_t)blk->n)
+    {
+        t_decoded *last = blk->first + blk->n - 1;
+
+        if (blk->hle != NULL)//the call counts as one instruction, as in the interpreter
+        {
+            rPC = blk->start + 2;
+            cur = blk->first;
+            cur_instr = cur->instr;
+            if (hle_run(*blk->hle))
+            {
+                budget--;
+                goto next_block;
+            }
+        }
+
+        budget -= blk->n;
+
+        if (engine >= ENGINE_JIT && blk->exec_cnt == JIT_THRESHOLD && blk->native == NULL)
+            blk->native = jit.compile(this, blk);
+
+        blk->exec_cnt++;
+        if (blk->native != NULL)
+        {
+            syncFlags();
+            if (blk->native(this, r, &st->cpsr) != 0)
+            {
+                if (cur != last)
+                    rPC = blk->start + (cur - blk->first + 1) * 2;
+                std::rethrow_exception(jit_exc);
+            }
+        }
+        else
+        {
+            try
+            {
+                for (cur = blk->first; cur < last; cur++)
+                    (this->*(handler_tab[cur->cls]))(*cur);
+            }
+            catch (...)
+            {
+                rPC = blk->start + (cur - blk->first + 1) * 2;
+                cur_instr = cur->instr;
+                throw;
+            }
+
+            rPC = blk->start + blk->n * 2;
+            cur = last;
+            cur_instr = last->instr;
+            (this->*(handler_tab[last->cls]))(*last);
+        }
+
+        if (blk->idle)//watch the loop every IDLE_CHECK_PERIOD runs, host code looping in itself comes back that often
+        {
+            if (rPC != last->imm)
+                idleLeft();
+            else if ((blk->exec_cnt & (IDLE_CHECK_PERIOD - 1)) == 0)
+                idleCheck(blk->start + (blk->n - 1) * 2);
+        }
+        if (blk->idiom != NULL && rPC == last->imm)
+            idiom_run(*blk->idiom);
+
+next_block:
+        if (budget == 0)//stopped, PC may be past the code segment
+            return;
+
+        //chain to the successor
+        t_block *next;
+
+        if (blk->link[0] != NULL && blk->link[0]->start == rPC)
+            next = blk->link[0];
+        else if (blk->link[1] != NULL && blk->link[1]->start == rPC)
+            next = blk->link[1];
+        else
+        {
+            next = get_block(rPC);
+            if (blk->link[0] == NULL)
+                blk->link[0] = next;
+            else if (blk->link[1] == NULL)
+                blk->link[1] = next;
+        }
+
+        blk = next;
+    }
+}
+
+/**
+  * Run one handler on behalf of host code, host code reads and writes CPSR itself so the flags are brought up to date afterwards. C++ exceptions can not unwind through the generated code, so the exception is kept and the host code returns to run_blocks(), which rethrows it.
+  * @param cpu The core
+  * @param d The predecoded instruction
+  * @return 0, or 1 if the handler threw
+  */
+int Thumb::jit_call(Thumb *cpu, const t_decoded *d)
+{
+    cpu->cur = const_cast<t_decoded *>(d);
+    cpu->cur_instr = d->instr;
+    try
+    {
+        (cpu->*(handler_tab[d->cls]))(*d);
+    }
+    catch (...)
+    {
+        cpu->syncFlags();
+        cpu->jit_exc = std::current_exception();
+        return 1;
+    }
+
+    cpu->syncFlags();
+    return 0;
+}
+
+/**
+  * Print the dead flag and superinstruction statistics of the interpreter, or the per-block execution counts of the block engine, the idioms recognised, the calls of library routines run on the host, and what the JIT engine translated and how much of the AOT image ran.
+  * @param fp The output file
+  */
+void Thumb::dump_stats(FILE *fp)
+{
+    if (engine == ENGINE_INTERP)
+        dump_interp(fp);
+    dump_idioms(fp);
+    hle.dump(fp);
+    blocks.dump(fp);
+    if (engine >= ENGINE_JIT)
+        jit.dump(fp);
+    if (engine == ENGINE_AOT)
+        aot.dump(fp);
+}
+
+/**
+  * Translate the Thumb code of the loaded program ahead of time, see thumb_aot::build().
+  * @param elf_path The ELF file, the image is written next to it
+  * @exception Error If the image can not be built
+  */
+void Thumb::build_aot(const char *elf_path)
+{
+    aot.build(this, elf_path);
+    aot.dump(stdout);
+}
@@ -0,0 +1,98 @@
+/*! \file block.h
+	\brief Guest basic blocks for the Thumb block engine.
+
+	A block is a run of predecoded Thumb instructions which ends at the first instruction that reads or writes PC (branches, BL suffix, BX/BLX, POP {pc}, SWI, ...). The block engine runs a block as one unit and chains it to its successors.
+ */
+#ifndef __BLOCK_H__
+#define __BLOCK_H__
+
+/*!
+	\addtogroup instruction
+ */
+/*@{*/
+
+#include <stdio.h>
+#include "arch.h"
+
+/*! \def BLOCK_MAX_INSTR
+	\brief The maximum number of instructions in one block
+ */
+#define BLOCK_MAX_INSTR     64
+
+struct t_decoded;
+struct t_idiom;
+struct hle_routine;
+class Thumb;
+
+/*! \typedef jit_fn
+	\brief Host code of a translated block. Returns 0 with PC set to the next block, or 1 if a handler it called threw.
+ */
+typedef int (*jit_fn)(Thumb *cpu, GP_Reg *r, EFLAG *cpsr);
+
+//! Whether an instruction must be the last one of a block
+bool ends_block(const t_decoded &d);
+
+/*! \struct t_block
+	\brief A guest basic block.
+ */
+struct t_block
+{
+	//! The virtual address of the first instruction.
+    int start;
+	//! The number of instructions, the last one may be a branch.
+    int n;
+	//! The predecoded entry of the first instruction, the others follow it in MMU's cache.
+    t_decoded *first;
+	//! The successors this block has been chained to, compared by address before use.
+    t_block *link[2];
+	//! How many times the block has been executed.
+    unsigned long long exec_cnt;
+	//! The host code of the block, NULL if it is not translated.
+    jit_fn native;
+	//! Whether the block ends with the branch closing a loop without side effects, see Thumb::idle_loop().
+    bool idle;
+	//! The idiom of the loop the block ends by closing, NULL if none, see Thumb::match_idiom().
+    t_idiom *idiom;
+	//! The library routine run on the host instead of the block, whose first instruction is its entry point, NULL if none.
+    hle_routine *hle;
+};
+
+/*! \class block_cache
+	\brief The directory of guest basic blocks.
+
+	Maps every halfword of the code segment to the block starting there. Owns the blocks.
+ */
+class block_cache
+{
+public:
+	//! A constructor
+    block_cache();
+	//! A destructor
+    ~block_cache();
+
+private:
+	//! One slot per halfword of code segment, NULL if no block starts there
+    t_block **map;
+	//! The virtual address of code segment
+    int text_VMA;
+	//! The size of code segment
+    int text_sz;
+
+public:
+	//! Allocate the directory for a code segment
+    void init(int VMA, int size);
+	//! Whether the directory is allocated
+    bool ready(){ return map != NULL; };
+	//! Give out the block starting at address, NULL if not built yet
+    /*!
+		\param address The virtual address, it must be inside code segment
+	 */
+    t_block *lookup(int address){ return map[(unsigned int)(address - text_VMA)>>1]; };
+	//! Record a new block
+    void insert(t_block *blk);
+	//! Print the per-block execution counts, hottest first
+    void dump(FILE *fp);
+};
+
+/*@}*/
+#endif // __BLOCK_H__
@@ -0,0 +1,187 @@
+/*! \file core.cpp
+	\brief The emulated core.
+
+	Chooses the decoder by the T bit, and switches between them on STOP_SWITCH_MODE.
+ */
+#include "core.h"
+#include "error.h"
+
+/**
+  * Zero the registers and the semihosting counts, start in ARM status, bind both decoders to them.
+  */
+arm_core::arm_core() : arm(&state), thumb(&state)
+{
+    for (int i = 0; i < 16; i++)
+        state.r[i] = 0;
+
+    state.cpsr = 0;
+    state.flag_op = FLAGS_NONE;
+    state.flag_res = state.flag_a = state.flag_b = 0;
+    state.swi.clock_reads = state.swi.time_reads = state.swi.others = 0;
+    state.swi.clock_skip = state.swi.time_skip = 0;
+
+    last_stop.reason = STOP_NONE;
+    last_stop.fault = FAULT_NONE;
+    last_stop.address = 0;
+    last_stop.executed = 0;
+    calling = false;
+}
+
+/**
+  * Nothing to do, DeinitMMU() deletes the MMU.
+  */
+arm_core::~arm_core()
+{
+
+}
+
+/**
+  * The ARM decoder loads the program and owns the MMU, the Thumb decoder uses the same one. An entry point with bit 0 set starts in Thumb status.
+  * @exception Error For errors which are memory-related, file-related, etc.
+  */
+void arm_core::InitMMU()
+{
+    arm.InitMMU();
+    thumb.AttachMMU(arm.get_mmu());
+
+    if (state.r[15] & 1)
+    {
+        state.cpsr |= CPSR_T;
+        state.r[15] &= ~1;
+    }
+}
+
+/**
+  * Delete the MMU modular.
+  */
+void arm_core::DeinitMMU()
+{
+    arm.DeinitMMU();
+}
+
+/**
+  * Both decoders answer SYS_GET_CMDLINE with the same command line.
+  * @param arg The command line
+  * @param len Its length
+  */
+void arm_core::getArg(char *arg, int len)
+{
+    arm.getArg(arg, len);
+    thumb.getArg(arg, len);
+}
+
+/**
+  * Both decoders run with the same engine, the ARM one has only the interpreter.
+  * @param mode ENGINE_INTERP, ENGINE_BLOCK, ENGINE_JIT or ENGINE_AOT
+  */
+void arm_core::setEngine(int mode)
+{
+    arm.setEngine(mode);
+    thumb.setEngine(mode);
+}
+
+/**
+  * Run the decoder the T bit selects, and go on with the other one each time it stops for a switch of instruction set, until some other stop or the budget is used up. While a function started by call() runs, the fault of fetching at CALL_RETURN is its return.
+  * @param max_instructions The instruction budget, RUN_FOREVER for no limit
+  * @return Why it stopped, never STOP_SWITCH_MODE
+  */
+StopReason arm_core::run(uint64_t max_instructions)
+{
+    uint64_t executed = 0;
+
+    while (1)
+    {
+        CPU *cpu = (state.cpsr & CPSR_T) ? (CPU *)&thumb : (CPU *)&arm;
+        StopReason why = cpu->run(max_instructions == RUN_FOREVER ? RUN_FOREVER : max_instructions - executed);
+
+        executed += cpu->stop_info().executed;
+        if (why != STOP_SWITCH_MODE)
+        {
+            last_stop = cpu->stop_info();
+            break;
+        }
+    }
+
+    last_stop.executed = executed;
+    if (calling && last_stop.reason == STOP_FAULT && state.r[15] == CALL_RETURN)
+    {
+        last_stop.reason = STOP_RETURNED;//executed already leaves out the fetch at CALL_RETURN, it faults before it takes from the budget
+        last_stop.fault = FAULT_NONE;
+        last_stop.address = CALL_RETURN;
+        last_stop.detail.clear();
+    }
+    if (last_stop.reason != STOP_BUDGET && last_stop.reason != STOP_BREAKPOINT)
+        calling = false;
+
+    return last_stop.reason;
+}
+
+/**
+  * Set up the call of a function of the program as AAPCS does, and run it. Neither the entry point of the program nor its exit are run, and the program is not loaded again: what earlier calls left in its memory is still there. Each call starts with SP at the top of the stack, the registers the function has to preserve keep the values the last run left in them.
+  * @param name The name of the function in the symbol table of the program
+  * @param args The arguments, 32-bit each, 64-bit ones are passed as two of them
+  * @param num The number of arguments, at most CALL_MAX_ARGS
+  * @param max_instructions The instruction budget, RUN_FOREVER for no limit
+  * @return Why it stopped, STOP_RETURNED once the function returned
+  * @exception Error If the program has no such function, or there are too many arguments
+  */
+StopReason arm_core::call(const char *name, const uint32_t *args, int num, uint64_t max_instructions)
+{
+    MMU *mmu = arm.get_mmu();
+    const guest_symbol *sym = mmu->getSymbol(name);
+
+    if (sym == NULL || !sym->func)
+    {
+        Error e;
+        e.error_name = std::string("No function ") + name + " in the program";
+        throw e;
+    }
+    if (num < 0 || num > CALL_MAX_ARGS)
+    {
+        Error e;
+        e.error_name = std::string("Too many arguments for ") + name;
+        throw e;
+    }
+
+    uint32_t sp = mmu->getStackTop();
+    bool in_thumb = sym->address & 1;
+
+    if (num > 4)
+        sp = (sp - 4 * (num - 4)) & ~7u;//8-byte aligned at the call
+    for (int i = 4; i < num; i++)
+        mmu->set_word(sp + 4 * (i - 4), args[i]);
+    for (int i = 0; i < 4; i++)
+        state.r[i] = i < num ? args[i] : 0;
+
+    state.r[13] = sp;
+    state.r[14] = CALL_RETURN | (in_thumb ? 1 : 0);//BX LR stays in the instruction set of the function
+    state.r[15] = sym->address & ~1;
+    state.cpsr = in_thumb ? state.cpsr | CPSR_T : state.cpsr & ~CPSR_T;
+
+    //the registers are not the ones a watched loop left
+    arm.forgetIdle();
+    thumb.forgetIdle();
+    calling = true;
+
+    return run(max_instructions);
+}
+
+/**
+  * Translate the Thumb code of the loaded program into the image ENGINE_AOT loads, ARM code is left to the interpreter.
+  * @param elf_path The ELF file the program was loaded from
+  * @exception Error If the image can not be built
+  */
+void arm_core::build_aot(const char *elf_path)
+{
+    thumb.build_aot(elf_path);
+}
+
+/**
+  * Print the profiling information of both decoders.
+  * @param fp The output file
+  */
+void arm_core::dump_stats(FILE *fp)
+{
+    arm.dump_stats(fp);
+    thumb.dump_stats(fp);
+}
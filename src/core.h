@@ -0,0 +1,88 @@
+/*! \file core.h
+	\brief The emulated core.
+
+	One register file, run by the ARM or the Thumb decoder as the T bit says.
+ */
+#ifndef __CORE_H__
+#define __CORE_H__
+
+#include <stdio.h>
+#include "CPU.h"
+#include "ARM.h"
+#include "Thumb.h"
+
+/*! \def CALL_RETURN
+	\brief The return address arm_core::call() gives the function, out of any segment, fetching there ends the call
+ */
+#define CALL_RETURN     0xfffffff0
+
+/*! \def CALL_MAX_ARGS
+	\brief The most arguments arm_core::call() passes, the ones after the fourth on the stack
+ */
+#define CALL_MAX_ARGS   16
+
+/*! \class arm_core
+	\brief A core with an ARM and a Thumb decoder on one cpu_state.
+
+	An interworking branch flips the T bit and stops the running decoder with STOP_SWITCH_MODE, run() then goes on with the other decoder in the same call. Nothing is allocated, copied or thrown on the way.
+
+	Besides running the program from its entry point, the host may load it once and call its functions by name with call(), as many times as it likes.
+ */
+class arm_core
+{
+    template<int N> friend class thumb_lockstep;
+
+public:
+	//! A constructor
+    arm_core();
+	//! A destructor
+    ~arm_core();
+
+private:
+	//! The registers both decoders work on
+    cpu_state state;
+	//! The ARM decoder
+    ARM arm;
+	//! The Thumb decoder
+    Thumb thumb;
+	//! The details of the last stop of run()
+    StopInfo last_stop;
+	//! Whether a function started by call() has not returned yet
+    bool calling;
+
+public:
+	//! Load the program, and start in the instruction set of its entry point
+    void InitMMU();
+	//! Deinitialize the MMU module
+    void DeinitMMU();
+	//! Give the command line to the SWI components of both decoders
+    void getArg(char *arg, int len);
+	//! Collect the console output of both decoders in a string, NULL for stdout
+    void setConsole(std::string *out){ arm.setConsole(out); thumb.setConsole(out); };
+	//! Choose the execution engine of both decoders
+    void setEngine(int mode);
+	//! Choose which library routines of the program run on the host, HLE_OFF, HLE_ON or HLE_PRINTF, before InitMMU()
+    void setHLE(int level){ arm.setHLE(level); thumb.setHLE(level); };
+	//! Run instructions until the program stops, or max_instructions of them have run
+    StopReason run(uint64_t max_instructions = RUN_FOREVER);
+	//! The details of the last stop of run(), executed counts both decoders
+    const StopInfo &stop_info(){ return last_stop; };
+	//! Call a function of the program by name, and run it until it returns to the host or stops otherwise
+	/*!
+		The arguments go in r0-r3 and on the stack, as AAPCS passes them, and the function returns to CALL_RETURN, where run() stops with STOP_RETURNED. Any other stop is left as run() gives it, after STOP_BUDGET or STOP_BREAKPOINT run() goes on with the call.
+		\param name The name of the function in the symbol table of the program
+		\param args The arguments, 32-bit each, 64-bit ones are passed as two of them
+		\param num The number of arguments, at most CALL_MAX_ARGS
+		\param max_instructions The instruction budget, RUN_FOREVER for no limit
+		\return Why it stopped
+	 */
+    StopReason call(const char *name, const uint32_t *args, int num, uint64_t max_instructions = RUN_FOREVER);
+	//! Get the register value by its index, r0 and r1 hold the result of call()
+    GP_Reg get_reg_by_code(int reg_code){ return state.r[reg_code]; };
+	//! Translate the Thumb code of the loaded program ahead of time
+    void build_aot(const char *elf_path);
+	//! Print the profiling information of both decoders
+    void dump_stats(FILE *fp);
+};
+
+#endif // __CORE_H__
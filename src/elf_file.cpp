@@ -12,11 +12,14 @@
 {
     pro_header = NULL;
     sec_header = NULL;
+    symtab = NULL;
+    sym_name = NULL;
+    sym_num = 0;
     code_offset = 0;
 }
 
 /**
-  * Deinitialize the modular, delete the program header array, section header array
+  * Deinitialize the modular, delete the program header array, section header array, symbol table and symbol names
   */
  elf_file::~elf_file()
 {
@@ -36,6 +39,8 @@
             delete []sec_header;
     }
 
+    delete []symtab;
+    delete []sym_name;
 }
 
 /**
@@ -98,7 +103,7 @@ int elf_file::getCodeOffset(std::ifstream &ifile)
 
 
 /**
-  * Get the Thumb code ELF structure from the current dynamic link library.
+  * Get the Thumb code ELF structure from the current dynamic link library, and its symbol table with the string table it links to, if it has one.
   * @param ifile The file stream of the current shared object file
   */
 void elf_file::get_info(std::ifstream &ifile)
@@ -141,11 +146,31 @@ void elf_file::get_info(std::ifstream &ifile)
     ifile.seekg(sec_header[elf_header.e_shstrndx].sh_offset + code_offset);
     ifile.read(sec_name, sec_name_len);
 
+    for (int i = 0; i < elf_header.e_shnum; i++)
+    {
+        if (sec_header[i].sh_type != SHT_SYMTAB || sec_header[i].sh_link >= elf_header.e_shnum)
+            continue;
+
+        Elf32_Shdr &str = sec_header[sec_header[i].sh_link];
+
+        sym_num = sec_header[i].sh_size / sizeof(Elf32_Sym);
+        symtab = new Elf32_Sym[sym_num];
+        ifile.seekg(sec_header[i].sh_offset + code_offset);
+        ifile.read(reinterpret_cast<char *>(symtab), sym_num * sizeof(Elf32_Sym));
+
+        sym_name_len = str.sh_size;
+        sym_name = new char [sym_name_len + 1];
+        ifile.seekg(str.sh_offset + code_offset);
+        ifile.read(sym_name, sym_name_len);
+        sym_name[sym_name_len] = 0;//a broken table still ends its last name
+        break;
+    }
+
     return;
 }
 
 /**
-  * Set up the memory layout of MMU modular 
+  * Set up the memory layout of MMU modular, and give it the functions and data objects the symbol table defines. Local symbols are left out, calls by name are linked to the global and weak ones.
   * @param aMMU The reference of a MMU modular
   */
 void elf_file::setup_MMU(MMU &aMMU)
@@ -217,6 +242,16 @@ void elf_file::setup_MMU(MMU &aMMU)
     }
     aMMU.setStackSeg(0x200000);
     aMMU.setStackVMA(0x200000);
+
+    for (int i = 0; i < sym_num; i++)
+    {
+        int type = symtab[i].st_info & 0xf;
+
+        if ((type != STT_FUNC && type != STT_OBJECT) || (symtab[i].st_info >> 4) == STB_LOCAL
+        || symtab[i].st_shndx == SHN_UNDEF || symtab[i].st_name >= (Elf32_Word)sym_name_len)
+            continue;
+        aMMU.addSymbol(&sym_name[symtab[i].st_name], symtab[i].st_value, symtab[i].st_size, type == STT_FUNC);
+    }
 }
 
 
@@ -66,6 +66,32 @@ typedef uint32_t    Elf32_Word;
 #define SHF_ALLOC       0x2
 #define SHF_EXECINSTR   0x4
 
+/*! \def SHT_SYMTAB
+	\brief The sh_type, this section holds a symbol table
+ */
+
+/*! \def SHN_UNDEF
+	\brief The st_shndx of a symbol which is not defined in this file
+ */
+
+/*! \def STB_LOCAL
+	\brief The binding of a symbol, ELF32_ST_BIND(st_info), which is not visible outside its object file
+ */
+
+/*! \def STT_OBJECT
+	\brief The type of a symbol, ELF32_ST_TYPE(st_info), which is a data object
+ */
+
+/*! \def STT_FUNC
+	\brief The type of a symbol, ELF32_ST_TYPE(st_info), which is a function
+ */
+
+#define SHT_SYMTAB      2
+#define SHN_UNDEF       0
+#define STB_LOCAL       0
+#define STT_OBJECT      1
+#define STT_FUNC        2
+
 
 //! The structure of ELF header
 typedef struct{
@@ -113,6 +139,16 @@ typedef struct{
     Elf32_Word sh_entsize; /*!< This member gives the size in bytes of each entry.*/
 }Elf32_Shdr;
 
+//! The structure of symbol table entry
+typedef struct{
+    Elf32_Word st_name; /*!< This member holds an index into the object file's symbol string table.*/
+    Elf32_Addr st_value; /*!< This member gives the value of the associated symbol, an address for a function, with bit 0 set for Thumb code.*/
+    Elf32_Word st_size; /*!< This member gives the size in bytes of the object the symbol refers to, 0 if it has no size or the size is unknown.*/
+    unsigned char st_info; /*!< This member specifies the symbol's type and binding attributes.*/
+    unsigned char st_other; /*!< This member currently holds 0 and has no defined meaning.*/
+    Elf32_Half st_shndx; /*!< This member holds the section header table index the symbol is defined in relation to.*/
+}Elf32_Sym;
+
 
 /*! \class elf_file
 	\brief The class which interprets the ELF structure.
@@ -139,6 +175,15 @@ private:
 	//! The length of section name string
     int sec_name_len;
 
+	//! The array of symbol table entries, NULL if the file has no symbol table
+    Elf32_Sym *symtab;
+	//! The number of symbol table entries
+    int sym_num;
+	//! The string of symbol names
+    char *sym_name;
+	//! The length of symbol name string
+    int sym_name_len;
+
 	//! The file offset of Thumb code
     int code_offset;
 
@@ -1,7 +1,7 @@
 /*! \file error.h
 	\brief The error exception class collection.
 
-	All exceptions from instruction execution, Mode switch, Program End.
+	All exceptions from instruction execution and the host. Mode switches and the end of the program are not exceptions, CPU::run() returns a StopReason for them.
  */
 #ifndef __ERROR_H__
 #define __ERROR_H__
@@ -37,7 +37,7 @@ class UndefineInst: public InstructionExcept
 /*!	\exception UnexpectInst
 	\brief The derived class from InstructionExcept, used for a instruction can not be handled.
 
-	Like breakpoint, mode switch in Thumb status, these instruction cannot be handled by emulator, then this exception will be thrown out.
+	Like SWI other than semihosting, or endianness change, these instruction cannot be handled by emulator, then this exception will be thrown out.
  */
 class UnexpectInst: public InstructionExcept
 {
@@ -55,27 +55,6 @@ public:
     std::string error_name;
 };
 
-/*!	\exception SwitchMode
-	\brief For mode switch use.
-
-	When the emulator switches from ARM status to Thumb status, it throws out this exception.
- */
-class SwitchMode
-{
-public:
-	//! Note for mode switch, from what status to what status.
-    std::string switch_way;
-};
-
-/*!	\exception ProgramEnd
-	\brief For ending the program running in the emulator.
-
-	When SWI's 0x18 subroutine is called, this exception will be thrown out, the emulator will end as well as the program running in it.
- */
-class ProgramEnd
-{
-};
-
 /*@}*/
 #endif // __ERROR_H__
 
@@ -0,0 +1,887 @@
+/*! \file hle.cpp
+	\brief Library routines of the program run on the host.
+
+	The host routines work on the memory of MMU as the guest ones would: data, bss, heap and, byte by byte, the stack, with code and read only data for reads. A call whose memory is anywhere else, or whose string runs off its segment, is left to the guest routine, which faults or not on its own.
+ */
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+#include "hle.h"
+#include "Thumb.h"
+#include "ARM.h"
+
+/**
+  * Find the guest bytes from an address to the end of its segment.
+  * @param mmu The memory of the program
+  * @param address The virtual address
+  * @param write Whether the bytes will be written
+  * @param host Set to the host memory of the bytes, NULL for the stack, whose bytes go through get_byte() and set_byte()
+  * @param avail Set to the number of bytes up to the end of the segment
+  * @return false if the address is in no segment the host routines use
+  */
+static bool guest_run(MMU *mmu, uint32_t address, bool write, BYTE *&host, uint32_t &avail)
+{
+    int VMA, size;
+
+    host = mmu->host_range(address, write, VMA, size);//NULL for code and read only data too, if written
+    if (host == NULL && !mmu->stack_range(address, VMA, size))
+        return false;
+
+    avail = (uint32_t)(VMA + size) - address;
+    if (host != NULL)
+        host += address - VMA;
+    return true;
+}
+
+/**
+  * Read the byte i of a run found by guest_run().
+  */
+static inline BYTE peek(MMU *mmu, const BYTE *host, uint32_t address, uint32_t i)
+{
+    return host != NULL ? host[i] : mmu->get_byte(address + i);
+}
+
+/**
+  * Write the byte i of a run found by guest_run().
+  */
+static inline void poke(MMU *mmu, BYTE *host, uint32_t address, uint32_t i, BYTE data)
+{
+    if (host != NULL)
+        host[i] = data;
+    else
+        mmu->set_byte(address + i, data);
+}
+
+/**
+  * memcpy() and memmove(), r0 the destination, r1 the source, r2 the length, the destination is returned. Overlapping runs are copied as memmove() does.
+  */
+static bool libc_memmove(GP_Reg *r, MMU *mmu, const hle_table &)
+{
+    uint32_t dst = r[0], src = r[1], n = r[2], dst_avail, src_avail;
+    BYTE *d, *s;
+
+    if (n == 0)
+        return true;
+    if (!guest_run(mmu, dst, true, d, dst_avail) || !guest_run(mmu, src, false, s, src_avail) || n > dst_avail || n > src_avail)
+        return false;
+
+    if (d != NULL && s != NULL)
+    {
+        memmove(d, s, n);
+        return true;
+    }
+
+    std::vector<BYTE> buf(n);//one side is the stack
+
+    for (uint32_t i = 0; i < n; i++)
+        buf[i] = peek(mmu, s, src, i);
+    for (uint32_t i = 0; i < n; i++)
+        poke(mmu, d, dst, i, buf[i]);
+    return true;
+}
+
+/**
+  * memset(), r0 the destination, r1 the byte, r2 the length, the destination is returned.
+  */
+static bool libc_memset(GP_Reg *r, MMU *mmu, const hle_table &)
+{
+    uint32_t dst = r[0], n = r[2], avail;
+    BYTE *d;
+
+    if (n == 0)
+        return true;
+    if (!guest_run(mmu, dst, true, d, avail) || n > avail)
+        return false;
+
+    if (d != NULL)
+        memset(d, r[1] & 0xff, n);
+    else
+        for (uint32_t i = 0; i < n; i++)
+            mmu->set_byte(dst + i, r[1] & 0xff);
+    return true;
+}
+
+/**
+  * memcmp(), r0 and r1 the runs, r2 the length. The difference of the first bytes which differ is returned, as unsigned chars.
+  */
+static bool libc_memcmp(GP_Reg *r, MMU *mmu, const hle_table &)
+{
+    uint32_t a = r[0], b = r[1], n = r[2], a_avail, b_avail;
+    BYTE *pa, *pb;
+
+    if (n == 0)
+    {
+        r[0] = 0;
+        return true;
+    }
+    if (!guest_run(mmu, a, false, pa, a_avail) || !guest_run(mmu, b, false, pb, b_avail) || n > a_avail || n > b_avail)
+        return false;
+
+    r[0] = 0;
+    if (pa != NULL && pb != NULL && memcmp(pa, pb, n) == 0)
+        return true;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        BYTE ca = peek(mmu, pa, a, i), cb = peek(mmu, pb, b, i);
+
+        if (ca != cb)
+        {
+            r[0] = ca - cb;
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+  * strlen(), r0 the string.
+  */
+static bool libc_strlen(GP_Reg *r, MMU *mmu, const hle_table &)
+{
+    uint32_t s = r[0], avail;
+    BYTE *p;
+
+    if (!guest_run(mmu, s, false, p, avail))
+        return false;
+
+    if (p != NULL)
+    {
+        const BYTE *end = (const BYTE *)memchr(p, 0, avail);
+
+        if (end == NULL)
+            return false;
+        r[0] = end - p;
+        return true;
+    }
+
+    for (uint32_t i = 0; i < avail; i++)
+        if (mmu->get_byte(s + i) == 0)
+        {
+            r[0] = i;
+            return true;
+        }
+    return false;
+}
+
+/**
+  * strcmp(), r0 and r1 the strings. The difference of the first bytes which differ, or of the bytes where the first string ends, is returned, as unsigned chars.
+  */
+static bool libc_strcmp(GP_Reg *r, MMU *mmu, const hle_table &)
+{
+    uint32_t a = r[0], b = r[1], a_avail, b_avail;
+    BYTE *pa, *pb;
+
+    if (!guest_run(mmu, a, false, pa, a_avail) || !guest_run(mmu, b, false, pb, b_avail))
+        return false;
+
+    uint32_t n = a_avail < b_avail ? a_avail : b_avail;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        BYTE ca = peek(mmu, pa, a, i), cb = peek(mmu, pb, b, i);
+
+        if (ca != cb || ca == 0)
+        {
+            r[0] = ca - cb;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+  * Read a word of the program, from any segment the host routines use, as LDR reads it: the stack keeps whole words, whose bytes get_byte() does not give in memory order.
+  * @return false if the address is in none of them, or is not word aligned on the stack
+  */
+static bool guest_word(MMU *mmu, uint32_t address, uint32_t &w)
+{
+    BYTE *p;
+    uint32_t avail;
+
+    if (!guest_run(mmu, address, false, p, avail) || avail < 4)
+        return false;
+
+    if (p == NULL)
+    {
+        if ((address & MASK_2BIT) != 0)
+            return false;
+        w = mmu->get_word(address);
+        return true;
+    }
+    memcpy(&w, p, 4);
+    return true;
+}
+
+/**
+  * Read a string of the program, up to its terminating NUL or max bytes.
+  * @param mmu The memory of the program
+  * @param address The virtual address of the string
+  * @param max The most bytes read
+  * @param s Set to the string, without the NUL
+  * @return false if the string runs off its segment first
+  */
+static bool guest_string(MMU *mmu, uint32_t address, uint32_t max, std::string &s)
+{
+    BYTE *p;
+    uint32_t avail;
+
+    if (!guest_run(mmu, address, false, p, avail))
+        return false;
+
+    uint32_t n = avail < max ? avail : max;
+
+    s.clear();
+    for (uint32_t i = 0; i < n; i++)
+    {
+        BYTE c = peek(mmu, p, address, i);
+
+        if (c == 0)
+            return true;
+        s.push_back(c);
+    }
+    return n == max;
+}
+
+/**
+  * Write a string of the program and its NUL.
+  * @return false if the buffer runs off its segment, nothing is written then
+  */
+static bool guest_put_string(MMU *mmu, uint32_t address, const std::string &s)
+{
+    BYTE *p;
+    uint32_t avail;
+
+    if (!guest_run(mmu, address, true, p, avail) || avail < s.size() + 1)
+        return false;
+
+    for (uint32_t i = 0; i < s.size(); i++)
+        poke(mmu, p, address, i, s[i]);
+    poke(mmu, p, address, s.size(), 0);
+    return true;
+}
+
+/**
+  * The variadic arguments of a call, as the AAPCS passes them: in the core registers left, then on the stack, 64-bit ones in an even register pair or at a doubleword aligned address.
+  */
+class print_args
+{
+public:
+    /**
+      * Start at a register.
+      * @param regs The registers at the call
+      * @param m The memory of the program
+      * @param first The register of the first variadic argument
+      */
+    print_args(const GP_Reg *regs, MMU *m, int first)
+    {
+        r = regs;
+        mmu = m;
+        ncrn = first;
+        nsaa = regs[13];
+        ok = true;
+    }
+
+    /**
+      * The next 32-bit argument.
+      */
+    uint32_t word()
+    {
+        if (ncrn < 4)
+            return r[ncrn++];
+
+        uint32_t w = 0;
+
+        if (!guest_word(mmu, nsaa, w))
+            ok = false;
+        nsaa += 4;
+        return w;
+    }
+
+    /**
+      * The next 64-bit argument.
+      */
+    uint64_t dword()
+    {
+        ncrn = (ncrn + 1) & ~1;
+        if (ncrn >= 4)
+            nsaa = (nsaa + 7) & ~7;
+
+        uint64_t lo = word();
+
+        return lo | (uint64_t)word()<<32;
+    }
+
+    //! Whether all the arguments taken were in memory the host routines use
+    bool ok;
+
+private:
+    //! The registers at the call
+    const GP_Reg *r;
+    //! The memory of the program
+    MMU *mmu;
+    //! The next core register, 4 once they are used up
+    int ncrn;
+    //! The address of the next argument on the stack
+    uint32_t nsaa;
+};
+
+/**
+  * Append what the host snprintf() makes of one conversion.
+  */
+static void host_format(std::string &out, const char *spec, ...)
+{
+    va_list ap;
+    char buf[64];
+
+    va_start(ap, spec);
+    int n = vsnprintf(buf, sizeof(buf), spec, ap);
+    va_end(ap);
+
+    if (n < (int)sizeof(buf))
+    {
+        out.append(buf, n);
+        return;
+    }
+
+    std::vector<char> big(n + 1);
+
+    va_start(ap, spec);
+    vsnprintf(&big[0], n + 1, spec, ap);
+    va_end(ap);
+    out.append(&big[0], n);
+}
+
+/**
+  * Append a string padded with spaces to a width.
+  */
+static void pad(std::string &out, const std::string &s, int width, bool left)
+{
+    int n = width - (int)s.size();
+
+    if (left)
+        out += s;
+    if (n > 0)
+        out.append(n, ' ');
+    if (!left)
+        out += s;
+}
+
+/**
+  * Format as the vfprintf() of newlib does, for the flags - + space # 0, the width and precision, * for both, the length modifiers hh h l ll j z t L and the conversions d i u o x X c s p e E f g G and %%. Everything but %c, %s and %p goes through the host snprintf(), which gives the same output for them.
+  * @param mmu The memory of the program
+  * @param t The table of the routine, which knows what the printf() of the program supports
+  * @param fmt The virtual address of the format string
+  * @param ap The variadic arguments
+  * @param floats Whether the routine formats floating point, which the integer only iprintf() family does not
+  * @param out Set to the output
+  * @return false for what is not supported or is left to the program: positional arguments, %n, %a, %F, wide characters, NaN, a NULL string, memory out of the segments the host routines use, ...
+  */
+static bool print_format(MMU *mmu, const hle_table &t, uint32_t fmt, print_args &ap, bool floats, std::string &out)
+{
+    std::string f;
+
+    if (!guest_string(mmu, fmt, UINT32_MAX, f))
+        return false;
+
+    out.clear();
+    for (size_t i = 0; i < f.size(); )
+    {
+        if (f[i] != '%')
+        {
+            out.push_back(f[i++]);
+            continue;
+        }
+
+        std::string flags, len;
+        int width = -1, prec = -1;
+
+        for (i++; i < f.size() && strchr("-+ #0", f[i]) != NULL; i++)
+            if (flags.find(f[i]) == std::string::npos)
+                flags.push_back(f[i]);
+
+        if (i < f.size() && f[i] == '*')
+        {
+            int32_t w = ap.word();
+
+            if (w == INT_MIN)
+                return false;
+            if (w < 0 && flags.find('-') == std::string::npos)
+                flags.push_back('-');
+            width = w < 0 ? -w : w;
+            i++;
+        }
+        else
+            for (; i < f.size() && f[i] >= '0' && f[i] <= '9'; i++)
+                width = (width < 0 ? 0 : width * 10) + (f[i] - '0');
+
+        if (i < f.size() && f[i] == '.')
+        {
+            prec = 0;
+            if (++i < f.size() && f[i] == '*')
+            {
+                int32_t p = ap.word();
+
+                prec = p < 0 ? -1 : p;
+                i++;
+            }
+            else
+                for (; i < f.size() && f[i] >= '0' && f[i] <= '9'; i++)
+                    prec = prec * 10 + (f[i] - '0');
+        }
+
+        if (width > 0xffff || prec > 0xffff || i >= f.size() || f[i] == '$')//too wide for the host buffer, positional
+            return false;
+
+        while (i < f.size() && strchr("hljztL", f[i]) != NULL && len.size() < 2)
+            len.push_back(f[i++]);
+        if (i >= f.size())
+            return false;
+
+        char conv = f[i++];
+        bool long_long = len == "ll" || len == "j";
+        std::string spec = "%" + flags;
+
+        if (width >= 0)
+            spec += std::to_string(width);
+        if (prec >= 0)
+            spec += "." + std::to_string(prec);
+
+        if (len != "" && len != "hh" && len != "h" && len != "l" && len != "ll" && len != "j" && len != "z" && len != "t" && len != "L")
+            return false;
+        if (long_long && !t.printLongLong())
+            return false;
+
+        switch (conv)
+        {
+            case 'd':
+            case 'i':
+            {
+                if (len == "L")
+                    return false;
+
+                int64_t v = long_long ? (int64_t)ap.dword() : (int32_t)ap.word();
+
+                if (len == "hh")
+                    v = (signed char)v;
+                else if (len == "h")
+                    v = (short)v;
+                host_format(out, (spec + "lld").c_str(), (long long)v);
+                break;
+            }
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            {
+                if (len == "L")
+                    return false;
+
+                uint64_t v = long_long ? ap.dword() : ap.word();
+
+                if (len == "hh")
+                    v = (unsigned char)v;
+                else if (len == "h")
+                    v = (unsigned short)v;
+                host_format(out, (spec + "ll" + conv).c_str(), (unsigned long long)v);
+                break;
+            }
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'g':
+            case 'G':
+            {
+                if (!floats || !t.printFloat() || (len != "" && len != "l" && len != "L"))
+                    return false;
+
+                uint64_t bits = ap.dword();
+                double v;
+
+                memcpy(&v, &bits, 8);
+                if (isnan(v))//newlib versions differ on its sign
+                    return false;
+                host_format(out, (spec + conv).c_str(), v);
+                break;
+            }
+            case 'c':
+            {
+                if (len != "" || (flags != "" && flags != "-"))
+                    return false;
+                pad(out, std::string(1, (char)ap.word()), width, flags == "-");
+                break;
+            }
+            case 's':
+            {
+                std::string s;
+                uint32_t address = ap.word();
+
+                if (len != "" || (flags != "" && flags != "-") || address == 0
+                || !guest_string(mmu, address, prec < 0 ? UINT32_MAX : prec, s))
+                    return false;
+                pad(out, s, width, flags == "-");
+                break;
+            }
+            case 'p':
+            {
+                if (len != "" || (flags != "" && flags != "-"))
+                    return false;
+
+                uint32_t v = ap.word();
+                std::string s = "0x";
+
+                if (prec < 0)
+                    host_format(s, "%x", v);
+                else if (v != 0 || prec != 0)
+                    host_format(s, "%.*x", prec, v);
+                pad(out, s, width, flags == "-");
+                break;
+            }
+            case '%':
+            {
+                if (flags != "" || width >= 0 || prec >= 0 || len != "")
+                    return false;
+                out.push_back('%');
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return ap.ok;
+}
+
+/**
+  * printf() and iprintf(), r0 the format, the arguments from r1. The output goes to the console in one piece, as long as stdout has none of its own buffered; the number of bytes is returned.
+  */
+template <bool FLOAT>
+static bool libc_printf(GP_Reg *r, MMU *mmu, const hle_table &t)
+{
+    std::string out;
+    print_args ap(r, mmu, 1);
+
+    if (!t.stdStream(mmu, t.stdOut(mmu)) || !print_format(mmu, t, r[0], ap, FLOAT, out))
+        return false;
+
+    t.write(out);
+    r[0] = out.size();
+    return true;
+}
+
+/**
+  * fprintf() and fiprintf(), r0 the stream, r1 the format, the arguments from r2. Only stdout and stderr with none of their own output buffered are taken, their output goes to the console as SYS_WRITE sends it.
+  */
+template <bool FLOAT>
+static bool libc_fprintf(GP_Reg *r, MMU *mmu, const hle_table &t)
+{
+    std::string out;
+    print_args ap(r, mmu, 2);
+
+    if (!t.stdStream(mmu, r[0]) || !print_format(mmu, t, r[1], ap, FLOAT, out))
+        return false;
+
+    t.write(out);
+    r[0] = out.size();
+    return true;
+}
+
+/**
+  * sprintf() and siprintf(), r0 the buffer, r1 the format, the arguments from r2. The buffer must hold the output and its NUL within its segment.
+  */
+template <bool FLOAT>
+static bool libc_sprintf(GP_Reg *r, MMU *mmu, const hle_table &t)
+{
+    std::string out;
+    print_args ap(r, mmu, 2);
+
+    if (!print_format(mmu, t, r[1], ap, FLOAT, out) || !guest_put_string(mmu, r[0], out))
+        return false;
+
+    r[0] = out.size();
+    return true;
+}
+
+/**
+  * snprintf() and sniprintf(), r0 the buffer, r1 its size, r2 the format, the arguments from r3. What fits of the output is written with a NUL, the length of the whole output is returned.
+  */
+template <bool FLOAT>
+static bool libc_snprintf(GP_Reg *r, MMU *mmu, const hle_table &t)
+{
+    std::string out;
+    print_args ap(r, mmu, 3);
+    uint32_t size = r[1];
+
+    if (size > INT_MAX || !print_format(mmu, t, r[2], ap, FLOAT, out))//newlib fails a size over INT_MAX with EOVERFLOW
+        return false;
+    if (size > 0 && !guest_put_string(mmu, r[0], out.substr(0, size - 1)))
+        return false;
+
+    r[0] = out.size();
+    return true;
+}
+
+/**
+  * The routines of the C library run on the host, by the name the program links them with.
+  */
+static const hle_def libc_routines[] =
+{
+    {"memcpy", libc_memmove},
+    {"memmove", libc_memmove},
+    {"memset", libc_memset},
+    {"memcmp", libc_memcmp},
+    {"strlen", libc_strlen},
+    {"strcmp", libc_strcmp}
+};
+
+/**
+  * The printf() family of the C library run on the host, with HLE_PRINTF.
+  */
+static const hle_def print_routines[] =
+{
+    {"printf", libc_printf<true> },
+    {"fprintf", libc_fprintf<true> },
+    {"sprintf", libc_sprintf<true> },
+    {"snprintf", libc_snprintf<true> },
+    {"iprintf", libc_printf<false> },
+    {"fiprintf", libc_fprintf<false> },
+    {"siprintf", libc_sprintf<false> },
+    {"sniprintf", libc_snprintf<false> }
+};
+
+/**
+  * Whether a routine branches back to its own entry point, a loop whose head is the entry. Reaching the entry is then not always a call, so the routine is left to the emulator.
+  * @param mmu The memory of the program
+  * @param entry The virtual address of the entry point
+  * @param size The size of the routine in bytes
+  * @param thumb Whether the routine is Thumb code, otherwise ARM code
+  * @return true if a conditional or unconditional branch in the routine targets its entry point
+  */
+static bool loops_to_entry(MMU *mmu, int entry, int size, bool thumb)
+{
+    int end = mmu->getTextVMA() + mmu->getTextSz();
+    int len = thumb ? 2 : 4;
+
+    if (entry + size < end)
+        end = entry + size;
+
+    for (int address = entry; address + len <= end; address += len)
+    {
+        int target;
+
+        if (thumb)
+        {
+            T_INSTR instr = mmu->getInstr(address);
+
+            if ((instr & 0xf000) == 0xd000 && ((instr>>8) & MASK_4BIT) < 14)//B<cond>, 14 and 15 are undefined and SWI
+                target = address + 4 + (int8_t)(instr & MASK_8BIT) * 2;
+            else if ((instr & 0xf800) == 0xe000)//B
+                target = address + 4 + ((int32_t)((uint32_t)instr<<21)>>20);
+            else
+                continue;
+        }
+        else
+        {
+            A_INSTR instr = mmu->getInstr32(address);
+
+            if ((instr & 0x0f000000) == 0x0a000000 && (instr>>28) != 15)//B<cond>, not BL or BLX
+                target = address + 8 + ((int32_t)(instr<<8)>>6);
+            else
+                continue;
+        }
+
+        if (target == entry)
+            return true;
+    }
+    return false;
+}
+
+/**
+  * Nothing is found until init().
+  */
+hle_table::hle_table()
+{
+    level = HLE_ON;
+    console = NULL;
+    impure_ptr = 0;
+    print_float = print_long_long = true;
+}
+
+/**
+  * Look the routines of a table up in the symbol table of the program, and take those in the code segment, of one instruction set, whose size is known, and which do not loop back to their entry point.
+  * @param mmu The memory of the program
+  * @param defs The routines
+  * @param num The number of routines
+  * @param thumb Whether to take the Thumb routines, otherwise the ARM ones
+  */
+void hle_table::add(MMU *mmu, const hle_def *defs, int num, bool thumb)
+{
+    for (int i = 0; i < num; i++)
+    {
+        const guest_symbol *sym = mmu->getSymbol(defs[i].name);
+
+        if (sym == NULL || !sym->func || (sym->address & 1) != thumb || sym->size <= 0)
+            continue;
+
+        int entry = sym->address & ~1;
+
+        if (entry < mmu->getTextVMA() || entry >= mmu->getTextVMA() + mmu->getTextSz() || (!thumb && (entry & MASK_2BIT) != 0)
+        || loops_to_entry(mmu, entry, sym->size, thumb))
+            continue;
+
+        hle_routine h = {defs[i].name, defs[i].fn, entry, 0, 0};
+
+        routines.insert(std::make_pair(entry, h));//aliases of one routine share the entry, the first name is kept
+    }
+}
+
+/**
+  * Find the routines of the C library and the AEABI helpers in the symbol table of the program, those of one instruction set.
+  * @param mmu The memory of the program
+  * @param thumb Whether to take the Thumb routines, otherwise the ARM ones
+  */
+void hle_table::init(MMU *mmu, bool thumb)
+{
+    routines.clear();
+    if (level == HLE_OFF)
+        return;
+
+    add(mmu, libc_routines, sizeof(libc_routines) / sizeof(libc_routines[0]), thumb);
+    add(mmu, aeabi_routines, aeabi_routine_num, thumb);
+    if (level < HLE_PRINTF)
+        return;
+
+    const guest_symbol *impure = mmu->getSymbol("_impure_ptr");
+    bool nano = mmu->getSymbol("_printf_i") != NULL;
+
+    impure_ptr = impure != NULL && !impure->func ? impure->address : 0;
+    print_float = !nano || mmu->getSymbol("_printf_float") != NULL;
+    print_long_long = !nano;
+    add(mmu, print_routines, sizeof(print_routines) / sizeof(print_routines[0]), thumb);
+}
+
+/**
+  * Give out the stdout stream of the program, _impure_ptr->_stdout of newlib, whose struct _reent starts with _errno, _stdin, _stdout and _stderr.
+  * @param mmu The memory of the program
+  * @return The virtual address of the FILE, 0 if the program has no _impure_ptr
+  */
+uint32_t hle_table::stdOut(MMU *mmu) const
+{
+    uint32_t reent, stream;
+
+    if (impure_ptr == 0 || !guest_word(mmu, impure_ptr, reent) || !guest_word(mmu, reent + 8, stream))
+        return 0;
+    return stream;
+}
+
+/**
+  * Whether a stream of the program is its stdout or stderr, with nothing of its own in its buffer, whose output printf() can then write ahead of it. The FILE of newlib starts with _p, _r, _w, the short _flags and _file, and _bf._base, so _file is 1 or 2 and _p is still at _bf._base. A stream not set up yet by __sinit() has _file 0, and is left to the program.
+  * @param mmu The memory of the program
+  * @param stream The virtual address of the FILE
+  */
+bool hle_table::stdStream(MMU *mmu, uint32_t stream) const
+{
+    uint32_t p, flags_file, base;
+
+    if (stream == 0 || !guest_word(mmu, stream, p) || !guest_word(mmu, stream + 12, flags_file) || !guest_word(mmu, stream + 16, base))
+        return false;
+
+    int file = (int16_t)(flags_file>>16);
+
+    return (file == 1 || file == 2) && (base == 0 || p == base);
+}
+
+/**
+  * Write output of the program to the console, where SYS_WRITE sends the handle newlib opens ":tt" with, for both stdout and stderr.
+  * @param data The output
+  */
+void hle_table::write(const std::string &data) const
+{
+    if (console != NULL)
+        console->append(data);
+    else
+    {
+        ssize_t res = ::write(1, data.data(), data.size());
+
+        (void)res;//a failed write is not seen by the program, which has had its return value already
+    }
+}
+
+/**
+  * Print the routines found, by entry point, and how many of their calls ran on the host.
+  * @param fp The output file
+  */
+void hle_table::dump(FILE *fp)
+{
+    for (std::map<int, hle_routine>::iterator it = routines.begin(); it != routines.end(); ++it)
+        fprintf(fp, "HLE: %-8s at 0x%08x, %llu calls on the host, %llu left to the guest routine\n",
+                it->second.name, it->first, it->second.calls, it->second.declined);
+}
+
+/**
+  * Run a library routine on the host instead of the guest one, whose entry point PC is at, and return to LR as BX LR would.
+  * @param h The routine
+  * @return false if the host routine left the call to the guest one, nothing is changed then
+  */
+bool Thumb::hle_run(hle_routine &h)
+{
+    if (!h.fn(r, my_mmu, hle))
+    {
+        h.declined++;
+        return false;
+    }
+
+    h.calls++;
+    interwork(rLR);
+    return true;
+}
+
+/**
+  * The first instruction of a library routine run on the host, for the interpreter loops. The whole call counts as this one instruction; a call left to the guest routine runs the instruction as usual.
+  * @param d The predecoded instruction
+  */
+void Thumb::hle_call(const t_decoded &d)
+{
+    hle_routine *h = hle.lookup(rPC - 2);
+
+    if (h == NULL || !hle_run(*h))
+        (this->*(handler_tab[d.cls]))(d);
+}
+
+/**
+  * Run a library routine on the host instead of the guest one, whose entry point PC is at, and return to LR as BX LR would.
+  * @param h The routine
+  * @return false if the host routine left the call to the guest one, nothing is changed then
+  */
+bool ARM::hle_run(hle_routine &h)
+{
+    if (!h.fn(r, my_mmu, hle))
+    {
+        h.declined++;
+        return false;
+    }
+
+    h.calls++;
+    interwork(rLR);
+    return true;
+}
+
+/**
+  * The first instruction of a library routine run on the host. The whole call counts as this one instruction; a call left to the guest routine decodes the instruction again and runs it as usual.
+  * @param d The predecoded instruction
+  */
+void ARM::hle_call(const a_decoded &d)
+{
+    hle_routine *h = hle.lookup(rPC - 4);
+
+    if (h != NULL && hle_run(*h))
+        return;
+
+    a_decoded n;
+
+    decode_fields(rPC - 4, n);
+    if (n.cond == 14 || ConditionPassed(n.cond))
+        (this->*(n.handler))(n);
+}
@@ -0,0 +1,136 @@
+/*! \file hle.h
+	\brief Library routines of the program run on the host.
+
+	Compiled programs spend much of their time in memcpy, memset, strlen, printf, ... of the C library, and in the division and soft-float helpers of the run-time library, run one instruction at a time. These routines are found by name in the symbol table of the ELF file, and a call reaching the entry point of one of them is done by a host routine on the memory of MMU, which then returns to LR.
+ */
+#ifndef __HLE_H__
+#define __HLE_H__
+
+/*!
+	\addtogroup instruction
+ */
+/*@{*/
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include "arch.h"
+
+/*! \def HLE_OFF
+	\brief No routine of the program runs on the host
+ */
+#define HLE_OFF         0
+
+/*! \def HLE_ON
+	\brief The memory and string routines of the C library and the AEABI helpers run on the host
+ */
+#define HLE_ON          1
+
+/*! \def HLE_PRINTF
+	\brief printf(), fprintf(), sprintf() and snprintf() run on the host too
+ */
+#define HLE_PRINTF      2
+
+class MMU;
+class hle_table;
+
+/*! \typedef hle_fn
+	\brief A host routine, given the registers at the call, the memory of the program and the table it was found in. It sets the result registers and returns true, or returns false having changed nothing, to leave the call to the guest routine.
+ */
+typedef bool (*hle_fn)(GP_Reg *r, MMU *mmu, const hle_table &t);
+
+/*! \struct hle_def
+	\brief A host routine, and the name of the guest routine it replaces.
+ */
+struct hle_def
+{
+	//! The name the program links the guest routine with
+    const char *name;
+	//! The host routine
+    hle_fn fn;
+};
+
+//! The AEABI run-time helpers, integer division and soft-float, see aeabi.cpp
+extern const hle_def aeabi_routines[];
+//! The number of aeabi_routines
+extern const int aeabi_routine_num;
+
+/*! \struct hle_routine
+	\brief A routine of the program run on the host.
+ */
+struct hle_routine
+{
+	//! The name of the guest routine
+    const char *name;
+	//! The host routine
+    hle_fn fn;
+	//! The virtual address of the entry point of the guest routine
+    int entry;
+	//! How many calls ran on the host, and how many were left to the guest routine
+    unsigned long long calls, declined;
+};
+
+/*! \class hle_table
+	\brief The routines of the program run on the host, by the address of their entry point.
+
+	Each decoder has its own table, of the routines in its instruction set. Only routines whose size the symbol table gives are taken, and only if no branch in them goes back to the entry point: reaching it is then always a call.
+ */
+class hle_table
+{
+public:
+	//! A constructor, the table is enabled
+    hle_table();
+
+private:
+	//! Which routines are run on the host, HLE_OFF, HLE_ON or HLE_PRINTF
+    int level;
+	//! The routines found in the program, by entry point
+    std::map<int, hle_routine> routines;
+	//! Where the console output goes instead of the host stdout, NULL for stdout
+    std::string *console;
+	//! The virtual address of _impure_ptr of the program, which points at its stdin, stdout and stderr, 0 if it has none
+    int impure_ptr;
+	//! Whether the printf() of the program formats floating point, which the newlib-nano one only does if _printf_float is linked in
+    bool print_float;
+	//! Whether the printf() of the program formats 64-bit integers, which the newlib-nano one does not
+    bool print_long_long;
+
+	//! Take the routines of a table which the program has
+    void add(MMU *mmu, const hle_def *defs, int num, bool thumb);
+
+public:
+	//! Choose which routines init() finds, HLE_OFF leaves all of them to the emulator
+    void enable(int l){ level = l; };
+	//! Write the output of printf() to a string, NULL to write it to stdout
+    void setConsole(std::string *out){ console = out; };
+	//! Whether a stream of the program is its stdout or stderr, with no output of its own buffered
+    bool stdStream(MMU *mmu, uint32_t stream) const;
+	//! Give out the stdout stream of the program, 0 if it cannot be found
+    uint32_t stdOut(MMU *mmu) const;
+	//! Write output of the program to the console, where SYS_WRITE sends stdout and stderr
+    void write(const std::string &data) const;
+	//! Whether the printf() of the program formats floating point
+    bool printFloat() const { return print_float; };
+	//! Whether the printf() of the program formats 64-bit integers
+    bool printLongLong() const { return print_long_long; };
+	//! Find the routines of the program loaded into an MMU, the Thumb ones or the ARM ones
+    void init(MMU *mmu, bool thumb);
+	//! Give out the routine whose entry point is at an address, NULL if none
+    /*!
+		\param address The virtual address of an instruction
+	 */
+    hle_routine *lookup(int address)
+    {
+        if (routines.empty())
+            return NULL;
+
+        std::map<int, hle_routine>::iterator it = routines.find(address);
+
+        return it == routines.end() ? NULL : &it->second;
+    };
+	//! Print how many calls of each routine ran on the host
+    void dump(FILE *fp);
+};
+
+/*@}*/
+#endif // __HLE_H__
@@ -0,0 +1,555 @@
+/*! \file idiom.cpp
+	\brief Guest copy, fill and compare loops run on the host.
+
+	A loop is recognised statically from its closing branch, see Thumb::match_idiom(). When the branch is taken, the runs the loop will make are counted from its registers, and all but the last of them done on the host; the last one is left to the handlers, so the registers and flags on leaving are the ones the loop leaves.
+ */
+#include <string.h>
+#include "idiom.h"
+#include "Thumb.h"
+
+/**
+  * The condition on the flags of c - x which is the one on the flags of x - c, for the tests whose constant is the first operand.
+  */
+static const uint8_t mirror_cond[14] = {0, 1, 9, 8, 4, 5, 6, 7, 3, 2, 13, 12, 11, 10};
+
+/**
+  * The value a register has in the loop where an instruction reads it: what the runs before added, plus what this run added up to the instruction.
+  * @param r The register
+  * @param delta What this run added to each register so far
+  * @param step What each run adds to each register
+  * @return The value, the register as it is at the branch back plus off and step * i
+  */
+static idiom_val loop_val(int r, const int32_t *delta, const int32_t *step)
+{
+    idiom_val v;
+
+    v.reg = r;
+    v.off = delta[r];
+    v.step = step[r];
+    return v;
+}
+
+/**
+  * Find the idiom of the loop a branch closes, recognised on the first call for the address.
+  * @param address The virtual address of the branch
+  * @return The idiom, NULL if the loop is not one
+  */
+t_idiom *Thumb::loop_idiom(int address)
+{
+    std::unordered_map<int, t_idiom>::iterator it = idioms.find(address);
+
+    if (it == idioms.end())
+    {
+        t_idiom &id = idioms[address];
+
+        if (!match_idiom(address, id))
+            id.n = 0;
+        return id.n != 0 ? &id : NULL;
+    }
+
+    return it->second.n != 0 ? &it->second : NULL;
+}
+
+/**
+  * Whether the branch at an address closes a loop of at most IDIOM_LOOP_INSTRS instructions which copies, fills or compares memory. The loop may have loads and stores with immediate or register offsets, add and sub of an immediate, cmp, and conditional branches out of it. Each register r0-r7 has to be one of:
+  * - left alone by the loop, the bases, ends and fill values;
+  * - only stepped by add or sub of an immediate, the pointers and counters;
+  * - loaded once per run before the loop reads it, the values copied or compared.
+  *
+  * Stores store a loaded value of the same size, or a register the loop leaves alone. Conditional branches test a stepped register against a constant or a register left alone, or two loaded values for equality.
+  * @param address The virtual address of the branch
+  * @param id Filled with the loop, as it is at the branch back
+  * @return true if the loop is an idiom
+  */
+bool Thumb::match_idiom(int address, t_idiom &id)
+{
+    t_decoded body[IDIOM_LOOP_INSTRS];
+    int kind[8] = {0}, loads[8] = {0};//kind: 1 stepped, 2 loaded
+    int32_t delta[8] = {0};
+    int8_t loaded[8];
+    bool work = false;
+
+    decode_fields(address, body[0]);
+    if (body[0].cls != T_CON_BR && body[0].cls != T_UNCON_BR)
+        return false;
+    if (body[0].imm >= address || (address - body[0].imm)/2 >= IDIOM_LOOP_INSTRS || body[0].imm < my_mmu->getTextVMA())
+        return false;
+
+    id.head = body[0].imm;
+    id.n = (address - id.head)/2 + 1;
+    id.streams = id.tests = 0;
+    id.skip = 0;
+    id.hits = id.runs = 0;
+    memset(id.step, 0, sizeof(id.step));
+    memset(loaded, -1, sizeof(loaded));
+
+    //what writes each register
+    for (int k = 0; k < id.n; k++)
+    {
+        t_decoded &d = body[k];
+
+        decode_fields(id.head + k * 2, d);
+        switch (d.cls)
+        {
+            case T_LD_STR_WORD_BYTE_IMM:
+            case T_LD_STR_HALFW_IMM:
+            case T_LD_STR_REG_OFFSET:
+                if ((d.cls == T_LD_STR_REG_OFFSET && d.op >= 3) || (d.cls != T_LD_STR_REG_OFFSET && (d.op & MASK_1BIT)))
+                {
+                    kind[d.rd] |= 2;
+                    loads[d.rd]++;
+                }
+                break;
+            case T_ADD_SUB_MOV_CMP_IMM://cmp, add, sub
+                if (d.op == 0)
+                    return false;
+                if (d.op >= 2)
+                {
+                    kind[d.rd] |= 1;
+                    id.step[d.rd] += d.op == 2 ? d.imm : -d.imm;
+                }
+                break;
+            case T_ADD_SUB_REG_OR_IMM://add, sub of an immediate to the register itself
+                if (d.op < 2 || d.rd != d.rn)
+                    return false;
+                kind[d.rd] |= 1;
+                id.step[d.rd] += d.op == 2 ? d.imm : -d.imm;
+                break;
+            case T_DATA_PROC_REG://cmp
+                if (d.op != 10)
+                    return false;
+                break;
+            case T_CON_BR:
+                if (k < id.n - 1 && d.imm >= id.head && d.imm <= address)
+                    return false;
+                break;
+            case T_UNCON_BR:
+                if (k < id.n - 1)
+                    return false;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    for (int i = 0; i < 8; i++)
+        if (kind[i] == 3 || (kind[i] == 2 && loads[i] != 1))
+            return false;
+
+    //the streams and the tests, with the flags of the last compare
+    bool flags = false, data = false, add = false;
+    idiom_val fa, fb;
+    int8_t fla = -1, flb = -1;
+
+    for (int k = 0; k < id.n; k++)
+    {
+        const t_decoded &d = body[k];
+
+        switch (d.cls)
+        {
+            case T_LD_STR_WORD_BYTE_IMM:
+            case T_LD_STR_HALFW_IMM:
+            case T_LD_STR_REG_OFFSET:
+            {
+                static const uint8_t reg_size[8] = {4, 2, 1, 1, 4, 2, 1, 2};//STR, STRH, STRB, LDRSB, LDR, LDRH, LDRB, LDRSH
+                int index = d.cls == T_LD_STR_REG_OFFSET ? d.rm : -1;
+
+                if (id.streams == IDIOM_MAX_STREAMS || kind[d.rn] == 2 || (index >= 0 && kind[index] == 2))
+                    return false;
+
+                idiom_stream &s = id.s[id.streams];
+
+                s.base = d.rn;
+                s.index = index;
+                s.off = d.imm + delta[d.rn] + (index >= 0 ? delta[index] : 0);
+                s.step = id.step[d.rn] + (index >= 0 ? id.step[index] : 0);
+                s.sign = false;
+                if (d.cls == T_LD_STR_REG_OFFSET)
+                {
+                    s.size = reg_size[d.op];
+                    s.store = d.op < 3;
+                    s.sign = d.op == 3 || d.op == 7;
+                }
+                else
+                {
+                    s.size = d.cls == T_LD_STR_HALFW_IMM ? 2 : (d.op & 2) ? 1 : 4;
+                    s.store = !(d.op & MASK_1BIT);
+                }
+                s.align = d.cls == T_LD_STR_REG_OFFSET && d.op == 2 ? 4 : s.size;//STRB(2) wants a word address
+                s.src = s.value = -1;
+
+                if (!s.store)
+                    loaded[d.rd] = id.streams;
+                else if (kind[d.rd] == 2)//copy
+                {
+                    if (loaded[d.rd] < 0 || id.s[loaded[d.rd]].size != s.size)
+                        return false;
+                    s.src = loaded[d.rd];
+                    work = true;
+                }
+                else if (kind[d.rd] == 0)//fill
+                {
+                    s.value = d.rd;
+                    work = true;
+                }
+                else
+                    return false;
+
+                id.streams++;
+                break;
+            }
+            case T_ADD_SUB_MOV_CMP_IMM:
+            case T_ADD_SUB_REG_OR_IMM:
+            {
+                int rd = d.rd;
+
+                if (kind[rd] == 2)
+                    return false;
+                flags = true;
+                data = false;
+                add = d.op == 2;
+                fa = loop_val(rd, delta, id.step);
+                fb.reg = -1;
+                fb.off = d.imm;
+                fb.step = 0;
+                if (!(d.cls == T_ADD_SUB_MOV_CMP_IMM && d.op == 1))//add, sub
+                    delta[rd] += add ? d.imm : -d.imm;
+                break;
+            }
+            case T_DATA_PROC_REG://cmp Rn, Rm
+                flags = true;
+                add = false;
+                data = kind[d.rd] == 2 || kind[d.rm] == 2;
+                if (data)
+                {
+                    fla = loaded[d.rd];
+                    flb = loaded[d.rm];
+                    if (kind[d.rd] != 2 || kind[d.rm] != 2 || fla < 0 || flb < 0)
+                        return false;
+                }
+                else
+                {
+                    fa = loop_val(d.rd, delta, id.step);
+                    fb = loop_val(d.rm, delta, id.step);
+                }
+                break;
+            case T_CON_BR:
+            {
+                int cond = k == id.n - 1 ? d.op : d.op ^ 1;//the loop goes on while it holds
+
+                if (!flags || id.tests == IDIOM_MAX_TESTS)
+                    return false;
+
+                idiom_test &t = id.t[id.tests];
+
+                if (data)
+                {
+                    const idiom_stream &a = id.s[fla], &b = id.s[flb];
+
+                    if (cond != 0 || a.size != b.size || a.sign != b.sign || a.step != a.size || b.step != b.size)
+                        return false;
+                    t.la = fla;
+                    t.lb = flb;
+                    work = true;
+                }
+                else
+                {
+                    if ((cond >= 4 && cond <= 7) || cond > 13 || (add && cond > 1))
+                        return false;
+                    if (add)//Z of x + imm is the one of x - (-imm)
+                        fb.off = -fb.off;
+                    if (fb.step == 0)
+                    {
+                        t.x = fa;
+                        t.c = fb;
+                    }
+                    else if (fa.step == 0)
+                    {
+                        t.x = fb;
+                        t.c = fa;
+                        cond = mirror_cond[cond];
+                    }
+                    else
+                        return false;
+                    t.la = t.lb = -1;
+                }
+                t.cond = cond;
+                id.tests++;
+                break;
+            }
+            default://the branch back
+                break;
+        }
+    }
+
+    return work;
+}
+
+/**
+  * How many runs in a row a value test lets the loop go on, from the run about to start. x steps through x + step * i, and the loop goes on while the condition holds on the flags of x - c. Where the value would wrap around before the test fails, the runs up to the wrap are given, the loop runs on by itself from there.
+  * @param cond The condition, EQ, NE, or one of the unsigned and signed orders
+  * @param x The value in the run about to start
+  * @param step What each run adds to it
+  * @param c What it is compared with
+  * @param limit The most runs wanted
+  * @return The runs, at most limit
+  */
+static uint64_t test_runs(int cond, uint32_t x, int32_t step, uint32_t c, uint64_t limit)
+{
+    uint64_t runs = limit;
+
+    if (cond == 0)//EQ
+        return x != c ? 0 : (step == 0 ? limit : (limit < 1 ? limit : 1));
+
+    if (cond == 1)//NE
+    {
+        if (x == c)
+            return 0;
+        if (step == 0)
+            return limit;
+
+        uint32_t s = step > 0 ? step : -(uint32_t)step;
+        uint32_t d = step > 0 ? c - x : x - c;
+
+        runs = d % s == 0 ? d / s : ((uint64_t)d + (1ull<<32)) / s;//past the wrap it is at least that far
+        return runs < limit ? runs : limit;
+    }
+
+    //the orders, counted on 64 bits where nothing wraps
+    bool sign = cond >= 10;
+    bool above = cond == 2 || cond == 8 || cond == 10 || cond == 12;//CS, HI, GE, GT: goes on while x >= bound
+    int64_t X = sign ? (int64_t)(int32_t)x : (int64_t)x;
+    int64_t bound = sign ? (int64_t)(int32_t)c : (int64_t)c;
+    int64_t lo = sign ? INT32_MIN : 0, hi = sign ? INT32_MAX : UINT32_MAX;
+
+    if (cond == 8 || cond == 9 || cond == 12 || cond == 13)//HI, LS, GT, LE
+        bound++;
+    if (above ? X < bound : X >= bound)
+        return 0;
+
+    if (step > 0)
+    {
+        uint64_t inside = (hi - X) / step + 1;
+
+        if (inside < runs)
+            runs = inside;
+        if (!above && (uint64_t)((bound - X + step - 1) / step) < runs)
+            runs = (bound - X + step - 1) / step;
+    }
+    else if (step < 0)
+    {
+        uint64_t inside = (X - lo) / -(int64_t)step + 1;
+
+        if (inside < runs)
+            runs = inside;
+        if (above && (uint64_t)((X - bound) / -(int64_t)step + 1) < runs)
+            runs = (X - bound) / -(int64_t)step + 1;
+    }
+
+    return runs;
+}
+
+/**
+  * Find the host memory of every stream of an idiom for a number of runs. Every access has to be aligned as its handler wants, and the range of a stream has to lie in one segment MMU gives out host memory for, writable for a store; the stack is not, its words are kept reversed. A store must not overlap any other stream, so the accesses of the runs can be done in any order.
+  * @param mmu The memory
+  * @param r The registers at the branch back
+  * @param id The idiom
+  * @param runs The number of runs
+  * @param host Filled with the host address of the first access of each stream
+  * @return false if the runs can not be done on the host
+  */
+static bool stream_memory(MMU *mmu, const GP_Reg *r, const t_idiom &id, uint64_t runs, BYTE **host)
+{
+    uint32_t lo[IDIOM_MAX_STREAMS], hi[IDIOM_MAX_STREAMS];
+
+    for (int k = 0; k < id.streams; k++)
+    {
+        const idiom_stream &s = id.s[k];
+        uint32_t a = r[s.base] + (s.index >= 0 ? r[s.index] : 0) + s.off;
+        int64_t end = (int64_t)a + (int64_t)s.step * (int64_t)(runs - 1);
+        int VMA, size;
+
+        if (a % s.align != 0 || s.step % s.align != 0 || end < 0 || end > (int64_t)0xffffffff - s.size)
+            return false;
+
+        lo[k] = a < end ? a : end;
+        hi[k] = (a > end ? a : end) + s.size;
+
+        BYTE *seg = mmu->host_range(lo[k], s.store, VMA, size);
+
+        if (seg == NULL || hi[k] - (uint32_t)VMA > (uint32_t)size)
+            return false;
+        host[k] = seg + (a - (uint32_t)VMA);
+    }
+
+    for (int k = 0; k < id.streams; k++)
+        if (id.s[k].store)
+            for (int j = 0; j < id.streams; j++)
+                if (j != k && lo[j] < hi[k] && lo[k] < hi[j])
+                    return false;
+
+    return true;
+}
+
+/**
+  * The runs a compare loop goes on, while its two streams read equal values.
+  * @param a The host memory of the first stream
+  * @param b The host memory of the second stream
+  * @param size The access size, both streams step by it
+  * @param runs The most runs
+  * @return The runs before the first difference, at most runs
+  */
+static uint64_t equal_runs(const BYTE *a, const BYTE *b, int size, uint64_t runs)
+{
+    if (memcmp(a, b, runs * size) == 0)
+        return runs;
+
+    uint64_t j = 0;
+
+    while (a[j] == b[j])
+        j++;
+    return j / size;
+}
+
+/**
+  * Copy a stream of a loop to another for a number of runs, with memcpy() where both are contiguous.
+  * @param dst The host memory of the first store
+  * @param dstep What each run adds to the store address
+  * @param src The host memory of the first load
+  * @param sstep What each run adds to the load address
+  * @param size The access size
+  * @param m The number of runs
+  */
+static void copy_runs(BYTE *dst, int32_t dstep, const BYTE *src, int32_t sstep, int size, uint64_t m)
+{
+    if (dstep == sstep && (dstep == size || dstep == -size))
+    {
+        uint64_t back = dstep < 0 ? (m - 1) * size : 0;
+
+        memcpy(dst - back, src - back, m * size);
+        return;
+    }
+
+    for (uint64_t i = 0; i < m; i++)
+        memcpy(dst + (int64_t)i * dstep, src + (int64_t)i * sstep, size);
+}
+
+/**
+  * Store one value over a stream of a loop for a number of runs, with memset() where the stream is contiguous and the bytes of the value are the same.
+  * @param dst The host memory of the first store
+  * @param step What each run adds to the store address
+  * @param value The register stored, its low size bytes
+  * @param size The access size
+  * @param m The number of runs
+  */
+static void fill_runs(BYTE *dst, int32_t step, uint32_t value, int size, uint64_t m)
+{
+    BYTE bytes[4];
+
+    memcpy(bytes, &value, 4);//guest memory is little endian, as the host
+    if ((step == size || step == -size) && (size == 1 || (bytes[1] == bytes[0] && (size == 2 || (bytes[2] == bytes[0] && bytes[3] == bytes[0])))))
+    {
+        uint64_t back = step < 0 ? (m - 1) * size : 0;
+
+        memset(dst - back, bytes[0], m * size);
+        return;
+    }
+
+    for (uint64_t i = 0; i < m; i++)
+        memcpy(dst + (int64_t)i * step, bytes, size);
+}
+
+/**
+  * The closing branch of an idiom was taken, do the runs the loop makes from here on the host, but the last one. The runs are bounded by the value tests, by the budget, and by the first difference of a compare; their loads and stores are done with memcpy(), memset() and memcmp(), the stepped registers moved on, and the budget charged as if they had run. The last run is left to the handlers: it writes every loaded register before reading it and sets the flags the loop leaves, so nothing the host runs skipped can be seen. If the memory can not be used on the host the loop runs by itself for IDIOM_BACKOFF taken branches.
+  * @param id The idiom, PC is at its head
+  */
+void Thumb::idiom_run(t_idiom &id)
+{
+    BYTE *host[IDIOM_MAX_STREAMS];
+    uint64_t runs = budget / id.n;
+
+    if (id.skip != 0)
+    {
+        id.skip--;
+        return;
+    }
+
+    for (int k = 0; k < id.tests; k++)
+    {
+        const idiom_test &t = id.t[k];
+
+        if (t.la < 0)
+            runs = test_runs(t.cond, r[t.x.reg] + t.x.off, t.x.step, (t.c.reg >= 0 ? r[t.c.reg] : 0) + t.c.off, runs);
+    }
+    if (runs > 0xffffffffu)
+        runs = 0xffffffffu;
+    if (runs < 2)
+        return;
+
+    if (!stream_memory(my_mmu, r, id, runs, host))
+    {
+        id.skip = IDIOM_BACKOFF;
+        return;
+    }
+
+    for (int k = 0; k < id.tests; k++)
+        if (id.t[k].la >= 0)
+            runs = equal_runs(host[id.t[k].la], host[id.t[k].lb], id.s[id.t[k].la].size, runs);
+    if (runs < 2)
+        return;
+
+    uint64_t m = runs - 1;
+
+    for (int k = 0; k < id.streams; k++)
+    {
+        const idiom_stream &s = id.s[k];
+
+        if (!s.store)
+            continue;
+        if (s.src >= 0)
+            copy_runs(host[k], s.step, host[s.src], id.s[s.src].step, s.size, m);
+        else
+            fill_runs(host[k], s.step, r[s.value], s.size, m);
+    }
+
+    for (int i = 0; i < 8; i++)
+        r[i] += (uint32_t)((int64_t)id.step[i] * (int64_t)m);
+    budget -= m * id.n;
+    id.hits++;
+    id.runs += m;
+}
+
+/**
+  * A branch closing an idiom, as con_br() or uncon_br(), which runs the loop on the host once the branch is taken. The block engine runs con_br() and uncon_br() and the idiom in run_blocks().
+  * @param d The predecoded entry of the branch
+  */
+void Thumb::idiom_br(const t_decoded &d)
+{
+    if (d.cls == T_UNCON_BR || ConditionPassed(d.op))
+    {
+        t_idiom *id = loop_idiom(rPC - 2);
+
+        rPC = d.imm;
+        idiom_run(*id);
+    }
+}
+
+/**
+  * Print how many loops were recognised as idioms, and how much of them ran on the host.
+  * @param fp The output file
+  */
+void Thumb::dump_idioms(FILE *fp)
+{
+    int loops = 0;
+    unsigned long long hits = 0, runs = 0;
+
+    for (std::unordered_map<int, t_idiom>::iterator it = idioms.begin(); it != idioms.end(); ++it)
+        if (it->second.n != 0)
+        {
+            loops++;
+            hits += it->second.hits;
+            runs += it->second.runs;
+        }
+
+    fprintf(fp, "Idioms: %d copy, fill and compare loops recognised, run %llu times on the host for %llu runs\n", loops, hits, runs);
+}
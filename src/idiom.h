@@ -0,0 +1,117 @@
+/*! \file idiom.h
+	\brief Guest copy, fill and compare loops run on the host.
+
+	Compiled guest code copies, fills and compares memory with short Thumb loops of loads, stores, add or sub of an immediate and a conditional branch. Such a loop is recognised from its closing branch, and when its branch is taken its next runs are done by host memcpy(), memset() and memcmp() on the memory of MMU.
+ */
+#ifndef __IDIOM_H__
+#define __IDIOM_H__
+
+/*!
+	\addtogroup instruction
+ */
+/*@{*/
+
+#include "arch.h"
+
+/*! \def IDIOM_LOOP_INSTRS
+	\brief The most instructions of a loop recognised as an idiom
+ */
+#define IDIOM_LOOP_INSTRS   16
+
+/*! \def IDIOM_MAX_STREAMS
+	\brief The most loads and stores in the loop of an idiom
+ */
+#define IDIOM_MAX_STREAMS   6
+
+/*! \def IDIOM_MAX_TESTS
+	\brief The most tests, conditional branches, in the loop of an idiom
+ */
+#define IDIOM_MAX_TESTS     4
+
+/*! \def IDIOM_BACKOFF
+	\brief The taken branches an idiom lets the loop run by itself after its memory could not be used on the host
+ */
+#define IDIOM_BACKOFF       64
+
+/*! \struct idiom_val
+	\brief A value of the loop, r[reg] + off + step * i in run i counted from the branch back, reg -1 for a constant.
+ */
+struct idiom_val
+{
+	//! The register, -1 for none
+    int8_t reg;
+	//! What the loop added to the register before the value is taken, or the constant
+    int32_t off;
+	//! What each run adds
+    int32_t step;
+};
+
+/*! \struct idiom_stream
+	\brief A load or a store of the loop, one access per run.
+ */
+struct idiom_stream
+{
+	//! The address, r[base] + r[index] + off + step * i
+    int8_t base, index;
+	//! The constant part of the address
+    int32_t off;
+	//! What each run adds to the address
+    int32_t step;
+	//! The access size in bytes
+    uint8_t size;
+	//! The alignment the handler wants, which is not always the size
+    uint8_t align;
+	//! Whether it is a store
+    bool store;
+	//! Whether it is a sign extending load
+    bool sign;
+	//! For a store, the load stream whose value it stores, -1 for a fill
+    int8_t src;
+	//! For a fill, the register stored, which the loop does not change
+    int8_t value;
+};
+
+/*! \struct idiom_test
+	\brief A conditional branch of the loop, and the flags it reads.
+
+	A value test compares x with c, which the loop does not change, as the flags of x - c are read by a condition. A data test compares what two load streams read, the loop going on while they are equal.
+ */
+struct idiom_test
+{
+	//! The value compared, a register the loop steps
+    idiom_val x;
+	//! What it is compared with
+    idiom_val c;
+	//! The condition under which the loop goes on, for a value test
+    uint8_t cond;
+	//! The load streams of a data test, -1 for a value test
+    int8_t la, lb;
+};
+
+/*! \struct t_idiom
+	\brief A loop which copies, fills or compares memory, recognised from its closing branch.
+ */
+struct t_idiom
+{
+	//! The virtual address of the first instruction, the target of the branch
+    int head;
+	//! The number of instructions of a run, the branch included, 0 if the loop is not an idiom
+    int n;
+	//! The loads and stores
+    idiom_stream s[IDIOM_MAX_STREAMS];
+	//! The number of streams
+    int streams;
+	//! The conditional branches
+    idiom_test t[IDIOM_MAX_TESTS];
+	//! The number of tests
+    int tests;
+	//! What each run adds to r0-r7, 0 for the registers it does not step
+    int32_t step[8];
+	//! The taken branches left before the host is tried again
+    int skip;
+	//! How many times runs were done on the host, and how many runs
+    unsigned long long hits, runs;
+};
+
+/*@}*/
+#endif // __IDIOM_H__
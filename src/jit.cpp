@@ -0,0 +1,945 @@
+/*! \file jit.cpp
+	\brief The x86-64 translator for hot Thumb blocks.
+
+	A block is translated as a whole: the ALU instructions, moves, constant loads and branches become host instructions, the others call their handler through Thumb::jit_call(). Flags are only written to CPSR where a later instruction, a handler, or the next block may read them.
+ */
+#include <string.h>
+#include "jit.h"
+#include "Thumb.h"
+#include "error.h"
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+/*! \def JF_N
+	\brief Negative flag in the 4-bit NZCV masks of the translator
+ */
+/*! \def JF_Z
+	\brief Zero flag in the 4-bit NZCV masks of the translator
+ */
+/*! \def JF_C
+	\brief Carry flag in the 4-bit NZCV masks of the translator
+ */
+/*! \def JF_V
+	\brief Overflow flag in the 4-bit NZCV masks of the translator
+ */
+#define JF_N        0x8
+#define JF_Z        0x4
+#define JF_C        0x2
+#define JF_V        0x1
+#define JF_ALL      0xf
+
+/*! \def JIT_INSTR_CODE
+	\brief The most host code bytes one guest instruction can take
+ */
+#define JIT_INSTR_CODE  192
+
+/*! \struct jit_instr
+	\brief What the translator knows about one guest instruction of a block.
+ */
+struct jit_instr
+{
+	//! The flags the instruction reads.
+    int rd_flags;
+	//! The flags the instruction always writes.
+    int wr_flags;
+	//! The flags live after the instruction.
+    int live;
+	//! The guest registers the host code touches, one bit per register.
+    int regs;
+	//! Whether host code is generated, otherwise the handler is called.
+    bool native;
+	//! Whether host CF is the inverted C flag, as after a subtraction.
+    bool inv;
+	//! Whether SF and ZF need a test of the result first.
+    bool test;
+};
+
+/**
+  * The x86 condition code testing a condition field on host flags.
+  * @param cond The condition field
+  * @param inv Whether host CF is the inverted C flag
+  * @return The condition code, -1 if host flags can not express it
+  */
+static int cond_cc(int cond, bool inv)
+{
+    switch (cond)
+    {
+        case 0: return 0x4;//e
+        case 1: return 0x5;//ne
+        case 2: return inv ? 0x3 : 0x2;//ae : b
+        case 3: return inv ? 0x2 : 0x3;
+        case 4: return 0x8;//s
+        case 5: return 0x9;//ns
+        case 6: return 0x0;//o
+        case 7: return 0x1;//no
+        case 8: return inv ? 0x7 : -1;//a
+        case 9: return inv ? 0x6 : -1;//be
+        case 10: return 0xd;//ge
+        case 11: return 0xc;//l
+        case 12: return 0xf;//g
+        case 13: return 0xe;//le
+        default: return -1;
+    }
+}
+
+/**
+  * Fill in what the translator knows about an instruction: the flags the handler reads and writes, and whether host code can replace the handler. Host flags of the native instructions match the handlers'.
+  * @param d The predecoded instruction
+  * @param ji The result
+  */
+static void analyse(const t_decoded &d, jit_instr &ji)
+{
+    ji.rd_flags = ji.wr_flags = 0;
+    ji.regs = 0;
+    ji.native = false;
+    ji.inv = ji.test = false;
+
+    switch (d.cls)
+    {
+        case T_ADD_SUB_REG_OR_IMM:
+        {
+            bool imm = (d.op>>1) & MASK_1BIT;
+
+            ji.wr_flags = JF_ALL;
+            ji.inv = d.op & MASK_1BIT;
+            ji.regs = (1<<d.rd) | (1<<d.rn) | (imm ? 0 : 1<<d.rm);
+            ji.native = true;
+            break;
+        }
+        case T_SHIFT_BY_IMM:
+            ji.wr_flags = (d.op == 0 && d.imm == 0) ? JF_N | JF_Z : JF_N | JF_Z | JF_C;
+            ji.test = d.imm == 0;
+            ji.regs = (1<<d.rd) | (1<<d.rm);
+            ji.native = d.op == 0 || d.imm != 0;
+            break;
+        case T_ADD_SUB_MOV_CMP_IMM:
+            ji.wr_flags = (d.op == 0) ? JF_N | JF_Z : JF_ALL;
+            ji.inv = d.op == 1 || d.op == 3;
+            ji.test = d.op == 0;
+            ji.regs = 1<<d.rd;
+            ji.native = true;
+            break;
+        case T_LD_FROM_POOL:
+            ji.regs = 1<<d.rd;
+            ji.native = true;//only if the pool is in code segment, checked by compile()
+            break;
+        case T_SPEC_DATA_PROC:
+            if (d.op == 1)//cmp
+            {
+                ji.wr_flags = JF_ALL;
+                ji.inv = true;
+            }
+            ji.regs = (1<<d.rd) | (1<<d.rm);
+            ji.native = d.rd != 15 && d.rm != 15;
+            break;
+        case T_DATA_PROC_REG:
+            ji.regs = (1<<d.rd) | (1<<d.rm);
+            switch (d.op)
+            {
+                case 0:case 1:case 8:case 12:case 14://and, eor, tst, orr, bic
+                    ji.wr_flags = JF_N | JF_Z;
+                    ji.native = true;
+                    break;
+                case 13:case 15://mul, mvn
+                    ji.wr_flags = JF_N | JF_Z;
+                    ji.test = true;
+                    ji.native = true;
+                    break;
+                case 9://neg
+                    ji.wr_flags = JF_ALL;
+                    ji.inv = true;
+                    ji.native = true;
+                    break;
+                case 10:case 11://cmp, cmn
+                    ji.wr_flags = JF_ALL;
+                    ji.inv = d.op == 10;
+                    ji.native = true;
+                    break;
+                case 5:case 6://adc, sbc
+                    ji.rd_flags = JF_C;
+                    ji.wr_flags = JF_ALL;
+                    break;
+                default://shift by register, C is kept for a zero shift
+                    ji.wr_flags = JF_N | JF_Z;
+                    break;
+            }
+            break;
+        case T_MISC:
+            switch (d.op)
+            {
+                case 0://adjust sp
+                    ji.regs = 1<<13;
+                    ji.native = true;
+                    break;
+                case 2://extend
+                    ji.regs = (1<<d.rd) | (1<<d.rm);
+                    ji.native = true;
+                    break;
+                case 10://reverse bytes
+                    ji.regs = (1<<d.rd) | (1<<d.rn);
+                    ji.native = d.imm != 2;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case T_ADD_TO_SP_OR_PC:
+            ji.regs = (1<<d.rd) | (d.op ? 1<<13 : 0);
+            ji.native = true;
+            break;
+        case T_CON_BR:
+            ji.rd_flags = cond_pass_tab.reads[d.op];
+            ji.native = true;
+            break;
+        case T_UNCON_BR:
+            ji.native = true;
+            break;
+        case T_BL_BLX_PREFIX:
+        case T_BL_SUFFIX:
+            ji.regs = 1<<14;
+            ji.native = true;
+            break;
+        case T_LD_STR_REG_OFFSET:
+            ji.regs = (1<<d.rd) | (1<<d.rn) | (1<<d.rm);
+            ji.native = true;
+            break;
+        case T_LD_STR_WORD_BYTE_IMM:
+        case T_LD_STR_HALFW_IMM:
+            ji.regs = (1<<d.rd) | (1<<d.rn);
+            ji.native = true;
+            break;
+        case T_LD_STR_STACK:
+            ji.regs = (1<<d.rd) | (1<<13);
+            ji.native = true;
+            break;
+        default://ld/st multiple, push, pop, and the ones ending a block
+            break;
+    }
+}
+
+/*! \struct jit_access
+	\brief How a load or store instruction accesses memory.
+ */
+struct jit_access
+{
+	//! The access size in bytes
+    int size;
+	//! The address bits which must be clear for the host code, otherwise the handler decides
+    int align;
+	//! Whether it is a load
+    bool load;
+	//! Whether a byte or halfword load is sign extended
+    bool sign;
+};
+
+/**
+  * Describe the memory access of a load or store instruction.
+  * @param d The predecoded instruction
+  * @return The access
+  */
+static jit_access mem_access(const t_decoded &d)
+{
+    jit_access a;
+
+    a.sign = false;
+    switch (d.cls)
+    {
+        case T_LD_STR_WORD_BYTE_IMM:
+            a.size = ((d.op>>1) & MASK_1BIT) ? 1 : 4;
+            a.load = d.op & MASK_1BIT;
+            break;
+        case T_LD_STR_HALFW_IMM:
+            a.size = 2;
+            a.load = d.op;
+            break;
+        case T_LD_STR_STACK:
+            a.size = 4;
+            a.load = d.op;
+            break;
+        default://T_LD_STR_REG_OFFSET
+        {
+            static const int size[8] = {4, 2, 1, 1, 4, 2, 1, 2};
+
+            a.size = size[d.op];
+            a.load = d.op >= 3;
+            a.sign = d.op == 3 || d.op == 7;
+            break;
+        }
+    }
+    a.align = a.size - 1;
+    if (d.cls == T_LD_STR_REG_OFFSET && d.op == 2)//the handler wants STRB(2) word aligned
+        a.align = 3;
+
+    return a;
+}
+
+#if defined(__x86_64__)
+
+/*! \struct jit_label
+	\brief A jump whose 32-bit displacement is filled in later.
+ */
+struct jit_label
+{
+	//! Where the displacement is
+    BYTE *at;
+};
+
+/*! \class x86_emitter
+	\brief Write x86-64 machine code for one block.
+
+	Host register use: rbx points to r[], rbp to CPSR, [rsp] keeps the Thumb pointer, r12d-r15d hold cached guest registers, eax, ecx and edx are scratch, r11b keeps a branch condition.
+ */
+class x86_emitter
+{
+public:
+	//! A constructor
+    x86_emitter(BYTE *code){ p = code; for (int i = 0; i < GPR_num; i++) host[i] = -1; dirty = 0; };
+
+	//! The next byte to write
+    BYTE *p;
+	//! The host register of every guest register, -1 for those left in r[]
+    int host[GPR_num];
+	//! The cached guest registers written since they were stored, one bit per register
+    int dirty;
+
+	//! Write a byte
+    void b(int v){ *p++ = (BYTE)v; };
+	//! Write a 32-bit value
+    void d32(uint32_t v){ memcpy(p, &v, 4); p += 4; };
+	//! Write a 64-bit value
+    void d64(uint64_t v){ memcpy(p, &v, 8); p += 8; };
+
+	//! 32-bit register to register operation, dst is the r/m operand
+    void rr(int op, int dst, int src)
+    {
+        int rex = 0x40 | ((src>>3)<<2) | (dst>>3);
+        if (rex != 0x40)
+            b(rex);
+        b(op);
+        b(0xc0 | ((src & 7)<<3) | (dst & 7));
+    };
+	//! 32-bit load or store between a host register and r[g]
+    void rm(int op, int h, int g)
+    {
+        if (h >= 8)
+            b(0x44);
+        b(op);
+        b(0x43 | ((h & 7)<<3));//[rbx + disp8]
+        b(g * 4);
+    };
+	//! Copy guest register g into scratch register h
+    void load(int h, int g)
+    {
+        if (host[g] >= 0)
+            rr(0x89, h, host[g]);
+        else
+            rm(0x8b, h, g);
+    };
+	//! Copy scratch register h into guest register g
+    void store(int g, int h)
+    {
+        if (host[g] >= 0)
+        {
+            rr(0x89, host[g], h);
+            dirty |= 1<<g;
+        }
+        else
+            rm(0x89, h, g);
+    };
+	//! Group 1 operation with a 32-bit immediate on a scratch register, ext is the opcode extension
+    void alu_imm(int ext, int h, uint32_t imm){ b(0x81); b(0xc0 | (ext<<3) | h); d32(imm); };
+	//! Shift a scratch register by an immediate, ext is the opcode extension
+    void shift_imm(int ext, int h, int cnt){ b(0xc1); b(0xc0 | (ext<<3) | h); b(cnt); };
+	//! mov h, imm32
+    void mov_imm(int h, uint32_t imm){ b(0xb8 + h); d32(imm); };
+	//! Set PC to a constant
+    void set_pc(uint32_t addr){ b(0xc7); b(0x43); b(15 * 4); d32(addr); };
+	//! Write the dirty cached registers back to r[]
+    void flush()
+    {
+        for (int g = 0; g < GPR_num; g++)
+            if ((dirty>>g) & 1)
+                rm(0x89, host[g], g);
+    };
+	//! Load every cached register from r[]
+    void reload()
+    {
+        for (int g = 0; g < GPR_num; g++)
+            if (host[g] >= 0)
+                rm(0x8b, host[g], g);
+        dirty = 0;
+    };
+	//! Save the callee-saved registers, and set up rbx, rbp, [rsp]
+    void prologue()
+    {
+        b(0x53); b(0x55);//push rbx, rbp
+        b(0x41); b(0x54); b(0x41); b(0x55); b(0x41); b(0x56); b(0x41); b(0x57);//push r12-r15
+        b(0x48); b(0x83); b(0xec); b(0x08);//sub rsp, 8
+        b(0x48); b(0x89); b(0x3c); b(0x24);//mov [rsp], rdi
+        b(0x48); b(0x89); b(0xf3);//mov rbx, rsi
+        b(0x48); b(0x89); b(0xd5);//mov rbp, rdx
+    };
+	//! Return ret
+    void epilogue(int ret)
+    {
+        if (ret == 0)
+        {
+            b(0x31); b(0xc0);//xor eax, eax
+        }
+        else
+            mov_imm(0, ret);
+        b(0x48); b(0x83); b(0xc4); b(0x08);//add rsp, 8
+        b(0x41); b(0x5f); b(0x41); b(0x5e); b(0x41); b(0x5d); b(0x41); b(0x5c);//pop r15-r12
+        b(0x5d); b(0x5b); b(0xc3);//pop rbp, rbx, ret
+    };
+	//! Leave the block with PC set to a constant
+    void exit_to(uint32_t addr)
+    {
+        flush();
+        set_pc(addr);
+        epilogue(0);
+    };
+	//! Jump back to the head of a block branching to itself while the budget holds another run of it, otherwise leave to its start. A loop without side effects, or an idiom, also leaves every IDLE_CHECK_PERIOD runs, for run_blocks() to watch it or run it on the host.
+    void loop_back(t_block *blk, uint64_t *budget, BYTE *head)
+    {
+        jit_label idle_out;
+
+        flush();
+        if (blk->idle || blk->idiom != NULL)
+        {
+            b(0x48); b(0xb8); d64((uint64_t)&blk->exec_cnt);//mov rax, &exec_cnt
+            b(0xf6); b(0x00); b(IDLE_CHECK_PERIOD - 1);//test byte [rax], period - 1
+            idle_out = jump(0x4);//jz
+        }
+        b(0x48); b(0xb8); d64((uint64_t)budget);//mov rax, &budget
+        b(0x48); b(0x81); b(0x38); d32(blk->n);//cmp qword [rax], n
+        jit_label out = jump(0x2);//jb
+        b(0x48); b(0x81); b(0x28); d32(blk->n);//sub qword [rax], n
+        b(0x48); b(0xb8); d64((uint64_t)&blk->exec_cnt);//mov rax, &exec_cnt
+        b(0x48); b(0xff); b(0x00);//inc qword [rax]
+        bind(jump(-1), head);
+        bind(out);
+        if (blk->idle || blk->idiom != NULL)
+            bind(idle_out);
+        exit_to(blk->start);
+    };
+	//! Jump on condition code cc, or always if cc is -1, to a label set later
+    jit_label jump(int cc)
+    {
+        jit_label l;
+        if (cc < 0)
+            b(0xe9);
+        else
+        {
+            b(0x0f);
+            b(0x80 | cc);
+        }
+        l.at = p;
+        d32(0);
+        return l;
+    };
+	//! Make a jump land here
+    void bind(jit_label l){ bind(l, p); };
+	//! Make a jump land at target
+    void bind(jit_label l, BYTE *target)
+    {
+        int32_t rel = (int32_t)(target - (l.at + 4));
+        memcpy(l.at, &rel, 4);
+    };
+	//! Copy NZCV, those in mask, from host flags into CPSR
+    void save_flags(int mask, bool inv)
+    {
+        uint32_t m = (uint32_t)mask<<28;
+
+        b(0x9c); b(0x58);//pushfq, pop rax
+        rr(0x89, 1, 0);//mov ecx, eax
+        alu_imm(4, 1, 0xc0);//and ecx, SF|ZF
+        shift_imm(4, 1, 24);//shl ecx, 24: N, Z
+        if (mask & JF_C)
+        {
+            rr(0x89, 2, 0);//mov edx, eax
+            alu_imm(4, 2, 1);//and edx, CF
+            if (inv)
+                alu_imm(6, 2, 1);//xor edx, 1
+            shift_imm(4, 2, 29);
+            rr(0x09, 1, 2);//or ecx, edx
+        }
+        if (mask & JF_V)
+        {
+            alu_imm(4, 0, 0x800);//and eax, OF
+            shift_imm(4, 0, 17);
+            rr(0x09, 1, 0);//or ecx, eax
+        }
+        alu_imm(4, 1, m);//and ecx, mask
+        b(0x8b); b(0x45); b(0x00);//mov eax, [rbp]
+        alu_imm(4, 0, ~m);
+        rr(0x09, 0, 1);//or eax, ecx
+        b(0x89); b(0x45); b(0x00);//mov [rbp], eax
+    };
+};
+
+/**
+  * Nothing is allocated until the first block is translated.
+  */
+thumb_jit::thumb_jit()
+{
+    buf = NULL;
+    cap = used = data_used = 0;
+    compiled = native_instrs = called_instrs = 0;
+}
+
+/**
+  * Release the code buffer.
+  */
+thumb_jit::~thumb_jit()
+{
+    if (buf != NULL)
+        munmap(buf, cap);
+}
+
+/**
+  * Translate a block into a jit_fn. Flag liveness is computed backward over the block, NZCV being live at its end; a handler is taken to read every flag. Registers used most by the translated instructions stay in host registers, and are written back before a handler is called or the block is left. A block branching to itself loops inside the host code while the instruction budget lasts.
+  * @param cpu The core running the block
+  * @param blk The block
+  * @return The host code, NULL if the block can not be translated
+  */
+jit_fn thumb_jit::compile(Thumb *cpu, t_block *blk)
+{
+    int n = blk->n;
+
+    if (buf == NULL && cap == 0)
+    {
+        cap = JIT_BUF_SZ;
+        void *mem = mmap(NULL, cap, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return NULL;//cap stays set, never try again
+        buf = (BYTE *)mem;
+    }
+    if (buf == NULL || cap - used - data_used < (size_t)n * (JIT_INSTR_CODE + sizeof(jit_mem_cache)) + 512)
+        return NULL;
+
+    //what every instruction does, and flag liveness
+    jit_instr ji[BLOCK_MAX_INSTR];
+    int live = JF_ALL;
+    unsigned int text_VMA = cpu->my_mmu->getTextVMA();
+    unsigned int text_sz = cpu->my_mmu->getTextSz();
+
+    for (int i = n - 1; i >= 0; i--)
+    {
+        const t_decoded &d = blk->first[i];
+
+        analyse(d, ji[i]);
+        ji[i].live = live;
+        if (d.cls == T_LD_FROM_POOL && (unsigned int)d.imm - text_VMA > text_sz - 4)
+            ji[i].native = false;
+
+        if (ji[i].native)
+            live = (live & ~ji[i].wr_flags) | ji[i].rd_flags;
+        else
+            live = JF_ALL;
+    }
+
+    //keep the most used registers in r12d-r15d
+    x86_emitter e(buf + used);
+    int uses[GPR_num] = {0};
+
+    for (int i = 0; i < n; i++)
+        if (ji[i].native)
+            for (int g = 0; g < 15; g++)
+                if ((ji[i].regs>>g) & 1)
+                    uses[g]++;
+
+    for (int k = 0; k < JIT_HOST_REGS; k++)
+    {
+        int best = -1;
+        for (int g = 0; g < 15; g++)
+            if (e.host[g] < 0 && uses[g] >= 2 && (best < 0 || uses[g] > uses[best]))
+                best = g;
+        if (best < 0)
+            break;
+        e.host[best] = 12 + k;
+    }
+
+    BYTE *entry = e.p;
+    e.prologue();
+    e.reload();
+    BYTE *head = e.p;
+
+    jit_label exc[BLOCK_MAX_INSTR];
+    int n_exc = 0;
+    int end = blk->start + n * 2;
+    bool ended = false;
+
+    for (int i = 0; i < n; i++)
+    {
+        const t_decoded &d = blk->first[i];
+        int next = blk->start + (i + 1) * 2;
+        bool last = (i == n - 1);
+
+        if (!ji[i].native)
+        {
+            //the handler, with r[] and PC as the interpreter leaves them
+            e.flush();
+            e.set_pc(next);
+            e.b(0x48); e.b(0x8b); e.b(0x3c); e.b(0x24);//mov rdi, [rsp]
+            e.b(0x48); e.b(0xbe); e.d64((uint64_t)&d);//mov rsi, &d
+            e.b(0x48); e.b(0xb8); e.d64((uint64_t)&Thumb::jit_call);//mov rax, jit_call
+            e.b(0xff); e.b(0xd0);//call rax
+            e.b(0x85); e.b(0xc0);//test eax, eax
+            exc[n_exc++] = e.jump(0x5);//jnz
+            e.reload();
+            if (last)
+            {
+                e.epilogue(0);//PC is what the handler left
+                ended = true;
+            }
+            called_instrs++;
+            continue;
+        }
+
+        native_instrs++;
+        switch (d.cls)
+        {
+            case T_LD_STR_REG_OFFSET:
+            case T_LD_STR_WORD_BYTE_IMM:
+            case T_LD_STR_HALFW_IMM:
+            case T_LD_STR_STACK:
+            {
+                jit_access a = mem_access(d);
+                int dirty = e.dirty;
+
+                data_used += sizeof(jit_mem_cache);
+                jit_mem_cache *c = (jit_mem_cache *)(buf + cap - data_used);
+                c->VMA = c->lim = 0;
+                c->host = NULL;
+                c->size = a.size;
+                c->write = !a.load;
+
+                //the address in eax, the value to store in edi
+                e.load(0, d.cls == T_LD_STR_STACK ? 13 : d.rn);
+                if (d.cls == T_LD_STR_REG_OFFSET)
+                {
+                    e.load(1, d.rm);
+                    e.rr(0x01, 0, 1);
+                }
+                else if (d.imm != 0)
+                    e.alu_imm(0, 0, d.imm);
+                if (!a.load)
+                    e.load(7, d.rd);
+
+                e.b(0x48); e.b(0xbe); e.d64((uint64_t)c);//mov rsi, c
+                e.rr(0x89, 2, 0);//mov edx, eax
+                e.b(0x2b); e.b(0x16);//sub edx, [rsi]
+                e.b(0x3b); e.b(0x56); e.b(0x04);//cmp edx, [rsi + 4]
+                jit_label miss = e.jump(0x3);//jae
+                jit_label unaligned;
+                if (a.align != 0)
+                {
+                    e.b(0xa8); e.b(a.align);//test al, align
+                    unaligned = e.jump(0x5);//jnz
+                }
+                e.b(0x48); e.b(0x8b); e.b(0x4e); e.b(0x08);//mov rcx, [rsi + 8]
+
+                //[rcx + rdx]
+                if (a.load)
+                {
+                    if (a.size == 4)
+                        e.b(0x8b);
+                    else
+                    {
+                        e.b(0x0f);
+                        e.b((a.size == 1 ? 0xb6 : 0xb7) | (a.sign ? 0x08 : 0));//movzx, movsx
+                    }
+                    e.b(0x04); e.b(0x11);
+                    e.store(d.rd, 0);
+                }
+                else
+                {
+                    if (a.size == 2)
+                        e.b(0x66);
+                    else if (a.size == 1)
+                        e.b(0x40);
+                    e.b(a.size == 1 ? 0x88 : 0x89); e.b(0x3c); e.b(0x11);
+                }
+                int done_dirty = e.dirty;
+                jit_label done = e.jump(-1);
+
+                //the handler, which also refreshes the cache
+                e.bind(miss);
+                if (a.align != 0)
+                    e.bind(unaligned);
+                e.dirty = dirty;
+                e.flush();
+                e.set_pc(next);
+                e.rr(0x89, 2, 0);//mov edx, eax
+                e.b(0x48); e.b(0xb9); e.d64((uint64_t)c);//mov rcx, c
+                e.b(0x48); e.b(0x8b); e.b(0x3c); e.b(0x24);//mov rdi, [rsp]
+                e.b(0x48); e.b(0xbe); e.d64((uint64_t)&d);//mov rsi, &d
+                e.b(0x48); e.b(0xb8); e.d64((uint64_t)&thumb_jit::mem_miss);//mov rax, mem_miss
+                e.b(0xff); e.b(0xd0);//call rax
+                e.b(0x85); e.b(0xc0);//test eax, eax
+                exc[n_exc++] = e.jump(0x5);//jnz
+                e.reload();
+
+                e.bind(done);
+                e.dirty = done_dirty;
+                break;
+            }
+            case T_ADD_SUB_REG_OR_IMM:
+                e.load(0, d.rn);
+                if ((d.op>>1) & MASK_1BIT)
+                    e.alu_imm((d.op & 1) ? 5 : 0, 0, d.imm);
+                else
+                {
+                    e.load(1, d.rm);
+                    e.rr((d.op & 1) ? 0x29 : 0x01, 0, 1);
+                }
+                e.store(d.rd, 0);
+                break;
+            case T_SHIFT_BY_IMM:
+                e.load(0, d.rm);
+                if (d.imm != 0)
+                    e.shift_imm(d.op == 0 ? 4 : (d.op == 1 ? 5 : 7), 0, d.imm);
+                e.store(d.rd, 0);
+                break;
+            case T_ADD_SUB_MOV_CMP_IMM:
+                if (d.op == 0)
+                    e.mov_imm(0, d.imm);
+                else
+                {
+                    e.load(0, d.rd);
+                    e.alu_imm(d.op == 2 ? 0 : (d.op == 3 ? 5 : 7), 0, d.imm);
+                }
+                if (d.op != 1)
+                    e.store(d.rd, 0);
+                break;
+            case T_LD_FROM_POOL://code segment is never written
+                e.mov_imm(0, cpu->my_mmu->get_word(d.imm));
+                e.store(d.rd, 0);
+                break;
+            case T_SPEC_DATA_PROC:
+                e.load(1, d.rm);
+                if (d.op == 2)//cpy
+                    e.store(d.rd, 1);
+                else
+                {
+                    e.load(0, d.rd);
+                    e.rr(d.op == 0 ? 0x01 : 0x39, 0, 1);
+                    if (d.op == 0)
+                        e.store(d.rd, 0);
+                }
+                break;
+            case T_DATA_PROC_REG:
+                e.load(0, d.rd);
+                e.load(1, d.rm);
+                switch (d.op)
+                {
+                    case 0: e.rr(0x21, 0, 1); break;//and
+                    case 1: e.rr(0x31, 0, 1); break;//eor
+                    case 8: e.rr(0x85, 0, 1); break;//test
+                    case 12: e.rr(0x09, 0, 1); break;//or
+                    case 14://bic
+                        e.b(0xf7); e.b(0xd1);//not ecx
+                        e.rr(0x21, 0, 1);
+                        break;
+                    case 13://imul eax, ecx
+                        e.b(0x0f); e.b(0xaf); e.b(0xc1);
+                        break;
+                    case 15://not eax, from Rs
+                        e.rr(0x89, 0, 1);
+                        e.b(0xf7); e.b(0xd0);
+                        break;
+                    case 9://neg eax, from Rs
+                        e.rr(0x89, 0, 1);
+                        e.b(0xf7); e.b(0xd8);
+                        break;
+                    case 10: e.rr(0x39, 0, 1); break;//cmp
+                    case 11: e.rr(0x01, 0, 1); break;//add, result dropped
+                }
+                if (d.op != 8 && d.op != 10 && d.op != 11)
+                    e.store(d.rd, 0);
+                break;
+            case T_MISC:
+                if (d.op == 0)
+                {
+                    e.load(0, 13);
+                    e.alu_imm(0, 0, d.imm);
+                    e.store(13, 0);
+                    break;
+                }
+                e.load(0, d.rm);
+                if (d.op == 2)
+                {
+                    static const BYTE ext[4] = {0xbf, 0xbe, 0xb7, 0xb6};//sxth, sxtb, uxth, uxtb
+                    e.b(0x0f); e.b(ext[d.imm]); e.b(0xc0);
+                }
+                else if (d.imm == 0)//rev
+                {
+                    e.b(0x0f); e.b(0xc8);//bswap eax
+                }
+                else if (d.imm == 1)//rev16
+                {
+                    e.b(0x0f); e.b(0xc8);
+                    e.shift_imm(0, 0, 16);//rol eax, 16
+                }
+                else//revsh
+                {
+                    e.b(0x66); e.shift_imm(0, 0, 8);//rol ax, 8
+                    e.b(0x0f); e.b(0xbf); e.b(0xc0);//movsx eax, ax
+                }
+                e.store(d.rd, 0);
+                break;
+            case T_ADD_TO_SP_OR_PC:
+                if (d.op == 0)
+                    e.mov_imm(0, d.imm);
+                else
+                {
+                    e.load(0, 13);
+                    e.alu_imm(0, 0, d.imm);
+                }
+                e.store(d.rd, 0);
+                break;
+            case T_BL_BLX_PREFIX:
+                e.mov_imm(0, d.imm);
+                e.store(14, 0);
+                break;
+            case T_BL_SUFFIX:
+                e.load(0, 14);
+                e.alu_imm(0, 0, d.imm);
+                e.mov_imm(1, next | 1);
+                e.store(14, 1);
+                e.flush();
+                e.b(0x89); e.b(0x43); e.b(15 * 4);//mov [rbx + 60], eax
+                e.epilogue(0);
+                ended = true;
+                break;
+            case T_UNCON_BR:
+                if (d.imm == blk->start)
+                    e.loop_back(blk, &cpu->budget, head);
+                else
+                    e.exit_to(d.imm);
+                ended = true;
+                break;
+            case T_CON_BR:
+            {
+                jit_label not_taken;
+
+                if (i > 0 && ji[i - 1].native && cond_cc(d.op, ji[i - 1].inv) >= 0
+                 && (cond_pass_tab.reads[d.op] & ~ji[i - 1].wr_flags) == 0)
+                {
+                    e.b(0x45); e.b(0x84); e.b(0xdb);//test r11b, r11b
+                    not_taken = e.jump(0x4);//jz
+                }
+                else
+                {
+                    e.b(0x8b); e.b(0x45); e.b(0x00);//mov eax, [rbp]
+                    e.shift_imm(5, 0, 28);//shr eax, 28
+                    e.mov_imm(1, cond_pass_tab.mask[d.op]);
+                    e.b(0x0f); e.b(0xa3); e.b(0xc1);//bt ecx, eax
+                    not_taken = e.jump(0x3);//jnc
+                }
+
+                if (d.imm == blk->start)
+                    e.loop_back(blk, &cpu->budget, head);
+                else
+                    e.exit_to(d.imm);
+
+                e.bind(not_taken);
+                e.exit_to(next);
+                ended = true;
+                break;
+            }
+        }
+
+        //flags the rest of the block, or the next block, may read
+        int save = ji[i].wr_flags & ji[i].live;
+        bool fuse = !last && i + 1 == n - 1 && blk->first[i + 1].cls == T_CON_BR && ji[i + 1].native
+                 && cond_cc(blk->first[i + 1].op, ji[i].inv) >= 0
+                 && (cond_pass_tab.reads[blk->first[i + 1].op] & ~ji[i].wr_flags) == 0;
+
+        if ((save != 0 || fuse) && ji[i].test)
+            e.rr(0x85, 0, 0);//test eax, eax
+        if (fuse)
+        {
+            e.b(0x41); e.b(0x0f); e.b(0x90 | cond_cc(blk->first[i + 1].op, ji[i].inv)); e.b(0xc3);//setcc r11b
+        }
+        if (save != 0)
+            e.save_flags(save, ji[i].inv);
+    }
+
+    if (!ended)
+        e.exit_to(end);
+
+    if (n_exc > 0)
+    {
+        for (int k = 0; k < n_exc; k++)
+            e.bind(exc[k]);
+        e.epilogue(1);
+    }
+
+    used = e.p - buf;
+    compiled++;
+
+    return (jit_fn)entry;
+}
+
+/**
+  * Run the handler of a load or store whose address missed the cache, or was not aligned. If the handler succeeds, the cache is pointed at the segment of the address.
+  * @param cpu The core
+  * @param d The predecoded instruction
+  * @param address The address of the access
+  * @param c The cache of the instruction
+  * @return 0, or 1 if the handler threw
+  */
+int thumb_jit::mem_miss(Thumb *cpu, const t_decoded *d, int address, jit_mem_cache *c)
+{
+    if (Thumb::jit_call(cpu, d) != 0)
+        return 1;
+
+    int VMA, size;
+    BYTE *host = cpu->my_mmu->host_range(address, c->write, VMA, size);
+
+    if (host != NULL && size >= c->size)
+    {
+        c->VMA = VMA;
+        c->lim = size - c->size + 1;
+        c->host = host;
+    }
+
+    return 0;
+}
+
+#else
+
+thumb_jit::thumb_jit()
+{
+    buf = NULL;
+    cap = used = data_used = 0;
+    compiled = native_instrs = called_instrs = 0;
+}
+
+thumb_jit::~thumb_jit()
+{
+}
+
+/**
+  * No translator for this host, every block stays with the block engine.
+  */
+jit_fn thumb_jit::compile(Thumb *cpu, t_block *blk)
+{
+    return NULL;
+}
+
+#endif
+
+/**
+  * Print how much was translated.
+  * @param fp The output file
+  */
+void thumb_jit::dump(FILE *fp)
+{
+    fprintf(fp, "JIT: %d blocks translated, %d instructions to host code, %d to handler calls, %lu code bytes\n",
+            compiled, native_instrs, called_instrs, (unsigned long)used);
+}
@@ -0,0 +1,96 @@
+/*! \file jit.h
+	\brief The x86-64 translator for hot Thumb blocks.
+
+	Blocks of the block engine which run often enough are translated into x86-64 machine code. Instructions the translator does not handle are executed by calling their Thumb handler from the generated code.
+ */
+#ifndef __JIT_H__
+#define __JIT_H__
+
+/*!
+	\addtogroup instruction
+ */
+/*@{*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include "arch.h"
+#include "block.h"
+
+/*! \def JIT_THRESHOLD
+	\brief A block is translated when it has been executed this many times
+ */
+#define JIT_THRESHOLD   32
+
+/*! \def JIT_BUF_SZ
+	\brief The size of the buffer for generated code
+ */
+#define JIT_BUF_SZ      (16<<20)
+
+/*! \def JIT_HOST_REGS
+	\brief The number of guest registers kept in host registers inside a block
+ */
+#define JIT_HOST_REGS   4
+
+class Thumb;
+struct t_decoded;
+
+/*! \struct jit_mem_cache
+	\brief The segment a load or store of translated code used last time.
+
+	The host code accesses host memory directly while the address stays inside the segment, and calls the handler otherwise, which refreshes the entry.
+ */
+struct jit_mem_cache
+{
+	//! The virtual address of the segment
+    uint32_t VMA;
+	//! Offsets below it are inside the segment for the access size, 0 if the entry is empty
+    uint32_t lim;
+	//! The host memory of the segment
+    BYTE *host;
+	//! The access size in bytes
+    int size;
+	//! Whether the access is a store
+    bool write;
+};
+
+/*! \class thumb_jit
+	\brief Translate Thumb blocks into x86-64 code.
+
+	The generated function has the type jit_fn. Guest registers live in r[], the most used ones of a block are kept in r12-r15 while the block runs. NZCV is taken from host EFLAGS after the native instruction and written to CPSR when a later instruction or block may read it. Conditional branches right after a native add, sub or cmp test the host flags directly.
+ */
+class thumb_jit
+{
+public:
+	//! A constructor
+    thumb_jit();
+	//! A destructor
+    ~thumb_jit();
+
+private:
+	//! The executable buffer, NULL if the host can not run generated code
+    BYTE *buf;
+	//! The size of buf
+    size_t cap;
+	//! The bytes of buf in use by code, from the start
+    size_t used;
+	//! The bytes of buf in use by jit_mem_cache entries, from the end
+    size_t data_used;
+	//! The number of translated blocks
+    int compiled;
+	//! The number of guest instructions translated into host code
+    int native_instrs;
+	//! The number of guest instructions executed by calling their handler
+    int called_instrs;
+
+	//! Run the handler of a load or store which missed its cache, and refresh the cache
+    static int mem_miss(Thumb *cpu, const t_decoded *d, int address, jit_mem_cache *c);
+
+public:
+	//! Translate a block
+    jit_fn compile(Thumb *cpu, t_block *blk);
+	//! Print the translation statistics
+    void dump(FILE *fp);
+};
+
+/*@}*/
+#endif // __JIT_H__
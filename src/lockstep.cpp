@@ -0,0 +1,695 @@
+/*! \file lockstep.cpp
+	\brief Several instances of one Thumb program run in lockstep.
+
+	The vectors in thumb_lockstep are the registers of record for lanes in Thumb status, the cpu_state of a lane is brought up to date before its core runs anything, and read back afterwards.
+ */
+#include <string.h>
+#include "lockstep.h"
+#include "error.h"
+
+extern char file_name[100];
+
+/*! \def LANE_SELECT
+	\brief a for the lanes in the mask m, b for the others, just a when m has every running lane (ALL), so m must be the lanes of the step, not a condition of them
+ */
+#define LANE_SELECT(m, a, b)    (ALL ? (a) : (((a) & (m)) | ((b) & ~(m))))
+
+/*! \def LANES_APART
+	\brief The next PC vector_step() gives when the lanes it ran may have parted
+ */
+#define LANES_APART             0xffffffffu
+
+/**
+  * The lanes are allocated, nothing is loaded until InitMMU().
+  * @param lanes The number of lanes, 1 to N
+  */
+template<int N>
+thumb_lockstep<N>::thumb_lockstep(int lanes)
+{
+    num = lanes;
+    memset(r, 0, sizeof(r));
+    memset(&fn, 0, sizeof(fn));
+    memset(&fz, 0, sizeof(fz));
+    memset(&fc, 0, sizeof(fc));
+    memset(&fv, 0, sizeof(fv));
+    memset(&live, 0, sizeof(live));
+
+    for (int l = 0; l < N; l++)
+    {
+        core[l] = l < num ? new arm_core : NULL;
+        executed[l] = 0;
+        last_stop[l].reason = STOP_NONE;
+        last_stop[l].fault = FAULT_NONE;
+        last_stop[l].address = 0;
+        last_stop[l].executed = 0;
+    }
+
+    max_instrs = RUN_FOREVER;
+    idle_wait = IDLE_CHECK_PERIOD;
+    steps = partial_steps = 0;
+    vector_instrs = local_instrs = scalar_instrs = 0;
+}
+
+/**
+  * Delete the cores, DeinitMMU() deletes their MMUs.
+  */
+template<int N>
+thumb_lockstep<N>::~thumb_lockstep()
+{
+    for (int l = 0; l < num; l++)
+        delete core[l];
+}
+
+/**
+  * Load the program into the core of every lane, give each lane its number as the argument on its command line, and collect the console output of each lane apart.
+  * @param hle Which library routines of the program run on the host, HLE_OFF, HLE_ON or HLE_PRINTF
+  * @exception Error For errors which are memory-related, file-related, etc.
+  */
+template<int N>
+void thumb_lockstep<N>::InitMMU(int hle)
+{
+    for (int l = 0; l < num; l++)
+    {
+        char cmdline[128];
+
+        core[l]->setHLE(hle);
+        core[l]->InitMMU();
+        snprintf(cmdline, sizeof(cmdline), "%s %d", file_name, l);
+        core[l]->getArg(cmdline, strlen(cmdline));
+        core[l]->setConsole(&console[l]);
+
+        save_lane(l);
+        live[l] = -1;
+    }
+}
+
+/**
+  * Delete the MMU of every lane.
+  */
+template<int N>
+void thumb_lockstep<N>::DeinitMMU()
+{
+    for (int l = 0; l < num; l++)
+        core[l]->DeinitMMU();
+}
+
+/**
+  * Copy the registers and NZCV of a lane to the cpu_state of its core, the other bits of CPSR live there.
+  * @param l The lane
+  */
+template<int N>
+void thumb_lockstep<N>::load_lane(int l)
+{
+    cpu_state &st = core[l]->state;
+
+    for (int i = 0; i < 16; i++)
+        st.r[i] = r[i][l];
+
+    st.cpsr = (st.cpsr & 0x0fffffff) | (EFLAG)(fn[l] & 1)<<31 | (EFLAG)(fz[l] & 1)<<30 | (EFLAG)(fc[l] & 1)<<29 | (EFLAG)(fv[l] & 1)<<28;
+    st.flag_op = FLAGS_NONE;
+}
+
+/**
+  * Copy the registers and NZCV of the core of a lane back to the vectors, flags left pending by the core are worked out first.
+  * @param l The lane
+  */
+template<int N>
+void thumb_lockstep<N>::save_lane(int l)
+{
+    cpu_state &st = core[l]->state;
+
+    core[l]->thumb.syncFlags();
+    for (int i = 0; i < 16; i++)
+        r[i][l] = st.r[i];
+
+    fn[l] = -(int32_t)((st.cpsr>>31) & 1);
+    fz[l] = -(int32_t)((st.cpsr>>30) & 1);
+    fc[l] = -(int32_t)((st.cpsr>>29) & 1);
+    fv[l] = -(int32_t)((st.cpsr>>28) & 1);
+}
+
+/**
+  * Take a lane out of the schedule, and keep why it stopped.
+  * @param l The lane
+  * @param why STOP_BUDGET when the lane ran its budget, otherwise what the run of its core returned
+  */
+template<int N>
+void thumb_lockstep<N>::retire(int l, StopReason why)
+{
+    if (why == STOP_BUDGET)
+    {
+        last_stop[l].reason = STOP_BUDGET;
+        last_stop[l].fault = FAULT_NONE;
+        last_stop[l].address = r[15][l];
+        last_stop[l].detail.clear();
+    }
+    else
+        last_stop[l] = core[l]->stop_info();
+
+    last_stop[l].executed = executed[l];
+    live[l] = 0;
+}
+
+/**
+  * Run one instruction of a lane on its core, with all its registers. SWI, faults, switches to ARM status, ... all come this way.
+  * @param l The lane
+  * @return false if the lane stopped
+  */
+template<int N>
+bool thumb_lockstep<N>::scalar_step(int l)
+{
+    load_lane(l);
+    StopReason why = core[l]->run(1);
+    save_lane(l);
+
+    executed[l] += core[l]->stop_info().executed;
+    scalar_instrs++;
+    if (why != STOP_BUDGET)
+    {
+        retire(l, why);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+  * Run a lane in ARM status on its core until it switches back to Thumb status, stops, or runs out of budget.
+  * @param l The lane
+  */
+template<int N>
+void thumb_lockstep<N>::run_arm(int l)
+{
+    while (!(core[l]->state.cpsr & CPSR_T))
+    {
+        if (executed[l] >= max_instrs)
+        {
+            retire(l, STOP_BUDGET);
+            return;
+        }
+        if (!scalar_step(l))
+            return;
+    }
+}
+
+/**
+  * Run the handler of an instruction on the core of one lane, copying in and out only Rd, Rn, Rm, SP and NZCV. The instruction must not read or write other registers, nor branch. If the handler throws, it runs again as a scalar step, which reports the fault.
+  * @param l The lane
+  * @param d The predecoded instruction
+  * @param address The address of the instruction
+  */
+template<int N>
+void thumb_lockstep<N>::local_step(int l, const t_decoded *d, int address)
+{
+    cpu_state &st = core[l]->state;
+    const int used[4] = {d->rd, d->rn, d->rm, 13};
+
+    for (int k = 0; k < 4; k++)
+        st.r[used[k]] = r[used[k]][l];
+    st.r[15] = address + 2;
+    st.cpsr = (st.cpsr & 0x0fffffff) | (EFLAG)(fn[l] & 1)<<31 | (EFLAG)(fz[l] & 1)<<30 | (EFLAG)(fc[l] & 1)<<29 | (EFLAG)(fv[l] & 1)<<28;
+    st.flag_op = FLAGS_NONE;
+
+    if (Thumb::jit_call(&core[l]->thumb, d) != 0)
+    {
+        scalar_step(l);
+        return;
+    }
+
+    r[d->rd][l] = st.r[d->rd];
+    r[13][l] = st.r[13];
+    r[15][l] = address + 2;
+    fn[l] = -(int32_t)((st.cpsr>>31) & 1);
+    fz[l] = -(int32_t)((st.cpsr>>30) & 1);
+    fc[l] = -(int32_t)((st.cpsr>>29) & 1);
+    fv[l] = -(int32_t)((st.cpsr>>28) & 1);
+
+    executed[l]++;
+    local_instrs++;
+}
+
+/**
+  * The lanes for which a condition holds, the condition field of a conditional branch.
+  * @param cond The condition, 0 to 13
+  * @param mask Set to -1 for the lanes it holds for
+  */
+template<int N>
+void thumb_lockstep<N>::cond_mask(int cond, vec &mask)
+{
+    switch (cond)
+    {
+        case 0: mask = fz; break;
+        case 1: mask = ~fz; break;
+        case 2: mask = fc; break;
+        case 3: mask = ~fc; break;
+        case 4: mask = fn; break;
+        case 5: mask = ~fn; break;
+        case 6: mask = fv; break;
+        case 7: mask = ~fv; break;
+        case 8: mask = fc & ~fz; break;
+        case 9: mask = ~fc | fz; break;
+        case 10: mask = ~(fn ^ fv); break;
+        case 11: mask = fn ^ fv; break;
+        case 12: mask = ~fz & ~(fn ^ fv); break;
+        default: mask = fz | (fn ^ fv); break;
+    }
+}
+
+/**
+  * Set N and Z of the lanes in m from a result.
+  * @param res The result
+  * @param m -1 for the lanes running the instruction
+  */
+template<int N> template<bool ALL>
+inline void thumb_lockstep<N>::set_nz(const vec &res, const vec &m)
+{
+    fn = LANE_SELECT(m, res < 0, fn);
+    fz = LANE_SELECT(m, res == 0, fz);
+}
+
+/**
+  * Add two numbers and a carry for the lanes in m, setting NZCV as the handlers do, subtraction adds the complement with a carry of 1.
+  * @param a The first operand
+  * @param b The second operand
+  * @param carry_in -1 for lanes adding a carry
+  * @param m -1 for the lanes running the instruction
+  * @param res Set to the sum, may be one of the operands
+  */
+template<int N> template<bool ALL>
+inline void thumb_lockstep<N>::add_flags(const vec &a, const vec &b, const vec &carry_in, const vec &m, vec &res)
+{
+    vec sum = (vec)((uvec)a + (uvec)b - (uvec)carry_in);
+
+    set_nz<ALL>(sum, m);
+    fc = LANE_SELECT(m, ((a & b) | ((a | b) & ~sum)) >> 31, fc);
+    fv = LANE_SELECT(m, ((a ^ sum) & (b ^ sum)) >> 31, fv);
+    res = sum;
+}
+
+/**
+  * Run an instruction for the lanes in m on the vectors: the ALU instructions but the shifts by register, moves and adds of the high registers, constants from literal pools in code segment, and the branches which do not switch status.
+  * @param d The predecoded instruction
+  * @param address The address of the instruction
+  * @param m -1 for the lanes at the address, all the running lanes if ALL, the registers of stopped lanes are then clobbered
+  * @param next Set to the PC all the lanes in m go on at, LANES_APART if they may have parted
+  * @return false if the instruction has to run on the cores of the lanes
+  */
+template<int N> template<bool ALL>
+bool thumb_lockstep<N>::vector_step(const t_decoded &d, int address, const vec &m, uint32_t &next)
+{
+    vec zero = fz ^ fz, ones = ~zero, res;
+
+    switch (d.cls)
+    {
+        case T_ADD_SUB_REG_OR_IMM:
+        {
+            vec b = ((d.op>>1) & MASK_1BIT) ? zero + d.imm : r[d.rm];
+            if (d.op & 1)
+                add_flags<ALL>(r[d.rn], ~b, ones, m, res);
+            else
+                add_flags<ALL>(r[d.rn], b, zero, m, res);
+
+            r[d.rd] = LANE_SELECT(m, res, r[d.rd]);
+            break;
+        }
+        case T_SHIFT_BY_IMM:
+        {
+            vec x = r[d.rm], c;
+            int n = d.imm;
+
+            if (d.op == 0 && n == 0)//mov, C unaffected
+            {
+                set_nz<ALL>(x, m);
+                r[d.rd] = LANE_SELECT(m, x, r[d.rd]);
+                break;
+            }
+            if (d.op == 0)
+            {
+                c = (vec)((uvec)x<<(n - 1))>>31;
+                res = (vec)((uvec)x<<n);
+            }
+            else if (n == 0)//shift by 32
+            {
+                c = x>>31;
+                res = d.op == 1 ? zero : c;
+            }
+            else
+            {
+                c = (vec)((uvec)x<<(32 - n))>>31;
+                res = d.op == 1 ? (vec)((uvec)x>>n) : x>>n;
+            }
+            fc = LANE_SELECT(m, c, fc);
+            set_nz<ALL>(res, m);
+            r[d.rd] = LANE_SELECT(m, res, r[d.rd]);
+            break;
+        }
+        case T_ADD_SUB_MOV_CMP_IMM:
+        {
+            switch (d.op)
+            {
+                case 0:
+                    res = zero + d.imm;
+                    set_nz<ALL>(res, m);
+                    break;
+                case 1:
+                    add_flags<ALL>(r[d.rd], zero + ~d.imm, ones, m, res);
+                    break;
+                case 2:
+                    add_flags<ALL>(r[d.rd], zero + d.imm, zero, m, res);
+                    break;
+                default:
+                    add_flags<ALL>(r[d.rd], zero + ~d.imm, ones, m, res);
+                    break;
+            }
+            if (d.op != 1)
+                r[d.rd] = LANE_SELECT(m, res, r[d.rd]);
+            break;
+        }
+        case T_DATA_PROC_REG:
+        {
+            vec a = r[d.rd], b = r[d.rm];
+
+            switch (d.op)
+            {
+                case 0: res = a & b; break;
+                case 1: res = a ^ b; break;
+                case 12: res = a | b; break;
+                case 14: res = a & ~b; break;
+                case 13: res = (vec)((uvec)a * (uvec)b); break;
+                case 15: res = ~b; break;
+                case 8: res = a & b; break;
+                case 5: add_flags<ALL>(a, b, fc, m, res); break;
+                case 6: add_flags<ALL>(a, ~b, fc, m, res); break;
+                case 9: add_flags<ALL>(zero, ~b, ones, m, res); break;
+                case 10: add_flags<ALL>(a, ~b, ones, m, res); break;
+                case 11: add_flags<ALL>(a, b, zero, m, res); break;
+                default://shifts by register
+                    return false;
+            }
+            if (d.op <= 1 || d.op == 8 || d.op >= 12)
+                set_nz<ALL>(res, m);
+            if (d.op != 8 && d.op != 10 && d.op != 11)
+                r[d.rd] = LANE_SELECT(m, res, r[d.rd]);
+            break;
+        }
+        case T_SPEC_DATA_PROC:
+            if (d.rd == 15 || d.rm == 15)
+                return false;
+            if (d.op == 1)
+                add_flags<ALL>(r[d.rd], ~r[d.rm], ones, m, res);
+            else if (d.op == 0)
+                r[d.rd] = LANE_SELECT(m, (vec)((uvec)r[d.rd] + (uvec)r[d.rm]), r[d.rd]);
+            else
+                r[d.rd] = LANE_SELECT(m, r[d.rm], r[d.rd]);
+            break;
+        case T_LD_FROM_POOL:
+        {
+            MMU *mmu = core[0]->arm.get_mmu();
+
+            if ((unsigned int)(d.imm - mmu->getTextVMA()) > (unsigned int)mmu->getTextSz() - 4)
+                return false;
+            r[d.rd] = LANE_SELECT(m, zero + (int32_t)mmu->get_word(d.imm), r[d.rd]);//code segment is the same in every lane
+            break;
+        }
+        case T_ADD_TO_SP_OR_PC:
+            r[d.rd] = LANE_SELECT(m, d.op == 0 ? zero + d.imm : (vec)((uvec)r[13] + d.imm), r[d.rd]);
+            break;
+        case T_MISC:
+            if (d.op == 0)
+                r[13] = LANE_SELECT(m, (vec)((uvec)r[13] + d.imm), r[13]);
+            else if (d.op == 2)
+            {
+                vec x = r[d.rm];
+
+                switch (d.imm)
+                {
+                    case 0: res = (vec)((uvec)x<<16)>>16; break;//sxth
+                    case 1: res = (vec)((uvec)x<<24)>>24; break;//sxtb
+                    case 2: res = x & 0xffff; break;//uxth
+                    default: res = x & 0xff; break;//uxtb
+                }
+                r[d.rd] = LANE_SELECT(m, res, r[d.rd]);
+            }
+            else
+                return false;
+            break;
+        case T_CON_BR:
+        {
+            vec taken, fall = LANE_SELECT(m, zero + (address + 2), r[15]);
+
+            cond_mask(d.op, taken);
+            taken &= m;
+            r[15] = ((zero + d.imm) & taken) | (fall & ~taken);//taken is per lane even if ALL
+            if (none(taken))
+                next = address + 2;
+            else if (none(taken ^ m))
+                next = d.imm;
+            else
+                next = LANES_APART;
+            return true;
+        }
+        case T_UNCON_BR:
+            r[15] = LANE_SELECT(m, zero + d.imm, r[15]);
+            next = d.imm;
+            return true;
+        case T_BL_BLX_PREFIX:
+            r[14] = LANE_SELECT(m, zero + d.imm, r[14]);
+            break;
+        case T_BL_SUFFIX:
+        {
+            vec target = (vec)((uvec)r[14] + d.imm);
+
+            r[14] = LANE_SELECT(m, zero + ((address + 2) | 1), r[14]);
+            r[15] = LANE_SELECT(m, target, r[15]);
+            next = LANES_APART;//the prefix is the same in every lane, but may not have run in this step
+            return true;
+        }
+        default:
+            return false;
+    }
+
+    r[15] = LANE_SELECT(m, zero + (address + 2), r[15]);
+    next = address + 2;
+    return true;
+}
+
+/**
+  * Whether an instruction may run by local_step(): it touches no register but Rd, Rn, Rm, SP and the flags, and does not branch.
+  * @param d The predecoded instruction
+  * @return true if it may
+  */
+static bool is_local(const t_decoded &d)
+{
+    switch (d.cls)
+    {
+        case T_LD_STR_REG_OFFSET:
+        case T_LD_STR_WORD_BYTE_IMM:
+        case T_LD_STR_HALFW_IMM:
+        case T_LD_STR_STACK:
+        case T_DATA_PROC_REG:
+            return true;
+        case T_MISC:
+            return d.op == 10;//rev
+        default:
+            return false;
+    }
+}
+
+/**
+  * Watch the loop without side effects a branch closes on each lane which ran it, as Thumb::idle_br() does on a core, see CPU::idleCheck(). Lanes which did not take the branch stop being watched. While all of them take it, their registers are compared on their cores every IDLE_CHECK_PERIOD runs, a lane found idle is retired with STOP_IDLE.
+  * @param d The branch
+  * @param address Its address
+  * @param m -1 for the lanes which ran it
+  * @param next The address the lanes went on from, see vector_step()
+  * @param pending The steps run together, not in executed yet, they count for a lane which stops
+  * @return true if a lane stopped
+  */
+template<int N>
+bool thumb_lockstep<N>::watch_idle(const t_decoded &d, int address, const vec &m, uint32_t next, uint64_t pending)
+{
+    bool stopped = false;
+
+    if (next != (uint32_t)d.imm)
+    {
+        for (int l = 0; l < num; l++)
+            if (m[l] && r[15][l] != d.imm)
+                core[l]->thumb.idleLeft();
+        return false;
+    }
+    if (--idle_wait != 0)
+        return false;
+    idle_wait = IDLE_CHECK_PERIOD;
+
+    for (int l = 0; l < num; l++)
+    {
+        if (!m[l])
+            continue;
+
+        Thumb &t = core[l]->thumb;
+
+        load_lane(l);
+        t.last_stop.reason = STOP_NONE;
+        t.idleCheck(address);
+        if (t.last_stop.reason == STOP_IDLE)//taken out of the schedule as retire() does
+        {
+            last_stop[l] = t.stop_info();
+            last_stop[l].executed = executed[l] + pending;
+            live[l] = 0;
+            stopped = true;
+        }
+    }
+
+    return stopped;
+}
+
+/**
+  * Run the lanes until every one of them has stopped. A regroup picks the lowest PC of the lanes in Thumb status, so lanes which took different paths meet again at the join, and each step runs the instruction there for the lanes at it. While all running lanes are at one PC they go on together without a regroup, until a branch may part them, an instruction runs on the cores of the lanes, or a budget runs out.
+  * @param max_instructions The instruction budget of each lane, RUN_FOREVER for no limit
+  */
+template<int N>
+void thumb_lockstep<N>::run(uint64_t max_instructions)
+{
+    MMU *mmu = core[0]->arm.get_mmu();
+    Thumb &decoder = core[0]->thumb;
+    uint32_t pc = 0;
+    uint64_t together = 0;//the steps the lanes may still run together, 0 to regroup
+    uint64_t pending = 0;//the steps run together, not in executed yet
+    int active = 0;
+    vec m = live;
+
+    max_instrs = max_instructions;
+
+    while (1)
+    {
+        if (together == 0)
+        {
+            int running = 0;
+
+            pc = 0xffffffff;
+            for (int l = 0; l < num; l++)
+            {
+                if (!live[l])
+                    continue;
+                executed[l] += pending;
+                if (executed[l] >= max_instrs)
+                {
+                    retire(l, STOP_BUDGET);
+                    continue;
+                }
+                if (!(core[l]->state.cpsr & CPSR_T))
+                    run_arm(l);
+                if (!live[l])
+                    continue;
+
+                running++;
+                if ((uint32_t)r[15][l] < pc)
+                    pc = r[15][l];
+            }
+            pending = 0;
+
+            if (running == 0)
+                break;
+
+            m = live & (r[15] == (int32_t)pc);
+            active = 0;
+            for (int l = 0; l < num; l++)
+                if (m[l])
+                    active++;
+
+            if (active < running)
+                partial_steps++;
+            else
+            {
+                together = RUN_FOREVER;
+                for (int l = 0; l < num; l++)
+                    if (live[l] && max_instrs - executed[l] < together)
+                        together = max_instrs - executed[l];
+            }
+        }
+        steps++;
+
+        t_decoded *d;
+
+        try
+        {
+            d = mmu->getThumbDecoded(pc);
+            if (d->handler == NULL)
+                decoder.decode(pc, *d);
+        }
+        catch (Error &e)//out of code segment, every lane reports it on its own
+        {
+            d = NULL;
+        }
+
+        uint32_t next, address = pc;
+
+        bool hle = d != NULL && d->handler == &Thumb::hle_call;//a call of a library routine run on the host, by the core of each lane
+
+        if (d != NULL && !hle && (together > 0 ? vector_step<true>(*d, pc, m, next) : vector_step<false>(*d, pc, m, next)))
+        {
+            vector_instrs += active;
+            if (together == 0)
+            {
+                for (int l = 0; l < num; l++)
+                    if (m[l])
+                        executed[l]++;
+            }
+            else
+            {
+                pending++;
+                together--;
+                if (next == LANES_APART)
+                    together = 0;
+                pc = next;
+            }
+            if (d->handler == &Thumb::idle_br && watch_idle(*d, address, m, next, pending))
+                together = 0;
+            continue;
+        }
+
+        //on the cores of the lanes, which count for themselves
+        for (int l = 0; l < num; l++)
+            if (live[l])
+                executed[l] += pending;
+        pending = 0;
+
+        bool local = d != NULL && !hle && is_local(*d);
+
+        for (int l = 0; l < num; l++)
+        {
+            if (!m[l])
+                continue;
+            if (local)
+                local_step(l, d, pc);
+            else
+                scalar_step(l);
+        }
+
+        if (together > 0 && local && none(m & ~live))//no lane stopped
+        {
+            together--;
+            pc += 2;
+        }
+        else
+            together = 0;
+    }
+}
+
+/**
+  * Print how many steps the lanes shared, and which way their instructions ran.
+  * @param fp The output file
+  */
+template<int N>
+void thumb_lockstep<N>::dump_stats(FILE *fp)
+{
+    unsigned long long total = vector_instrs + local_instrs + scalar_instrs;
+
+    fprintf(fp, "Lockstep: %d lanes, %llu steps, %llu of them with running lanes masked off\n", num, steps, partial_steps);
+    fprintf(fp, "Lockstep: %llu lane instructions, %llu on the vectors, %llu by handlers on one lane, %llu by scalar steps\n",
+            total, vector_instrs, local_instrs, scalar_instrs);
+    if (steps > 0)
+        fprintf(fp, "Lockstep: %.2f lanes per step\n", (double)total / steps);
+}
+
+template class thumb_lockstep<8>;
+template class thumb_lockstep<16>;
@@ -0,0 +1,136 @@
+/*! \file lockstep.h
+	\brief Several instances of one Thumb program run in lockstep.
+
+	Every lane is a whole core with its own memory, loaded from the same ELF file, and its own command line. The Thumb registers of all lanes are kept structure-of-arrays, one host vector per guest register, so an instruction is decoded once and its ALU work done for all lanes in one vector operation: AVX2 when the emulator is built with -mavx2, SSE2 pairs otherwise.
+ */
+#ifndef __LOCKSTEP_H__
+#define __LOCKSTEP_H__
+
+/*!
+	\addtogroup instruction
+ */
+/*@{*/
+
+#include <stdio.h>
+#include <string>
+#include "arch.h"
+#include "CPU.h"
+#include "core.h"
+
+/*! \def LOCKSTEP_MAX_LANES
+	\brief The most lanes one thumb_lockstep runs
+ */
+#define LOCKSTEP_MAX_LANES  16
+
+/*! \struct lane_vec
+	\brief The host vectors of N lanes of 32 bits, a lane is a guest instance. Only 8 and 16 lanes are defined.
+ */
+template<int N> struct lane_vec;
+
+template<> struct lane_vec<8>
+{
+	//! Signed lanes, comparisons give -1 or 0 per lane
+    typedef int32_t vec __attribute__((vector_size(32)));
+	//! Unsigned lanes
+    typedef uint32_t uvec __attribute__((vector_size(32)));
+};
+
+template<> struct lane_vec<16>
+{
+	//! Signed lanes, comparisons give -1 or 0 per lane
+    typedef int32_t vec __attribute__((vector_size(64)));
+	//! Unsigned lanes
+    typedef uint32_t uvec __attribute__((vector_size(64)));
+};
+
+/*! \class thumb_lockstep
+	\brief Run up to N instances of a Thumb program in lockstep.
+
+	Each step runs one instruction for the lanes whose PC is the lowest, the others are masked off; lanes which branched apart are regrouped when their PCs meet again. ALU instructions, constant loads and branches work on the vectors. Loads, stores and shifts by register run the handler of Thumb.cpp on the core of each lane with just the registers they use, and the other instructions, SWI, push and pop, BX, the entry points of library routines run on the host, ..., one scalar step of the core of the lane. Lanes in ARM status run on their own until they are back in Thumb status. Branches closing a loop without side effects are watched for running idle on the core of each lane, as the interpreter does.
+
+	The vectors are aligned to their size, which operator new of C++14 does not respect, so the object is not allocated by new.
+ */
+template<int N>
+class thumb_lockstep
+{
+public:
+	//! Signed lanes
+    typedef typename lane_vec<N>::vec vec;
+	//! Unsigned lanes
+    typedef typename lane_vec<N>::uvec uvec;
+
+	//! A constructor, lanes at most N
+    thumb_lockstep(int lanes);
+	//! A destructor
+    ~thumb_lockstep();
+
+private:
+	//! The number of lanes in use
+    int num;
+	//! The core of each lane
+    arm_core *core[N];
+	//! The Thumb registers of the lanes, r[15] is the address of the next instruction
+    vec r[16];
+	//! The NZCV flags of the lanes, -1 for set
+    vec fn, fz, fc, fv;
+	//! -1 for the lanes still running
+    vec live;
+	//! The number of instructions each lane ran
+    uint64_t executed[N];
+	//! The instruction budget of each lane
+    uint64_t max_instrs;
+	//! Why each lane stopped
+    StopInfo last_stop[N];
+	//! The console output of each lane
+    std::string console[N];
+	//! The runs of branches closing a loop without side effects, taken by all their lanes, left until the lanes are compared
+    int idle_wait;
+	//! The number of steps, and of steps some running lanes sat out
+    unsigned long long steps, partial_steps;
+	//! The number of lane instructions run on the vectors, by a handler on one lane, and by a scalar step
+    unsigned long long vector_instrs, local_instrs, scalar_instrs;
+
+	//! Copy the registers of a lane to its core
+    void load_lane(int l);
+	//! Copy the registers of the core of a lane back
+    void save_lane(int l);
+	//! Take a lane out of the schedule
+    void retire(int l, StopReason why);
+	//! Run one instruction of a lane on its core, false if it stopped
+    bool scalar_step(int l);
+	//! Run lanes in ARM status until they switch back to Thumb status
+    void run_arm(int l);
+	//! Run the handler of an instruction on one lane, with the registers it reads and writes
+    void local_step(int l, const t_decoded *d, int address);
+	//! Watch the loop a branch closes for running idle on the lanes in m, true if a lane stopped
+    bool watch_idle(const t_decoded &d, int address, const vec &m, uint32_t next, uint64_t pending);
+	//! Run an instruction on the vectors for the lanes in m, false if it can not be; ALL if m has every running lane
+    template<bool ALL> bool vector_step(const t_decoded &d, int address, const vec &m, uint32_t &next);
+	//! Whether no lane of v is set
+    static bool none(const vec &v){ for (int l = 0; l < N; l++) if (v[l]) return false; return true; };
+	//! The lanes for which a condition holds
+    void cond_mask(int cond, vec &mask);
+	//! Set N and Z of the lanes in m from a result
+    template<bool ALL> void set_nz(const vec &res, const vec &m);
+	//! Add with carry for the lanes in m, setting NZCV
+    template<bool ALL> void add_flags(const vec &a, const vec &b, const vec &carry_in, const vec &m, vec &res);
+
+public:
+	//! Load the program into every lane, lane i gets the command line "<file name> i", the console output of each lane is kept apart
+    void InitMMU(int hle = HLE_ON);
+	//! Deinitialize the MMU of every lane
+    void DeinitMMU();
+	//! Run every lane until it stops, or has run max_instructions
+    void run(uint64_t max_instructions = RUN_FOREVER);
+	//! The number of lanes
+    int lanes(){ return num; };
+	//! Why a lane stopped, executed is the number of instructions it ran in all
+    const StopInfo &stop_info(int lane){ return last_stop[lane]; };
+	//! What a lane wrote to the console
+    const std::string &output(int lane){ return console[lane]; };
+	//! Print how often the lanes ran together
+    void dump_stats(FILE *fp);
+};
+
+/*@}*/
+#endif // __LOCKSTEP_H__
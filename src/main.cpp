@@ -1,15 +1,129 @@
 #include <cstdlib>
 #include <iostream>
 #include <cstring>
-#include "Thumb.h"
+#include <vector>
+#include "core.h"
 #include "error.h"
-#include "ARM.h"
+#include "media.h"
+#include "lockstep.h"
 
 // TODO (Birdman#1#): the default stacktop is at 0x200000, it limits the heap size of 1MB, if more heap spaces is needed, increase the stacktop address,  make the stacktop as a parameter to override the default 0x200000
 #pragma align(1)
 char file_name[100] = {0};
 
 
+/*!
+	Print why a run stopped, the way the program ended or faulted.
+	\param info The stop of the run
+ */
+static void print_stop(const StopInfo &info)
+{
+    switch (info.reason)
+    {
+        case STOP_ENDED:
+            std::cout<<"\nThe Program Ended\n";
+            break;
+        case STOP_BREAKPOINT:
+            std::cout<<"\nBreakpoint at "<<std::hex<<info.address<<std::dec<<std::endl;
+            break;
+        case STOP_BUDGET:
+            std::cout<<"\nStopped at "<<std::hex<<info.address<<std::dec<<" after the instruction budget ran out"<<std::endl;
+            break;
+        case STOP_IDLE:
+            std::cout<<"\nIdle at "<<std::hex<<info.address<<std::dec<<": the program loops without side effects, nothing can end it"<<std::endl;
+            break;
+        case STOP_RETURNED:
+            std::cout<<"\nThe Function Returned\n";
+            break;
+        default://STOP_FAULT
+            if (info.fault == FAULT_UNEXPECTED)
+                std::cout<<"\nUnexpect Instr:"<<info.detail<<std::endl;
+            else if (info.fault == FAULT_UNDEFINED)
+                std::cout<<"\nUndefine Instr:"<<info.detail<<std::endl;
+            else
+                std::cout<<"\nError:"<<info.detail<<std::endl;
+            break;
+    }
+}
+
+/*!
+	Run instances of the program in lockstep, and print the console output of each of them and how it stopped.
+	\param lanes The number of instances, at most N
+	\param max_instrs The instruction budget of each instance
+	\param stats Whether to print how often the instances ran together
+	\param hle Which library routines of the program run on the host, HLE_OFF, HLE_ON or HLE_PRINTF
+	\return The exit status of the emulator
+ */
+template<int N> static int run_lockstep(int lanes, uint64_t max_instrs, bool stats, int hle)
+{
+    thumb_lockstep<N> batch(lanes);//not new, it is more aligned than operator new of C++14 gives
+
+    try
+    {
+        batch.InitMMU(hle);
+    }
+    catch(Error &e)
+    {
+        std::cout<<"\nError:"<<e.error_name<<std::endl;
+        return EXIT_FAILURE;
+    }
+
+    batch.run(max_instrs);
+
+    for (int l = 0; l < lanes; l++)
+    {
+        const StopInfo &info = batch.stop_info(l);
+
+        std::cout<<"Lane "<<l<<", "<<info.executed<<" instructions:\n"<<batch.output(l);
+        print_stop(info);
+        std::cout<<std::endl;
+    }
+
+    if (stats)
+        batch.dump_stats(stderr);
+
+    batch.DeinitMMU();
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+	Call functions of the program one after the other, and print what each of them returned, or how it stopped.
+	\param arm The core, with the program loaded
+	\param calls The calls, each a function name followed by its arguments, separated by commas
+	\param max_instrs The instruction budget of each call
+	\return The exit status of the emulator
+ */
+static int run_calls(arm_core *arm, const std::vector<char *> &calls, uint64_t max_instrs)
+{
+    for (size_t c = 0; c < calls.size(); c++)
+    {
+        std::vector<uint32_t> args;//all of them, call() refuses more than CALL_MAX_ARGS
+        char *name = strtok(calls[c], ",");
+
+        for (char *a = strtok(NULL, ","); a != NULL; a = strtok(NULL, ","))
+            args.push_back(strtoul(a, NULL, 0));
+
+        try
+        {
+            if (arm->call(name, args.data(), (int)args.size(), max_instrs) != STOP_RETURNED)
+            {
+                print_stop(arm->stop_info());
+                return EXIT_FAILURE;
+            }
+        }
+        catch(Error &e)
+        {
+            std::cout<<"\nError:"<<e.error_name<<std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::cout<<name<<" = "<<arm->get_reg_by_code(0)<<" ("<<std::hex<<"0x"<<arm->get_reg_by_code(0)<<std::dec<<"), "<<arm->stop_info().executed<<" instructions"<<std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 /*!
 	entry point of the emulator, pass the parameters into the Thumb program through this function. Start the emulator.
 	\param param_1 first parameter to be passed
@@ -22,19 +136,81 @@ int main(int argc,char* argv[])
     // format the parameter, seperate the parameter by 0x20
     //sprintf(main_param, "%d\040%d\040", param_1, param_2);
 
-	if (argc != 2)
+    int engine = ENGINE_INTERP;
+    bool stats = false;
+    bool aot_build = false;
+    int hle = HLE_ON;
+    int lanes = 0;
+    uint64_t max_instrs = RUN_FOREVER;
+    std::vector<char *> calls;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-block") == 0)
+            engine = ENGINE_BLOCK;
+        else if (strcmp(argv[i], "-jit") == 0)
+            engine = ENGINE_JIT;
+        else if (strcmp(argv[i], "-aot") == 0)
+            engine = ENGINE_AOT;
+        else if (strcmp(argv[i], "-aot-build") == 0)
+            aot_build = true;
+        else if (strcmp(argv[i], "-stats") == 0)
+            stats = true;
+        else if (strcmp(argv[i], "-no-hle") == 0)
+            hle = HLE_OFF;
+        else if (strcmp(argv[i], "-hle-printf") == 0)
+            hle = HLE_PRINTF;
+        else if (strcmp(argv[i], "-lanes") == 0 && i + 1 < argc)
+            lanes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-call") == 0 && i + 1 < argc)
+            calls.push_back(argv[++i]);
+        else if (strcmp(argv[i], "-max") == 0 && i + 1 < argc)
+            max_instrs = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-media-bench") == 0)
+            return media_bench(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+        else if (argv[i][0] != '-' && file_name[0] == 0)
+            strcpy(file_name, argv[i]);
+        else
+        {
+            file_name[0] = 0;
+            break;
+        }
+    }
+
+	if (file_name[0] == 0 || lanes < 0 || lanes > LOCKSTEP_MAX_LANES)
 	{
-		std::cout<<"Use: \"ARMulator [file name]\" to run!"<<std::endl;
+		std::cout<<"Use: \"ARMulator [-block|-jit|-aot] [-aot-build] [-lanes n] [-stats] [-no-hle|-hle-printf] [-call f,args] [-max n] [file name]\" to run!"<<std::endl;
+		std::cout<<"  -block  run chained basic blocks"<<std::endl;
+		std::cout<<"  -jit    run chained basic blocks, translate hot ones into x86-64 code"<<std::endl;
+		std::cout<<"  -aot    run chained basic blocks, the ones of <file name>.aot.so in its host code from the start"<<std::endl;
+		std::cout<<"  -aot-build  translate the Thumb code into <file name>.aot.so with the host C compiler, and exit"<<std::endl;
+		std::cout<<"  -lanes n  run n instances (up to 16) in lockstep, instance i gets the argument i"<<std::endl;
+		std::cout<<"  -stats  print the dead flag, superinstruction or block statistics when the program ends"<<std::endl;
+		std::cout<<"  -no-hle  run memcpy, memset, strlen, ... of the program as its own code, not on the host"<<std::endl;
+		std::cout<<"  -hle-printf  run printf, fprintf, sprintf and snprintf of the program on the host too"<<std::endl;
+		std::cout<<"  -call f,a,b,...  call the function f of the program with the arguments a, b, ..., not its entry point, repeat it for more calls"<<std::endl;
+		std::cout<<"  -max n  stop after n instructions"<<std::endl;
+		std::cout<<"Or \"ARMulator -media-bench\" to check and time the SSE2 media instructions against the scalar ones."<<std::endl;
 		return EXIT_FAILURE;
 	}
 	
-	strcpy(file_name, argv[1]);
-	
-    CPU *arm = new ARM;
+    if (lanes > 0)
+        return lanes <= 8 ? run_lockstep<8>(lanes, max_instrs, stats, hle) : run_lockstep<16>(lanes, max_instrs, stats, hle);
+
+    arm_core *arm = new arm_core;
+    arm->setEngine(engine);
+    arm->setHLE(hle);
 
     try
     {
         arm->InitMMU();
+        if (aot_build)
+        {
+            arm->build_aot(file_name);
+            arm->DeinitMMU();
+            delete arm;
+            return EXIT_SUCCESS;
+        }
     }
     catch(Error &e)
     {
@@ -42,45 +218,46 @@ int main(int argc,char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (!calls.empty())
+    {
+        int status = run_calls(arm, calls, max_instrs);
+
+        if (stats)
+            arm->dump_stats(stderr);
+        arm->DeinitMMU();
+        delete arm;
+        return status;
+    }
+
+    bool running = true;
 
-    while(1)
+    while(running)
     {
+        StopReason why;
+
         try
         {
-            arm->fetch();
-            arm->exec();
+            why = arm->run(max_instrs);
         }
-        catch(Error &e)
+        catch(Error &e)//errors of the host
         {
-            arm->DeinitMMU();
             std::cout<<"\nError:"<<e.error_name<<std::endl;
             break;
         }
-        catch(UnexpectInst &e)
-        {
-            std::cout<<"\nUnexpect Instr:"<<e.error_name<<std::endl;
-            break;
-        }
-        catch(UndefineInst &e)
-        {
-            std::cout<<"\nUndefine Instr:"<<e.error_name<<std::endl;
-            break;
-        }
-        catch(SwitchMode &e)
-        {
-            Thumb *tmp = new Thumb;
-            tmp->CopyCPU(arm);
-            delete arm;
-            arm = tmp;
-            //arm->getArg(main_param, strlen(main_param));
-        }
-        catch(ProgramEnd &e)
-        {
-            std::cout<<"\nThe Program Ended\n";
-            break;
-        }
+
+        const StopInfo &info = arm->stop_info();
+
+        if (max_instrs != RUN_FOREVER)
+            max_instrs -= info.executed;
+
+        print_stop(info);
+        if (why != STOP_BREAKPOINT)
+            running = false;
     }
 
+    if (stats)
+        arm->dump_stats(stderr);
+
     arm->DeinitMMU();
     delete arm;
 
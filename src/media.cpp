@@ -0,0 +1,375 @@
+/*! \file media.cpp
+	\brief The ARMv6 packed arithmetic.
+
+	The SSE2 path widens the lanes of the operands (bytes to 16 bits, halfwords to 32 bits) so the sum or difference is exact, then narrows it back: by masking for the wrapping operations, with the saturating packs for the saturating ones, after an arithmetic shift for the halving ones. The GE bits are a compare of the exact result gathered by movemask.
+ */
+#include <stdlib.h>
+#include <chrono>
+#include "media.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+  * Whether lane i of op2 subtracts.
+  */
+static inline bool lane_sub(int op2, int i)
+{
+    return op2 == MEDIA_SUB16 || op2 == MEDIA_SUB8 || (op2 == MEDIA_ASX && i == 0) || (op2 == MEDIA_SAX && i == 1);
+}
+
+/**
+  * Run a parallel add or subtract one lane at a time, widened to an int so the carry, the saturation and the halving fall out of the exact sum.
+  * @param op1 The kind, MEDIA_S ... MEDIA_UH
+  * @param op2 The operation, MEDIA_ADD16 ... MEDIA_SUB8
+  * @param rn The first operand
+  * @param rm The second operand
+  * @param ge Set to the four GE bits, one per byte
+  * @return The result
+  */
+uint32_t media_parallel_ref(int op1, int op2, uint32_t rn, uint32_t rm, uint32_t &ge)
+{
+    bool is_signed = op1 < 4;
+    int bits = op2 >= MEDIA_ADD8 ? 8 : 16;
+    int32_t mask = (1<<bits) - 1;
+    int32_t sign = 1<<(bits - 1);
+    uint32_t result = 0;
+
+    if (op2 == MEDIA_ASX || op2 == MEDIA_SAX)
+        rm = (rm>>16) | (rm<<16);
+
+    ge = 0;
+    for (int i = 0; i < 32 / bits; i++)
+    {
+        int32_t a = (rn>>(i * bits)) & mask;
+        int32_t b = (rm>>(i * bits)) & mask;
+        bool sub = lane_sub(op2, i);
+
+        if (is_signed)
+        {
+            a = (a ^ sign) - sign;
+            b = (b ^ sign) - sign;
+        }
+
+        int32_t s = sub ? a - b : a + b;
+
+        switch (op1 & 3)
+        {
+        	case 1://the unsigned add sets GE on a carry out, the others on a result >= 0
+        		if (!is_signed && !sub ? s > mask : s >= 0)
+        		    ge |= (bits / 8 == 1 ? 1 : 3)<<(i * bits / 8);
+        		break;
+        	case 2:
+        		if (s > (is_signed ? sign - 1 : mask))
+        		    s = is_signed ? sign - 1 : mask;
+        		if (s < (is_signed ? -sign : 0))
+        		    s = is_signed ? -sign : 0;
+        		break;
+        	case 3:
+        		s >>= 1;
+        		break;
+        }
+        result |= (uint32_t)(s & mask)<<(i * bits);
+    }
+
+    return result;
+}
+
+/**
+  * Sum the absolute differences of the four unsigned bytes, one byte at a time.
+  * @param rn The first operand
+  * @param rm The second operand
+  * @return The sum
+  */
+uint32_t media_usad8_ref(uint32_t rn, uint32_t rm)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; i < 32; i += 8)
+        sum += abs((int)((rn>>i) & 0xff) - (int)((rm>>i) & 0xff));
+
+    return sum;
+}
+
+#if defined(__SSE2__)
+
+/**
+  * The byte lanes, ADD8 and SUB8, in 16 bit lanes.
+  */
+static inline uint32_t parallel8(int op1, bool sub, uint32_t rn, uint32_t rm, uint32_t &ge)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = _mm_cvtsi32_si128(rn);
+    __m128i b = _mm_cvtsi32_si128(rm);
+
+    if (op1 < 4)//a byte in both halves of a lane, shifted down with its sign
+    {
+        a = _mm_srai_epi16(_mm_unpacklo_epi8(a, a), 8);
+        b = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+    }
+    else
+    {
+        a = _mm_unpacklo_epi8(a, zero);
+        b = _mm_unpacklo_epi8(b, zero);
+    }
+
+    __m128i s = sub ? _mm_sub_epi16(a, b) : _mm_add_epi16(a, b);
+    __m128i low = _mm_set1_epi16(0xff);
+
+    switch (op1)
+    {
+    	case MEDIA_S:
+    	case MEDIA_U:
+    	{
+    	    __m128i limit = op1 == MEDIA_U && !sub ? low : _mm_set1_epi16(-1);
+
+    	    ge = _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(s, limit), zero)) & 0xf;
+    		return _mm_cvtsi128_si32(_mm_packus_epi16(_mm_and_si128(s, low), zero));
+    	}
+    	case MEDIA_Q:
+    		return _mm_cvtsi128_si32(_mm_packs_epi16(s, zero));
+    	case MEDIA_UQ:
+    		return _mm_cvtsi128_si32(_mm_packus_epi16(s, zero));
+    	default://halving
+    		return _mm_cvtsi128_si32(_mm_packus_epi16(_mm_and_si128(_mm_srai_epi16(s, 1), low), zero));
+    }
+}
+
+/**
+  * The halfword lanes, ADD16, ASX, SAX and SUB16, in 32 bit lanes.
+  */
+static inline uint32_t parallel16(int op1, int op2, uint32_t rn, uint32_t rm, uint32_t &ge)
+{
+    __m128i zero = _mm_setzero_si128();
+
+    if (op2 == MEDIA_ASX || op2 == MEDIA_SAX)
+        rm = (rm>>16) | (rm<<16);
+
+    __m128i a = _mm_cvtsi32_si128(rn);
+    __m128i b = _mm_cvtsi32_si128(rm);
+
+    if (op1 < 4)
+    {
+        a = _mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16);
+        b = _mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16);
+    }
+    else
+    {
+        a = _mm_unpacklo_epi16(a, zero);
+        b = _mm_unpacklo_epi16(b, zero);
+    }
+
+    __m128i s;
+
+    if (op2 == MEDIA_ADD16)
+        s = _mm_add_epi32(a, b);
+    else if (op2 == MEDIA_SUB16)
+        s = _mm_sub_epi32(a, b);
+    else//one lane of each, picked by a mask of the subtracting lane
+    {
+        __m128i m = op2 == MEDIA_ASX ? _mm_set_epi32(0, 0, 0, -1) : _mm_set_epi32(0, 0, -1, 0);
+
+        s = _mm_or_si128(_mm_and_si128(m, _mm_sub_epi32(a, b)), _mm_andnot_si128(m, _mm_add_epi32(a, b)));
+    }
+
+    switch (op1)
+    {
+    	case MEDIA_S:
+    	case MEDIA_U:
+    	{
+    	    __m128i limit = _mm_set1_epi32(-1);
+    	    int mm;
+
+    	    if (op1 == MEDIA_U)//a carry out for the adding lanes
+    	        limit = _mm_set_epi32(-1, -1, lane_sub(op2, 1) ? -1 : 0xffff, lane_sub(op2, 0) ? -1 : 0xffff);
+    	    mm = _mm_movemask_epi8(_mm_cmpgt_epi32(s, limit));
+    	    ge = ((mm & 0x1) ? 0x3 : 0) | ((mm & 0x10) ? 0xc : 0);
+    		return _mm_cvtsi128_si32(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 2, 0)));
+    	}
+    	case MEDIA_Q:
+    		return _mm_cvtsi128_si32(_mm_packs_epi32(s, zero));
+    	case MEDIA_UQ://packs saturates to signed halfwords, biased by 0x8000 around it
+    	{
+    	    __m128i bias = _mm_set1_epi32(0x8000);
+
+    	    s = _mm_packs_epi32(_mm_sub_epi32(s, bias), zero);
+    		return _mm_cvtsi128_si32(_mm_add_epi16(s, _mm_set1_epi16((short)0x8000)));
+    	}
+    	default://halving
+    		return _mm_cvtsi128_si32(_mm_shufflelo_epi16(_mm_srai_epi32(s, 1), _MM_SHUFFLE(3, 3, 2, 0)));
+    }
+}
+
+/**
+  * Run a parallel add or subtract with SSE2, the byte operations in 16 bit lanes and the halfword ones in 32 bit lanes.
+  * @param op1 The kind, MEDIA_S ... MEDIA_UH
+  * @param op2 The operation, MEDIA_ADD16 ... MEDIA_SUB8
+  * @param rn The first operand
+  * @param rm The second operand
+  * @param ge Set to the four GE bits for MEDIA_S and MEDIA_U
+  * @return The result
+  */
+uint32_t media_parallel(int op1, int op2, uint32_t rn, uint32_t rm, uint32_t &ge)
+{
+    if (op2 >= MEDIA_ADD8)
+        return parallel8(op1, op2 == MEDIA_SUB8, rn, rm, ge);
+    return parallel16(op1, op2, rn, rm, ge);
+}
+
+/**
+  * Sum the absolute differences of the four unsigned bytes with psadbw.
+  * @param rn The first operand
+  * @param rm The second operand
+  * @return The sum
+  */
+uint32_t media_usad8(uint32_t rn, uint32_t rm)
+{
+    return _mm_cvtsi128_si32(_mm_sad_epu8(_mm_cvtsi32_si128(rn), _mm_cvtsi32_si128(rm)));
+}
+
+#else
+
+/**
+  * Without SSE2 on the host, the reference does the work.
+  * @param op1 The kind, MEDIA_S ... MEDIA_UH
+  * @param op2 The operation, MEDIA_ADD16 ... MEDIA_SUB8
+  * @param rn The first operand
+  * @param rm The second operand
+  * @param ge Set to the four GE bits for MEDIA_S and MEDIA_U
+  * @return The result
+  */
+uint32_t media_parallel(int op1, int op2, uint32_t rn, uint32_t rm, uint32_t &ge)
+{
+    return media_parallel_ref(op1, op2, rn, rm, ge);
+}
+
+/**
+  * Without SSE2 on the host, the reference does the work.
+  * @param rn The first operand
+  * @param rm The second operand
+  * @return The sum
+  */
+uint32_t media_usad8(uint32_t rn, uint32_t rm)
+{
+    return media_usad8_ref(rn, rm);
+}
+
+#endif
+
+/**
+  * The number of operand pairs of media_bench(), and their values, a xorshift sequence.
+  */
+#define BENCH_OPS       (1<<20)
+
+static uint32_t bench_rn[BENCH_OPS], bench_rm[BENCH_OPS];
+
+typedef uint32_t (*parallel_fn)(int op1, int op2, uint32_t rn, uint32_t rm, uint32_t &ge);
+typedef uint32_t (*usad_fn)(uint32_t rn, uint32_t rm);
+
+/**
+  * Run one operation over all the operands through a function pointer, so neither side is inlined into the loop.
+  * @return The nanoseconds per operation, sum gets a checksum of the results
+  */
+static double time_parallel(parallel_fn fn, int op1, int op2, uint32_t &sum)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    uint32_t ge = 0;
+
+    sum = 0;
+    for (int i = 0; i < BENCH_OPS; i++)
+    {
+        sum += fn(op1, op2, bench_rn[i], bench_rm[i], ge);
+        sum += ge;
+    }
+
+    std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - t0;
+    return t.count() / BENCH_OPS;
+}
+
+/**
+  * Run USAD8 over all the operands through a function pointer, as time_parallel() does.
+  * @return The nanoseconds per operation, sum gets a checksum of the results
+  */
+static double time_usad(usad_fn fn, uint32_t &sum)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    sum = 0;
+    for (int i = 0; i < BENCH_OPS; i++)
+        sum += fn(bench_rn[i], bench_rm[i]);
+
+    std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - t0;
+    return t.count() / BENCH_OPS;
+}
+
+/**
+  * Time media_parallel() against media_parallel_ref() and media_usad8() against media_usad8_ref() on the same operands, and compare every result and GE.
+  * @param fp Where the table and the first few mismatches go
+  * @return The number of mismatches
+  */
+int media_bench(FILE *fp)
+{
+    static const char *kinds[8] = { "", "S", "Q", "SH", "", "U", "UQ", "UH" };
+    static const char *ops[8] = { "ADD16", "ASX", "SAX", "SUB16", "ADD8", "", "", "SUB8" };
+    parallel_fn volatile sse = media_parallel, ref = media_parallel_ref;
+    usad_fn volatile sse_usad = media_usad8, ref_usad = media_usad8_ref;
+    uint32_t x = 0x12345678;
+    int wrong = 0;
+
+    for (int i = 0; i < BENCH_OPS; i++)//the bytes at 0x00, 0x7f, 0x80 and 0xff now and then, where the lanes saturate or carry
+    {
+        x ^= x<<13; x ^= x>>17; x ^= x<<5;
+        bench_rn[i] = x;
+        x ^= x<<13; x ^= x>>17; x ^= x<<5;
+        bench_rm[i] = (i & 3) == 0 ? x & 0x807fff00 : (i & 3) == 1 ? x | 0x7f80ff00 : x;
+    }
+
+#if defined(__SSE2__)
+    fprintf(fp, "%-10s %10s %10s\n", "", "scalar", "SSE2");
+#else
+    fprintf(fp, "%-10s %10s %10s\n", "", "scalar", "scalar");//no SSE2 on the host, media_parallel() is the reference
+#endif
+
+    for (int op1 = 0; op1 < 8; op1++)
+        for (int op2 = 0; op2 < 8; op2++)
+        {
+            if (!MEDIA_VALID(op1, op2))
+                continue;
+
+            for (int i = 0; i < BENCH_OPS; i++)
+            {
+                uint32_t ge_ref = 0, ge_sse = 0;
+                uint32_t want = media_parallel_ref(op1, op2, bench_rn[i], bench_rm[i], ge_ref);
+                uint32_t got = media_parallel(op1, op2, bench_rn[i], bench_rm[i], ge_sse);
+
+                if (want != got || (MEDIA_SETS_GE(op1) && ge_ref != ge_sse))
+                {
+                    if (wrong++ < 8)
+                        fprintf(fp, "%s%s %08x %08x: %08x GE %x, expected %08x GE %x\n", kinds[op1], ops[op2],
+                                bench_rn[i], bench_rm[i], got, ge_sse, want, ge_ref);
+                }
+            }
+
+            uint32_t sum_ref, sum_sse;
+            double t_ref = time_parallel(ref, op1, op2, sum_ref);
+            double t_sse = time_parallel(sse, op1, op2, sum_sse);
+            char name[16];
+
+            snprintf(name, sizeof(name), "%s%s", kinds[op1], ops[op2]);
+            fprintf(fp, "%-10s %7.2f ns %7.2f ns\n", name, t_ref, t_sse);
+        }
+
+    for (int i = 0; i < BENCH_OPS; i++)
+        if (media_usad8(bench_rn[i], bench_rm[i]) != media_usad8_ref(bench_rn[i], bench_rm[i]))
+            wrong++;
+
+    uint32_t sum_ref, sum_sse;
+    double t_ref = time_usad(ref_usad, sum_ref);
+    double t_sse = time_usad(sse_usad, sum_sse);
+
+    fprintf(fp, "%-10s %7.2f ns %7.2f ns\n", "USAD8", t_ref, t_sse);
+    fprintf(fp, "%d mismatches\n", wrong);
+
+    return wrong;
+}
@@ -0,0 +1,75 @@
+/*! \file media.h
+	\brief The ARMv6 packed arithmetic.
+
+	The parallel add and subtract instructions and USAD8 of the ARM decoder, computed in the lanes of host SSE2 registers where the host has them, and by a scalar reference otherwise.
+ */
+#ifndef __MEDIA_H__
+#define __MEDIA_H__
+
+/*!
+	\addtogroup instruction
+ */
+/*@{*/
+
+#include <stdio.h>
+#include "arch.h"
+
+#define MEDIA_S         1       //!< signed, sets GE (op1, bits 22:20)
+#define MEDIA_Q         2       //!< signed saturating
+#define MEDIA_SH        3       //!< signed halving
+#define MEDIA_U         5       //!< unsigned, sets GE
+#define MEDIA_UQ        6       //!< unsigned saturating
+#define MEDIA_UH        7       //!< unsigned halving
+
+#define MEDIA_ADD16     0       //!< add the halfwords (op2, bits 7:5)
+#define MEDIA_ASX       1       //!< subtract the low halfwords, add the high ones, the halves of Rm exchanged
+#define MEDIA_SAX       2       //!< add the low halfwords, subtract the high ones, the halves of Rm exchanged
+#define MEDIA_SUB16     3       //!< subtract the halfwords
+#define MEDIA_ADD8      4       //!< add the bytes
+#define MEDIA_SUB8      7       //!< subtract the bytes
+
+/*! \def MEDIA_VALID
+	\brief Whether op1 and op2 make a parallel add or subtract, the others are undefined
+ */
+#define MEDIA_VALID(op1, op2)   (((op1) & 3) != 0 && (op2) != 5 && (op2) != 6)
+
+/*! \def MEDIA_SETS_GE
+	\brief Whether a parallel add or subtract of op1 writes the GE bits
+ */
+#define MEDIA_SETS_GE(op1)      (((op1) & 3) == 1)
+
+/*!
+	Run a parallel add or subtract on the host vector unit.
+	\param op1 The kind, MEDIA_S ... MEDIA_UH
+	\param op2 The operation, MEDIA_ADD16 ... MEDIA_SUB8
+	\param rn The first operand
+	\param rm The second operand
+	\param ge Set to the four GE bits, one per byte, for MEDIA_S and MEDIA_U
+	\return The result
+ */
+uint32_t media_parallel(int op1, int op2, uint32_t rn, uint32_t rm, uint32_t &ge);
+
+/*!
+	Run a parallel add or subtract one lane at a time, the reference for media_parallel().
+ */
+uint32_t media_parallel_ref(int op1, int op2, uint32_t rn, uint32_t rm, uint32_t &ge);
+
+/*!
+	The sum of the absolute differences of the four unsigned bytes of rn and rm (USAD8), on the host vector unit.
+ */
+uint32_t media_usad8(uint32_t rn, uint32_t rm);
+
+/*!
+	The scalar reference for media_usad8().
+ */
+uint32_t media_usad8_ref(uint32_t rn, uint32_t rm);
+
+/*!
+	Time both implementations of every operation on random operands, check that they agree, and print the results.
+	\param fp Where the table goes
+	\return The number of operands on which the two implementations disagree
+ */
+int media_bench(FILE *fp);
+
+/*@}*/
+#endif // __MEDIA_H__
@@ -0,0 +1,229 @@
+/*! \file native.cpp
+	\brief Host functions the program calls by name through SYS_NATIVE.
+
+	The registry starts with crc32, sha256, fft and ifft. An embedder adds its own, zlib inflate for one, with native_register() before the program runs.
+ */
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "native.h"
+
+/**
+  * crc32, the CRC-32 of zlib and gzip over views[0], going on from the CRC in result, 0 to start.
+  */
+static int native_crc32(const native_view *views, int num, uint32_t &result)
+{
+    static uint32_t table[256];
+
+    if (num != 1)
+        return EINVAL;
+
+    if (table[1] == 0)
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c>>1) : c>>1;
+            table[i] = c;
+        }
+
+    uint32_t crc = ~result;
+
+    for (uint32_t i = 0; i < views[0].size; i++)
+        crc = table[(crc ^ views[0].data[i]) & 0xff] ^ (crc>>8);
+    result = ~crc;
+    return 0;
+}
+
+/**
+  * The SHA-256 compression of one 64-byte block.
+  */
+static void sha256_block(uint32_t h[8], const BYTE *p)
+{
+    static const uint32_t k[64] =
+    {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t w[64], s[8];
+
+#define ROR(x, n)   ((x)>>(n) | (x)<<(32 - (n)))
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i]<<24 | p[4 * i + 1]<<16 | p[4 * i + 2]<<8 | p[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+        w[i] = w[i - 16] + (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15]>>3))
+             + w[i - 7] + (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2]>>10));
+
+    memcpy(s, h, sizeof(s));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + k[i] + w[i];
+        uint32_t t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+        memmove(&s[1], &s[0], 7 * sizeof(uint32_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+#undef ROR
+
+    for (int i = 0; i < 8; i++)
+        h[i] += s[i];
+}
+
+/**
+  * sha256, the SHA-256 digest of views[0] into the 32 bytes of views[1].
+  */
+static int native_sha256(const native_view *views, int num, uint32_t &result)
+{
+    if (num != 2 || views[1].size < 32 || !views[1].writable)
+        return EINVAL;
+
+    uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    uint32_t n = views[0].size, i;
+    BYTE tail[128] = { 0 };
+
+    for (i = 0; i + 64 <= n; i += 64)
+        sha256_block(h, views[0].data + i);
+
+    uint32_t rest = n - i, len = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)n * 8;
+
+    if (rest > 0)
+        memcpy(tail, views[0].data + i, rest);
+    tail[rest] = 0x80;
+    for (int b = 0; b < 8; b++)
+        tail[len - 1 - b] = bits>>(8 * b);
+    for (i = 0; i < len; i += 64)
+        sha256_block(h, tail + i);
+
+    for (i = 0; i < 8; i++)
+        for (int b = 0; b < 4; b++)
+            views[1].data[4 * i + b] = h[i]>>(24 - 8 * b);
+    result = 0;
+    return 0;
+}
+
+/**
+  * The in-place radix-2 FFT of views[0], complex floats as real and imaginary pairs, whose number is a power of two.
+  * @param inverse Whether to take the inverse transform, scaled by 1/n
+  */
+static int fft(const native_view *views, int num, uint32_t &result, bool inverse)
+{
+    if (num != 1 || !views[0].writable || views[0].size % 8 != 0)
+        return EINVAL;
+
+    uint32_t n = views[0].size / 8;
+
+    if (n == 0 || (n & (n - 1)) != 0)
+        return EINVAL;
+
+    std::vector<float> x(2 * n);
+
+    memcpy(&x[0], views[0].data, views[0].size);//the buffer is not always aligned for floats
+    for (uint32_t i = 1, j = 0; i < n; i++)
+    {
+        uint32_t bit = n>>1;
+
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+        {
+            std::swap(x[2 * i], x[2 * j]);
+            std::swap(x[2 * i + 1], x[2 * j + 1]);
+        }
+    }
+
+    for (uint32_t len = 2; len <= n; len <<= 1)
+    {
+        double a = (inverse ? 2 : -2) * M_PI / len;
+
+        for (uint32_t i = 0; i < n; i += len)
+            for (uint32_t k = 0; k < len / 2; k++)
+            {
+                float wr = cos(a * k), wi = sin(a * k);
+                float *u = &x[2 * (i + k)], *v = &x[2 * (i + k + len / 2)];
+                float tr = v[0] * wr - v[1] * wi, ti = v[0] * wi + v[1] * wr;
+
+                v[0] = u[0] - tr;
+                v[1] = u[1] - ti;
+                u[0] += tr;
+                u[1] += ti;
+            }
+    }
+
+    if (inverse)
+        for (uint32_t i = 0; i < 2 * n; i++)
+            x[i] /= n;
+
+    memcpy(views[0].data, &x[0], views[0].size);
+    result = n;
+    return 0;
+}
+
+/**
+  * fft, the forward transform of views[0] in place, unscaled.
+  */
+static int native_fft(const native_view *views, int num, uint32_t &result)
+{
+    return fft(views, num, result, false);
+}
+
+/**
+  * ifft, the inverse transform of views[0] in place, scaled by 1/n.
+  */
+static int native_ifft(const native_view *views, int num, uint32_t &result)
+{
+    return fft(views, num, result, true);
+}
+
+/**
+  * The registered functions, with the built-in ones in from the start.
+  */
+static std::map<std::string, native_fn> &registry()
+{
+    static std::map<std::string, native_fn> fns =
+    {
+        {"crc32", native_crc32},
+        {"sha256", native_sha256},
+        {"fft", native_fft},
+        {"ifft", native_ifft}
+    };
+
+    return fns;
+}
+
+/**
+  * Make a host function callable by the program through SYS_NATIVE.
+  * @param name The name the program calls it by
+  * @param fn The function
+  * @return false if a function of that name is registered already, or the name is longer than NATIVE_NAME_LEN
+  */
+bool native_register(const char *name, native_fn fn)
+{
+    if (strlen(name) > NATIVE_NAME_LEN)
+        return false;
+    return registry().insert(std::make_pair(std::string(name), fn)).second;
+}
+
+/**
+  * Give out a registered host function.
+  * @param name The name the program calls it by
+  * @return The function, NULL if none is registered by that name
+  */
+native_fn native_lookup(const char *name)
+{
+    std::map<std::string, native_fn>::const_iterator it = registry().find(name);
+
+    return it == registry().end() ? NULL : it->second;
+}
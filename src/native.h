@@ -0,0 +1,50 @@
+/*! \file native.h
+	\brief Host functions the program calls by name through SYS_NATIVE.
+
+	A program whose source is at hand can hand its hot kernels, checksums, hashes, transforms, ..., to native code on the host. It passes the name of a registered function and up to NATIVE_MAX_VIEWS buffers, each an address and a length, and the function works on host views of those buffers, checked against the bounds of their segments.
+ */
+#ifndef __NATIVE_H__
+#define __NATIVE_H__
+
+/*!
+	\addtogroup swi
+ */
+/*@{*/
+
+#include "arch.h"
+
+/*! \def NATIVE_MAX_VIEWS
+	\brief The most buffers a call of SYS_NATIVE passes
+ */
+#define NATIVE_MAX_VIEWS    4
+
+/*! \def NATIVE_NAME_LEN
+	\brief The longest name of a host function
+ */
+#define NATIVE_NAME_LEN     63
+
+/*! \struct native_view
+	\brief A buffer of the program, in host memory.
+ */
+struct native_view
+{
+	//! The host memory of the buffer, NULL if it is empty
+    BYTE *data;
+	//! The size in bytes, all of them in one segment of the program
+    uint32_t size;
+	//! Whether the buffer may be written, false for code and read only data
+    bool writable;
+};
+
+/*! \typedef native_fn
+	\brief A host function the program calls. It gets the buffers of the call and a result word, which holds what the program put in it and goes back to it. It returns 0, or an errno value for SYS_ERRNO.
+ */
+typedef int (*native_fn)(const native_view *views, int num, uint32_t &result);
+
+//! Make a host function callable by name, false if the name is taken or too long
+bool native_register(const char *name, native_fn fn);
+//! Give out the host function of a name, NULL if none is registered
+native_fn native_lookup(const char *name);
+
+/*@}*/
+#endif // __NATIVE_H__
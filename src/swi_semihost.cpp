@@ -2,6 +2,7 @@
 	\brief The implementation of software interrupt handler
  */
 #include "swi_semihost.h"
+#include "native.h"
 #include <iostream>
 #include <time.h>
 #include "error.h"
@@ -48,6 +49,8 @@ static int previous_errno = 0;
   */
  swi_semihost::swi_semihost()
 {
+    console = NULL;
+    events = NULL;
     //fopen_mode[12][4]={"r","rb","r+","r+b","w","wb","w+","w+b","a","ab","a+","a+b"};
 }
 
@@ -96,10 +99,18 @@ void swi_semihost::get_para(const GP_Reg *para)
 
 
 /**
-  * Choose right swi handler according to the swi_type
+  * Choose right swi handler according to the swi_type, and count the call in the events of the core
+  * @return true for SYS_KILL
   */
-void swi_semihost::swi_handler()
+bool swi_semihost::swi_handler()
 {
+    if (swi_type == SYS_CLOCK)
+        events->clock_reads++;
+    else if (swi_type == SYS_TIME)
+        events->time_reads++;
+    else
+        events->others++;
+
     switch (swi_type)
     {
     	case SYS_OPEN:
@@ -164,26 +175,29 @@ void swi_semihost::swi_handler()
         	break;
         case SYS_KILL:
             sys_kill();
-            break;
+            return true;
         case SYS_ELAPSED:
             sys_elapsed();
         	break;
         case SYS_TICKFREQ:
             sys_tickfreq();
         	break;
+        case SYS_NATIVE:
+            sys_native();
+        	break;
     	default:
     		break;
     }
 
+    return false;
 }
 
 /**
-  *
+  * Nothing to release, the core stops running the program when swi_handler() returns.
   */
 void swi_semihost::sys_kill()
 {
-    ProgramEnd e;
-    throw e;
+
 }
 
 /**
@@ -257,17 +271,17 @@ void swi_semihost::sys_system()
 }
 
 /**
-  *
+  * The seconds since Jan 1, 1970, plus those idle loops skipped
   */
 void swi_semihost::sys_time()
 {
-    parameter[0] = time(NULL);
+    parameter[0] = time(NULL) + events->time_skip;
     //get_errno();
     previous_errno = errno;
 }
 
 /**
-  *
+  * The centiseconds of host processor time, plus those idle loops skipped
   */
 void swi_semihost::sys_clock()
 {
@@ -280,6 +294,7 @@ void swi_semihost::sys_clock()
     /* Presume unix... clock() returns microseconds.  */
     (clock () / 10000);
 #endif
+    parameter[0] += events->clock_skip;
 
     //get_errno();
     previous_errno = errno;
@@ -464,7 +479,15 @@ void swi_semihost::sys_write()
 
     data[len] = 0;
 
-    int res = write(handler, data, len);
+    int res;
+
+    if (handler == 1 && console != NULL)
+    {
+        console->append(data, len);
+        res = len;
+    }
+    else
+        res = write(handler, data, len);
 
     parameter[0] = res == -1 ? -1 : len - res;
 
@@ -482,7 +505,13 @@ void swi_semihost::sys_write0()
     char msg;
     int i = 0;
     while ((msg = my_mmu->get_byte(parameter[1] + i)) != 0)
-        std::cout<<msg;
+    {
+        if (console != NULL)
+            console->push_back(msg);
+        else
+            std::cout<<msg;
+        i++;
+    }
 }
 
 /**
@@ -491,7 +520,11 @@ void swi_semihost::sys_write0()
 void swi_semihost::sys_writec()
 {
     char msg = my_mmu->get_byte(parameter[1]);
-    std::cout<<msg;
+
+    if (console != NULL)
+        console->push_back(msg);
+    else
+        std::cout<<msg;
 }
 
 /**
@@ -547,6 +580,68 @@ void swi_semihost::sys_tickfreq()
 
 }
 
+/**
+  * Call a host function registered by name. r1 points at a block of words: the address of the name, the result word, which the function reads and writes, the number of buffers, and the address and length of each. The buffers must each lie in one segment, data, bss or heap, or code and read only data which are only read; the stack keeps whole words rather than bytes in memory order, so it has no host view to give. r0 is set to 0, or to -1 with the errno of SYS_ERRNO set: ENOENT for an unknown name, EFAULT for a buffer out of bounds, or what the function returned.
+  */
+void swi_semihost::sys_native()
+{
+    int block = parameter[1];
+    int name_pointer = my_mmu->get_word(block);
+    uint32_t result = my_mmu->get_word(block + 4);
+    uint32_t num = my_mmu->get_word(block + 8);
+    char name[NATIVE_NAME_LEN + 1];
+    native_view views[NATIVE_MAX_VIEWS];
+    int i;
+
+    for (i = 0; i < NATIVE_NAME_LEN && (name[i] = my_mmu->get_byte(name_pointer + i)) != 0; i++)
+        ;
+    name[i] = 0;
+
+    native_fn fn = native_lookup(name);
+
+    parameter[0] = -1;
+    if (fn == NULL)
+    {
+        previous_errno = ENOENT;
+        return;
+    }
+    if (num > NATIVE_MAX_VIEWS)
+    {
+        previous_errno = EINVAL;
+        return;
+    }
+
+    for (i = 0; i < (int)num; i++)
+    {
+        int address = my_mmu->get_word(block + 12 + 8 * i), VMA, size;
+        uint32_t len = my_mmu->get_word(block + 16 + 8 * i);
+        BYTE *host = my_mmu->host_range(address, true, VMA, size);
+
+        views[i].writable = host != NULL;
+        if (host == NULL)
+            host = my_mmu->host_range(address, false, VMA, size);
+
+        if (len > 0 && (host == NULL || len > (uint32_t)(VMA + size - address)))
+        {
+            previous_errno = EFAULT;
+            return;
+        }
+        views[i].size = len;
+        views[i].data = len == 0 ? NULL : host + (address - VMA);
+    }
+
+    int err = fn(views, num, result);
+
+    if (err != 0)
+    {
+        previous_errno = err;
+        return;
+    }
+
+    my_mmu->set_word(block + 4, result);
+    parameter[0] = 0;
+}
+
 void swi_semihost::getArg(char *arg, int len)
 {
     memset(argv, 0, 100);
@@ -12,6 +12,7 @@
  */
 /*@{*/
 
+#include <string>
 #include "arch.h"
 #include "MMU.h"
 
@@ -38,6 +39,23 @@
 #define SYS_KILL        0x18    //!< kill the current process
 #define SYS_ELAPSED     0x30    //!< get the number of target ticks since support code started
 #define SYS_TICKFREQ    0x31    //!< define a tick frequency
+#define SYS_NATIVE      0x100   //!< call a host function registered by name, see native.h
+
+
+/*! \struct swi_events
+	\brief What the semihosting calls of a core did, kept in the registers of the core for both decoders.
+
+	The idle loop check of CPU tells from it whether a loop did nothing but read the clock, and moves that clock on to its next tick instead of spinning until it gets there.
+ */
+struct swi_events
+{
+	//! The SYS_CLOCK and the SYS_TIME calls
+    unsigned long long clock_reads, time_reads;
+	//! The other calls, which may change something outside the registers
+    unsigned long long others;
+	//! The centiseconds added to SYS_CLOCK, and the seconds added to SYS_TIME, skipped for idle loops waiting on them
+    uint32_t clock_skip, time_skip;
+};
 
 
 /*! \class swi_semihost
@@ -82,12 +100,19 @@ private:
     char argv[100];
 	//! The length of arguments string
     int arg_len;
+	//! Where the console output goes instead of the host stdout, NULL for stdout
+    std::string *console;
+	//! The calls counted for the core, and the time its idle loops skipped
+    swi_events *events;
 
 public:
 	//! Get the parameter
     void get_para(const GP_Reg *para);
 	//! Choose the corresponding handler program
-    void swi_handler();
+	/*!
+		\return true if the program asked to end, the core then stops running it
+	 */
+    bool swi_handler();
 
 	//! Get the pointer of MMU module
     void getMMU(MMU *mmu);
@@ -95,6 +120,10 @@ public:
     void getHeapInfo(int heap_addr, int heap_limit, int stack_addr, int stack_limit);
 	//! Get the arguments for running program inside the emulator
     void getArg(char *arg, int len);
+	//! Collect the console output in a string, NULL to write it to stdout
+    void setConsole(std::string *out){ console = out; };
+	//! Count the calls in the events of the core, whose clocks may run ahead of the host
+    void getEvents(swi_events *ev){ events = ev; };
 
 private:
 	//! open a file on the host
@@ -143,6 +172,8 @@ private:
     void sys_elapsed();
 	//! define a tick frequency
     void sys_tickfreq();
+	//! call a host function registered by name
+    void sys_native();
 
 
 };
@@ -0,0 +1,630 @@
+/*! \file vfp.cpp
+	\brief The VFPv2 floating point coprocessor.
+
+	Single and double precision arithmetic runs on host float and double. The host rounding mode is only changed around an operation when FPSCR asks for one other than round to nearest, which is what the rest of the emulator runs with.
+ */
+#include <string.h>
+#include <math.h>
+#include <fenv.h>
+#include "vfp.h"
+#include "error.h"
+
+/**
+  * The host rounding modes, by the RMode field of FPSCR.
+  */
+static const int round_modes[4] = { FE_TONEAREST, FE_UPWARD, FE_DOWNWARD, FE_TOWARDZERO };
+
+/**
+  * Whether a value is a signaling NaN.
+  */
+static inline bool is_snan(float v)
+{
+    uint32_t b;
+
+    memcpy(&b, &v, sizeof(b));
+    return (b & 0x7fc00000) == 0x7f800000 && (b & 0x003fffff) != 0;
+}
+
+/**
+  * Whether a value is a signaling NaN.
+  */
+static inline bool is_snan(double v)
+{
+    uint64_t b;
+
+    memcpy(&b, &v, sizeof(b));
+    return (b & 0x7ff8000000000000ull) == 0x7ff0000000000000ull && (b & 0x0007ffffffffffffull) != 0;
+}
+
+/**
+  * A NaN made quiet, its sign and payload kept.
+  */
+static inline float quiet(float v)
+{
+    uint32_t b;
+
+    memcpy(&b, &v, sizeof(b));
+    b |= 0x00400000;
+    memcpy(&v, &b, sizeof(b));
+    return v;
+}
+
+/**
+  * A NaN made quiet, its sign and payload kept.
+  */
+static inline double quiet(double v)
+{
+    uint64_t b;
+
+    memcpy(&b, &v, sizeof(b));
+    b |= 0x0008000000000000ull;
+    memcpy(&v, &b, sizeof(b));
+    return v;
+}
+
+/**
+  * The default NaN, positive and quiet, where the host gives a negative one.
+  */
+static inline float default_nan(float)
+{
+    uint32_t b = 0x7fc00000;
+    float v;
+
+    memcpy(&v, &b, sizeof(b));
+    return v;
+}
+
+/**
+  * The default NaN, positive and quiet, where the host gives a negative one.
+  */
+static inline double default_nan(double)
+{
+    uint64_t b = 0x7ff8000000000000ull;
+    double v;
+
+    memcpy(&v, &b, sizeof(b));
+    return v;
+}
+
+/**
+  * All registers zero, round to nearest, VFP enabled.
+  */
+vfp::vfp()
+{
+    memset(s, 0, sizeof(s));
+    fpscr = 0;
+    fpexc = VFP_FPEXC_EN;
+    host_round = FE_TONEAREST;
+}
+
+/**
+  * Set the host rounding mode for FPSCR and clear the host exception flags, before an operation which may round or raise an exception.
+  */
+void vfp::begin()
+{
+    if (host_round != FE_TONEAREST)
+        fesetround(host_round);
+    feclearexcept(FE_ALL_EXCEPT);
+}
+
+/**
+  * Gather the host exception flags of the operation into the cumulative bits of FPSCR, and go back to round to nearest.
+  */
+void vfp::end()
+{
+    int e = fetestexcept(FE_ALL_EXCEPT);
+
+    if (host_round != FE_TONEAREST)
+        fesetround(FE_TONEAREST);
+
+    if (e & FE_INVALID)
+        fpscr |= FPSCR_IOC;
+    if (e & FE_DIVBYZERO)
+        fpscr |= FPSCR_DZC;
+    if (e & FE_OVERFLOW)
+        fpscr |= FPSCR_OFC;
+    if (e & FE_UNDERFLOW)
+        fpscr |= FPSCR_UFC;
+    if (e & FE_INEXACT)
+        fpscr |= FPSCR_IXC;
+}
+
+/**
+  * Read a register, single register n for float, double register n for double.
+  * @param n The register number
+  * @return The value
+  */
+template<typename T>
+inline T vfp::get(int n)
+{
+    T v;
+
+    if (sizeof(T) == 4)
+        memcpy(&v, &s[n & 31], sizeof(v));
+    else
+    {
+        uint64_t b = ((uint64_t)s[(2*n + 1) & 31]<<32) | s[(2*n) & 31];
+        memcpy(&v, &b, sizeof(v));
+    }
+    return v;
+}
+
+/**
+  * Write a register, single register n for float, double register n for double.
+  * @param n The register number
+  * @param v The value
+  */
+template<typename T>
+inline void vfp::set(int n, T v)
+{
+    if (sizeof(T) == 4)
+        memcpy(&s[n & 31], &v, sizeof(v));
+    else
+    {
+        uint64_t b;
+        memcpy(&b, &v, sizeof(b));
+        s[(2*n) & 31] = (uint32_t)b;
+        s[(2*n + 1) & 31] = (uint32_t)(b>>32);
+    }
+}
+
+/**
+  * An operand of an arithmetic operation, a denormal one is taken as zero in flush to zero mode.
+  * @param v The value of the register
+  * @return The operand
+  */
+template<typename T>
+inline T vfp::input(T v)
+{
+    if ((fpscr & FPSCR_FZ) && fpclassify(v) == FP_SUBNORMAL)
+    {
+        fpscr |= FPSCR_IDC;
+        return copysign((T)0, v);
+    }
+    return v;
+}
+
+/**
+  * Write the result of an arithmetic operation, a denormal result is flushed to zero in flush to zero mode. A NaN result is the default NaN in default NaN mode, otherwise the first signaling NaN operand made quiet, or the first quiet NaN operand, as ARM picks it. An invalid operation on numbers, 0 * inf, inf - inf, the root of a negative number, ..., gives the default NaN rather than the negative one of the host.
+  * @param n The destination register
+  * @param v The result
+  * @param ops The operands in the order ARM looks for NaNs in, NULL for a conversion, whose NaN the host already makes from its operand
+  * @param num The number of operands
+  */
+template<typename T>
+inline void vfp::output(int n, T v, const T *ops, int num)
+{
+    if ((fpscr & FPSCR_FZ) && fpclassify(v) == FP_SUBNORMAL)
+    {
+        fpscr |= FPSCR_UFC;
+        v = copysign((T)0, v);
+    }
+    else if (isnan(v) && (fpscr & FPSCR_DN))
+        v = default_nan(v);
+    else if (isnan(v) && ops != NULL)
+    {
+        int i;
+
+        for (i = 0; i < num && !is_snan(ops[i]); i++);
+        if (i == num)
+            for (i = 0; i < num && !isnan(ops[i]); i++);
+        v = i < num ? quiet(ops[i]) : default_nan(v);
+    }
+
+    set<T>(n, v);
+}
+
+/**
+  * Compare two values into the NZCV bits of FPSCR, equal is 0110, less than 1000, greater than 0010 and unordered 0011.
+  * @param a The first operand
+  * @param b The second operand
+  * @param quiet_nan Whether only a signaling NaN is an invalid operation (FCMP), or any NaN (FCMPE)
+  */
+template<typename T>
+void vfp::compare(T a, T b, bool quiet_nan)
+{
+    uint32_t nzcv;
+
+    a = input(a);
+    b = input(b);
+    if (isnan(a) || isnan(b))
+    {
+        nzcv = 0x3;
+        if (!quiet_nan || is_snan(a) || is_snan(b))
+            fpscr |= FPSCR_IOC;
+    }
+    else if (a == b)
+        nzcv = 0x6;
+    else if (a < b)
+        nzcv = 0x8;
+    else
+        nzcv = 0x2;
+
+    fpscr = (fpscr & 0x0fffffff) | nzcv<<28;
+}
+
+/**
+  * Convert a value into a 32-bit integer. Values out of range saturate and a NaN gives 0, both are invalid operations.
+  * @param v The value
+  * @param is_signed Whether the integer is signed
+  * @param round_zero Whether to round toward zero instead of the mode of FPSCR
+  * @return The integer
+  */
+template<typename T>
+uint32_t vfp::to_int(T v, bool is_signed, bool round_zero)
+{
+    double rounded;
+
+    v = input(v);
+    if (isnan(v))
+    {
+        fpscr |= FPSCR_IOC;
+        return 0;
+    }
+
+    switch (round_zero ? 3 : (fpscr>>22) & 3)
+    {
+    	case 0://the host runs round to nearest, even on ties
+    	    rounded = nearbyint(v);
+    		break;
+    	case 1:
+    	    rounded = ceil(v);
+    		break;
+    	case 2:
+    	    rounded = floor(v);
+    		break;
+    	default:
+    	    rounded = trunc(v);
+    		break;
+    }
+
+    double lo = is_signed ? -2147483648.0 : 0.0;
+    double hi = is_signed ? 2147483647.0 : 4294967295.0;
+
+    if (rounded < lo || rounded > hi)
+    {
+        fpscr |= FPSCR_IOC;
+        return rounded < lo ? (uint32_t)(int64_t)lo : (uint32_t)(int64_t)hi;
+    }
+
+    if (rounded != v)
+        fpscr |= FPSCR_IXC;
+    return is_signed ? (uint32_t)(int32_t)rounded : (uint32_t)rounded;
+}
+
+/**
+  * The data processing instructions of one precision, float for coprocessor 10 and double for 11. The opcode is p:q:r:s (bit 23, 21, 20, 6), opcode 1111 is extended by Fn:N. Arithmetic and the copy, absolute, negate and square root instructions work on short vectors when LEN of FPSCR is not 0 and Fd is out of the first bank, a vector Fm in the first bank is a scalar. Compares and conversions are always scalar.
+  * @param instr The instruction
+  * @param d The destination register
+  * @param n The first operand register
+  * @param m The second operand register
+  * @exception UndefineInst For undefined instructions
+  */
+template<typename T>
+void vfp::data_proc(A_INSTR instr, int d, int n, int m)
+{
+    int op = ((instr>>20) & 0x8) | ((instr>>19) & 0x6) | ((instr>>6) & 1);
+    int ext = ((instr>>15) & 0x1e) | ((instr>>7) & 1);
+    bool dbl = sizeof(T) == 8;
+
+    if (op == 15 && ext > 3)//compares and conversions
+    {
+        int Sd = ((instr>>11) & 0x1e) | ((instr>>22) & 1);
+        int Sm = ((instr<<1) & 0x1e) | ((instr>>5) & 1);
+
+        switch (ext)
+        {
+        	case 8://fcmp
+        	case 9://fcmpe
+        	    compare(get<T>(d), get<T>(m), ext == 8);
+        		return;
+        	case 10://fcmpz
+        	case 11://fcmpez
+        	    compare(get<T>(d), (T)0, ext == 10);
+        		return;
+        	case 15://fcvtds, fcvtsd
+        	{
+        	    begin();
+        	    if (dbl)
+        	    {
+        	        volatile float res = (float)input(get<double>(m));
+        	        end();
+        	        output<float>(Sd, res);
+        	    }
+        	    else
+        	    {
+        	        volatile double res = (double)input(get<float>(Sm));
+        	        end();
+        	        output<double>((instr>>12) & 0xf, res);
+        	    }
+        		return;
+        	}
+        	case 16://fuito
+        	case 17://fsito
+        	{
+        	    begin();
+        	    volatile T res = ext == 16 ? (T)s[Sm] : (T)(int32_t)s[Sm];
+        	    end();
+        	    set<T>(d, res);
+        		return;
+        	}
+        	case 24://ftoui
+        	case 25://ftouiz
+        	case 26://ftosi
+        	case 27://ftosiz
+        	    s[Sd] = to_int(get<T>(m), ext >= 26, ext & 1);
+        		return;
+        	default:
+        	{
+        	    UndefineInst e;
+        	    throw e;
+        	}
+        }
+    }
+
+    if (op > 8 && op != 15)
+    {
+        UndefineInst e;
+        throw e;
+    }
+
+    int bank = dbl ? 4 : 8;//registers in a bank
+    int len = ((fpscr>>16) & 7) + 1;
+    int stride = ((fpscr>>20) & 3) == 3 ? 2 : 1;
+    bool m_vector = m >= bank;
+
+    if (d < bank)//scalar
+        len = 1;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (op == 15)
+        {
+            T vm = get<T>(m);
+
+            switch (ext)
+            {
+            	case 0://fcpy
+            	    set<T>(d, vm);
+            		break;
+            	case 1://fabs
+            	    set<T>(d, fabs(vm));
+            		break;
+            	case 2://fneg
+            	    set<T>(d, -vm);
+            		break;
+            	default://3, fsqrt
+            	{
+            	    begin();
+            	    vm = input(vm);
+            	    volatile T res = sqrt(vm);
+            	    end();
+            	    output<T>(d, res, &vm, 1);
+            		break;
+            	}
+            }
+        }
+        else
+        {
+            T vn = input(get<T>(n));
+            T vm = input(get<T>(m));
+            T vd = input(get<T>(d));
+
+            begin();
+            volatile T res;
+
+            if (op <= 5)
+            {
+                volatile T prod = vn * vm;
+
+                switch (op)
+                {
+                	case 0://fmac
+                	    res = vd + prod;
+                		break;
+                	case 1://fnmac
+                	    res = vd - prod;
+                		break;
+                	case 2://fmsc
+                	    res = -vd + prod;
+                		break;
+                	case 3://fnmsc
+                	    res = -vd - prod;
+                		break;
+                	case 4://fmul
+                	    res = prod;
+                		break;
+                	default://5, fnmul
+                	    res = -prod;
+                		break;
+                }
+            }
+            else if (op == 6)//fadd
+                res = vn + vm;
+            else if (op == 7)//fsub
+                res = vn - vm;
+            else//8, fdiv
+                res = vn / vm;
+            end();
+
+            T ops[3] = { vd, vn, vm };//the accumulator first, then the product
+
+            if (op <= 3)
+                output<T>(d, res, ops, 3);
+            else
+                output<T>(d, res, ops + 1, 2);
+        }
+
+        //the next element of each vector, wrapping inside its bank
+        d = d - d % bank + (d % bank + stride) % bank;
+        n = n - n % bank + (n % bank + stride) % bank;
+        if (m_vector)
+            m = m - m % bank + (m % bank + stride) % bank;
+    }
+}
+
+/**
+  * Execute a data processing instruction of coprocessor 10 (single precision) or 11 (double precision).
+  * @param instr The instruction
+  * @exception UndefineInst For undefined instructions
+  */
+void vfp::data_proc(A_INSTR instr)
+{
+    int Fd = (instr>>12) & 0xf;
+    int Fn = (instr>>16) & 0xf;
+    int Fm = (instr) & 0xf;
+
+    if ((instr>>8) & 1)//double
+        data_proc<double>(instr, Fd, Fn, Fm);
+    else
+        data_proc<float>(instr, Fd<<1 | ((instr>>22) & 1), Fn<<1 | ((instr>>7) & 1), Fm<<1 | ((instr>>5) & 1));
+}
+
+/**
+  * Execute FLDS, FSTS, FLDD, FSTD and the multiple forms, FLDMX and FSTMX (double with an odd word count) leave the last word alone. A double register is the word at the lower address for its low half.
+  * @param instr The instruction
+  * @param base The value of the base register, PC reads as the address of the instruction plus 8
+  * @param mmu The memory
+  * @return The base register to be written back, base itself if there is no writeback
+  * @exception UndefineInst For undefined instructions
+  */
+int vfp::load_store(A_INSTR instr, int base, MMU *mmu)
+{
+    int P = (instr>>24) & 1;
+    int U = (instr>>23) & 1;
+    int W = (instr>>21) & 1;
+    int L = (instr>>20) & 1;
+    bool dbl = (instr>>8) & 1;
+    int offset = (instr) & 0xff;
+    int Fd = (instr>>12) & 0xf;
+    int first = dbl ? Fd * 2 : (Fd<<1 | ((instr>>22) & 1));//the first single register
+    int address, words;
+
+    if (P == 1 && W == 0)//one register
+    {
+        address = U ? base + offset * 4 : base - offset * 4;
+        words = dbl ? 2 : 1;
+    }
+    else if (P != U)//multiple, increment after or decrement before
+    {
+        address = U ? base : base - offset * 4;
+        words = dbl ? offset & ~1 : offset;
+        if (W == 1)
+            base = U ? base + offset * 4 : base - offset * 4;
+    }
+    else
+    {
+        UndefineInst e;
+        throw e;
+    }
+
+    for (int i = 0; i < words; i++, address += 4)
+        if (L == 1)
+            s[(first + i) & 31] = mmu->get_word(address);
+        else
+            mmu->set_word(address, s[(first + i) & 31]);
+
+    return base;
+}
+
+/**
+  * Execute FMSR, FMRS, FMDLR, FMRDL, FMDHR, FMRDH, FMXR and FMRX. FMRX to PC (FMSTAT) is left to the ARM decoder, it writes CPSR. FPSID is read only, FPEXC always reads as enabled.
+  * @param instr The instruction
+  * @param r The ARM registers
+  * @exception UndefineInst For undefined instructions
+  */
+void vfp::reg_transfer(A_INSTR instr, GP_Reg *r)
+{
+    int opcode = (instr>>21) & 7;
+    int L = (instr>>20) & 1;
+    int Rd = (instr>>12) & 0xf;
+    int Fn = (instr>>16) & 0xf;
+    uint32_t *reg;
+
+    if ((instr>>8) & 1)//double, opcode 0 is the low half, 1 the high half
+    {
+        if (opcode > 1)
+        {
+            UndefineInst e;
+            throw e;
+        }
+        reg = &s[Fn * 2 + opcode];
+    }
+    else if (opcode == 0)//single
+        reg = &s[Fn<<1 | ((instr>>7) & 1)];
+    else if (opcode == 7)//system register
+    {
+        uint32_t fpsid = VFP_FPSID;
+
+        switch (Fn)
+        {
+        	case 0:
+        	    reg = &fpsid;
+        		break;
+        	case 1:
+        	    reg = &fpscr;
+        		break;
+        	case 8:
+        	    reg = &fpexc;
+        		break;
+        	default:
+        	{
+        	    UndefineInst e;
+        	    throw e;
+        	}
+        }
+
+        if (L == 1)
+            r[Rd] = *reg;
+        else if (Fn == 1)
+        {
+            fpscr = r[Rd] & FPSCR_MASK;
+            host_round = round_modes[(fpscr>>22) & 3];
+        }
+        else if (Fn == 8)
+            fpexc = r[Rd] | VFP_FPEXC_EN;
+        return;
+    }
+    else
+    {
+        UndefineInst e;
+        throw e;
+    }
+
+    if (L == 1)
+        r[Rd] = *reg;
+    else
+        *reg = r[Rd];
+}
+
+/**
+  * Execute FMSRR, FMRRS, FMDRR and FMRRD, Rd goes with the lower register or the low half, Rn with the other.
+  * @param instr The instruction
+  * @param r The ARM registers
+  * @exception UndefineInst For undefined instructions
+  */
+void vfp::two_reg_transfer(A_INSTR instr, GP_Reg *r)
+{
+    int L = (instr>>20) & 1;
+    int Rn = (instr>>16) & 0xf;
+    int Rd = (instr>>12) & 0xf;
+    int Fm = (instr) & 0xf;
+    int first = ((instr>>8) & 1) ? Fm * 2 : (Fm<<1 | ((instr>>5) & 1));
+
+    if (((instr>>4) & 0xd) != 1)//bit[7:6] and bit 4 are 00 and 1
+    {
+        UndefineInst e;
+        throw e;
+    }
+
+    if (L == 1)
+    {
+        r[Rd] = s[first & 31];
+        r[Rn] = s[(first + 1) & 31];
+    }
+    else
+    {
+        s[first & 31] = r[Rd];
+        s[(first + 1) & 31] = r[Rn];
+    }
+}
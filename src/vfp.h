@@ -0,0 +1,93 @@
+/*! \file vfp.h
+	\brief The VFPv2 floating point coprocessor.
+
+	Coprocessors 10 (single precision) and 11 (double precision) of the ARM decoder, computed on the host FPU.
+ */
+#ifndef __VFP_H__
+#define __VFP_H__
+
+/*!
+	\addtogroup instruction
+ */
+/*@{*/
+
+#include "arch.h"
+#include "MMU.h"
+
+/*! \def VFP_FPSID
+	\brief The FPSID register, a VFPv2 unit of ARM
+ */
+#define VFP_FPSID       0x410120b4
+
+/*! \def VFP_FPEXC_EN
+	\brief The enable bit of FPEXC, always set
+ */
+#define VFP_FPEXC_EN    (1<<30)
+
+#define FPSCR_IOC       (1<<0)      //!< invalid operation, cumulative
+#define FPSCR_DZC       (1<<1)      //!< division by zero, cumulative
+#define FPSCR_OFC       (1<<2)      //!< overflow, cumulative
+#define FPSCR_UFC       (1<<3)      //!< underflow, cumulative
+#define FPSCR_IXC       (1<<4)      //!< inexact, cumulative
+#define FPSCR_IDC       (1<<7)      //!< input denormal, cumulative
+#define FPSCR_FZ        (1<<24)     //!< flush to zero
+#define FPSCR_DN        (1<<25)     //!< default NaN
+#define FPSCR_MASK      0xf3ff9f9f  //!< the bits of FPSCR which exist
+
+/*! \class vfp
+	\brief Emulate the VFPv2 instructions.
+
+	The 32 single precision registers are kept as words, double register n is made of single registers 2n (low word) and 2n + 1. Arithmetic is done with host float and double, in the rounding mode of FPSCR, and the host exception flags are gathered into the cumulative bits of FPSCR after every operation. Exceptions are never trapped, the enable bits of FPSCR only read back. Short vectors (FPSCR LEN and STRIDE) are supported for the data processing instructions.
+ */
+class vfp
+{
+public:
+	//! A constructor
+    vfp();
+
+private:
+	//! The single precision registers
+    uint32_t s[32];
+	//! The status and control register
+    uint32_t fpscr;
+	//! The exception register
+    uint32_t fpexc;
+	//! The host rounding mode for the mode in FPSCR
+    int host_round;
+
+	//! Set the host rounding mode and clear the host exception flags before an operation
+    void begin();
+	//! Gather the host exception flags into FPSCR after an operation
+    void end();
+
+	//! Read a register of type T, float for single and double for double
+    template<typename T> inline T get(int n);
+	//! Write a register of type T
+    template<typename T> inline void set(int n, T v);
+	//! Flush a denormal operand to zero in flush to zero mode
+    template<typename T> inline T input(T v);
+	//! Write a result, flushing a denormal one to zero, and making a NaN the one ARM gives
+    template<typename T> inline void output(int n, T v, const T *ops = NULL, int num = 0);
+
+	//! The data processing instructions of one precision
+    template<typename T> void data_proc(A_INSTR instr, int d, int n, int m);
+	//! Compare two values into the NZCV bits of FPSCR
+    template<typename T> void compare(T a, T b, bool quiet_nan);
+	//! Convert a value into an integer in the rounding mode given, saturating
+    template<typename T> uint32_t to_int(T v, bool is_signed, bool round_zero);
+
+public:
+	//! Execute a data processing instruction (CDP)
+    void data_proc(A_INSTR instr);
+	//! Execute a load or store, return the base register written back
+    int load_store(A_INSTR instr, int base, MMU *mmu);
+	//! Execute a transfer between one ARM register and a VFP register (MCR, MRC)
+    void reg_transfer(A_INSTR instr, GP_Reg *r);
+	//! Execute a transfer between two ARM registers and VFP registers (MCRR, MRRC)
+    void two_reg_transfer(A_INSTR instr, GP_Reg *r);
+	//! Get the value of FPSCR
+    uint32_t get_fpscr(){ return fpscr; };
+};
+
+/*@}*/
+#endif // __VFP_H__
@@ -0,0 +1,71 @@
+@ The bx pc veneer from Thumb into ARM code, with N set.
+@
+@ bx pc at a word aligned address branches to the ARM code 4 bytes on,
+@ past the nop. Were PC read as the address + 2, the branch would land on
+@ the bx itself, and the Thumb pair run as the ARM word 0x46c04778,
+@ uxtab16mi, which N set lets through. The ARM code adds to r4 and returns
+@ to Thumb, r4 is printed, see bx_pc_veneer.exp; uxtab16 would have put r0
+@ in it first.
+@
+@ Built with
+@   arm-none-eabi-as bx_pc_veneer.s -o bx_pc_veneer.o
+@   arm-none-eabi-ld -Ttext=0x8000 -Tdata=0x40000 bx_pc_veneer.o -o bx_pc_veneer.elf
+
+    .syntax divided
+    .text
+    .global _start
+    .arm
+_start:
+    add r0, pc, #1
+    bx r0
+    .thumb
+main:
+    mov r0, #7
+    mov r4, #0
+    mov r3, #1
+    mov r5, #2
+    cmp r3, r5                  @ N set
+    bl veneer
+    mov r0, r4
+    bl hex                      @ 00000042
+    mov r0, #0x18               @ SYS_EXIT
+    swi 0xab
+hex:                            @ print r0 in hex and a newline
+    push {r4, r5, lr}
+    mov r4, r0
+    mov r5, #8
+digit:
+    lsr r0, r4, #28
+    lsl r4, r4, #4
+    cmp r0, #10
+    blt decimal
+    add r0, #39
+decimal:
+    add r0, #48
+    bl putc
+    sub r5, #1
+    bne digit
+    mov r0, #10
+    bl putc
+    pop {r4, r5, pc}
+putc:
+    push {r0, r1, lr}
+    ldr r1, chbuf_p
+    strb r0, [r1, #0]
+    mov r0, #3                  @ SYS_WRITEC
+    swi 0xab
+    pop {r0, r1, pc}
+    .align 2
+chbuf_p:
+    .word chbuf
+veneer:
+    bx pc
+    nop
+    .arm
+    .word 0xe2844042            @ add r4, r4, #0x42
+    .word 0xe12fff1e            @ bx lr
+    .thumb
+
+    .bss
+chbuf:
+    .space 4
@@ -0,0 +1,38 @@
+@ The instruction count of -call.
+@
+@ add3 runs 3 adds and its bx lr, 4 instructions, sum5 its push, 4 adds, a
+@ load of the argument on the stack and its pop, 7. The fetch at the return
+@ address, which ends the call, is not one of them. Run with
+@   armulator -call add3,1,2,3 -call sum5,1,2,3,4,5 call_count.elf
+@ see call_count.exp.
+@
+@ Built with
+@   arm-none-eabi-as call_count.s -o call_count.o
+@   arm-none-eabi-ld -Ttext=0x8000 -Tdata=0x40000 call_count.o -o call_count.elf
+
+    .syntax divided
+    .text
+    .global _start
+    .arm
+_start:
+    add r0, pc, #1
+    bx r0
+    .thumb
+main:
+    mov r0, #0x18               @ SYS_EXIT
+    swi 0xab
+    .align
+add3:
+    add r0, r0, r1
+    add r0, r0, r2
+    add r0, r0, r3
+    bx lr
+    .align
+sum5:
+    push {r4, lr}
+    add r0, r0, r1
+    add r0, r0, r2
+    add r0, r0, r3
+    ldr r4, [sp, #8]
+    add r0, r0, r4
+    pop {r4, pc}
@@ -0,0 +1,85 @@
+@ Lanes which run a loop a different number of times.
+@
+@ Under "armulator -lanes n" lane i gets the command line "<file name> i",
+@ runs the loop i + 3 times and prints its sum in hex. The conditional
+@ branch closing the loop is taken by some lanes and not by others, so the
+@ lanes part there and each must end with its own sum, as a single core
+@ would, see lanes_diverge.exp. The command line is scanned for its last
+@ character, so the counts there are for a run from this directory.
+@
+@ Built with
+@   arm-none-eabi-as lanes_diverge.s -o lanes_diverge.o
+@   arm-none-eabi-ld -Ttext=0x8000 -Tdata=0x40000 lanes_diverge.o -o lanes_diverge.elf
+
+    .syntax divided
+    .text
+    .global _start
+    .arm
+_start:
+    add r0, pc, #1
+    bx r0
+    .thumb
+main:
+    mov r0, #0x15               @ SYS_GET_CMDLINE
+    ldr r1, cmd_p
+    swi 0xab
+    ldr r1, cmdbuf_p
+    mov r3, #0
+scan:                           @ r3 = the last character, the lane number
+    ldrb r2, [r1, #0]
+    cmp r2, #0
+    beq scanned
+    mov r3, r2
+    add r1, #1
+    b scan
+scanned:
+    sub r3, #44                 @ '0' + 4, the loop runs r3 - 1 times
+    mov r4, #0
+    mov r5, #1
+loop:
+    add r4, r4, r5
+    lsl r4, r4, #1
+    add r5, #1
+    cmp r5, r3
+    blt loop
+    mov r6, #8
+digit:
+    lsr r0, r4, #28
+    lsl r4, r4, #4
+    cmp r0, #10
+    blt decimal
+    add r0, #39
+decimal:
+    add r0, #48
+    bl putc
+    sub r6, #1
+    bne digit
+    mov r0, #10
+    bl putc
+    mov r0, #0x18               @ SYS_EXIT
+    swi 0xab
+putc:
+    push {r0, r1, lr}
+    ldr r1, chbuf_p
+    strb r0, [r1, #0]
+    mov r0, #3                  @ SYS_WRITEC
+    swi 0xab
+    pop {r0, r1, pc}
+    .align 2
+cmd_p:
+    .word cmdblk
+cmdbuf_p:
+    .word cmdbuf
+chbuf_p:
+    .word chbuf
+
+    .data
+cmdblk:
+    .word cmdbuf
+    .word 64
+
+    .bss
+cmdbuf:
+    .space 64
+chbuf:
+    .space 4
@@ -0,0 +1,72 @@
+@ rev, rev16 and revsh whose destination is their source register.
+@
+@ Each result is printed in hex, see rev_same_reg.exp; the interpreter,
+@ -block and -jit must all give it.
+@
+@ Built with
+@   arm-none-eabi-as -march=armv6 rev_same_reg.s -o rev_same_reg.o
+@   arm-none-eabi-ld -Ttext=0x8000 -Tdata=0x40000 rev_same_reg.o -o rev_same_reg.elf
+
+    .syntax divided
+    .text
+    .global _start
+    .arm
+_start:
+    add r0, pc, #1
+    bx r0
+    .thumb
+main:
+    ldr r4, value_p
+    ldr r4, [r4, #0]            @ 0x11223384
+    mov r1, r4
+    rev r1, r1
+    mov r0, r1
+    bl hex                      @ 84332211
+    mov r1, r4
+    rev16 r1, r1
+    mov r0, r1
+    bl hex                      @ 22118433
+    mov r1, r4
+    revsh r1, r1
+    mov r0, r1
+    bl hex                      @ ffff8433
+    mov r0, #0x18               @ SYS_EXIT
+    swi 0xab
+hex:                            @ print r0 in hex and a newline
+    push {r4, r5, lr}
+    mov r4, r0
+    mov r5, #8
+digit:
+    lsr r0, r4, #28
+    lsl r4, r4, #4
+    cmp r0, #10
+    blt decimal
+    add r0, #39
+decimal:
+    add r0, #48
+    bl putc
+    sub r5, #1
+    bne digit
+    mov r0, #10
+    bl putc
+    pop {r4, r5, pc}
+putc:
+    push {r0, r1, lr}
+    ldr r1, chbuf_p
+    strb r0, [r1, #0]
+    mov r0, #3                  @ SYS_WRITEC
+    swi 0xab
+    pop {r0, r1, pc}
+    .align 2
+value_p:
+    .word value
+chbuf_p:
+    .word chbuf
+
+    .data
+value:
+    .word 0x11223384
+
+    .bss
+chbuf:
+    .space 4
@@ -0,0 +1,87 @@
+@ A shift by register whose N and Z are overwritten, but whose C is read.
+@
+@ asr r1, r3 shifts by 255, leaving 0 and C clear; sbc r1, r6 reads that C
+@ and gives 0xffffffff with only N set. The flags of the shift are not dead,
+@ so the interpreter must not run it as its flag-free variant. r1 and then
+@ the flags as an NZCV nibble are printed, see shift_reg_carry.exp.
+@
+@ Built with
+@   arm-none-eabi-as shift_reg_carry.s -o shift_reg_carry.o
+@   arm-none-eabi-ld -Ttext=0x8000 -Tdata=0x40000 shift_reg_carry.o -o shift_reg_carry.elf
+
+    .syntax divided
+    .text
+    .global _start
+    .arm
+_start:
+    add r0, pc, #1
+    bx r0
+    .thumb
+main:
+    mov r0, #8
+    mov r9, r0
+    mov r0, #4
+    mov r10, r0
+    mov r0, #2
+    mov r11, r0
+    mov r0, #1
+    mov r12, r0
+    mov r0, #0
+    mov r8, r0
+    mov r6, #0
+    mvn r3, r6                  @ 0xffffffff
+    mov r1, #0xff
+    mov r0, #1
+    lsr r0, r0, #1              @ C set
+    asr r1, r3
+    sbc r1, r6
+    bpl n_clear                 @ gather NZCV in r8, hi register adds keep the flags
+    add r8, r9
+n_clear:
+    bne z_clear
+    add r8, r10
+z_clear:
+    bcc c_clear
+    add r8, r11
+c_clear:
+    bvc v_clear
+    add r8, r12
+v_clear:
+    mov r0, r1
+    bl hex                      @ ffffffff
+    mov r0, r8
+    bl hex                      @ 00000008
+    mov r0, #0x18               @ SYS_EXIT
+    swi 0xab
+hex:                            @ print r0 in hex and a newline
+    push {r4, r5, lr}
+    mov r4, r0
+    mov r5, #8
+digit:
+    lsr r0, r4, #28
+    lsl r4, r4, #4
+    cmp r0, #10
+    blt decimal
+    add r0, #39
+decimal:
+    add r0, #48
+    bl putc
+    sub r5, #1
+    bne digit
+    mov r0, #10
+    bl putc
+    pop {r4, r5, pc}
+putc:
+    push {r0, r1, lr}
+    ldr r1, chbuf_p
+    strb r0, [r1, #0]
+    mov r0, #3                  @ SYS_WRITEC
+    swi 0xab
+    pop {r0, r1, pc}
+    .align 2
+chbuf_p:
+    .word chbuf
+
+    .bss
+chbuf:
+    .space 4
@@ -0,0 +1,29 @@
+@ SYS_WRITE0 prints a whole string.
+@
+@ The string is written with one SYS_WRITE0 (0x04), r1 pointing at it; it
+@ used to be read at r1 over and over, its first character printed without
+@ end. See write0_string.exp.
+@
+@ Built with
+@   arm-none-eabi-as write0_string.s -o write0_string.o
+@   arm-none-eabi-ld -Ttext=0x8000 -Tdata=0x40000 write0_string.o -o write0_string.elf
+
+    .syntax divided
+    .text
+    .global _start
+    .arm
+_start:
+    add r0, pc, #1
+    bx r0
+    .thumb
+main:
+    ldr r1, msg_addr
+    mov r0, #4                  @ SYS_WRITE0
+    swi 0xab
+    mov r0, #0x18               @ SYS_EXIT
+    swi 0xab
+    .align
+msg_addr:
+    .word msg
+msg:
+    .asciz "write0 ok\n"